@@ -0,0 +1,164 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Model;
+class Shader;
+class World;
+
+// Texture unit the bone palettes are bound to, for the scene and shadow shaders alike
+#define ANIMATION_TEXTURE_UNIT 10
+
+// Lowest rate clips are resampled to at import, the frames are spread evenly over the clip's duration.
+// Before compression every track has a key on every frame.
+#define ANIMATION_SAMPLE_RATE 30.0f
+
+// Bones one vertex is blended from, the same as MAX_BONE_INFLUENCE in mesh.h
+#define ANIMATION_MAX_INFLUENCES 4
+
+// Animated instances one job samples at least
+#define ANIMATION_BATCH 8
+
+// Keyframes of one animation as imported, resampled so all tracks share their key times. Frames store the
+// tracks structure of arrays, each component of a frame is trackStride floats in a row. Only the input of
+// CompressAnimation, models keep the compressed AnimationClip.
+struct ResampledClip {
+    std::string name;
+    float duration = 0.0f;             // seconds
+    uint32_t frameCount = 0;           // keys per track, evenly spaced so the last one sits at duration
+    std::vector<uint32_t> trackNodes;  // model node each track drives
+    uint32_t trackStride = 0;          // track count rounded up to 4, padding lanes hold the identity
+
+    std::vector<float> rotations;      // per frame x, y, z, w blocks of trackStride floats
+    std::vector<float> translations;   // per frame x, y, z blocks
+    std::vector<float> scales;         // per frame x, y, z blocks
+
+    uint32_t morphTargetCount = 0;     // targets of the model, the weights are empty if the clip doesn't move them
+    std::vector<float> morphWeights;   // per frame morphTargetCount floats
+};
+
+// How far compression may move a track away from the resampled clip
+struct AnimationCompression {
+    float rotationTolerance = 0.002f;     // radians
+    float translationTolerance = 0.001f;  // model units
+    float scaleTolerance = 0.001f;
+};
+
+// The keys of one kind of transform for the tracks that actually change, 16 bits per component. Lanes
+// are padded to a multiple of 4 so they decode four at a time.
+struct AnimationChannel {
+    std::vector<uint16_t> tracks;      // clip track of each lane
+    uint32_t stride = 0;               // lanes, tracks rounded up to 4
+    std::vector<float> rangeMin;       // translations and scales: x, y, z blocks of stride floats
+    std::vector<float> rangeExtent;    // the same, max - min
+    std::vector<uint16_t> keys;        // per key three blocks of stride values
+};
+
+// Compressed clip. Tracks that stay within tolerance of their first key are stored once as a constant.
+// Frames that every changing track can interpolate from its neighbours are dropped, so all tracks still
+// share their keys and one search per sample finds the pair to blend. Rotations are smallest three
+// encoded (the largest component is dropped and rebuilt from the unit length, its index goes into the
+// spare top bits), translations and scales are quantized within each track's range over the clip.
+struct AnimationClip {
+    std::string name;
+    float duration = 0.0f;             // seconds
+    uint32_t frameCount = 0;           // frames of the resampled clip
+    std::vector<uint32_t> trackNodes;  // model node each track drives
+    uint32_t trackStride = 0;          // track count rounded up to 4
+
+    std::vector<uint16_t> keyFrames;   // resampled frames that were kept, the first and last always are
+
+    std::vector<float> constantRotations;     // x, y, z, w blocks of trackStride floats, every track's first key
+    std::vector<float> constantTranslations;  // x, y, z blocks
+    std::vector<float> constantScales;        // x, y, z blocks
+
+    AnimationChannel rotations;
+    AnimationChannel translations;
+    AnimationChannel scales;
+
+    uint32_t morphTargetCount = 0;     // same as the resampled clip, weights are kept on every frame
+    std::vector<float> morphWeights;
+
+    size_t TrackCount() const { return trackNodes.size(); }
+
+    // Memory the keys take
+    size_t Bytes() const;
+};
+
+// Reduces and quantizes a resampled clip
+AnimationClip CompressAnimation(const ResampledClip& clip, const AnimationCompression& settings = AnimationCompression());
+
+// Local transforms of a clip's tracks at one point in time, structure of arrays like the clip's constants
+struct AnimationPose {
+    std::vector<float> rotations;     // x, y, z, w blocks of trackStride floats
+    std::vector<float> translations;  // x, y, z blocks
+    std::vector<float> scales;        // x, y, z blocks
+
+    // decoded keys of one channel, reused between samples
+    std::vector<float> first;
+    std::vector<float> second;
+    std::vector<float> blended;
+};
+
+// Interpolates the clip at time (wrapped to its duration) into pose, straight from the compressed keys:
+// rotations nlerp along the shorter arc, translations and scales lerp, four tracks per SSE instruction
+// where available
+void SampleAnimation(const AnimationClip& clip, float time, AnimationPose& pose);
+
+// Interpolates the clip's morph target weights at time into morphTargetCount floats, leaves them alone if
+// the clip has none
+void SampleMorphWeights(const AnimationClip& clip, float time, float* weights);
+
+// Turns a pose into the model's skinning palette: every node without a track keeps its file transform,
+// the hierarchy is walked parents first and each bone gets node matrix * bone offset. nodeMatrices is
+// scratch space for one matrix per node of the model.
+void ComputeSkinningPalette(const Model& model, const AnimationClip& clip, const AnimationPose& pose,
+                            std::vector<glm::mat4>& nodeMatrices, glm::mat4* palette);
+
+// Plays the clips of every AnimatorComponent. Update samples all of them in parallel on the job system
+// into one CPU palette array, Upload streams it into a texture buffer that the skinning shaders read their
+// bones from at the instance's paletteOffset. Palettes are allocated per instance when it spawns.
+class Animator {
+  public:
+    void Init();
+    void Shutdown();
+
+    // Reserves a palette for an animated instance of model, returns its first bone
+    uint32_t Allocate(const Model& model);
+
+    // Advances every animated instance by deltaTime and computes its palette, then samples the morph weights
+    // of the ones with a MorphComponent into the MorphTargetLibrary
+    void Update(World& world, float deltaTime);
+
+    // Uploads the palettes and binds them to ANIMATION_TEXTURE_UNIT
+    void Upload();
+
+    // Points a shader's bonePalette sampler at the palettes
+    void Apply(Shader& shader) const;
+
+    size_t AnimatedCount() const { return animatedCount; }
+    size_t BoneCount() const { return palettes.size(); }
+
+  private:
+    struct Scratch {
+      AnimationPose pose;
+      std::vector<glm::mat4> nodeMatrices;
+    };
+
+    std::vector<glm::mat4> palettes;
+    std::vector<Scratch> threadScratch;
+    std::vector<float> morphScratch;
+    size_t animatedCount = 0;
+    GLuint paletteBuffer = 0;
+    GLuint paletteTexture = 0;
+    size_t bufferBones = 0;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Bounding volumes and the overlap tests shared by the spatial structures
+
+// Axis aligned box. An empty box has min > max so growing it by anything yields that thing.
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    static AABB Empty() { return { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) }; }
+
+    bool IsEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    glm::vec3 Center() const { return (min + max) * 0.5f; }
+    glm::vec3 Extents() const { return (max - min) * 0.5f; }
+
+    void Grow(const glm::vec3& point) {
+      min = glm::min(min, point);
+      max = glm::max(max, point);
+    }
+
+    void Grow(const AABB& box) {
+      min = glm::min(min, box.min);
+      max = glm::max(max, box.max);
+    }
+
+    // Half the surface area, which is all the SAH needs
+    float HalfArea() const {
+      glm::vec3 d = max - min;
+      return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    bool Contains(const AABB& box) const {
+      return min.x <= box.min.x && min.y <= box.min.y && min.z <= box.min.z &&
+             max.x >= box.max.x && max.y >= box.max.y && max.z >= box.max.z;
+    }
+};
+
+inline AABB Union(const AABB& a, const AABB& b) {
+    return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+inline bool Overlaps(const AABB& a, const AABB& b) {
+    return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+           a.min.y <= b.max.y && a.max.y >= b.min.y &&
+           a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Box around a transformed box (Arvo's method, exact for affine transforms)
+inline AABB TransformAABB(const AABB& box, const glm::mat4& transform) {
+    if (box.IsEmpty())
+      return box;
+
+    glm::vec3 center = glm::vec3(transform * glm::vec4(box.Center(), 1.0f));
+    glm::vec3 extents = box.Extents();
+    glm::vec3 worldExtents(0.0f);
+    for (int i = 0; i < 3; i++)
+      worldExtents += glm::abs(glm::vec3(transform[i])) * extents[i];
+    return { center - worldExtents, center + worldExtents };
+}
+
+struct Sphere {
+    glm::vec3 center;
+    float radius;
+};
+
+inline bool Overlaps(const Sphere& sphere, const AABB& box) {
+    glm::vec3 closest = glm::clamp(sphere.center, box.min, box.max);
+    glm::vec3 d = closest - sphere.center;
+    return glm::dot(d, d) <= sphere.radius * sphere.radius;
+}
+
+// Ray with the reciprocal direction precomputed for slab tests
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    glm::vec3 invDirection;
+
+    Ray() {}
+    Ray(const glm::vec3& origin, const glm::vec3& direction)
+      : origin(origin), direction(direction), invDirection(1.0f / direction) {}
+};
+
+// Slab test. Returns the entry distance, or -1 if the ray misses the box within [0, maxT].
+inline float IntersectRayAABB(const Ray& ray, const AABB& box, float maxT) {
+    glm::vec3 t0 = (box.min - ray.origin) * ray.invDirection;
+    glm::vec3 t1 = (box.max - ray.origin) * ray.invDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+    return enter <= exit ? enter : -1.0f;
+}
+
+enum FrustumResult {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTS,
+    FRUSTUM_INSIDE
+};
+
+// Six inward facing planes (xyz = normal, w = distance) extracted from a view projection matrix
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum FromMatrix(const glm::mat4& viewProjection) {
+      Frustum frustum;
+      glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+      glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+      glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+      glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+      frustum.planes[0] = row3 + row0; // left
+      frustum.planes[1] = row3 - row0; // right
+      frustum.planes[2] = row3 + row1; // bottom
+      frustum.planes[3] = row3 - row1; // top
+      frustum.planes[4] = row3 + row2; // near
+      frustum.planes[5] = row3 - row2; // far
+      for (int i = 0; i < 6; i++)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+      return frustum;
+    }
+
+    // Tests a box against the planes set in mask. Planes the box is completely inside of are cleared
+    // from mask so children of that box don't have to test them again.
+    FrustumResult Test(const AABB& box, unsigned int& mask) const {
+      glm::vec3 center = box.Center();
+      glm::vec3 extents = box.Extents();
+      for (int i = 0; i < 6; i++) {
+        if (!(mask & (1u << i)))
+          continue;
+        glm::vec3 normal(planes[i]);
+        float distance = glm::dot(normal, center) + planes[i].w;
+        float radius = glm::dot(glm::abs(normal), extents);
+        if (distance + radius < 0.0f)
+          return FRUSTUM_OUTSIDE;
+        if (distance - radius >= 0.0f)
+          mask &= ~(1u << i);
+      }
+      return mask ? FRUSTUM_INTERSECTS : FRUSTUM_INSIDE;
+    }
+
+    bool Overlaps(const AABB& box) const {
+      unsigned int mask = 0x3F;
+      return Test(box, mask) != FRUSTUM_OUTSIDE;
+    }
+};
+
+#endif
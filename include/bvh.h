@@ -0,0 +1,200 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "bounds.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define BVH_NULL 0xFFFFFFFFu
+
+// Nodes a query keeps on its stack before it has to fall back to the heap
+#define BVH_STACK_SIZE 128
+
+// Dynamic bounding volume hierarchy over objects identified by proxies.
+//
+// Objects are inserted one at a time by walking down the cheapest SAH path, and moved by refitting
+// their ancestors with tree rotations on the way up, so the tree stays good without rebuilding.
+// Rebuild() does a full binned SAH build over the current objects when a lot of them changed at once
+// (e.g. after loading a scene). Proxies stay valid across moves and rebuilds.
+//
+// Leaves store their bounds grown by a margin. Objects moving inside that margin don't touch the tree;
+// queries test against the grown bounds, so results are conservative by up to that margin.
+class DynamicBVH {
+  public:
+    explicit DynamicBVH(float margin = 0.0f);
+
+    // Adds an object and returns its proxy
+    uint32_t Insert(const AABB& bounds, uint64_t userData);
+
+    void Remove(uint32_t proxy);
+
+    // Updates the bounds of an object. Returns false if the object stayed inside its grown bounds and
+    // the tree was left alone.
+    bool Move(uint32_t proxy, const AABB& bounds);
+
+    // Rebuilds the whole tree top down with a binned SAH, keeping all proxies
+    void Rebuild();
+
+    void Clear();
+
+    const AABB& GetBounds(uint32_t proxy) const { return nodes[proxy].box; }
+    uint64_t GetUserData(uint32_t proxy) const { return nodes[proxy].userData; }
+    size_t ProxyCount() const { return proxyCount; }
+    uint32_t Height() const { return root == BVH_NULL ? 0 : nodes[root].height; }
+
+    // Sum of the internal node areas relative to the root, lower means cheaper queries
+    float Cost() const;
+
+    // Calls fn(proxy, userData) for every object overlapping the box
+    template <typename Fn>
+    void QueryAABB(const AABB& box, Fn&& fn) const {
+      QueryStack stack(Height());
+      uint32_t count = 0;
+      if (root != BVH_NULL)
+        stack.data[count++] = root;
+
+      while (count > 0) {
+        const Node& node = nodes[stack.data[--count]];
+        if (!Overlaps(node.box, box))
+          continue;
+        if (node.IsLeaf()) {
+          fn(stack.data[count], node.userData);
+        }
+        else {
+          stack.data[count++] = node.child[0];
+          stack.data[count++] = node.child[1];
+        }
+      }
+    }
+
+    // Calls fn(proxy, userData) for every object overlapping the sphere
+    template <typename Fn>
+    void QuerySphere(const Sphere& sphere, Fn&& fn) const {
+      QueryStack stack(Height());
+      uint32_t count = 0;
+      if (root != BVH_NULL)
+        stack.data[count++] = root;
+
+      while (count > 0) {
+        const Node& node = nodes[stack.data[--count]];
+        if (!Overlaps(sphere, node.box))
+          continue;
+        if (node.IsLeaf()) {
+          fn(stack.data[count], node.userData);
+        }
+        else {
+          stack.data[count++] = node.child[0];
+          stack.data[count++] = node.child[1];
+        }
+      }
+    }
+
+    // Calls fn(proxy, userData) for every object inside or crossing the frustum. Subtrees completely
+    // inside are reported without testing anything below them.
+    template <typename Fn>
+    void QueryFrustum(const Frustum& frustum, Fn&& fn) const {
+      // entries pack the node index with the mask of planes still worth testing, which limits the
+      // tree to 2^26 nodes
+      QueryStack stack(Height());
+      uint32_t count = 0;
+      if (root != BVH_NULL)
+        stack.data[count++] = (root << 6) | 0x3F;
+
+      while (count > 0) {
+        uint32_t entry = stack.data[--count];
+        uint32_t index = entry >> 6;
+        unsigned int mask = entry & 0x3F;
+        const Node& node = nodes[index];
+        if (mask && frustum.Test(node.box, mask) == FRUSTUM_OUTSIDE)
+          continue;
+        if (node.IsLeaf()) {
+          fn(index, node.userData);
+        }
+        else {
+          stack.data[count++] = (node.child[0] << 6) | mask;
+          stack.data[count++] = (node.child[1] << 6) | mask;
+        }
+      }
+    }
+
+    // Walks the objects the ray passes through roughly front to back. fn(proxy, userData, maxT) returns
+    // the new maximum distance: the distance of a closer hit to shrink the search, maxT to keep going
+    // or 0 to stop.
+    template <typename Fn>
+    void Raycast(const Ray& ray, float maxT, Fn&& fn) const {
+      QueryStack stack(Height());
+      uint32_t count = 0;
+      if (root != BVH_NULL && IntersectRayAABB(ray, nodes[root].box, maxT) >= 0.0f)
+        stack.data[count++] = root;
+
+      while (count > 0) {
+        const Node& node = nodes[stack.data[--count]];
+        if (node.IsLeaf()) {
+          // the box was entered before maxT shrank, check again
+          if (IntersectRayAABB(ray, node.box, maxT) < 0.0f)
+            continue;
+          maxT = fn(stack.data[count], node.userData, maxT);
+          if (maxT <= 0.0f)
+            return;
+          continue;
+        }
+
+        // push the farther child first so the nearer one is visited next
+        float t0 = IntersectRayAABB(ray, nodes[node.child[0]].box, maxT);
+        float t1 = IntersectRayAABB(ray, nodes[node.child[1]].box, maxT);
+        uint32_t near = node.child[0], far = node.child[1];
+        if (t1 >= 0.0f && (t0 < 0.0f || t1 < t0)) {
+          std::swap(near, far);
+          std::swap(t0, t1);
+        }
+        if (t1 >= 0.0f)
+          stack.data[count++] = far;
+        if (t0 >= 0.0f)
+          stack.data[count++] = near;
+      }
+    }
+
+  private:
+    struct Node {
+      AABB box;
+      uint32_t parent;      // next free node while on the free list
+      uint32_t child[2];
+      uint32_t height;      // 0 for leaves
+      uint64_t userData;
+
+      bool IsLeaf() const { return child[0] == BVH_NULL; }
+    };
+
+    // Traversal stack, on the stack for any sane tree and on the heap for degenerate ones
+    struct QueryStack {
+      uint32_t fixed[BVH_STACK_SIZE];
+      std::vector<uint32_t> heap;
+      uint32_t* data;
+
+      explicit QueryStack(uint32_t height) : data(fixed) {
+        // a depth first walk holds at most one sibling per level plus the current node
+        if (height + 2 > BVH_STACK_SIZE) {
+          heap.resize(height + 2);
+          data = heap.data();
+        }
+      }
+    };
+
+    uint32_t allocateNode();
+    void freeNode(uint32_t index);
+    void insertLeaf(uint32_t leaf);
+    void removeLeaf(uint32_t leaf);
+    void refitUpwards(uint32_t index);
+    void rotate(uint32_t index);
+    void updateNode(uint32_t index);
+
+    std::vector<Node> nodes;
+    uint32_t root = BVH_NULL;
+    uint32_t freeList = BVH_NULL;
+    size_t proxyCount = 0;
+    float margin;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef CASCADED_SHADOWS_H
+#define CASCADED_SHADOWS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "camera.h"
+#include "ecs.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Layers of the depth texture array, the fragment shader declares its arrays with this size
+#define SHADOW_MAX_CASCADES 4
+
+// Texture unit Apply binds the cascade array to
+#define SHADOW_TEXTURE_UNIT 7
+
+// Everything that decides what the shadows cost. Each cascade costs resolution^2 * 4 bytes and one
+// pass over its casters whenever it re-renders.
+struct ShadowSettings {
+    int resolution = 2048;           // texels per side of every cascade
+    int cascadeCount = 4;            // up to SHADOW_MAX_CASCADES
+    float maxDistance = 60.0f;       // view depth the last cascade ends at, never past the camera's far plane
+    float splitLambda = 0.75f;       // 0 splits the depth range uniformly, 1 logarithmically
+    int cachedCascades = 2;          // the farthest ones only re-render every cacheInterval frames
+    int cacheInterval = 4;
+    float minCasterTexels = 1.5f;    // casters whose bounds span fewer texels of a cascade are skipped
+    size_t maxCastersPerCascade = 4096;  // the largest ones win when there are more
+};
+
+// Cascaded shadow maps for one directional light. The view frustum between the camera's near plane and
+// maxDistance is split into cascades, each covered by an orthographic projection from the light that is
+// rendered into one layer of a depth texture array.
+//
+// Every cascade is fitted to the bounding sphere of its slice of the frustum, so its size doesn't change
+// as the camera turns, and its origin is snapped to whole texels, so the shadow edges don't crawl as the
+// camera moves. Casters are gathered per cascade from the scene BVH with the near plane left out, since
+// anything between the light and the cascade can throw a shadow into it; depth clamping flattens those
+// onto the near plane. The far cascades cover a lot of the scene for little of the screen, so they are
+// cached and re-rendered in turn every few frames.
+//
+// Per frame: Update, Render, then Apply to every shader that reads the shadows.
+class CascadedShadowMap {
+  public:
+    // Creates the texture array and framebuffer, needs a current context. Returns false if they can't be used.
+    bool Init(const ShadowSettings& settings = ShadowSettings());
+    void Shutdown();
+
+    // Changes the settings, the texture array is recreated if its size changed and every cascade re-renders
+    void Configure(const ShadowSettings& settings);
+    const ShadowSettings& Settings() const { return settings; }
+
+    // Fits the cascades to the camera, aspect is the width over height of its projection.
+    // lightDirection is where the light shines to.
+    void Update(Camera& camera, float aspect, const glm::vec3& lightDirection);
+
+    // Renders the cascades due this frame into their layers and restores the default framebuffer with the
+    // given viewport
+    void Render(World& world, const DynamicBVH& bvh, int width, int height);
+
+    // Turns the shadows off until the next Update
+    void Disable() { enabled = false; }
+
+    // Binds the cascades and sets the shadow uniforms of a shader that includes the shadow lookup
+    void Apply(Shader& shader) const;
+
+    // Light view projection cascade i was last rendered with
+    const glm::mat4& CascadeMatrix(int i) const { return cascades[i].matrix; }
+    float CascadeSplit(int i) const { return cascades[i].splitFar; }
+
+  private:
+    struct Cascade {
+      glm::mat4 fitted;            // fitted to this frame's camera, becomes matrix when the layer re-renders
+      float fittedTexelSize;
+      glm::mat4 matrix;            // what the layer holds
+      float texelSize;             // world size of one texel of the layer
+      float splitFar;              // view depth the cascade covers up to
+      bool valid;
+    };
+
+    struct Caster {
+      Entity entity;
+      float size;
+    };
+
+    // uniform locations of one shader, looked up again when a hot reload swaps its program
+    struct ShaderUniforms {
+      const Shader* shader;
+      unsigned int program;
+      GLint shadowMap;
+      GLint cascadeCount;
+      GLint texel;
+      GLint matrices[SHADOW_MAX_CASCADES];
+      GLint splits[SHADOW_MAX_CASCADES];
+      GLint texelSizes[SHADOW_MAX_CASCADES];
+    };
+
+    bool createTexture();
+    void destroyTexture();
+    // draws the casters of one cascade into its layer, returns how many
+    size_t renderCascade(World& world, const DynamicBVH& bvh, int index);
+    const ShaderUniforms& uniformsOf(const Shader& shader) const;
+
+    ShadowSettings settings;
+    bool initialized = false;
+    bool enabled = false;
+    bool invalidated = true;      // every cascade re-renders next time
+    uint64_t frame = 0;
+    glm::vec3 lightDirection = glm::vec3(0.0f);
+
+    Cascade cascades[SHADOW_MAX_CASCADES] = {};
+    std::vector<Caster> casters;
+    mutable std::vector<ShaderUniforms> shaderUniforms;  // one per shader Apply has seen
+
+    std::unique_ptr<Shader> depthShader;
+    GLuint depthTexture = 0;
+    GLuint framebuffer = 0;
+    int textureResolution = 0;
+    int textureLayers = 0;
+};
+
+#endif
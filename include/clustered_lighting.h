@@ -0,0 +1,130 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "ecs.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <vector>
+
+class ShadowAtlas;
+
+// Cluster grid: screen tiles along x and y, exponential depth slices along z. X * Y must be a multiple of 4.
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+// Point and spot lights binned per frame, the rest is dropped
+#define CLUSTER_MAX_LIGHTS 4096
+// Lights a single cluster can reference
+#define CLUSTER_MAX_LIGHTS_PER_CLUSTER 128
+// Directional lights go to every fragment through uniforms
+#define CLUSTER_MAX_DIRECTIONAL_LIGHTS 4
+
+// First texture unit used by the light buffers, Apply binds it and the two after it
+#define CLUSTER_TEXTURE_UNIT 4
+
+// Clustered forward lighting. Every frame the point and spot lights of the world are binned into a 3D grid
+// of view space clusters on the job system, four clusters per SSE sphere test, and uploaded as texture
+// buffers: the lights, an (offset, count) pair per cluster and the light index lists. The fragment shader
+// finds its cluster from gl_FragCoord and view depth and only loops over the lights listed there.
+class ClusteredLighting {
+  public:
+    // Creates the texture buffers, needs a current context
+    void Init();
+    void Shutdown();
+
+    // Gathers the lights of the world, bins them against the clusters of the camera and uploads the result.
+    // projection has to be a symmetric perspective projection with the given near and far planes. Lights
+    // with a shadow in shadowAtlas this frame get pointed at its face records.
+    void Update(World& world, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane,
+                const ShadowAtlas* shadowAtlas = nullptr);
+
+    // Binds the light buffers and sets the lighting uniforms of a shader that includes the clustered lighting code
+    void Apply(Shader& shader, int width, int height) const;
+
+    // Bins already gathered view space spheres, split out of Update so it can run without a context.
+    // Fills clusterOffsets/clusterCounts/lightIndices.
+    void Bin(const glm::vec4* viewSpheres, size_t count);
+
+    // Recomputes the view space bounds of every cluster when the projection changes
+    void SetProjection(const glm::mat4& projection, float nearPlane, float farPlane);
+
+    size_t LightCount() const { return lightCount; }
+    size_t IndexCount() const { return lightIndices.size(); }
+    // where the directional lights of the last Update shine to, in the order the shader gets them
+    const std::vector<glm::vec3>& DirectionalDirections() const { return directionalDirections; }
+    const std::vector<uint32_t>& ClusterCounts() const { return clusterCounts; }
+    const std::vector<uint16_t>& LightIndices() const { return lightIndices; }
+    const std::vector<uint32_t>& ClusterOffsets() const { return clusterOffsets; }
+
+    static const int ClusterCount = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+  private:
+    // one light in the light buffer, four RGBA32F texels
+    struct GpuLight {
+      glm::vec4 positionRange;    // world position, range
+      glm::vec4 colorCosInner;    // color * intensity, cosine of the inner cone angle
+      glm::vec4 directionCosOuter;  // direction the light points at, cosine of the outer cone angle
+      glm::vec4 shadow;           // first shadow atlas face or -1, 1 for point lights
+    };
+
+    // view space bounds of the clusters of one depth slice, structure of arrays so four load at once
+    struct SliceBounds {
+      float minX[CLUSTER_X * CLUSTER_Y];
+      float minY[CLUSTER_X * CLUSTER_Y];
+      float maxX[CLUSTER_X * CLUSTER_Y];
+      float maxY[CLUSTER_X * CLUSTER_Y];
+      float minZ;
+      float maxZ;
+    };
+
+    // uniform locations of one shader, looked up again when a hot reload swaps its program
+    struct ShaderUniforms {
+      const Shader* shader;
+      unsigned int program;
+      GLint lights;
+      GLint ranges;
+      GLint indices;
+      GLint grid;
+      GLint screenSize;
+      GLint nearPlane;
+      GLint sliceScale;
+      GLint directionalCount;
+      GLint directionalDirections[CLUSTER_MAX_DIRECTIONAL_LIGHTS];
+      GLint directionalColors[CLUSTER_MAX_DIRECTIONAL_LIGHTS];
+    };
+
+    void binSlice(int slice, const glm::vec4* viewSpheres, size_t count);
+    const ShaderUniforms& uniformsOf(const Shader& shader) const;
+
+    GLuint lightBuffer = 0;
+    GLuint clusterBuffer = 0;
+    GLuint indexBuffer = 0;
+    GLuint lightTexture = 0;
+    GLuint clusterTexture = 0;
+    GLuint indexTexture = 0;
+
+    glm::mat4 projection = glm::mat4(0.0f);
+    float nearPlane = 0.0f;
+    float farPlane = 0.0f;
+    std::vector<SliceBounds> slices;
+
+    std::vector<GpuLight> lights;
+    std::vector<glm::vec4> viewSpheres;
+    std::vector<glm::vec3> directionalDirections;
+    std::vector<glm::vec3> directionalColors;
+    size_t lightCount = 0;
+
+    std::vector<uint16_t> clusterLights;   // CLUSTER_MAX_LIGHTS_PER_CLUSTER slots per cluster, filled by the slice jobs
+    std::vector<uint32_t> clusterCounts;
+    std::vector<uint32_t> clusterOffsets;
+    std::vector<uint16_t> lightIndices;    // clusterLights compacted
+    std::vector<glm::uvec2> clusterData;   // offset and count per cluster as uploaded
+    mutable std::vector<ShaderUniforms> shaderUniforms;  // one per shader Apply has seen
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Highest texture unit the replay keeps track of, binds to units above it are never skipped
+#define COMMAND_TEXTURE_UNITS 16
+// Same for uniform buffer bindings
+#define COMMAND_UNIFORM_BINDINGS 8
+
+enum CommandType : uint16_t {
+  COMMAND_SET_MAT4,
+  COMMAND_SET_FLOAT,
+  COMMAND_SET_INT,
+  COMMAND_BIND_TEXTURE,
+  COMMAND_BIND_UNIFORM_BUFFER,
+  COMMAND_SET_CULL_FACE,
+  COMMAND_DRAW_INDEXED,
+  COMMAND_DRAW_INDEXED_RANGES
+};
+
+// Every command starts with its type and its size in bytes, so a buffer can be walked without knowing
+// the layout of the commands it skips
+struct CommandHeader {
+    uint16_t type;
+    uint16_t size;
+};
+
+struct SetMat4Command {
+    CommandHeader header;
+    int32_t location;
+    float value[16];
+};
+
+struct SetFloatCommand {
+    CommandHeader header;
+    int32_t location;
+    float value;
+};
+
+struct SetIntCommand {
+    CommandHeader header;
+    int32_t location;
+    int32_t value;
+};
+
+struct BindTextureCommand {
+    CommandHeader header;
+    uint32_t unit;
+    uint32_t texture;
+};
+
+struct BindUniformBufferCommand {
+    CommandHeader header;
+    uint32_t binding;
+    uint32_t buffer;
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct SetCullFaceCommand {
+    CommandHeader header;
+    uint32_t face;           // GL_BACK or GL_FRONT, 0 turns culling off
+};
+
+struct DrawIndexedCommand {
+    CommandHeader header;
+    uint32_t vertexArray;
+    uint32_t indexCount;     // 32 bit indices, triangles
+    uint32_t instanceCount;
+};
+
+// Parts of a vertex array's indices drawn with one multi draw, the ranges are kept next to the commands
+struct DrawIndexedRangesCommand {
+    CommandHeader header;
+    uint32_t vertexArray;
+    uint32_t firstRange;
+    uint32_t rangeCount;
+};
+
+// Draw commands recorded into linear memory. Recording makes no GL calls, so worker threads can each fill
+// their own buffer at the same time, with uniform locations and object names resolved up front on the GL
+// thread. Replay then walks the buffers in order on the GL thread and issues the calls, skipping vertex
+// array, texture and uniform buffer binds and face culling changes that are already in place.
+//
+// Buffers keep their memory over Clear, so recording settles into no allocations after a few frames.
+class CommandBuffer {
+  public:
+    void Clear();
+
+    void SetMat4(int32_t location, const glm::mat4& value);
+    void SetFloat(int32_t location, float value);
+    void SetInt(int32_t location, int32_t value);
+    void BindTexture(uint32_t unit, uint32_t texture);
+    void BindUniformBuffer(uint32_t binding, uint32_t buffer, uint32_t offset, uint32_t size);
+    void SetCullFace(uint32_t face);
+    void DrawIndexed(uint32_t vertexArray, uint32_t indexCount, uint32_t instanceCount = 1);
+
+    // Starts a multi draw of parts of a vertex array's indices, AddRange adds the parts. Ranges that continue
+    // the previous one are merged into it, a multi draw left without ranges draws nothing.
+    void DrawIndexedRanges(uint32_t vertexArray);
+    void AddRange(uint32_t firstIndex, uint32_t indexCount);
+
+    size_t CommandCount() const { return commandCount; }
+    size_t Size() const { return data.size(); }
+
+    // Issues the commands of every buffer, in order, on the thread that owns the GL context. Leaves no
+    // vertex array bound, texture unit 0 active and face culling off.
+    static void Replay(const std::vector<CommandBuffer>& buffers);
+
+  private:
+    template <typename T>
+    T& push(CommandType type);
+
+    std::vector<uint8_t> data;
+    size_t commandCount = 0;
+
+    // index counts and byte offsets of the multi draws, in the form glMultiDrawElements takes them
+    std::vector<int32_t> rangeCounts;
+    std::vector<const void*> rangeOffsets;
+    size_t openRanges = 0;  // offset of the last DrawIndexedRangesCommand in data
+};
+
+#endif
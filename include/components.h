@@ -0,0 +1,85 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "bounds.h"
+#include "camera.h"
+#include "model.h"
+#include "scene.h"
+
+#include <cstdint>
+
+// Local position, rotation and scale of an entity that can move. UpdateTransforms rebuilds the
+// WorldTransformComponent from it whenever dirty is set.
+struct TransformComponent {
+    glm::vec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+    uint32_t dirty;
+};
+
+// Final matrix used for rendering. Static entities only have this one and no TransformComponent,
+// which keeps them out of the transform update entirely.
+struct WorldTransformComponent {
+    glm::mat4 matrix;
+};
+
+// Draws a model, with every mesh in one material or in its own
+struct MeshRendererComponent {
+    Model* model;
+    uint32_t material;  // MaterialLibrary index, MATERIAL_NONE keeps the materials of the model's meshes
+    uint32_t flags;     // SceneInstanceFlags
+};
+
+// World space bounds of a mesh renderer and its proxy in the scene BVH (BVH_NULL until inserted)
+struct BoundsComponent {
+    AABB world;
+    uint32_t proxy;
+};
+
+// Plays one of the model's animation clips, the palette at paletteOffset skins its meshes (see Animator)
+struct AnimatorComponent {
+    uint32_t clip;          // index into Model::animations
+    float time;             // seconds into the clip
+    float speed;            // playback rate, 1 is the clip's own
+    uint32_t paletteOffset; // first bone in the Animator's palettes
+};
+
+// Morph target weights of an instance in the MorphTargetLibrary, one per target of the model. An
+// AnimatorComponent next to it drives them from the clip.
+struct MorphComponent {
+    uint32_t weightOffset;
+};
+
+// Plays one of the model's clips from its vertex animation textures, entirely on the GPU (see CrowdRenderer)
+struct VertexAnimationComponent {
+    uint32_t clip;          // index into Model::animations
+    float timeOffset;       // seconds into the clip at time 0
+    float speed;            // playback rate, 1 is the clip's own
+};
+
+// Light placed at the entity's transform, spot and directional lights point down the entity's -Z
+struct LightComponent {
+    SceneLightType type;
+    glm::vec3 color;
+    float intensity;
+    float range;
+    float innerAngle;
+    float outerAngle;
+    bool castShadows;   // point and spot lights compete for a place in the shadow atlas
+};
+
+// Drives an entity transform from a Camera
+struct CameraComponent {
+    Camera* camera;
+    float nearPlane;
+    float farPlane;
+};
+
+// Builds a dirty transform component from position, rotation and scale
+TransformComponent MakeTransform(const glm::vec3& position, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+                                 const glm::vec3& scale = glm::vec3(1.0f));
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef ECS_H
+#define ECS_H
+
+#include "job_system.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Maximum number of distinct component types, archetypes are identified by a bit per type
+#define ECS_MAX_COMPONENTS 64
+
+typedef uint64_t ComponentMask;
+
+// Handle to an entity. The generation makes handles of destroyed entities invalid even when the
+// index gets reused.
+struct Entity {
+    uint32_t index;
+    uint32_t generation;
+
+    bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+const Entity NullEntity = { 0xFFFFFFFFu, 0 };
+
+// Packs a handle into 64 bits, e.g. to store it as user data in spatial structures
+inline uint64_t EntityToBits(Entity entity) { return ((uint64_t)entity.generation << 32) | entity.index; }
+inline Entity EntityFromBits(uint64_t bits) { return { (uint32_t)bits, (uint32_t)(bits >> 32) }; }
+
+// Hands out a small integer id per component type
+class ComponentRegistry {
+  public:
+    static uint32_t Register(size_t size);
+    static size_t Size(uint32_t id);
+};
+
+template <typename T>
+uint32_t ComponentId() {
+    // components are moved around with memcpy when entities change archetype
+    static_assert(std::is_trivially_copyable<T>::value, "components must be trivially copyable");
+    static const uint32_t id = ComponentRegistry::Register(sizeof(T));
+    return id;
+}
+
+template <typename... Ts>
+ComponentMask MaskOf() {
+    return (ComponentMask(0) | ... | (ComponentMask(1) << ComponentId<Ts>()));
+}
+
+// All entities with exactly the same set of components. Every component type gets its own tightly
+// packed column, so iterating one component touches nothing but that component's memory.
+class Archetype {
+  public:
+    ComponentMask mask = 0;
+    std::vector<uint32_t> componentIds;
+    std::vector<std::vector<unsigned char>> columns;
+    std::vector<size_t> componentSizes;
+    std::vector<Entity> entities;
+
+    // column of every component id in this archetype, -1 if the archetype doesn't have it
+    int columnIndex[ECS_MAX_COMPONENTS];
+
+    // archetypes reached by adding or removing one component, filled lazily
+    std::unordered_map<uint32_t, Archetype*> addEdges;
+    std::unordered_map<uint32_t, Archetype*> removeEdges;
+
+    explicit Archetype(ComponentMask mask);
+
+    size_t Size() const { return entities.size(); }
+
+    template <typename T>
+    T* Column() { return (T*)columns[columnIndex[ComponentId<T>()]].data(); }
+
+    void* ComponentData(uint32_t id, uint32_t row) {
+      int column = columnIndex[id];
+      return columns[column].data() + row * componentSizes[column];
+    }
+
+    // Appends an entity with zeroed components, returns its row
+    uint32_t Push(Entity entity);
+
+    // Removes a row by moving the last row into it. Returns the entity that moved, or NullEntity.
+    Entity SwapRemove(uint32_t row);
+
+    void Reserve(size_t count);
+};
+
+// Owns all entities and their components, runs queries and systems.
+// Structural changes (Create, Destroy, Add, Remove) must not happen while iterating a query.
+class World {
+  public:
+    World();
+    ~World();
+
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    // Creates an entity without components
+    Entity Create();
+
+    // Creates an entity directly in the archetype for the given components
+    template <typename... Ts>
+    Entity Create(const Ts&... components) {
+      Archetype* archetype = getArchetype(MaskOf<Ts...>());
+      Entity entity = allocateEntity();
+      uint32_t row = archetype->Push(entity);
+      records[entity.index].archetype = archetype;
+      records[entity.index].row = row;
+      (std::memcpy(archetype->ComponentData(ComponentId<Ts>(), row), &components, sizeof(Ts)), ...);
+      return entity;
+    }
+
+    void Destroy(Entity entity);
+    bool IsAlive(Entity entity) const;
+    size_t EntityCount() const { return aliveCount; }
+
+    // Makes room for count entities with exactly these components
+    template <typename... Ts>
+    void Reserve(size_t count) {
+      getArchetype(MaskOf<Ts...>())->Reserve(count);
+    }
+
+    template <typename T>
+    void Add(Entity entity, const T& component) {
+      if (!IsAlive(entity))
+        return;
+      uint32_t id = ComponentId<T>();
+      if (!(records[entity.index].archetype->mask & (ComponentMask(1) << id)))
+        moveEntity(entity, nextArchetype(records[entity.index].archetype, id, true));
+      const EntityRecord& record = records[entity.index];
+      std::memcpy(record.archetype->ComponentData(id, record.row), &component, sizeof(T));
+    }
+
+    template <typename T>
+    void Remove(Entity entity) {
+      if (!Has<T>(entity))
+        return;
+      moveEntity(entity, nextArchetype(records[entity.index].archetype, ComponentId<T>(), false));
+    }
+
+    template <typename T>
+    bool Has(Entity entity) const {
+      return IsAlive(entity) && (records[entity.index].archetype->mask & (ComponentMask(1) << ComponentId<T>()));
+    }
+
+    // Returns the component, or nullptr if the entity doesn't have it. The pointer is only valid until
+    // the next structural change.
+    template <typename T>
+    T* Get(Entity entity) {
+      if (!Has<T>(entity))
+        return nullptr;
+      const EntityRecord& record = records[entity.index];
+      return (T*)record.archetype->ComponentData(ComponentId<T>(), record.row);
+    }
+
+    // Calls fn(count, entities, Ts*...) once per matching archetype with the raw component arrays
+    template <typename... Ts, typename Fn>
+    void EachChunk(Fn&& fn) {
+      for (Archetype* archetype : match(MaskOf<Ts...>())) {
+        if (archetype->Size() > 0)
+          fn(archetype->Size(), archetype->entities.data(), archetype->template Column<Ts>()...);
+      }
+    }
+
+    // Calls fn(entity, Ts&...) for every entity that has all the given components
+    template <typename... Ts, typename Fn>
+    void Each(Fn&& fn) {
+      EachChunk<Ts...>([&](size_t count, const Entity* entities, Ts*... columns) {
+        for (size_t i = 0; i < count; i++)
+          fn(entities[i], columns[i]...);
+      });
+    }
+
+    // Same as Each but spread over the job system. fn runs concurrently and may only touch the
+    // components it is given (and anything else it synchronizes itself).
+    template <typename... Ts, typename Fn>
+    void ParallelEach(Fn&& fn, size_t minBatch = 4096) {
+      const std::vector<Archetype*>& archetypes = match(MaskOf<Ts...>());
+
+      // cut every archetype into ranges so small archetypes don't hold up big ones
+      std::vector<ParallelRange> parallelRanges;
+      for (Archetype* archetype : archetypes) {
+        for (size_t begin = 0; begin < archetype->Size(); begin += minBatch)
+          parallelRanges.push_back({archetype, begin, std::min(archetype->Size(), begin + minBatch)});
+      }
+
+      JobSystem::Get().ParallelFor(parallelRanges.size(), 1, [&](size_t first, size_t last) {
+        for (size_t r = first; r < last; r++) {
+          const ParallelRange& range = parallelRanges[r];
+          std::tuple<Ts*...> columns(range.archetype->template Column<Ts>()...);
+          const Entity* entities = range.archetype->entities.data();
+          for (size_t i = range.begin; i < range.end; i++)
+            fn(entities[i], std::get<Ts*>(columns)[i]...);
+        }
+      });
+    }
+
+    // Registers a system. Systems run in registration order, but consecutive systems whose component
+    // accesses don't conflict (no write overlaps a read or write of another) run in parallel.
+    void AddSystem(const char* name, ComponentMask reads, ComponentMask writes, std::function<void(World&, float)> fn);
+
+    // Runs all registered systems once
+    void RunSystems(float deltaTime);
+
+  private:
+    struct EntityRecord {
+      Archetype* archetype;
+      uint32_t row;
+      uint32_t generation;
+    };
+
+    struct QueryCache {
+      std::vector<Archetype*> archetypes;
+      size_t archetypesSeen = 0;
+    };
+
+    struct ParallelRange {
+      Archetype* archetype;
+      size_t begin;
+      size_t end;
+    };
+
+    struct System {
+      const char* name;
+      ComponentMask reads;
+      ComponentMask writes;
+      std::function<void(World&, float)> fn;
+    };
+
+    Entity allocateEntity();
+    Archetype* getArchetype(ComponentMask mask);
+    Archetype* nextArchetype(Archetype* from, uint32_t componentId, bool add);
+    void moveEntity(Entity entity, Archetype* to);
+    const std::vector<Archetype*>& match(ComponentMask mask);
+
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<ComponentMask, Archetype*> archetypeByMask;
+    std::unordered_map<ComponentMask, QueryCache> queries;
+    std::mutex queryMutex;
+
+    std::vector<EntityRecord> records;
+    std::vector<uint32_t> freeIndices;
+    size_t aliveCount = 0;
+
+    std::vector<System> systems;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <vector>
+
+// Reports files written in a directory, with inotify on Linux. Editors that save through a temporary file
+// and a rename are caught as well. Elsewhere Init fails and Poll never reports anything.
+class FileWatcher {
+  public:
+    ~FileWatcher();
+
+    // Starts watching the files directly in directory, returns false if it can't
+    bool Init(const std::string& directory);
+    void Shutdown();
+
+    // Never blocks. Fills changed with the paths (directory/name) of the files written since the last call,
+    // each once, and returns whether there were any.
+    bool Poll(std::vector<std::string>& changed);
+
+  private:
+    std::string directory;
+    int descriptor = -1;
+    int watch = -1;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "ecs.h"
+#include "meshlets.h"
+#include "model.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <vector>
+
+// Frames the compute path waits before reading back how many instances survived, so the read never stalls
+#define GPU_CULLING_READBACK_FRAMES 3
+
+// Draw commands the cluster pass may write over all meshes, the meshes past it are drawn whole
+#define GPU_CULLING_MAX_CLUSTER_COMMANDS (1 << 20)
+
+// GPU instance culling against a hierarchical Z pyramid built from the previous frame's depth buffer.
+// Mesh renderers are grouped into batches of the same model and material and uploaded once. Every frame
+// each instance is tested against the frustum and the pyramid on the GPU, and the survivors are compacted
+// per batch and drawn instanced, so the CPU never touches individual instances.
+//
+// With GL 4.3 the test is a compute shader that bumps the instance counts of an indirect draw buffer. On
+// GL 3.3 a vertex and geometry shader write the survivors through transform feedback and the counts come
+// from GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN queries, which the CPU has to wait for before drawing.
+//
+// On the compute path meshes with at least MESHLET_MIN_COUNT meshlets are culled a second time per meshlet:
+// every meshlet of every surviving instance is tested against the frustum, the pyramid and its normal cone,
+// and the survivors are appended to the mesh's own commands, which go out with one multi draw indirect. With
+// GL 4.6 the draw count comes from the GPU as well, otherwise the commands left over are zero.
+//
+// Per frame: Update, Cull, Draw, then BuildHiZ once the scene's depth is complete.
+class GpuCuller {
+  public:
+    // Compiles the shaders, needs a current context. Returns false if culling isn't available.
+    bool Init();
+    void Shutdown();
+
+    // Uploads every mesh renderer whose flags share no bit with excludeFlags, grouped into batches
+    void Build(World& world, uint32_t excludeFlags);
+
+    // Re-uploads the matrices and bounds of the movable instances
+    void Update(World& world);
+
+    // Tests every instance against the frustum of viewProjection and the depth pyramid, then the meshlets
+    // of the survivors, facing away from cameraPosition included
+    void Cull(const glm::mat4& viewProjection, const glm::vec3& cameraPosition);
+
+    // Draws the surviving instances. The shader has to take the model matrix from the instance attributes
+    // at MESH_INSTANCE_ATTRIBUTE and multiply it with the meshTransform uniform, and have its MaterialBlock
+    // applied. Batches without a material draw each mesh with its own.
+    void Draw(Shader& shader);
+
+    // Turns the scene's depth texture into the pyramid for the next frame's Cull. viewProjection is the
+    // matrix the depth was rendered with.
+    void BuildHiZ(GLuint depthTexture, int width, int height, const glm::mat4& viewProjection);
+
+    // Forgets the pyramid, the next Cull only tests the frustum
+    void InvalidateHiZ() { hizValid = false; }
+
+    // Turns the meshlet pass on or off, meshes are drawn whole while it is off
+    void SetClusterCulling(bool enabled) { clusterCulling = enabled; }
+
+    bool Ready() const { return initialized && !batches.empty(); }
+    bool UsesCompute() const { return useCompute; }
+    size_t InstanceCount() const { return instanceCount; }
+
+    // Instances drawn by the last Draw, a few frames old on the compute path
+    size_t VisibleCount() const { return visibleCount; }
+
+    // Meshlets the last Cull tested and how many of them were drawn, as old as VisibleCount
+    size_t TestedClusterCount() const { return testedClusters; }
+    size_t VisibleClusterCount() const { return visibleClusters; }
+
+  private:
+    // per instance record, 96 bytes. boundsMin.w holds the batch index as uint bits.
+    struct GpuInstance {
+      glm::mat4 model;
+      glm::vec4 boundsMin;
+      glm::vec4 boundsMax;
+    };
+
+    // matches the std430 Batch struct of cullInstances.comp
+    struct GpuBatch {
+      uint32_t first;
+      uint32_t firstCommand;
+      uint32_t commandCount;
+      uint32_t padding;
+    };
+
+    // layout glDrawElementsIndirect reads
+    struct DrawCommand {
+      uint32_t count;
+      uint32_t instanceCount;
+      uint32_t firstIndex;
+      uint32_t baseVertex;
+      uint32_t baseInstance;
+    };
+
+    // matches the std430 Meshlet struct of cullClusters.comp
+    struct GpuMeshlet {
+      glm::vec4 sphere;
+      glm::vec4 cone;
+      uint32_t firstIndex;
+      uint32_t indexCount;
+      uint32_t padding[2];
+    };
+
+    struct Batch {
+      Model* model;
+      uint32_t material;      // MaterialLibrary index, MATERIAL_NONE draws each mesh with its own
+      uint32_t first;         // first instance, also where its survivors start in the visible buffer
+      uint32_t count;
+      uint32_t firstCommand;  // one draw command per mesh of the model
+      unsigned int visible;   // survivors of the last frame that was read back
+      bool mirrored;          // an instance's transform flips the winding, the batch draws without face culling
+      std::vector<int> clusterDraws;  // ClusterDraw of each mesh, -1 for the ones drawn whole
+    };
+
+    // one mesh of a batch drawn meshlet by meshlet
+    struct ClusterDraw {
+      uint32_t batch;
+      uint32_t mesh;
+      uint32_t firstMeshlet;  // in the meshlet buffer
+      uint32_t meshletCount;
+      uint32_t firstCommand;  // room for a command per meshlet of every instance of the batch
+      unsigned int visible;   // commands written, of the last frame that was read back
+      unsigned long long triangles;  // in them
+    };
+
+    struct MovableInstance {
+      Entity entity;
+      uint32_t slot;
+    };
+
+    // uniform locations, looked up once the programs are linked
+    struct CullUniforms {
+      GLint viewProjection;
+      GLint hizViewProjection;
+      GLint hizSize;
+      GLint hizLevels;
+      GLint hizValid;
+      GLint hiz;
+    };
+
+    struct ClusterUniforms {
+      GLint meshTransform;
+      GLint visibleFirst;
+      GLint instanceCommand;
+      GLint firstMeshlet;
+      GLint meshletCount;
+      GLint firstCommand;
+      GLint counter;
+      GLint cameraPosition;
+    };
+
+    // locations in a shader Draw was called with, looked up again when the shader is reloaded
+    struct ShaderUniforms {
+      const Shader* shader;
+      unsigned int program;
+      GLint meshTransform;
+    };
+
+    static CullUniforms findCullUniforms(GLuint program);
+    void setCullUniforms(GLuint program, const CullUniforms& uniforms, const glm::mat4& viewProjection);
+    void buildClusterDraws();
+    void cullClusters(const glm::mat4& viewProjection, const glm::vec3& cameraPosition);
+    void readVisibleCounts();
+    const ShaderUniforms& uniformsOf(const Shader& shader);
+    void destroyBuffers();
+    void destroyHiZ();
+
+    bool initialized = false;
+    bool useCompute = false;
+    bool useDrawCount = false;   // glMultiDrawElementsIndirectCount, GL 4.6
+    bool clusterCulling = true;
+    bool culledClusters = false; // whether the last Cull ran the meshlet pass
+
+    std::vector<Batch> batches;
+    std::vector<MovableInstance> movable;  // in slot order
+    std::vector<GpuInstance> instances;    // copy of the instance buffer, Update patches it and uploads once
+    size_t instanceCount = 0;
+    size_t visibleCount = 0;
+
+    std::vector<ClusterDraw> clusterDraws;
+    size_t clusterCommandCount = 0;
+    size_t meshletCount = 0;
+    size_t testedClusters = 0;
+    size_t visibleClusters = 0;
+    std::vector<DrawCommand> readbackCommands;  // scratch of readVisibleCounts, kept so it allocates only once
+    std::vector<uint32_t> readbackCounters;
+    std::vector<ShaderUniforms> shaderUniforms;  // one per shader Draw has seen
+
+    GLuint cullProgram = 0;
+    GLuint clusterProgram = 0;     // 0 if the meshlet pass isn't available
+    GLuint hizProgram = 0;
+    CullUniforms cullUniforms = {};
+    CullUniforms clusterCullUniforms = {};
+    ClusterUniforms clusterUniforms = {};
+    GLint instanceCountUniform = -1;
+    GLint hizSourceUniform = -1;
+    GLint hizCopyDepthUniform = -1;
+    GLuint emptyVAO = 0;       // full screen triangle, positions come from gl_VertexID
+    GLuint cullVAO = 0;        // instance buffer as vertex input of the transform feedback path
+    GLuint instanceBuffer = 0;
+    GLuint visibleBuffer = 0;  // surviving model matrices, packed per batch
+    GLuint batchBuffer = 0;
+    GLuint commandBuffer = 0;
+    GLuint commandTemplate = 0;  // commands with zero instances, copied over commandBuffer before each cull
+    GLuint readbackBuffers[GPU_CULLING_READBACK_FRAMES] = {};
+    std::vector<GLuint> queries;  // one primitives written query per batch on the transform feedback path
+    GLuint meshletBuffer = 0;
+    GLuint clusterCommandBuffer = 0;
+    GLuint clusterCounterBuffer = 0;  // two per ClusterDraw: commands written and their triangles
+    GLuint clusterReadbackBuffers[GPU_CULLING_READBACK_FRAMES] = {};
+    size_t commandCount = 0;
+    uint64_t frame = 0;
+
+    GLuint hizTexture = 0;
+    GLuint hizFramebuffer = 0;
+    int hizWidth = 0;
+    int hizHeight = 0;
+    int hizLevels = 0;
+    bool hizValid = false;
+    glm::mat4 hizViewProjection = glm::mat4(1.0f);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed pool of worker threads for data parallel loops.
+// ParallelFor is meant to be called from the main thread; calls made from inside a job run inline.
+class JobSystem {
+  public:
+    // Returns the engine wide job system
+    static JobSystem& Get();
+
+    // Starts the workers, 0 uses one thread per core minus the calling thread
+    void Init(unsigned int workerCount = 0);
+    void Shutdown();
+
+    // Number of threads that take part in a ParallelFor, including the caller
+    unsigned int ThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+    // Splits [0, count) into batches of at least minBatch items and runs fn(begin, end) on every thread.
+    // Returns once all batches are done.
+    void ParallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)>& fn);
+
+    // Index of the calling thread in [0, ThreadCount()), 0 is the thread that called Init.
+    // Handy for per thread scratch buffers.
+    static unsigned int ThreadIndex();
+
+  private:
+    JobSystem() = default;
+    ~JobSystem();
+
+    void workerLoop(unsigned int index);
+    void runBatches();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool running = false;
+    unsigned long long generation = 0;
+
+    // the job currently being executed
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    size_t jobBatch = 0;
+    std::atomic<size_t> nextBatch{0};
+    std::atomic<size_t> batchesLeft{0};
+    unsigned int activeWorkers = 0;
+};
+
+#endif
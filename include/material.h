@@ -0,0 +1,87 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CommandBuffer;
+class Shader;
+
+// Uniform buffer binding the bound material's parameters are read from, the MaterialBlock of the shaders
+#define MATERIAL_UNIFORM_BINDING 0
+
+// Material 0 is plain white, used by meshes that come without one
+#define MATERIAL_DEFAULT 0u
+// Instances with this material draw every mesh with the mesh's own
+#define MATERIAL_NONE 0xFFFFFFFFu
+
+// Texture slots of a material, each bound to the texture unit of the same number
+enum MaterialTextureSlot {
+  MATERIAL_DIFFUSE_MAP,
+  MATERIAL_SPECULAR_MAP,
+  MATERIAL_NORMAL_MAP,      // tangent space, drawn with SHADER_NORMAL_MAP
+  MATERIAL_TEXTURE_SLOTS
+};
+
+// Parameter block of one material, std140 like MaterialBlock in fragmentShader.fs
+struct MaterialParameters {
+    glm::vec4 diffuse = glm::vec4(1.0f);                  // Kd, opacity in w
+    glm::vec4 specular = glm::vec4(0.5f, 0.5f, 0.5f, 32.0f);  // Ks, shininess (Ns) in w
+    glm::vec4 maps = glm::vec4(0.0f);                     // 1 per slot that has a texture, diffuse in x
+};
+
+struct Material {
+    MaterialParameters parameters;
+    GLuint textures[MATERIAL_TEXTURE_SLOTS] = {0, 0, 0};
+    uint32_t features = 0;    // ShaderFeature bits the material needs on top of what the pass uses
+};
+
+// Every material in one uniform buffer, each parameter block at its own aligned offset and uploaded once
+// when it is added. Meshes and instances refer to materials by index, so meshes sharing a material share
+// its block, and binding one is a single buffer range bind plus its textures.
+class MaterialLibrary {
+  public:
+    // Returns the engine wide library
+    static MaterialLibrary& Get();
+
+    // Creates the buffer, needs a current context. Materials added before are uploaded on the next Upload.
+    void Init();
+    void Shutdown();
+
+    // Adds a material and returns its index. Textures in maps are flagged in the parameters.
+    uint32_t Add(const Material& material);
+
+    const Material& At(uint32_t index) const { return materials[index]; }
+    size_t Count() const { return materials.size(); }
+
+    // Features of all materials together, a shader drawing any of them needs these
+    uint32_t Features() const { return features; }
+
+    // Uploads the blocks of materials added since the last call
+    void Upload();
+
+    // Points a shader's MaterialBlock and material samplers at the material bindings
+    void Apply(Shader& shader) const;
+
+    // Binds a material's parameter block and textures
+    void Bind(uint32_t index) const;
+
+    // Same as Bind, recorded for a replay on the GL thread. Safe from any thread while no material is added.
+    void Record(CommandBuffer& commands, uint32_t index) const;
+
+  private:
+    MaterialLibrary() = default;
+
+    std::vector<Material> materials;
+    uint32_t features = 0;
+    GLuint buffer = 0;
+    size_t stride = 0;       // parameter block size rounded up to the offset alignment
+    size_t capacity = 0;     // blocks the buffer holds
+    size_t uploaded = 0;     // blocks already in the buffer
+};
+
+#endif
@@ -7,6 +7,12 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "profiler.h"
+#include "material.h"
+#include "morph_targets.h"
+#include "meshlets.h"
+#include "bounds.h"
+#include "triangle_bvh.h"
 
 #include <string>
 #include <vector>
@@ -14,6 +20,9 @@ using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
 
+// First of the four attribute locations holding the per instance model matrix in instanced draws
+#define MESH_INSTANCE_ATTRIBUTE 8
+
 struct Vertex {
     // position
     glm::vec3 Position;
@@ -44,53 +53,139 @@ public:
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    uint32_t             material;  // index into the MaterialLibrary
+    bool                 skinned;   // vertices carry bone influences into the model's palette
+    MeshMorphTargets     morphTargets;  // blend shapes, targetCount is 0 for most meshes
+    AABB                 bounds;    // bounding box of the vertex positions
+    TriangleBVH          bvh;       // triangle hierarchy for ray casts
+    vector<Meshlet>      meshlets;  // clusters of the triangles, indices are ordered meshlet by meshlet
+    vector<MeshletBounds> meshletBounds;  // culling bounds of each meshlet
+    bool                 twoSided;  // drawn without back face culling: a two sided material, or not a closed surface
     unsigned int VAO;
 
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, uint32_t material = MATERIAL_DEFAULT,
+         bool skinned = false, bool twoSided = false)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->material = material;
+        this->skinned = skinned;
+        this->twoSided = twoSided || this->vertices.empty() ||
+                         !IsClosedMesh(&this->vertices[0].Position, sizeof(Vertex), this->vertices.size(), this->indices);
+
+        bounds = AABB::Empty();
+        for (const Vertex &vertex : this->vertices)
+            bounds.Grow(vertex.Position);
+        // the meshlets reorder the indices, the BVH's triangle numbers refer to the new order
+        if (!this->vertices.empty())
+        {
+            BuildMeshlets(&this->vertices[0].Position, sizeof(Vertex), this->vertices.size(), this->indices, meshlets, meshletBounds);
+            bvh.Build(&this->vertices[0].Position, sizeof(Vertex), this->indices.data(), this->indices.size());
+        }
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
-    // render the mesh
-    void Draw(Shader &shader) 
+    // GL_CULL_FACE state for drawing the mesh, mirrored when its transform flips the winding
+    void SetFaceCulling(bool mirrored) const
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-
-        for(unsigned int i = 0; i < textures.size(); i++)
+        if (twoSided)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-
-            cout << "Setting texture name: " <<  (name + number).c_str() << " with shader ID: " << shader.ID << endl;
-            
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            glDisable(GL_CULL_FACE);
+            return;
         }
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        glEnable(GL_CULL_FACE);
+        glCullFace(mirrored ? GL_FRONT : GL_BACK);
+    }
+
+    // render the mesh with its material, the shader needs MaterialLibrary::Apply once beforehand
+    void Draw()
+    {
+        MaterialLibrary::Get().Bind(material);
 
         // draw mesh
         glBindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
+        Profiler::Get().CountStateChange();
+        Profiler::Get().CountDraw(indices.size() / 3);
+
+    }
+
+    // points the per instance model matrix (attribute locations MESH_INSTANCE_ATTRIBUTE to +3) at a buffer
+    // of mat4s stride bytes apart, starting offset bytes in
+    void SetInstanceBuffer(unsigned int buffer, size_t offset, size_t stride = sizeof(glm::mat4))
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (unsigned int column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(MESH_INSTANCE_ATTRIBUTE + column);
+            glVertexAttribPointer(MESH_INSTANCE_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride,
+                                  (void*)(offset + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(MESH_INSTANCE_ATTRIBUTE + column, 1);
+        }
+        glBindVertexArray(0);
+        Profiler::Get().CountStateChange();
+    }
 
+    // points one more per instance vec4 attribute at a buffer, for instance data beyond the model matrix
+    void SetInstanceAttribute(unsigned int location, unsigned int buffer, size_t offset, size_t stride)
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)offset);
+        glVertexAttribDivisor(location, 1);
+        glBindVertexArray(0);
+        Profiler::Get().CountStateChange();
+    }
+
+    // draws count instances, SetInstanceBuffer has to be called first. The caller binds the material.
+    void DrawInstanced(unsigned int count)
+    {
+        glBindVertexArray(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, count);
+        glBindVertexArray(0);
+        Profiler::Get().CountStateChange();
+        Profiler::Get().CountDraw(indices.size() / 3 * (unsigned long long)count);
+    }
+
+    // draws with the DrawElementsIndirectCommand at offset bytes into the bound GL_DRAW_INDIRECT_BUFFER (GL 4.0+).
+    // The real instance count only exists on the GPU, the profiler counts triangles for countedInstances.
+    // The caller binds the material.
+    void DrawIndirect(size_t offset, unsigned int countedInstances)
+    {
+        glBindVertexArray(VAO);
+        glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset);
+        glBindVertexArray(0);
+        Profiler::Get().CountStateChange();
+        Profiler::Get().CountDraw(indices.size() / 3 * (unsigned long long)countedInstances);
+    }
+
+    // draws drawCount DrawElementsIndirectCommands starting offset bytes into the bound GL_DRAW_INDIRECT_BUFFER
+    // with one call (GL 4.3+). The profiler counts countedTriangles. The caller binds the material.
+    void MultiDrawIndirect(size_t offset, unsigned int drawCount, unsigned long long countedTriangles)
+    {
+        glBindVertexArray(VAO);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, (GLsizei)drawCount, 0);
+        glBindVertexArray(0);
+        Profiler::Get().CountStateChange();
+        Profiler::Get().CountDraw(countedTriangles);
+    }
+
+    // the same with the number of commands read from countOffset bytes into the bound GL_PARAMETER_BUFFER,
+    // at most maxDrawCount of them (GL 4.6)
+    void MultiDrawIndirectCount(size_t offset, size_t countOffset, unsigned int maxDrawCount, unsigned long long countedTriangles)
+    {
+        glBindVertexArray(VAO);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, (GLintptr)countOffset, (GLsizei)maxDrawCount, 0);
+        glBindVertexArray(0);
+        Profiler::Get().CountStateChange();
+        Profiler::Get().CountDraw(countedTriangles);
     }
 
 private:
@@ -115,6 +210,7 @@ private:
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        Profiler::Get().TrackBufferMemory(vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int));
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -126,6 +222,16 @@ private:
         // vertex texture coords
         glEnableVertexAttribArray(2);	
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // bone ids and weights, read by the skinning shaders
+        glEnableVertexAttribArray(3);
+        glVertexAttribIPointer(3, MAX_BONE_INFLUENCE, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, MAX_BONE_INFLUENCE, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
+        // tangents and bitangents, read by the normal mapping shaders
+        glEnableVertexAttribArray(5);
+        glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
         glBindVertexArray(0);
     }
@@ -0,0 +1,68 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Limits of one meshlet, small enough that culling one is a fine grained decision
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// Meshes with fewer meshlets than this are always drawn whole, culling their clusters can't pay for the draws
+#define MESHLET_MIN_COUNT 8
+
+// A cluster of neighbouring triangles, its indices follow each other in the mesh's index buffer
+struct Meshlet {
+    uint32_t firstIndex;
+    uint32_t triangleCount;
+    uint32_t vertexCount;   // distinct vertices its triangles use
+};
+
+// What a meshlet is culled with, in mesh space. A viewer for whom every triangle of the meshlet faces away
+// satisfies dot(center - eye, coneAxis) >= coneCutoff * length(center - eye) + radius.
+struct MeshletBounds {
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;     // average facing of the triangles
+    float coneCutoff;       // sine of the widest angle between a triangle and the axis, 1 if it never faces away
+};
+
+// Splits an indexed triangle list into meshlets, growing each from the triangles that share the most vertices
+// with it so they stay compact, and reorders indices so every meshlet's triangles are contiguous. positions
+// points at the first position and stride is the distance in bytes between two vertices.
+void BuildMeshlets(const glm::vec3* positions, size_t stride, size_t vertexCount, std::vector<unsigned int>& indices,
+                   std::vector<Meshlet>& meshlets, std::vector<MeshletBounds>& bounds);
+
+// True if every edge of the triangles is shared by exactly two of them, running opposite ways, once vertices
+// at the same position are merged. Only closed meshes can have their back faces culled: elsewhere a
+// triangle facing away may be the only thing in view.
+bool IsClosedMesh(const glm::vec3* positions, size_t stride, size_t vertexCount, const std::vector<unsigned int>& indices);
+
+// The frustum and camera of a view moved into the space of one mesh instance, so meshlets are tested against
+// their bounds as built. Exact for any affine transform.
+struct MeshletView {
+    glm::vec4 planes[6];
+    glm::vec3 eye;
+    bool cones;             // skipped for two sided meshes, and mirroring transforms that turn the triangles around
+
+    static MeshletView FromTransform(const Frustum& frustum, const glm::vec3& eye, const glm::mat4& transform, bool twoSided);
+
+    // False if the meshlet is outside the frustum or, with cones, faces away from the eye
+    bool Visible(const MeshletBounds& bounds) const {
+      for (int i = 0; i < 6; i++) {
+        if (glm::dot(glm::vec3(planes[i]), bounds.center) + planes[i].w < -bounds.radius)
+          return false;
+      }
+      if (!cones)
+        return true;
+      glm::vec3 toCenter = bounds.center - eye;
+      return glm::dot(toCenter, bounds.coneAxis) < bounds.coneCutoff * glm::length(toCenter) + bounds.radius;
+    }
+};
+
+#endif
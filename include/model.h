@@ -10,8 +10,11 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "animation.h"
 #include "mesh.h"
+#include "occlusion.h"
 #include "shader.h"
+#include "transform_hierarchy.h"
 
 #include <string>
 #include <fstream>
@@ -21,34 +24,107 @@
 #include <vector>
 using namespace std;
 
+// Closest hit of a ray cast against a model
+struct ModelHit {
+    uint32_t mesh;      // index into Model::meshes
+    uint32_t triangle;  // triangle of that mesh (first index / 3)
+    float u, v;         // barycentrics, the hit is (1 - u - v) * v0 + u * v1 + v * v2
+    float distance;     // along the ray as it was passed in
+};
+
 class Model 
 {
 public:
     // model data 
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
+    vector<uint32_t> materials;         // MaterialLibrary index of each material of the file, MATERIAL_NONE if no mesh uses it
+    TransformHierarchy nodes;           // node transforms of the file, depth first so parents come before children
+    vector<string>  nodeNames;          // name of each node, same order as nodes
+    vector<uint32_t> meshNodes;         // node each mesh is attached to, same order as meshes
+    vector<uint32_t> boneNodes;         // node driving each bone of the skinning palette
+    vector<glm::mat4> boneOffsets;      // mesh space to bone space in the bind pose, same order as boneNodes
+    vector<AnimationClip> animations;   // clips of the file, resampled to ANIMATION_SAMPLE_RATE and compressed
+    vector<string>  morphTargetNames;   // every morph target of the model, each mesh's targets follow each other
+    vector<float>   morphWeights;       // default weight of every morph target
+    AABB            bounds;             // bounding box of all meshes placed by their nodes
+    OccluderMesh    occluder;           // geometry for the occlusion buffer, empty if the model is too detailed
     string directory;
     bool gammaCorrection;
 
     // constructor, expects a filepath to a 3D model.
     Model(string const &path, bool gamma = false);
 
+    // empty model, meshes can be added by hand (used for built-in primitives)
+    Model() : bounds(AABB::Empty()), gammaCorrection(false) {}
+
     // draws the model, and thus all its meshes
     void Draw(Shader &shader);
+
+    // draws the model with every mesh placed by its node's world matrix on top of the given transform.
+    // With a boneOffset the skinned meshes take their placement from the bone palette there instead.
+    void Draw(Shader &shader, const glm::mat4 &transform, int boneOffset = -1);
+
+    // returns the index of the node with the given name, or -1 if there is none
+    int FindNode(const string &name) const;
+
+    // replaces a node's local transform, children follow on the next Draw
+    void SetNodeTransform(uint32_t node, const glm::mat4 &local);
+
+    // recomputes bounds from the meshes and node transforms, call after adding meshes by hand
+    void ComputeBounds();
+
+    // copies the meshes placed by their nodes into occluder if they have at most maxTriangles triangles in total,
+    // call after adding meshes by hand. Only use it for solid models, the copy is drawn as is.
+    void BuildOccluder(size_t maxTriangles = OCCLUDER_MAX_TRIANGLES);
+
+    // casts a world space ray against the model placed at transform, returns the closest hit within maxT
+    bool Raycast(const Ray &ray, const glm::mat4 &transform, float maxT, ModelHit &hit) const;
     
 private:
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path);
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene);
+    // processes a node in a recursive fashion. Adds the node and queues each mesh located at it, then repeats this process on its children nodes (if any).
+    // Meshes are only processed once every node exists, their bones can refer to nodes anywhere in the file.
+    void processNode(aiNode *node, const aiScene *scene, uint32_t parentNode, vector<pair<aiMesh*, uint32_t>> &meshQueue);
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene);
+    Mesh processMesh(aiMesh *mesh, const aiScene *scene, uint32_t meshNode);
+
+    // fills the bone influences of a mesh's vertices, adding its bones to the palette. Meshes without bones in a file
+    // with animations are bound rigidly to their own node, so node animation moves them as well.
+    bool processBones(aiMesh *mesh, const aiScene *scene, uint32_t meshNode, vector<Vertex> &vertices);
+
+    // imports a mesh's morph targets as sparse deltas from the base vertices into the MorphTargetLibrary
+    MeshMorphTargets processMorphTargets(aiMesh *mesh, const vector<Vertex> &vertices);
+
+    // returns the palette index of the bone driven by node with the given offset, adding it if it's new
+    uint32_t findOrAddBone(uint32_t node, const glm::mat4 &offset);
+
+    // resamples an assimp animation for CompressAnimation, channels for nodes that don't exist are dropped.
+    // Morph channels drive the targets of the meshes on the node of the same name.
+    ResampledClip loadAnimation(const aiAnimation *animation);
+
+    // adds a material with the colors and first maps of an assimp material to the library, returns its index
+    uint32_t addMaterial(aiMaterial *mat, const std::vector<Texture> &diffuseMaps, const std::vector<Texture> &specularMaps,
+                         const std::vector<Texture> &normalMaps);
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
     // the required info is returned as a Texture struct.
     std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName); 
 };
 
+// converts assimp's row major matrix into glm's column major layout
+inline glm::mat4 AssimpToGlm(const aiMatrix4x4 &m)
+{
+    return glm::mat4(m.a1, m.b1, m.c1, m.d1,
+                     m.a2, m.b2, m.c2, m.d2,
+                     m.a3, m.b3, m.c3, m.d3,
+                     m.a4, m.b4, m.c4, m.d4);
+}
+
+// loads a texture relative to the given directory and uploads it with mipmaps, throws on failure
+unsigned int TextureFromFile(const char *path, const std::string &directory);
+
 #endif
 
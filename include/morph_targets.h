@@ -0,0 +1,108 @@
+#ifndef MORPH_TARGETS_H
+#define MORPH_TARGETS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Shader;
+
+// Texture units of the vertex ranges, the deltas and the instance weights
+#define MORPH_RANGE_TEXTURE_UNIT 13
+#define MORPH_DELTA_TEXTURE_UNIT 14
+#define MORPH_WEIGHT_TEXTURE_UNIT 15
+
+// Targets one mesh can have, the shader finds a delta's target in a half float
+#define MORPH_MAX_MESH_TARGETS 2048
+
+// Deltas shorter than this are dropped at import
+#define MORPH_DELTA_EPSILON 1e-5f
+
+// Marks a mesh without morph targets
+#define MORPH_NONE 0xFFFFFFFFu
+
+// How far one target moves one vertex at weight 1
+struct MorphDelta {
+    uint32_t vertex;
+    uint32_t target;    // within its mesh
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+// Where a mesh's targets live, in the model's weights and in the library's buffers
+struct MeshMorphTargets {
+    uint32_t firstTarget = 0;       // model wide index of the mesh's first target
+    uint32_t targetCount = 0;
+    uint32_t rangeBase = MORPH_NONE;  // vertex range of the mesh's first vertex in the library
+    uint32_t deltaCount = 0;
+};
+
+// Sparse morph targets (blend shapes) of every mesh, applied in the vertex shader. A mesh only stores the
+// vertices its targets actually move: every vertex has a range of deltas, sorted by vertex, and the shader
+// adds each delta scaled by its target's weight before skinning. Weights are per instance, set from the
+// CPU and uploaded only where they changed since the last frame, the vertex buffers are never touched.
+//
+// Ranges are RG32UI (first delta, delta count), deltas two RGBA16F texels each (position and target, normal),
+// weights R32F, all in texture buffers.
+class MorphTargetLibrary {
+  public:
+    // Returns the engine wide library
+    static MorphTargetLibrary& Get();
+
+    // Creates the buffers, needs a current context. Meshes added before are uploaded on the next Upload.
+    void Init();
+    void Shutdown();
+
+    // Adds the deltas of a mesh with vertexCount vertices, sorted by vertex, returns its range base
+    uint32_t Add(const std::vector<MorphDelta>& deltas, uint32_t vertexCount);
+
+    // Reserves weights for an instance, starting out at defaults, returns the offset of its first weight
+    uint32_t Allocate(const float* defaults, size_t count);
+
+    // Replaces count weights at offset, only ones that differ are uploaded again
+    void SetWeights(uint32_t offset, const float* weights, size_t count);
+
+    // Uploads meshes added and weights changed since the last call, binds the buffers to their units
+    void Upload();
+
+    // Points a shader's morph samplers at the buffers
+    void Apply(Shader& shader) const;
+
+    size_t InstanceCount() const { return instanceCount; }
+    size_t DeltaCount() const { return deltas.size() / 8; }
+
+    // Weights uploaded by the last Upload
+    size_t UploadedWeights() const { return uploadedWeights; }
+
+  private:
+    MorphTargetLibrary() = default;
+
+    struct Buffer {
+      GLuint buffer = 0;
+      GLuint texture = 0;
+      size_t bytes = 0;
+    };
+
+    void createBuffer(Buffer& buffer, GLenum format);
+    void destroyBuffer(Buffer& buffer);
+    void uploadAll(Buffer& buffer, const void* data, size_t bytes);
+
+    std::vector<uint32_t> ranges;  // two per vertex
+    std::vector<uint16_t> deltas;  // eight half floats per delta
+    std::vector<float> weights;
+    bool meshesDirty = false;
+    bool weightsResized = false;
+    size_t dirtyBegin = 0;         // weights changed since the last Upload
+    size_t dirtyEnd = 0;
+    size_t instanceCount = 0;
+    size_t uploadedWeights = 0;
+
+    Buffer rangeBuffer;
+    Buffer deltaBuffer;
+    Buffer weightBuffer;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "bounds.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Default resolution of the software depth buffer, the width has to be a multiple of 4
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 192
+
+// Models with more triangles than this don't get an occluder mesh built automatically
+#define OCCLUDER_MAX_TRIANGLES 512
+
+// Simplified geometry drawn into the occlusion buffer. It must stay inside the real surface,
+// otherwise it hides things that are actually visible.
+struct OccluderMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+
+    bool Empty() const { return indices.empty(); }
+};
+
+// CPU occlusion culling. Occluders are rasterized into a small depth buffer with SSE edge functions,
+// a max depth pyramid is built on top and bounding boxes are rejected when their nearest point lies
+// behind everything in the area they cover. Rasterization and tests run on the job system.
+//
+// Per frame: BeginFrame, AddOccluder for each occluder, Render, then Cull/IsVisible.
+class OcclusionCuller {
+  public:
+    void Init(int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT);
+
+    // Clears the buffer and queued occluders
+    void BeginFrame(const glm::mat4& viewProjection);
+
+    // Queues an occluder, the mesh has to stay alive until Render returns
+    void AddOccluder(const OccluderMesh& mesh, const glm::mat4& transform);
+
+    // Transforms, clips and rasterizes all queued occluders and builds the depth pyramid
+    void Render();
+
+    // True if any part of the box might be visible. Boxes crossing the near plane always are.
+    bool IsVisible(const AABB& box) const;
+
+    // Tests count boxes in parallel, writes 1 (visible) or 0 (occluded) per box. Returns the number occluded.
+    size_t Cull(const AABB* boxes, size_t count, uint8_t* visible) const;
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    size_t OccluderCount() const { return occluders.size(); }
+    size_t TriangleCount() const;
+
+    // Depth pyramid level, row major with the bottom row first. Depth is 0 at the near plane and 1 at the far plane.
+    const std::vector<float>& Level(int level) const { return levels[level]; }
+    int LevelCount() const { return (int)levels.size(); }
+
+    // Rows one rasterization job covers
+    static const int BandHeight = 16;
+
+  private:
+    struct Occluder {
+      const OccluderMesh* mesh;
+      glm::mat4 transform;
+    };
+
+    // triangle in screen space with its pixel bounds
+    struct ScreenTriangle {
+      glm::vec3 v[3];
+      int minX, maxX, minY, maxY;
+    };
+
+    void transformOccluder(const Occluder& occluder, std::vector<glm::vec4>& clip, std::vector<ScreenTriangle>& out) const;
+    void addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, std::vector<ScreenTriangle>& out) const;
+    void rasterize(const ScreenTriangle& triangle, int rowBegin, int rowEnd);
+    void buildPyramid();
+
+    int width = 0;
+    int height = 0;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    std::vector<std::vector<float>> levels;
+    std::vector<int> levelWidths;
+    std::vector<int> levelHeights;
+    std::vector<Occluder> occluders;
+    std::vector<std::vector<ScreenTriangle>> threadTriangles;  // one list per job system thread
+    std::vector<std::vector<glm::vec4>> threadClip;            // clip space vertices, kept so they don't allocate
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef OUTLINE_H
+#define OUTLINE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+
+#include <memory>
+
+// Outline in pixels around outlined objects
+#define OUTLINE_WIDTH 3
+
+// Screen space outlines. The scene renders into a color target and a mask, written by the fragment shader
+// from its `outlined` uniform into its second output, so outlined objects cost nothing beyond the draw they
+// already have. Resolve then copies the scene to the bound framebuffer in one full screen pass that colors
+// every pixel near the mask's edge, which costs the same however many objects are outlined.
+class OutlinePass {
+  public:
+    // Compiles the edge shader, needs a current context
+    void Init();
+    void Shutdown();
+
+    // Draws the scene with its outlines into the bound framebuffer
+    void Resolve(GLuint colorTexture, GLuint maskTexture);
+
+    glm::vec3 color = glm::vec3(0.04f, 0.28f, 0.26f);
+
+  private:
+    std::unique_ptr<Shader> edgeShader;
+    GLuint emptyVAO = 0;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include "mesh.h"
+
+// Built-in meshes using the same vertex layout as loaded models (position, normal, texture coordinates)
+
+// Unit plane on the XZ axis facing up, spanning -1..1
+Mesh CreatePlaneMesh();
+
+// Unit cube centered at the origin with per face normals
+Mesh CreateCubeMesh();
+
+#endif
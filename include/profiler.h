@@ -0,0 +1,147 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Maximum number of named passes measured in a single frame
+#define PROFILER_MAX_PASSES 32
+// Number of frames of GPU queries kept in flight so results never stall the pipeline
+#define PROFILER_QUERY_FRAMES 4
+// Number of frame times shown in the frame time graph
+#define PROFILER_HISTORY 240
+
+// Counters collected over one frame
+struct FrameStats {
+    unsigned int drawCalls = 0;
+    unsigned int stateChanges = 0;
+    unsigned long long triangles = 0;
+    unsigned int visibleObjects = 0;
+    unsigned int culledObjects = 0;
+    unsigned int occludedObjects = 0;    // subset of culledObjects rejected by the occlusion buffer
+    unsigned int occlusionTested = 0;    // objects that passed frustum culling and were tested for occlusion
+    unsigned int meshletsCulled = 0;     // meshlets of drawn objects left out by meshlet culling
+    unsigned int meshletsTested = 0;
+    unsigned int lights = 0;
+    unsigned int clusterLightIndices = 0;   // light references summed over all clusters
+    unsigned int shadowMaps = 0;         // cascades and atlas tiles re-rendered
+    unsigned int shadowCasters = 0;      // objects drawn into them
+    unsigned long long allocations = 0;
+    unsigned long long allocatedBytes = 0;
+};
+
+// Timing of a single named pass
+struct PassTiming {
+    const char* name = nullptr;
+    float cpuMs = 0.0f;
+    float gpuMs = 0.0f;
+};
+
+// Collects per frame counters, CPU/GPU pass timings and memory usage and draws them as an ImGui overlay.
+// Pass names must be string literals (or otherwise outlive the profiler), they are stored by pointer.
+class Profiler {
+  public:
+    // Returns the engine wide profiler
+    static Profiler& Get();
+
+    // Creates the GPU timer queries, needs a current OpenGL context
+    void Init();
+    void Shutdown();
+
+    // Marks the frame boundaries, everything counted in between belongs to the frame
+    void BeginFrame();
+    void EndFrame();
+
+    // Measures the CPU and GPU time of a pass, passes must not overlap
+    void BeginPass(const char* name);
+    void EndPass();
+
+    // Counters, call them next to the matching GL calls
+    void CountDraw(unsigned long long triangles) { current.drawCalls++; current.triangles += triangles; }
+    void CountStateChange(unsigned int count = 1) { current.stateChanges += count; }
+    void CountVisible(unsigned int count = 1) { current.visibleObjects += count; }
+    void CountCulled(unsigned int count = 1) { current.culledObjects += count; }
+    void CountLights(unsigned int lights, unsigned int clusterIndices) {
+        current.lights += lights;
+        current.clusterLightIndices += clusterIndices;
+    }
+    void CountShadows(unsigned int maps, unsigned int casters) {
+        current.shadowMaps += maps;
+        current.shadowCasters += casters;
+    }
+    void CountOccluded(unsigned int occluded, unsigned int tested) {
+        current.culledObjects += occluded;
+        current.occludedObjects += occluded;
+        current.occlusionTested += tested;
+    }
+    void CountMeshlets(unsigned int culled, unsigned int tested) {
+        current.meshletsCulled += culled;
+        current.meshletsTested += tested;
+    }
+
+    // Tracks GPU memory, pass a negative size when a resource is released
+    void TrackTextureMemory(long long bytes) { textureBytes += bytes; }
+    void TrackBufferMemory(long long bytes) { bufferBytes += bytes; }
+
+    // Draws the overlay window, must be called between ImGui::NewFrame and ImGui::Render
+    void DrawOverlay(bool* open = nullptr);
+
+    const FrameStats& LastFrame() const { return last; }
+    float LastFrameMs() const { return lastFrameMs; }
+
+  private:
+    Profiler() = default;
+
+    struct PassQuery {
+        const char* name;
+        GLuint queries[2];
+        std::chrono::steady_clock::time_point cpuStart;
+        float cpuMs;
+    };
+
+    struct QueryFrame {
+        PassQuery passes[PROFILER_MAX_PASSES];
+        int passCount = 0;
+        bool pending = false;
+    };
+
+    void resolveQueries();
+
+    bool initialized = false;
+    FrameStats current;
+    FrameStats last;
+
+    QueryFrame queryFrames[PROFILER_QUERY_FRAMES];
+    int frameIndex = 0;
+    int openPass = -1;
+
+    PassTiming timings[PROFILER_MAX_PASSES];
+    int timingCount = 0;
+
+    std::chrono::steady_clock::time_point frameStart;
+    float lastFrameMs = 0.0f;
+    float frameHistory[PROFILER_HISTORY] = {};
+    int historyOffset = 0;
+    int historyCount = 0;     // frames recorded, the history isn't full for the first PROFILER_HISTORY
+
+    unsigned long long allocationsAtFrameStart = 0;
+    unsigned long long allocatedBytesAtFrameStart = 0;
+
+    long long textureBytes = 0;
+    long long bufferBytes = 0;
+};
+
+// Measures the enclosing scope as a pass
+class ProfileScope {
+  public:
+    explicit ProfileScope(const char* name) { Profiler::Get().BeginPass(name); }
+    ~ProfileScope() { Profiler::Get().EndPass(); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Directory linked program binaries are written to, relative to the working directory like resources/
+#define PROGRAM_CACHE_DIRECTORY "shader_cache"
+
+// Disk cache of linked programs. A program is keyed by a hash of everything that goes into it (stage
+// sources, defines, transform feedback varyings) and the driver's vendor, renderer and version strings, so a
+// driver update or an edited shader simply misses. A hit creates the program from its binary and skips
+// GLSL compilation and linking entirely. A binary the driver rejects is deleted and the program rebuilt.
+//
+// Needs glGetProgramBinary, core in GL 4.1. On older contexts every Load misses and Store does nothing.
+class ProgramCache {
+  public:
+    // Returns the engine wide cache
+    static ProgramCache& Get();
+
+    // Checks for program binary support, needs a current context. Until then the cache is disabled.
+    void Init(const char* directory = PROGRAM_CACHE_DIRECTORY);
+
+    bool Enabled() const { return enabled; }
+
+    // Key of a program built from the given parts, in the order given
+    uint64_t Key(const std::vector<std::string>& parts) const;
+
+    // Program created from the cached binary, 0 on a miss
+    GLuint Load(uint64_t key);
+
+    // Call on a program before linking it so the driver keeps its binary around
+    void PrepareLink(GLuint program) const;
+
+    // Writes a linked program's binary under key
+    void Store(uint64_t key, GLuint program);
+
+    size_t Hits() const { return hits; }
+    size_t Misses() const { return misses; }
+
+  private:
+    ProgramCache() = default;
+
+    std::string pathFor(uint64_t key) const;
+
+    bool enabled = false;
+    std::string directory;
+    uint64_t driverHash = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+// Frames a pooled target may sit unused before its texture is deleted
+#define RENDER_GRAPH_POOL_FRAMES 3
+
+// Handle to one version of a graph resource. Every write produces a new version, so a pass reading a
+// handle always sees the content of the pass that produced it.
+typedef uint32_t RenderResource;
+const RenderResource RENDER_RESOURCE_NONE = 0xFFFFFFFF;
+
+// Size and internal format of a transient render target. Depth formats become the depth attachment.
+struct RenderTargetDesc {
+    int width;
+    int height;
+    GLenum format;
+
+    bool operator<(const RenderTargetDesc& other) const {
+      if (width != other.width)
+        return width < other.width;
+      if (height != other.height)
+        return height < other.height;
+      return format < other.format;
+    }
+};
+
+// Per frame graph of GPU passes. Passes declare which resources they create, read and write, then Compile
+// drops passes nothing visible depends on, sorts the rest so every resource is written before it is read,
+// and works out how long each transient target lives. Execute hands out textures from a pool keyed by size
+// and format, reusing the texture of a target that is already dead for the next one that needs the same
+// kind, binds a framebuffer with each pass's targets and runs it under a profiler pass of the same name.
+//
+// Resources are either transient targets the graph owns, or imported: the window's framebuffer or
+// anything a system manages itself, like a shadow map, that passes only need to order themselves around.
+// Writing the window, or calling SideEffect, keeps a pass from being culled.
+//
+// Per frame: Reset, AddPass for everything, Compile, Execute.
+class RenderGraph {
+  public:
+    class PassBuilder {
+      public:
+        // New transient target written by this pass, cleared to clearValue (depth in x) before it runs
+        RenderResource Create(const char* name, const RenderTargetDesc& desc, const glm::vec4& clearValue);
+
+        // Reads a resource, the pass runs after the one that produced this version
+        RenderResource Read(RenderResource resource);
+
+        // Writes on top of a resource's current content, returns the version later passes have to read
+        RenderResource Write(RenderResource resource);
+
+        // Keeps the pass even if nothing reads what it writes
+        void SideEffect();
+
+      private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+        RenderGraph& graph;
+        uint32_t pass;
+    };
+
+    typedef std::function<void(PassBuilder&)> SetupFn;
+    typedef std::function<void(const RenderGraph&)> ExecuteFn;
+
+    void Init();
+    void Shutdown();
+
+    // Forgets last frame's passes, the pooled textures stay
+    void Reset();
+
+    // The default framebuffer, passes writing it draw to the window
+    RenderResource ImportBackbuffer(int width, int height);
+
+    // A resource some system owns, texture may be 0 if it is only used for ordering
+    RenderResource Import(const char* name, GLuint texture = 0);
+
+    // Runs setup right away to record the pass's resources, execute later if the pass survives Compile.
+    // name must be a string literal, it is used as the profiler pass.
+    void AddPass(const char* name, const SetupFn& setup, const ExecuteFn& execute);
+
+    // Culls, orders and allocates. Returns false if the passes depend on each other in a cycle.
+    bool Compile();
+    void Execute();
+
+    // Texture behind a resource, only valid while the graph executes
+    GLuint Texture(RenderResource resource) const;
+    const RenderTargetDesc& Desc(RenderResource resource) const;
+
+    size_t PassCount() const { return passes.size(); }
+    size_t CulledPassCount() const { return culledPasses; }
+    size_t PooledTextureCount() const { return pool.size(); }
+
+  private:
+    struct Resource {
+      const char* name;
+      RenderTargetDesc desc;
+      glm::vec4 clearValue;
+      bool imported;
+      bool backbuffer;
+      GLuint texture;         // imported texture, or the pooled one while executing
+      int firstPass;          // execution order range the transient target is alive for
+      int lastPass;
+    };
+
+    struct Version {
+      uint32_t resource;
+      uint32_t writer;        // pass that produced it, NO_PASS for imported content
+      RenderResource previous;  // version this one was written on top of
+      std::vector<uint32_t> readers;
+    };
+
+    struct Pass {
+      const char* name;
+      ExecuteFn execute;
+      std::vector<RenderResource> reads;
+      std::vector<RenderResource> writes;
+      std::vector<uint32_t> creates;   // resources cleared before the pass
+      bool sideEffect;
+      bool culled;
+    };
+
+    struct PooledTexture {
+      RenderTargetDesc desc;
+      GLuint texture;
+      bool inUse;
+      uint64_t lastUsed;      // frame
+    };
+
+    static const uint32_t NO_PASS = 0xFFFFFFFF;
+
+    RenderResource addVersion(uint32_t resource, uint32_t writer, RenderResource previous);
+    GLuint acquireTexture(const RenderTargetDesc& desc);
+    void releaseTexture(GLuint texture);
+    void trimPool();
+    GLuint framebufferFor(const std::vector<GLuint>& colors, GLuint depth, bool depthStencil);
+    void bindTargets(const Pass& pass);
+
+    std::vector<Resource> resources;
+    std::vector<Version> versions;
+    std::vector<Pass> passes;
+    std::vector<uint32_t> order;     // surviving passes in execution order
+    size_t culledPasses = 0;
+
+    std::vector<PooledTexture> pool;
+    std::map<std::vector<GLuint>, GLuint> framebuffers;   // attachments (colors, then depth) to framebuffer
+    uint64_t frame = 0;
+};
+
+#endif
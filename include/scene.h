@@ -0,0 +1,151 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Marks a missing string, model or material reference
+#define SCENE_NONE 0xFFFFFFFFu
+// Number of instances the loader hands over to the engine at once
+#define SCENE_CHUNK_INSTANCES 4096
+
+// Built-in geometry that does not need a model file
+enum ScenePrimitive {
+    PRIMITIVE_NONE,
+    PRIMITIVE_PLANE,
+    PRIMITIVE_CUBE
+};
+
+enum SceneLightType {
+    LIGHT_DIRECTIONAL,
+    LIGHT_POINT,
+    LIGHT_SPOT
+};
+
+// Instance flags
+enum SceneInstanceFlags {
+    INSTANCE_OUTLINE = 1 << 0,
+    INSTANCE_OCCLUDER = 1 << 1,  // drawn into the occlusion buffer, hides whatever is behind it
+    INSTANCE_ANIMATED = 1 << 2,  // plays the first animation of its model
+    INSTANCE_CROWD = 1 << 3      // plays one of its model's animations from baked vertex animation textures
+};
+
+// All strings are offsets into Scene::strings so records stay plain old data
+struct SceneMaterial {
+    uint32_t name = SCENE_NONE;
+    uint32_t diffuseMap = SCENE_NONE;
+    uint32_t specularMap = SCENE_NONE;
+    glm::vec3 color = glm::vec3(1.0f);
+    float shininess = 32.0f;
+};
+
+struct SceneModel {
+    uint32_t name = SCENE_NONE;
+    uint32_t path = SCENE_NONE;
+    ScenePrimitive primitive = PRIMITIVE_NONE;
+};
+
+struct SceneLight {
+    SceneLightType type = LIGHT_POINT;
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    glm::vec3 color = glm::vec3(1.0f);
+    float intensity = 1.0f;
+    float range = 10.0f;
+    // spot cone angles in degrees
+    float innerAngle = 12.5f;
+    float outerAngle = 17.5f;
+};
+
+struct SceneInstance {
+    glm::mat4 transform = glm::mat4(1.0f);
+    uint32_t model = SCENE_NONE;
+    uint32_t material = SCENE_NONE;
+    uint32_t flags = 0;
+};
+
+// Flat scene description, every array only ever grows so indices handed out stay valid while streaming
+class Scene {
+  public:
+    std::vector<SceneMaterial> materials;
+    std::vector<SceneModel>    models;
+    std::vector<SceneLight>    lights;
+    std::vector<SceneInstance> instances;
+    // NUL separated string table
+    std::vector<char>          strings;
+
+    // Returns the string at the given offset, or an empty string for SCENE_NONE
+    const char* GetString(uint32_t offset) const;
+
+    void Clear();
+};
+
+// Parses a JSON scene on a worker thread and hands the parsed records over in chunks.
+//
+// The file is an object with the arrays "materials", "models", "lights" and "instances". Instances refer
+// to models and materials by name (or index) so those sections have to come before "instances". An optional
+// "instanceCount" before the instances lets the engine reserve the instance array up front.
+class SceneLoader {
+  public:
+    SceneLoader() = default;
+    ~SceneLoader();
+
+    SceneLoader(const SceneLoader&) = delete;
+    SceneLoader& operator=(const SceneLoader&) = delete;
+
+    // Starts streaming the file, returns false if it can't be opened
+    bool Start(const std::string& path);
+
+    // Moves everything parsed so far into the scene, call once per frame. Returns true once the whole
+    // file has been consumed.
+    bool Poll(Scene& scene);
+
+    // Blocks until the file is parsed and moves everything into the scene
+    bool Finish(Scene& scene);
+
+    bool Failed() const { return failed.load(); }
+    // Copy of the failure message, the worker may still be writing it
+    std::string Error() const;
+
+    // Convenience wrapper that blocks until the whole file is loaded
+    static bool Load(const std::string& path, Scene& scene);
+
+  private:
+    friend class SceneSaxHandler;
+
+    // Everything parsed between two hand overs. Chunks are recycled so streaming doesn't allocate once warm.
+    struct Chunk {
+        std::vector<SceneMaterial> materials;
+        std::vector<SceneModel>    models;
+        std::vector<SceneLight>    lights;
+        std::vector<SceneInstance> instances;
+        std::vector<char>          strings;
+        uint32_t instanceCountHint = 0;
+    };
+
+    void run(std::string path);
+    Chunk* acquireChunk();
+    void publishChunk(Chunk* chunk);
+    void consumeChunk(Chunk* chunk, Scene& scene);
+    void setError(const std::string& message);
+
+    std::thread worker;
+    mutable std::mutex mutex;
+    std::vector<Chunk*> ready;
+    std::vector<Chunk*> consuming;
+    std::vector<Chunk*> freeChunks;
+    std::vector<Chunk*> allChunks;
+
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> failed{false};
+    std::string error;  // guarded by mutex
+};
+
+#endif
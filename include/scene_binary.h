@@ -0,0 +1,109 @@
+#ifndef SCENE_BINARY_H
+#define SCENE_BINARY_H
+
+#include "scene.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Compiled scene files are a header followed by flat arrays. Every array starts at a 64 byte aligned
+// offset from the start of the file, so the file can be memory mapped anywhere and used in place.
+// Integers are stored little endian.
+#define SCENE_BINARY_MAGIC 0x424E4353u // "SCNB"
+#define SCENE_BINARY_VERSION 1
+#define SCENE_BINARY_ALIGNMENT 64
+
+enum SceneBinarySection {
+    BINARY_SECTION_MATERIALS,
+    BINARY_SECTION_MODELS,
+    BINARY_SECTION_LIGHTS,
+    BINARY_SECTION_TRANSFORMS,
+    BINARY_SECTION_MODEL_IDS,
+    BINARY_SECTION_MATERIAL_IDS,
+    BINARY_SECTION_FLAGS,
+    BINARY_SECTION_STRINGS,
+    BINARY_SECTION_COUNT
+};
+
+struct SceneBinarySectionEntry {
+    uint64_t offset;
+    uint64_t count;
+    uint32_t stride;
+    uint32_t reserved;
+};
+
+struct SceneBinaryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fileSize;
+    SceneBinarySectionEntry sections[BINARY_SECTION_COUNT];
+};
+
+// Non-owning view of an array inside a mapped file
+template <typename T>
+class SceneArray {
+  public:
+    SceneArray() : ptr(nullptr), count(0) {}
+    SceneArray(const T* data, size_t count) : ptr(data), count(count) {}
+
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+
+  private:
+    const T* ptr;
+    size_t count;
+};
+
+// Writes a scene as a compiled binary file
+class SceneCompiler {
+  public:
+    static bool Compile(const Scene& scene, const std::string& path);
+};
+
+// Memory maps a compiled scene. Nothing is copied or parsed, pages are only read from disk once an
+// array is actually touched, so opening costs the same for ten or a million instances.
+class MappedScene {
+  public:
+    SceneArray<SceneMaterial> materials;
+    SceneArray<SceneModel>    models;
+    SceneArray<SceneLight>    lights;
+
+    // instance data, one entry per instance in each array
+    SceneArray<glm::mat4>     transforms;
+    SceneArray<uint32_t>      modelIds;
+    SceneArray<uint32_t>      materialIds;
+    SceneArray<uint32_t>      flags;
+
+    MappedScene() = default;
+    ~MappedScene();
+
+    MappedScene(const MappedScene&) = delete;
+    MappedScene& operator=(const MappedScene&) = delete;
+
+    // Maps the file and validates the header and section bounds
+    bool Open(const std::string& path);
+    void Close();
+
+    bool IsOpen() const { return base != nullptr; }
+    size_t InstanceCount() const { return transforms.size(); }
+
+    // Returns the string at the given offset, or an empty string for SCENE_NONE
+    const char* GetString(uint32_t offset) const;
+
+  private:
+    template <typename T>
+    bool mapSection(const SceneBinaryHeader& header, SceneBinarySection section, SceneArray<T>& array);
+
+    void* base = nullptr;
+    size_t size = 0;
+    SceneArray<char> strings;
+};
+
+#endif
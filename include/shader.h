@@ -7,12 +7,53 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <cstdint>
 
 class Shader {
   public:
   unsigned int ID;
 
-  Shader(const char* vertexPath, const char* fragmentPath);
+  // defines are added as #define lines, see Preprocess. Without wait the constructor only starts compiling,
+  // Ready tells when the program can be used without stalling.
+  Shader(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines = std::vector<std::string>(),
+         bool wait = true);
+  ~Shader();
+
+  // shaders are registered for hot reloading by address
+  Shader(const Shader&) = delete;
+  Shader& operator=(const Shader&) = delete;
+
+  // Lets the driver compile on its own threads if it has KHR_parallel_shader_compile, needs a current
+  // context. Without it every compile finishes within the call that waits for it.
+  static bool EnableParallelCompile(GLADloadproc loader);
+  static bool ParallelCompile();
+
+  // True once compiling is done, asks the driver without blocking
+  bool Ready();
+
+  // Blocks until compiling is done and reports errors, use() does it for shaders that aren't ready
+  void Wait();
+
+  // Reads a shader with every #include "file" replaced by that file, relative to the including one and
+  // each file at most once, and a #define per entry of defines right after the #version line. Returns an
+  // empty string if a file can't be read.
+  // files, if given, receives every file that went in.
+  static std::string Preprocess(const std::string& path, const std::vector<std::string>& defines = std::vector<std::string>(),
+                                std::vector<std::string>* files = nullptr);
+
+  // True if the file, or a file it includes, is one of the shader's sources
+  bool DependsOn(const std::string& file) const;
+
+  // Starts recompiling from the files on disk, the program is only replaced once the new one has linked
+  void Reload();
+
+  // Hot reloading of every live shader. ReloadChanged starts recompiling the shaders that depend on any of
+  // the files, FinishReloads swaps in the programs that are done, with the uniform values of the old program
+  // copied over, and keeps the old program where the new one failed. Both return how many shaders they
+  // touched. Call them on the render thread, outside of any pass.
+  static size_t ReloadChanged(const std::vector<std::string>& changedFiles);
+  static size_t FinishReloads();
 
   void use();
 
@@ -28,6 +69,29 @@ class Shader {
   void setMat2(const std::string &name, const glm::mat2 &mat) const;
   void setMat3(const std::string &name, const glm::mat3 &mat) const;
   void setMat4(const std::string &name, const glm::mat4 &mat) const;
+
+  private:
+  struct Build {
+    unsigned int program = 0;
+    unsigned int vertexStage = 0;
+    unsigned int fragmentStage = 0;
+    uint64_t cacheKey = 0;
+    bool pending = false;   // stages and program still compiling
+    bool linked = false;
+  };
+
+  // reads the sources and starts compiling them, or loads the program from the cache
+  void startBuild(Build& build);
+  bool buildDone(const Build& build) const;
+  // waits for the build and reports errors
+  void finishBuild(Build& build);
+
+  std::string vertexPath;
+  std::string fragmentPath;
+  std::vector<std::string> defines;
+  std::vector<std::string> dependencies;   // normalized paths of every source file
+  Build current;                           // build behind ID
+  Build reload;                            // replacement in flight, program 0 if none
 };
 
 #endif
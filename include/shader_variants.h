@@ -0,0 +1,61 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include "shader.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Features a shader can be specialized for, each one a define of the same name without the prefix
+enum ShaderFeature : uint32_t {
+  SHADER_INSTANCED = 1 << 0,     // model matrix from a per instance attribute
+  SHADER_SKINNED = 1 << 1,       // vertices blended by bone matrices
+  SHADER_NORMAL_MAP = 1 << 2,    // normals from a tangent space normal map
+  SHADER_SHADOWS = 1 << 3,       // shadow map lookups
+  SHADER_VERTEX_ANIMATION = 1 << 4,  // positions and normals from baked vertex animation textures, with INSTANCED
+  SHADER_MORPH_TARGETS = 1 << 5      // sparse blend shape deltas weighted per instance
+};
+
+#define SHADER_FEATURE_COUNT 6
+
+// Every combination of features of one vertex and fragment shader pair. A variant is compiled the first
+// time it is asked for, with a #define per feature bit, and kept until the variants are destroyed, so
+// materials can each use the smallest shader that does what they need instead of branching at runtime.
+//
+// Request starts variants ahead of time, with parallel compilation the driver builds them all at once
+// while the engine keeps drawing with a fallback variant that is already there.
+class ShaderVariants {
+  public:
+    ShaderVariants(const char* vertexPath, const char* fragmentPath);
+
+    // Starts compiling a variant without waiting for it
+    void Request(uint32_t features);
+
+    // Shader with exactly the given features, compiled and waited for on the first call
+    Shader& Get(uint32_t features);
+
+    // The variant if it has finished compiling, requesting it if needed, fallback until then
+    Shader& GetOrFallback(uint32_t features, uint32_t fallback);
+
+    // Variants still compiling
+    size_t PendingCount();
+
+    size_t VariantCount() const { return variants.size(); }
+
+    // Destroys every variant, call it while the context is still current
+    void Clear() { variants.clear(); }
+
+    // Define a feature bit turns into, e.g. SHADOWS
+    static const char* FeatureDefine(uint32_t feature);
+
+  private:
+    Shader& create(uint32_t features, bool wait);
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants;
+};
+
+#endif
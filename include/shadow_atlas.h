@@ -0,0 +1,146 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "components.h"
+#include "ecs.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Side of the atlas texture and the tile sizes it is carved into, all powers of two
+#define SHADOW_ATLAS_SIZE 4096
+#define SHADOW_ATLAS_MAX_TILE 1024
+#define SHADOW_ATLAS_MIN_TILE 128
+#define SHADOW_ATLAS_LEVELS 6        // quadtree levels from the whole atlas down to SHADOW_ATLAS_MIN_TILE
+
+// Apply binds the atlas to this unit and the face records to the one after it
+#define SHADOW_ATLAS_TEXTURE_UNIT 8
+
+// Texels of one face record in the face buffer: four matrix columns, then the tile
+#define SHADOW_ATLAS_FACE_TEXELS 5
+
+// What the local light shadows are allowed to cost
+struct ShadowAtlasSettings {
+    int maxShadowedLights = 32;      // lights in view that get shadows, the ones covering most of the screen win
+    int staticFacesPerFrame = 12;    // faces of static geometry rendered per frame, the rest wait their turn
+    float texelsPerPixel = 1.0f;     // tile texels per pixel of the light's radius on screen
+};
+
+// Shadow maps of point and spot lights packed into one depth atlas. Spot lights take one tile, point lights
+// six, one per cube face. Tiles are allocated from a quadtree in powers of two sized by how much of the
+// screen the light covers.
+//
+// Scenes are mostly static, so every tile exists twice: the static atlas holds the entities without a
+// TransformComponent and is only rendered when a light gets its tiles or moves. Each frame the faces that
+// moving entities touch get their static depth copied into the final atlas and only the moving entities
+// drawn on top. Casters are culled per face, against the scene BVH for static ones.
+//
+// Tiles of lights that leave the view stay cached until the space is needed for another light, least
+// recently used first. When the atlas is full lights fall back to smaller tiles, then to no shadows.
+//
+// Per frame: Update before the clustered lights so they can look up FirstFace, then Apply.
+class ShadowAtlas {
+  public:
+    // Creates the atlases and the face buffer, needs a current context. Returns false if they can't be used.
+    bool Init(const ShadowAtlasSettings& settings = ShadowAtlasSettings());
+    void Shutdown();
+
+    ShadowAtlasSettings& Settings() { return settings; }
+
+    // Picks the shadowed lights for this view, gives them tiles, renders what changed and uploads the face
+    // records. Restores the default framebuffer with the given viewport.
+    void Update(World& world, const DynamicBVH& bvh, const glm::mat4& viewProjection, const glm::vec3& viewPosition,
+                float projectionScale, int width, int height);
+
+    // Renders the static depth of every face that sees into bounds again, call it when static entities are
+    // added there
+    void InvalidateStatic(const AABB& bounds);
+
+    // First face record of a light in this frame's face buffer, -1 if it has no shadow this frame
+    int FirstFace(Entity light) const;
+
+    // Binds the atlas and the face buffer to a shader that includes the local shadow lookup
+    void Apply(Shader& shader) const;
+
+    size_t LightCount() const { return lights.size(); }
+
+  private:
+    enum TileState : uint8_t {
+      TILE_FREE,
+      TILE_SPLIT,
+      TILE_USED
+    };
+
+    struct Face {
+      glm::mat4 matrix;      // light view projection
+      int tile;              // quadtree node, -1 while unallocated
+      bool staticValid;      // static atlas tile holds this face
+      bool dirty;            // final tile differs from the static one
+    };
+
+    struct LightShadow {
+      Entity entity;
+      SceneLightType type;
+      glm::mat4 transform;   // light transform the static tiles were rendered with
+      float range;
+      float outerAngle;
+      int level;             // quadtree level of the tiles
+      int faceCount;         // 6 for point lights, 1 for spot lights
+      Face faces[6];
+      uint64_t lastUsed;     // frame the light last had a shadow
+      int firstFace;         // record in this frame's face buffer, -1 if none
+    };
+
+    struct Request {
+      Entity entity;
+      const LightComponent* light;
+      glm::mat4 transform;
+      float importance;      // radius on screen in pixels
+    };
+
+    // quadtree allocator, the nodes of level l start at (4^l - 1) / 3 and are in Morton order
+    int allocateTile(int level);
+    void freeTile(int node);
+    int findFree(int level, int index, int target) const;
+    int findSplittable(int level, int index, int target, int& foundLevel) const;
+    glm::ivec3 tileRect(int node) const;   // x, y, size in texels
+
+    bool allocateLight(LightShadow& shadow, int level);
+    void releaseLight(LightShadow& shadow);
+    bool evictLeastRecent();
+    void fitFaces(LightShadow& shadow);
+    // points viewport and scissor at a face's tile
+    void bindTile(const Face& face);
+    // draws faceCasters into the bound tile, returns how many
+    size_t drawCasters(World& world, const Face& face);
+
+    ShadowAtlasSettings settings;
+    bool initialized = false;
+    uint64_t frame = 0;
+
+    std::vector<uint8_t> tiles;
+    std::vector<LightShadow> lights;
+    std::unordered_map<uint64_t, size_t> lightIndex;   // entity bits to index into lights
+    std::vector<Request> requests;
+    std::vector<Entity> dynamicCasters;
+    std::vector<AABB> dynamicBounds;
+    std::vector<Entity> faceCasters;
+    std::vector<glm::vec4> faceData;
+
+    std::unique_ptr<Shader> depthShader;
+    GLuint staticTexture = 0;
+    GLuint finalTexture = 0;
+    GLuint staticFramebuffer = 0;
+    GLuint finalFramebuffer = 0;
+    GLuint faceBuffer = 0;
+    GLuint faceTexture = 0;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SYSTEMS_H
+#define SYSTEMS_H
+
+#include "bvh.h"
+#include "components.h"
+#include "ecs.h"
+
+// Rebuilds the world matrix of every dirty movable entity, in parallel
+void UpdateTransforms(World& world);
+
+// Refreshes the bounds of movable mesh renderers and moves their proxies in the BVH
+void UpdateBounds(World& world, DynamicBVH& bvh);
+
+// Copies camera positions and orientations into their entities' transforms
+void SyncCameras(World& world);
+
+// Registers the engine systems above in the order they have to run, bvh is the scene's spatial index
+void RegisterEngineSystems(World& world, DynamicBVH& bvh);
+
+#endif
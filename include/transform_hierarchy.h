@@ -0,0 +1,60 @@
+#ifndef TRANSFORM_HIERARCHY_H
+#define TRANSFORM_HIERARCHY_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define TRANSFORM_NO_PARENT 0xFFFFFFFFu
+
+// Scene graph transforms stored in flat arrays in depth first order: a parent always comes before its
+// children and every subtree occupies the contiguous range [node, subtreeEnd[node]).
+//
+// Changing a local transform only marks the node dirty. Update() then recomputes the world matrices of
+// the dirty subtrees and nothing else, so static hierarchies cost nothing per frame.
+class TransformHierarchy {
+  public:
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+    std::vector<uint32_t>  parent;
+    std::vector<uint32_t>  subtreeEnd;
+
+    // Appends a node. To keep subtrees contiguous the parent has to be the most recently added node or
+    // one of its ancestors (which is what a depth first walk produces). Returns the node index, or
+    // TRANSFORM_NO_PARENT if the parent would break the ordering.
+    uint32_t AddNode(uint32_t parentIndex, const glm::mat4& localTransform);
+
+    // Sets the local transform and marks the subtree for the next Update
+    void SetLocal(uint32_t node, const glm::mat4& localTransform);
+
+    const glm::mat4& GetLocal(uint32_t node) const { return local[node]; }
+    const glm::mat4& GetWorld(uint32_t node) const { return world[node]; }
+
+    // Recomputes world matrices below every dirty node. Large updates are split across the job system.
+    // Returns the number of nodes that were recomputed.
+    size_t Update();
+
+    size_t Size() const { return local.size(); }
+    bool IsDirty() const { return !dirtyNodes.empty(); }
+    void Clear();
+
+    // Number of nodes one parallel work item recomputes at least
+    static const size_t ParallelGrain = 1024;
+
+  private:
+    struct Range {
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    void updateRange(uint32_t begin, uint32_t end);
+    void splitRange(uint32_t root, std::vector<Range>& ranges);
+
+    std::vector<uint8_t>  dirty;
+    std::vector<uint32_t> dirtyNodes;
+    std::vector<Range>    ranges;
+};
+
+#endif
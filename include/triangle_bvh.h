@@ -0,0 +1,54 @@
+#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include "bounds.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Node of a triangle BVH, two per 64 byte cache line. Internal nodes (count == 0) keep their children
+// next to each other at leftFirst and leftFirst + 1, leaves hold count triangles starting at leftFirst.
+// min/max are followed by an int so a node loads straight into two SSE registers.
+struct alignas(32) TriangleBVHNode {
+    float min[3];
+    uint32_t leftFirst;
+    float max[3];
+    uint32_t count;
+};
+
+// Closest hit of a ray. The hit point is (1 - u - v) * v0 + u * v1 + v * v2 of the triangle.
+struct TriangleHit {
+    float t;
+    float u;
+    float v;
+    uint32_t triangle;  // index of the triangle in the source index buffer (first index / 3)
+};
+
+// Static BVH over the triangles of one mesh, built once with binned SAH. Triangle positions are copied
+// in leaf order so a leaf reads one contiguous block of memory.
+class TriangleBVH {
+  public:
+    // Builds the tree over an indexed triangle list. positions points at the first position and stride
+    // is the distance in bytes between two vertices, so interleaved vertex arrays work directly.
+    void Build(const glm::vec3* positions, size_t stride, const unsigned int* indices, size_t indexCount);
+
+    // Finds the closest triangle hit within [0, maxT]. Returns false if nothing was hit.
+    bool Raycast(const Ray& ray, float maxT, TriangleHit& hit) const;
+
+    bool Empty() const { return triangleIds.empty(); }
+    size_t NodeCount() const { return nodeCount; }
+    size_t TriangleCount() const { return triangleIds.size(); }
+    AABB Bounds() const;
+
+    // Triangles a leaf may hold when splitting doesn't pay off
+    static const uint32_t MaxLeafSize = 8;
+
+  private:
+    std::vector<TriangleBVHNode> nodes;
+    std::vector<glm::vec3> vertices;      // three per triangle, leaf order
+    std::vector<uint32_t> triangleIds;    // source triangle of every leaf slot
+    size_t nodeCount = 0;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef VERTEX_ANIMATION_H
+#define VERTEX_ANIMATION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "ecs.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Model;
+class Shader;
+
+// Texture units of the baked positions and normals
+#define VERTEX_ANIMATION_POSITION_UNIT 11
+#define VERTEX_ANIMATION_NORMAL_UNIT 12
+
+// Per instance clip attribute of crowd draws, after the model matrix at MESH_INSTANCE_ATTRIBUTE
+#define VERTEX_ANIMATION_ATTRIBUTE 12
+
+// Lowest rate clips are baked at, the shader blends neighbouring frames
+#define VERTEX_ANIMATION_SAMPLE_RATE 30.0f
+
+// Texels per row of the baked textures, frames of all vertices follow each other across rows
+#define VERTEX_ANIMATION_TEXTURE_WIDTH 2048
+
+// Frames of one clip in the baked textures
+struct VertexAnimationClip {
+    uint32_t firstFrame;
+    uint32_t frameCount;  // at least 2, evenly spaced so the last one sits at the clip's duration
+    float duration;       // seconds
+
+    // Frames played per second so a loop takes the clip's duration
+    float FrameRate() const { return duration > 0.0f ? (float)(frameCount - 1) / duration : VERTEX_ANIMATION_SAMPLE_RATE; }
+};
+
+// Every clip of a model played back on the CPU and written out as the model space position and normal of
+// every vertex on every frame, so the vertex shader replays them with four texel fetches instead of skinning.
+// Vertex v of frame f is texel f * vertexCount + v, laid out in rows of VERTEX_ANIMATION_TEXTURE_WIDTH.
+// Positions are RGBA16 normalized to the bounds over all frames, normals RGBA8 signed normalized.
+struct VertexAnimation {
+    std::vector<VertexAnimationClip> clips;
+    std::vector<uint32_t> meshFirstVertex;  // first vertex of each mesh of the model
+    uint32_t vertexCount = 0;               // vertices of all meshes
+    uint32_t frameCount = 0;                // frames of all clips
+    AABB bounds;                            // model space bounds over every frame
+    GLuint positions = 0;
+    GLuint normals = 0;
+    size_t textureBytes = 0;
+};
+
+// Bakes the clips of an animated model on the job system and uploads the textures. Clips that no longer fit
+// into the largest texture the driver supports are left out. Returns false if nothing could be baked.
+bool BakeVertexAnimation(const Model& model, VertexAnimation& bake);
+
+// Deletes the textures of a bake
+void DestroyVertexAnimation(VertexAnimation& bake);
+
+// Animated instances drawn from baked vertex animation textures. Every instance only stores its clip and
+// start time next to its model matrix, the frame is worked out on the GPU from one time uniform, so the CPU
+// does nothing per instance after Build. Instances of the same model and material are drawn with one
+// instanced draw per mesh. Crowds aren't in the scene BVH, a batch is culled against the frustum as a whole
+// and they cast no shadows.
+//
+// Per frame: Draw with a shader that has SHADER_INSTANCED | SHADER_VERTEX_ANIMATION and its MaterialBlock
+// applied.
+class CrowdRenderer {
+  public:
+    void Shutdown();
+
+    // Bake of the model, baked the first time it is asked for. nullptr if the model has no clips.
+    const VertexAnimation* Bake(const Model& model);
+
+    // Uploads every VertexAnimationComponent instance, grouped into batches
+    void Build(World& world);
+
+    // Draws the batches in the frustum of viewProjection with every instance time seconds into its clip
+    void Draw(Shader& shader, const glm::mat4& viewProjection, float time);
+
+    bool Ready() const { return !batches.empty(); }
+    size_t InstanceCount() const { return instanceCount; }
+
+    // Instances in the batches the last Draw didn't cull
+    size_t VisibleCount() const { return visibleCount; }
+
+  private:
+    // per instance record, matches the instance attributes of the vertex shader
+    struct CrowdInstance {
+      glm::mat4 model;
+      glm::vec4 animation;  // first frame, frame count, start time, frames per second
+    };
+
+    struct Batch {
+      Model* model;
+      const VertexAnimation* bake;
+      uint32_t material;    // MaterialLibrary index, MATERIAL_NONE draws each mesh with its own
+      uint32_t first;
+      uint32_t count;
+      AABB bounds;          // world space bounds of all its instances
+      bool mirrored;        // an instance's transform flips the winding, the batch draws without face culling
+    };
+
+    void destroyBuffers();
+
+    std::unordered_map<const Model*, VertexAnimation> bakes;
+    std::vector<Batch> batches;
+    GLuint instanceBuffer = 0;
+    size_t instanceCount = 0;
+    size_t visibleCount = 0;
+};
+
+#endif
@@ -0,0 +1,65 @@
+// Instance tests shared by cullInstances.vs and cullInstances.comp, both #include it
+
+uniform mat4 viewProjection;     // frame being culled
+uniform mat4 hizViewProjection;  // frame the depth pyramid was rendered with
+uniform sampler2D hiz;           // farthest depth of each texel, level 0 is the full depth buffer
+uniform ivec2 hizSize;
+uniform int hizLevels;
+uniform bool hizValid;
+
+vec3 boxCorner(vec3 boxMin, vec3 boxMax, int i)
+{
+    return vec3((i & 1) != 0 ? boxMax.x : boxMin.x, (i & 2) != 0 ? boxMax.y : boxMin.y, (i & 4) != 0 ? boxMax.z : boxMin.z);
+}
+
+// false if all eight corners are beyond the same clip plane
+bool insideFrustum(vec3 boxMin, vec3 boxMax)
+{
+    vec3 below = vec3(0.0);
+    vec3 above = vec3(0.0);
+    for (int i = 0; i < 8; i++)
+    {
+        vec4 clip = viewProjection * vec4(boxCorner(boxMin, boxMax, i), 1.0);
+        below += vec3(lessThan(clip.xyz, vec3(-clip.w)));
+        above += vec3(greaterThan(clip.xyz, vec3(clip.w)));
+    }
+    return !any(equal(below, vec3(8.0))) && !any(equal(above, vec3(8.0)));
+}
+
+// true if the box was behind everything in the area it covered last frame
+bool occluded(vec3 boxMin, vec3 boxMax)
+{
+    if (!hizValid)
+        return false;
+
+    vec2 rectMin = vec2(1.0);
+    vec2 rectMax = vec2(-1.0);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; i++)
+    {
+        vec4 clip = hizViewProjection * vec4(boxCorner(boxMin, boxMax, i), 1.0);
+        // behind the old camera, the pyramid knows nothing about it
+        if (clip.w <= 1e-5)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        rectMin = min(rectMin, ndc.xy);
+        rectMax = max(rectMax, ndc.xy);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+
+    // partly off screen last frame
+    if (any(lessThan(rectMin, vec2(-1.0))) || any(greaterThan(rectMax, vec2(1.0))))
+        return false;
+
+    // the level where the rectangle spans at most 2x2 texels, its corners cover the whole rectangle
+    vec2 pixelMin = (rectMin * 0.5 + 0.5) * vec2(hizSize);
+    vec2 pixelMax = (rectMax * 0.5 + 0.5) * vec2(hizSize);
+    vec2 extent = pixelMax - pixelMin;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, hizLevels - 1);
+    ivec2 texelMin = ivec2(clamp(pixelMin, vec2(0.0), vec2(hizSize - 1))) >> level;
+    ivec2 texelMax = ivec2(clamp(pixelMax, vec2(0.0), vec2(hizSize - 1))) >> level;
+
+    float farthest = max(max(texelFetch(hiz, texelMin, level).r, texelFetch(hiz, ivec2(texelMax.x, texelMin.y), level).r),
+                         max(texelFetch(hiz, ivec2(texelMin.x, texelMax.y), level).r, texelFetch(hiz, texelMax, level).r));
+    return nearest > farthest;
+}
@@ -0,0 +1,25 @@
+#version 330 core
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+in mat4 vModel[];
+flat in int vVisible[];
+
+// captured by transform feedback, one mat4 per surviving instance
+out vec4 outModel0;
+out vec4 outModel1;
+out vec4 outModel2;
+out vec4 outModel3;
+
+void main()
+{
+    if (vVisible[0] == 0)
+        return;
+
+    outModel0 = vModel[0][0];
+    outModel1 = vModel[0][1];
+    outModel2 = vModel[0][2];
+    outModel3 = vModel[0][3];
+    EmitVertex();
+    EndPrimitive();
+}
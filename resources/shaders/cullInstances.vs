@@ -0,0 +1,14 @@
+#version 330 core
+#include "cullCommon.glsl"
+layout (location = 0) in mat4 aModel;
+layout (location = 4) in vec4 aBoundsMin;
+layout (location = 5) in vec4 aBoundsMax;
+
+out mat4 vModel;
+flat out int vVisible;
+
+void main()
+{
+    vModel = aModel;
+    vVisible = insideFrustum(aBoundsMin.xyz, aBoundsMax.xyz) && !occluded(aBoundsMin.xyz, aBoundsMax.xyz) ? 1 : 0;
+}
@@ -1,17 +1,128 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out float Outline;   // mask the outline pass draws the edges of, see include/outline.h
 
 in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+#ifdef NORMAL_MAP
+in vec3 Tangent;
+in vec3 Bitangent;
+#endif
 
+// parameter block of the bound material, see include/material.h
+layout (std140) uniform MaterialBlock
+{
+    vec4 materialDiffuse;    // color, opacity in w
+    vec4 materialSpecular;   // color, shininess in w
+    vec4 materialMaps;       // x: diffuse map, y: specular map, z: normal map
+};
 uniform sampler2D texture_diffuse0;
-// uniform sampler2D texture_specular0;
+uniform sampler2D texture_specular0;
+uniform sampler2D texture_normal0;
 
 uniform vec3 viewPos;
-uniform vec3 lightPos;
+uniform mat4 view;
+uniform float outlined;
+
+// clustered lights, see include/clustered_lighting.h. Four texels per light: position and range,
+// color and cos(inner angle), direction and cos(outer angle), first shadow face (-1 for none) and point flag
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterRanges;   // offset into clusterIndices and light count per cluster
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterGrid;
+uniform vec2 clusterScreenSize;
+uniform float clusterNear;
+uniform float clusterSliceScale;        // slice = log(depth / near) * scale
+
+uniform int directionalLightCount;
+uniform vec3 directionalLightDirections[4];
+uniform vec3 directionalLightColors[4];
 
+#ifdef SHADOWS
+#include "shadows.glsl"
+#endif
+
+const float AMBIENT = 0.1;
+
+// Blinn-Phong for one light, toLight is normalized
+vec3 shade(vec3 toLight, vec3 radiance, vec3 normal, vec3 toView, vec3 albedo, vec3 specularColor)
+{
+    float diffuse = max(dot(normal, toLight), 0.0);
+    if (diffuse <= 0.0)
+        return vec3(0.0);
+    float specular = pow(max(dot(normal, normalize(toLight + toView)), 0.0), materialSpecular.w);
+    return radiance * (albedo * diffuse + specularColor * specular);
+}
 
 void main()
 {
+    // a missing map is left unbound and not sampled, the material colors alone stand in
+    vec3 albedo = materialDiffuse.rgb;
+    if (materialMaps.x > 0.5)
+        albedo *= texture(texture_diffuse0, TexCoords).rgb;
+    vec3 specularColor = materialSpecular.rgb;
+    if (materialMaps.y > 0.5)
+        specularColor *= texture(texture_specular0, TexCoords).rgb;
+    // shadow bias follows the surface, lighting the normal map
+    vec3 surfaceNormal = normalize(Normal);
+    vec3 normal = surfaceNormal;
+#ifdef NORMAL_MAP
+    // meshes without texture coordinates have no tangents to map with
+    if (materialMaps.z > 0.5 && dot(Tangent, Tangent) > 1e-12)
+    {
+        vec3 tangentNormal = texture(texture_normal0, TexCoords).rgb * 2.0 - 1.0;
+        normal = normalize(mat3(normalize(Tangent), normalize(Bitangent), surfaceNormal) * tangentNormal);
+    }
+#endif
+    vec3 toView = normalize(viewPos - FragPos);
+    vec3 color = albedo * AMBIENT;
+
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+
+    for (int i = 0; i < directionalLightCount; i++)
+    {
+        vec3 radiance = directionalLightColors[i];
+#ifdef SHADOWS
+        if (i == 0 && shadowCascadeCount > 0)
+            radiance *= directionalShadow(surfaceNormal, -directionalLightDirections[0], depth);
+#endif
+        color += shade(-directionalLightDirections[i], radiance, normal, toView, albedo, specularColor);
+    }
+
+    // cluster of this fragment, tiles from the window position and exponential slices from view depth
+    ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy / clusterScreenSize * vec2(clusterGrid.xy)),
+                          int(log(max(depth, clusterNear) / clusterNear) * clusterSliceScale));
+    cluster = clamp(cluster, ivec3(0), clusterGrid - 1);
+    uvec2 range = texelFetch(clusterRanges, (cluster.z * clusterGrid.y + cluster.y) * clusterGrid.x + cluster.x).rg;
+
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r) * 4;
+        vec4 positionRange = texelFetch(clusterLights, light);
+        vec4 colorCosInner = texelFetch(clusterLights, light + 1);
+        vec4 directionCosOuter = texelFetch(clusterLights, light + 2);
+        vec4 shadowFace = texelFetch(clusterLights, light + 3);
+
+        vec3 toLight = positionRange.xyz - FragPos;
+        float distance = length(toLight);
+        if (distance >= positionRange.w)
+            continue;
+        toLight /= max(distance, 1e-4);
+
+        // inverse square falloff faded to zero at the range, point lights have cosines that make spot 1
+        float ratio = distance / positionRange.w;
+        float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+        float attenuation = window * window / (1.0 + distance * distance);
+        float spot = clamp((dot(-toLight, directionCosOuter.xyz) - directionCosOuter.w) /
+                           (colorCosInner.w - directionCosOuter.w), 0.0, 1.0);
+#ifdef SHADOWS
+        if (spot > 0.0 && shadowFace.x >= 0.0)
+            spot *= localShadow(int(shadowFace.x), shadowFace.y > 0.5, -toLight * distance, surfaceNormal);
+#endif
+        color += shade(toLight, colorCosInner.rgb * attenuation * spot, normal, toView, albedo, specularColor);
+    }
 
-    FragColor = vec4(texture(texture_diffuse0, TexCoords).rgb, 1.0);
-}
\ No newline at end of file
+    FragColor = vec4(color, 1.0);
+    Outline = outlined;
+}
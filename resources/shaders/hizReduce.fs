@@ -0,0 +1,21 @@
+#version 330 core
+layout (location = 0) out float Depth;
+
+uniform sampler2D source;  // depth texture for level 0, otherwise the pyramid limited to the level below
+uniform bool copyDepth;
+
+void main()
+{
+    ivec2 target = ivec2(gl_FragCoord.xy);
+    if (copyDepth)
+    {
+        Depth = texelFetch(source, target, 0).r;
+        return;
+    }
+
+    // odd sizes round up, the last texel then only has one source row or column left
+    ivec2 last = textureSize(source, 0) - 1;
+    ivec2 base = target * 2;
+    Depth = max(max(texelFetch(source, min(base, last), 0).r, texelFetch(source, min(base + ivec2(1, 0), last), 0).r),
+                max(texelFetch(source, min(base + ivec2(0, 1), last), 0).r, texelFetch(source, min(base + ivec2(1, 1), last), 0).r));
+}
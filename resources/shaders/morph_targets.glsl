@@ -0,0 +1,22 @@
+// sparse morph target deltas and the weights of every instance, see include/morph_targets.h
+uniform usamplerBuffer morphRanges;  // first delta and delta count of every vertex
+uniform samplerBuffer morphDeltas;   // two texels per delta: position and target, normal
+uniform samplerBuffer morphWeights;
+uniform int morphRangeBase;          // range of the mesh's first vertex
+uniform int morphWeightBase;         // weight of the mesh's first target for this instance, -1 without targets
+
+// adds every delta of the vertex, scaled by the weight of its target
+void applyMorphTargets(inout vec3 position, inout vec3 normal)
+{
+    if (morphWeightBase < 0)
+        return;
+    uvec2 range = texelFetch(morphRanges, morphRangeBase + gl_VertexID).xy;
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int delta = int(range.x + i) * 2;
+        vec4 positionDelta = texelFetch(morphDeltas, delta);
+        float weight = texelFetch(morphWeights, morphWeightBase + int(positionDelta.w)).r;
+        position += weight * positionDelta.xyz;
+        normal += weight * texelFetch(morphDeltas, delta + 1).xyz;
+    }
+}
@@ -0,0 +1,27 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D sceneColor;
+uniform sampler2D outlineMask;   // 1 where an outlined object is the closest surface
+uniform vec3 outlineColor;
+uniform int outlineWidth;        // pixels
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec3 color = texelFetch(sceneColor, pixel, 0).rgb;
+
+    // pixels outside the mask within outlineWidth of it become the outline
+    if (texelFetch(outlineMask, pixel, 0).r < 0.5)
+    {
+        ivec2 last = textureSize(outlineMask, 0) - 1;
+        float edge = 0.0;
+        for (int y = -outlineWidth; y <= outlineWidth; y++)
+            for (int x = -outlineWidth; x <= outlineWidth; x++)
+                if (x * x + y * y <= outlineWidth * outlineWidth)
+                    edge = max(edge, texelFetch(outlineMask, clamp(pixel + ivec2(x, y), ivec2(0), last), 0).r);
+        color = mix(color, outlineColor, edge);
+    }
+
+    FragColor = vec4(color, 1.0);
+}
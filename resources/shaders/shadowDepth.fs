@@ -0,0 +1,6 @@
+#version 330 core
+
+// depth only, the cascade layers have no color attachment
+void main()
+{
+}
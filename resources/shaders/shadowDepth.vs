@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 lightViewProjection;
+
+// every caster goes through this one shader, boneOffset is -1 for the ones that aren't animated
+#include "skinning.glsl"
+
+void main()
+{
+    mat4 world = boneOffset >= 0 ? model * skinMatrix() : model;
+    gl_Position = lightViewProjection * world * vec4(aPos, 1.0);
+}
@@ -0,0 +1,80 @@
+// Shadow lookups of the scene shader, included when it is built with SHADOWS
+
+// cascaded shadows of the first directional light, see include/cascaded_shadows.h
+uniform sampler2DArrayShadow shadowMap;
+uniform int shadowCascadeCount;          // 0 without shadows
+uniform mat4 shadowMatrices[4];
+uniform float shadowSplits[4];           // view depth each cascade reaches
+uniform float shadowTexelSizes[4];       // world size of a texel of each cascade
+uniform float shadowMapTexel;            // 1 / resolution
+
+// point and spot light shadows, see include/shadow_atlas.h. Five texels per face:
+// light view projection columns, then the tile's atlas position and size and a texel's size one unit away
+uniform sampler2DShadow shadowAtlas;
+uniform samplerBuffer shadowFaces;
+uniform float shadowAtlasTexel;
+
+// how much of the first directional light reaches the fragment
+float directionalShadow(vec3 normal, vec3 toLight, float depth)
+{
+    int cascade = 0;
+    while (cascade < shadowCascadeCount && depth > shadowSplits[cascade])
+        cascade++;
+
+    // cached cascades re-render every few frames and can lag behind the camera, the next one covers for them
+    for (; cascade < shadowCascadeCount; cascade++)
+    {
+        // push the lookup off the surface by about a texel, more at grazing angles, so it doesn't shadow itself
+        float offset = shadowTexelSizes[cascade] * (2.0 - max(dot(normal, toLight), 0.0));
+        vec3 coords = (shadowMatrices[cascade] * vec4(FragPos + normal * offset, 1.0)).xyz * 0.5 + 0.5;
+        if (any(lessThan(coords.xy, vec2(0.0))) || any(greaterThan(coords.xy, vec2(1.0))))
+            continue;
+
+        // 3x3 taps, each one already a filtered 2x2 comparison
+        float lit = 0.0;
+        for (int y = -1; y <= 1; y++)
+            for (int x = -1; x <= 1; x++)
+                lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * shadowMapTexel, float(cascade), min(coords.z, 1.0)));
+        return lit / 9.0;
+    }
+    return 1.0;
+}
+
+// how much of a point or spot light reaches the fragment, fromLight is the vector from the light to it
+float localShadow(int face, bool pointLight, vec3 fromLight, vec3 normal)
+{
+    // point lights pick the cube face along the major axis
+    if (pointLight)
+    {
+        vec3 axis = abs(fromLight);
+        if (axis.x >= axis.y && axis.x >= axis.z)
+            face += fromLight.x > 0.0 ? 0 : 1;
+        else if (axis.y >= axis.z)
+            face += fromLight.y > 0.0 ? 2 : 3;
+        else
+            face += fromLight.z > 0.0 ? 4 : 5;
+    }
+
+    int texel = face * 5;
+    mat4 matrix = mat4(texelFetch(shadowFaces, texel), texelFetch(shadowFaces, texel + 1),
+                       texelFetch(shadowFaces, texel + 2), texelFetch(shadowFaces, texel + 3));
+    vec4 tile = texelFetch(shadowFaces, texel + 4);
+
+    // push the lookup off the surface by a bit more than a texel at this distance
+    vec4 clip = matrix * vec4(FragPos + normal * (tile.w * length(fromLight) * 1.5), 1.0);
+    if (clip.w <= 0.0)
+        return 1.0;
+    vec3 coords = clip.xyz / clip.w * 0.5 + 0.5;
+    if (any(lessThan(coords.xy, vec2(0.0))) || any(greaterThan(coords.xy, vec2(1.0))))
+        return 1.0;
+
+    // 3x3 taps kept inside the tile so they never read a neighbour
+    vec2 uv = tile.xy + coords.xy * tile.z;
+    vec2 lowest = tile.xy + vec2(0.5 * shadowAtlasTexel);
+    vec2 highest = tile.xy + vec2(tile.z - 0.5 * shadowAtlasTexel);
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(shadowAtlas, vec3(clamp(uv + vec2(x, y) * shadowAtlasTexel, lowest, highest), min(coords.z, 1.0)));
+    return lit / 9.0;
+}
@@ -0,0 +1,20 @@
+// bone influences of the vertex and the palettes of every animated instance, see include/animation.h
+layout (location = 3) in ivec4 aBoneIDs;
+layout (location = 4) in vec4 aWeights;
+
+uniform samplerBuffer bonePalette;   // four texels per matrix, one column each
+uniform int boneOffset;              // first bone of this instance's palette
+
+mat4 boneMatrix(int bone)
+{
+    int texel = (boneOffset + bone) * 4;
+    return mat4(texelFetch(bonePalette, texel), texelFetch(bonePalette, texel + 1),
+                texelFetch(bonePalette, texel + 2), texelFetch(bonePalette, texel + 3));
+}
+
+// model space placement of the vertex, the palette already holds node matrix * bone offset
+mat4 skinMatrix()
+{
+    return aWeights.x * boneMatrix(aBoneIDs.x) + aWeights.y * boneMatrix(aBoneIDs.y) +
+           aWeights.z * boneMatrix(aBoneIDs.z) + aWeights.w * boneMatrix(aBoneIDs.w);
+}
@@ -1,17 +1,71 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;   
-layout (location = 1) in vec2 aTexCoords;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+#ifdef NORMAL_MAP
+layout (location = 5) in vec3 aTangent;
+layout (location = 6) in vec3 aBitangent;
+#endif
 
+#ifdef INSTANCED
+// instance matrix from the GPU culled instance buffer, meshTransform places the mesh within its model
+layout (location = 8) in mat4 aInstanceModel;
+uniform mat4 meshTransform;
+#else
 uniform mat4 model;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
 
+#ifdef SKINNED
+#include "skinning.glsl"
+#endif
+#ifdef VERTEX_ANIMATION
+#include "vertex_animation.glsl"
+#endif
+#ifdef MORPH_TARGETS
+#include "morph_targets.glsl"
+#endif
+
 out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+#ifdef NORMAL_MAP
+out vec3 Tangent;
+out vec3 Bitangent;
+#endif
 
 
 void main()
 {
+    vec3 position = aPos;
+    vec3 normal = aNormal;
+#if defined(VERTEX_ANIMATION) && defined(INSTANCED)
+    // the bake is in model space already, nodes included
+    mat4 world = aInstanceModel;
+    bakedVertex(position, normal);
+#elif defined(INSTANCED)
+    mat4 world = aInstanceModel * meshTransform;
+#else
+    mat4 world = model;
+#endif
+#ifdef MORPH_TARGETS
+    // blend shapes move the vertex within its mesh, before the bones place it
+    applyMorphTargets(position, normal);
+#endif
+#ifdef SKINNED
+    world = world * skinMatrix();
+#endif
 
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
-}  
+    Normal = mat3(transpose(inverse(world))) * normal;
+#ifdef NORMAL_MAP
+    // the tangent made perpendicular to the normal again, morphs and bakes move the normal but not the tangent
+    vec3 unitNormal = normalize(Normal);
+    Tangent = mat3(world) * aTangent;
+    Tangent -= unitNormal * dot(unitNormal, Tangent);
+    Bitangent = mat3(world) * aBitangent;
+#endif
+    FragPos = vec3(world * vec4(position, 1.0f));
+    gl_Position = projection * view * world * vec4(position, 1.0f);
+}
@@ -0,0 +1,31 @@
+// baked clips of crowd instances, see include/vertex_animation.h
+layout (location = 12) in vec4 aInstanceAnimation;  // first frame, frame count, start time, frames per second
+
+uniform sampler2D vertexPositions;   // normalized to the bake bounds
+uniform sampler2D vertexNormals;
+uniform vec3 bakeBoundsMin;
+uniform vec3 bakeBoundsExtent;
+uniform int bakeVertexCount;         // texels per frame
+uniform int meshFirstVertex;         // where this mesh's vertices start within a frame
+uniform float animationTime;
+
+ivec2 bakedTexel(int frame)
+{
+    int texel = frame * bakeVertexCount + meshFirstVertex + gl_VertexID;
+    int width = textureSize(vertexPositions, 0).x;
+    return ivec2(texel % width, texel / width);
+}
+
+// model space position and normal of the vertex, blended between the two frames around the instance's time
+void bakedVertex(out vec3 position, out vec3 normal)
+{
+    float frame = mod((animationTime + aInstanceAnimation.z) * aInstanceAnimation.w, aInstanceAnimation.y - 1.0);
+    int first = int(aInstanceAnimation.x) + int(frame);
+    float blend = fract(frame);
+    ivec2 a = bakedTexel(first);
+    ivec2 b = bakedTexel(first + 1);
+
+    vec3 normalized = mix(texelFetch(vertexPositions, a, 0).xyz, texelFetch(vertexPositions, b, 0).xyz, blend);
+    position = bakeBoundsMin + normalized * bakeBoundsExtent;
+    normal = normalize(mix(texelFetch(vertexNormals, a, 0).xyz, texelFetch(vertexNormals, b, 0).xyz, blend));
+}
@@ -0,0 +1,566 @@
+#include "animation.h"
+#include "components.h"
+#include "ecs.h"
+#include "job_system.h"
+#include "model.h"
+#include "morph_targets.h"
+#include "profiler.h"
+#include "shader.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIMATION_SSE 1
+#include <emmintrin.h>
+#endif
+
+static_assert(ANIMATION_MAX_INFLUENCES == MAX_BONE_INFLUENCE, "vertices and shaders blend the same number of bones");
+
+// largest absolute value a component can have when it isn't the largest of a unit quaternion
+static const float SMALLEST_THREE_RANGE = 0.70710678f;
+
+static uint16_t quantize(float value, float min, float extent, float maxValue) {
+  float normalized = extent > 0.0f ? (value - min) / extent : 0.0f;
+  return (uint16_t)std::lround(std::min(std::max(normalized, 0.0f), 1.0f) * maxValue);
+}
+
+// smallest three: the three smaller components in 15, 15 and 16 bits, the index of the dropped largest one
+// in the top bits of the first two
+static void encodeRotation(glm::vec4 q, uint16_t* words) {
+  int largest = 0;
+  for (int c = 1; c < 4; c++) {
+    if (std::fabs(q[c]) > std::fabs(q[largest]))
+      largest = c;
+  }
+  // q and -q are the same rotation, keep the dropped component positive so it rebuilds with a plain sqrt
+  if (q[largest] < 0.0f)
+    q = -q;
+  float rest[3];
+  for (int c = 0, r = 0; c < 4; c++) {
+    if (c != largest)
+      rest[r++] = q[c];
+  }
+  const float min = -SMALLEST_THREE_RANGE, extent = 2.0f * SMALLEST_THREE_RANGE;
+  words[0] = (uint16_t)(quantize(rest[0], min, extent, 32767.0f) | ((largest & 1) << 15));
+  words[1] = (uint16_t)(quantize(rest[1], min, extent, 32767.0f) | ((largest >> 1) << 15));
+  words[2] = quantize(rest[2], min, extent, 65535.0f);
+}
+
+static glm::vec4 decodeRotation(uint16_t word0, uint16_t word1, uint16_t word2) {
+  float a = (word0 & 0x7FFF) / 32767.0f * 2.0f * SMALLEST_THREE_RANGE - SMALLEST_THREE_RANGE;
+  float b = (word1 & 0x7FFF) / 32767.0f * 2.0f * SMALLEST_THREE_RANGE - SMALLEST_THREE_RANGE;
+  float c = word2 / 65535.0f * 2.0f * SMALLEST_THREE_RANGE - SMALLEST_THREE_RANGE;
+  float d = std::sqrt(std::max(1.0f - a * a - b * b - c * c, 0.0f));
+  switch ((word0 >> 15) | ((word1 >> 15) << 1)) {
+    case 0: return glm::vec4(d, a, b, c);
+    case 1: return glm::vec4(a, d, b, c);
+    case 2: return glm::vec4(a, b, d, c);
+    default: return glm::vec4(a, b, c, d);
+  }
+}
+
+#ifdef ANIMATION_SSE
+static inline __m128 loadWords(const uint16_t* words) {
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)words), _mm_setzero_si128()));
+}
+
+static inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+// decodes key of a rotation channel into x, y, z, w blocks of channel.stride floats
+static void decodeRotations(const AnimationChannel& channel, size_t key, float* out) {
+  size_t stride = channel.stride;
+  const uint16_t* words = &channel.keys[key * stride * 3];
+#ifdef ANIMATION_SSE
+  __m128 scale15 = _mm_set1_ps(2.0f * SMALLEST_THREE_RANGE / 32767.0f);
+  __m128 scale16 = _mm_set1_ps(2.0f * SMALLEST_THREE_RANGE / 65535.0f);
+  __m128 offset = _mm_set1_ps(SMALLEST_THREE_RANGE);
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128i low15 = _mm_set1_epi32(0x7FFF);
+  for (size_t lane = 0; lane < stride; lane += 4) {
+    __m128i word0 = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(words + lane)), _mm_setzero_si128());
+    __m128i word1 = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(words + stride + lane)), _mm_setzero_si128());
+    __m128 a = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(word0, low15)), scale15), offset);
+    __m128 b = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(word1, low15)), scale15), offset);
+    __m128 c = _mm_sub_ps(_mm_mul_ps(loadWords(words + stride * 2 + lane), scale16), offset);
+    __m128 d = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(c, c))),
+                                      _mm_setzero_ps()));
+
+    // put the rebuilt component back where it was dropped, the others move up behind it
+    __m128i index = _mm_or_si128(_mm_srli_epi32(word0, 15), _mm_slli_epi32(_mm_srli_epi32(word1, 15), 1));
+    __m128 is0 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(0)));
+    __m128 is1 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(1)));
+    __m128 is2 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(2)));
+    __m128 is3 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(3)));
+    _mm_storeu_ps(out + lane, select(is0, d, a));
+    _mm_storeu_ps(out + stride + lane, select(is0, a, select(is1, d, b)));
+    _mm_storeu_ps(out + stride * 2 + lane, select(_mm_or_ps(is0, is1), b, select(is2, d, c)));
+    _mm_storeu_ps(out + stride * 3 + lane, select(is3, d, c));
+  }
+#else
+  for (size_t lane = 0; lane < stride; lane++) {
+    glm::vec4 q = decodeRotation(words[lane], words[stride + lane], words[stride * 2 + lane]);
+    for (int c = 0; c < 4; c++)
+      out[c * stride + lane] = q[c];
+  }
+#endif
+}
+
+// decodes key of a translation or scale channel into x, y, z blocks of channel.stride floats
+static void decodeVectors(const AnimationChannel& channel, size_t key, float* out) {
+  size_t stride = channel.stride;
+  const uint16_t* words = &channel.keys[key * stride * 3];
+#ifdef ANIMATION_SSE
+  __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+  for (size_t i = 0; i < stride * 3; i += 4) {
+    __m128 normalized = _mm_mul_ps(loadWords(words + i), scale);
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(&channel.rangeMin[i]), _mm_mul_ps(normalized, _mm_loadu_ps(&channel.rangeExtent[i]))));
+  }
+#else
+  for (size_t i = 0; i < stride * 3; i++)
+    out[i] = channel.rangeMin[i] + words[i] / 65535.0f * channel.rangeExtent[i];
+#endif
+}
+
+// nlerp of count quaternions in x, y, z, w blocks of stride floats, along the shorter arc
+static void blendRotations(const float* first, const float* second, float blend, size_t stride, float* out) {
+#ifdef ANIMATION_SSE
+  __m128 t = _mm_set1_ps(blend);
+  __m128 zero = _mm_setzero_ps();
+  __m128 signBit = _mm_set1_ps(-0.0f);
+  for (size_t lane = 0; lane < stride; lane += 4) {
+    __m128 ax = _mm_loadu_ps(first + lane), bx = _mm_loadu_ps(second + lane);
+    __m128 ay = _mm_loadu_ps(first + stride + lane), by = _mm_loadu_ps(second + stride + lane);
+    __m128 az = _mm_loadu_ps(first + stride * 2 + lane), bz = _mm_loadu_ps(second + stride * 2 + lane);
+    __m128 aw = _mm_loadu_ps(first + stride * 3 + lane), bw = _mm_loadu_ps(second + stride * 3 + lane);
+
+    // flip the second key onto the shorter arc where the two point into opposite hemispheres
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                            _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+    __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, zero), signBit);
+    bx = _mm_xor_ps(bx, flip);
+    by = _mm_xor_ps(by, flip);
+    bz = _mm_xor_ps(bz, flip);
+    bw = _mm_xor_ps(bw, flip);
+
+    __m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), t));
+    __m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), t));
+    __m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), t));
+    __m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), t));
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                                           _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+    _mm_storeu_ps(out + lane, _mm_div_ps(x, length));
+    _mm_storeu_ps(out + stride + lane, _mm_div_ps(y, length));
+    _mm_storeu_ps(out + stride * 2 + lane, _mm_div_ps(z, length));
+    _mm_storeu_ps(out + stride * 3 + lane, _mm_div_ps(w, length));
+  }
+#else
+  for (size_t lane = 0; lane < stride; lane++) {
+    float dot = 0.0f;
+    for (int c = 0; c < 4; c++)
+      dot += first[c * stride + lane] * second[c * stride + lane];
+    float sign = dot < 0.0f ? -1.0f : 1.0f;
+    float q[4], lengthSquared = 0.0f;
+    for (int c = 0; c < 4; c++) {
+      float a = first[c * stride + lane];
+      q[c] = a + (second[c * stride + lane] * sign - a) * blend;
+      lengthSquared += q[c] * q[c];
+    }
+    float length = std::sqrt(lengthSquared);
+    for (int c = 0; c < 4; c++)
+      out[c * stride + lane] = q[c] / length;
+  }
+#endif
+}
+
+static void blendValues(const float* first, const float* second, float blend, size_t count, float* out) {
+#ifdef ANIMATION_SSE
+  __m128 t = _mm_set1_ps(blend);
+  for (size_t i = 0; i < count; i += 4) {
+    __m128 a = _mm_loadu_ps(first + i);
+    _mm_storeu_ps(out + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(second + i), a), t)));
+  }
+#else
+  for (size_t i = 0; i < count; i++)
+    out[i] = first[i] + (second[i] - first[i]) * blend;
+#endif
+}
+
+// blends two keys of a channel and writes the lanes into their tracks of the pose
+static void sampleChannel(const AnimationChannel& channel, bool rotation, size_t key, float blend, size_t trackStride,
+                          AnimationPose& pose, float* target) {
+  if (channel.tracks.empty())
+    return;
+  int components = rotation ? 4 : 3;
+  size_t size = channel.stride * components;
+  pose.first.resize(size);
+  pose.second.resize(size);
+  pose.blended.resize(size);
+
+  if (rotation) {
+    decodeRotations(channel, key, pose.first.data());
+    decodeRotations(channel, key + 1, pose.second.data());
+    blendRotations(pose.first.data(), pose.second.data(), blend, channel.stride, pose.blended.data());
+  }
+  else {
+    decodeVectors(channel, key, pose.first.data());
+    decodeVectors(channel, key + 1, pose.second.data());
+    blendValues(pose.first.data(), pose.second.data(), blend, size, pose.blended.data());
+  }
+
+  for (size_t lane = 0; lane < channel.tracks.size(); lane++) {
+    size_t track = channel.tracks[lane];
+    for (int c = 0; c < components; c++)
+      target[c * trackStride + track] = pose.blended[c * channel.stride + lane];
+  }
+}
+
+// resampled frame at time wrapped to the clip's duration, fractional between two frames. The frames split
+// the duration evenly, so the loop reaches the last one right as it wraps.
+static float clipFrame(const AnimationClip& clip, float time) {
+  if (clip.duration <= 0.0f || clip.frameCount < 2)
+    return 0.0f;
+  time = std::fmod(time, clip.duration);
+  if (time < 0.0f)
+    time += clip.duration;
+  return std::min(time * (float)(clip.frameCount - 1) / clip.duration, (float)(clip.frameCount - 1));
+}
+
+void SampleAnimation(const AnimationClip& clip, float time, AnimationPose& pose) {
+  pose.rotations = clip.constantRotations;
+  pose.translations = clip.constantTranslations;
+  pose.scales = clip.constantScales;
+  if (clip.keyFrames.size() < 2)
+    return;
+
+  // the kept frames around time and the blend between them, the same for every track
+  float frame = clipFrame(clip, time);
+  size_t key = std::upper_bound(clip.keyFrames.begin(), clip.keyFrames.end(), (uint16_t)frame) - clip.keyFrames.begin();
+  key = std::min(std::max(key, (size_t)1), clip.keyFrames.size() - 1) - 1;
+  float blend = (frame - clip.keyFrames[key]) / (float)(clip.keyFrames[key + 1] - clip.keyFrames[key]);
+
+  size_t stride = clip.trackStride;
+  sampleChannel(clip.rotations, true, key, blend, stride, pose, pose.rotations.data());
+  sampleChannel(clip.translations, false, key, blend, stride, pose, pose.translations.data());
+  sampleChannel(clip.scales, false, key, blend, stride, pose, pose.scales.data());
+}
+
+void SampleMorphWeights(const AnimationClip& clip, float time, float* weights) {
+  size_t count = clip.morphTargetCount;
+  if (count == 0 || clip.morphWeights.size() < clip.frameCount * count)
+    return;
+
+  float frame = clipFrame(clip, time);
+  size_t first = (size_t)frame;
+  size_t second = std::min(first + 1, (size_t)clip.frameCount - 1);
+  float blend = frame - (float)first;
+  const float* a = &clip.morphWeights[first * count];
+  const float* b = &clip.morphWeights[second * count];
+  for (size_t i = 0; i < count; i++)
+    weights[i] = a[i] + (b[i] - a[i]) * blend;
+}
+
+size_t AnimationClip::Bytes() const {
+  size_t bytes = keyFrames.size() * sizeof(uint16_t) + morphWeights.size() * sizeof(float);
+  bytes += (constantRotations.size() + constantTranslations.size() + constantScales.size()) * sizeof(float);
+  for (const AnimationChannel* channel : {&rotations, &translations, &scales}) {
+    bytes += channel->tracks.size() * sizeof(uint16_t) + channel->keys.size() * sizeof(uint16_t);
+    bytes += (channel->rangeMin.size() + channel->rangeExtent.size()) * sizeof(float);
+  }
+  return bytes;
+}
+
+static glm::vec4 rotationAt(const ResampledClip& clip, size_t frame, size_t track) {
+  const float* rotations = &clip.rotations[frame * clip.trackStride * 4];
+  size_t stride = clip.trackStride;
+  return glm::vec4(rotations[track], rotations[stride + track], rotations[stride * 2 + track], rotations[stride * 3 + track]);
+}
+
+static glm::vec3 vectorAt(const std::vector<float>& values, size_t stride, size_t frame, size_t track) {
+  const float* frameValues = &values[frame * stride * 3];
+  return glm::vec3(frameValues[track], frameValues[stride + track], frameValues[stride * 2 + track]);
+}
+
+static float rotationError(const glm::vec4& a, const glm::vec4& b) {
+  return 2.0f * std::acos(std::min(std::fabs(glm::dot(glm::normalize(a), glm::normalize(b))), 1.0f));
+}
+
+static glm::vec4 nlerp(const glm::vec4& a, glm::vec4 b, float t) {
+  if (glm::dot(a, b) < 0.0f)
+    b = -b;
+  return glm::normalize(a + (b - a) * t);
+}
+
+AnimationClip CompressAnimation(const ResampledClip& source, const AnimationCompression& settings) {
+  AnimationClip clip;
+  clip.name = source.name;
+  clip.duration = source.duration;
+  clip.frameCount = std::min(source.frameCount, 65535u);
+  clip.trackNodes = source.trackNodes;
+  clip.trackStride = source.trackStride;
+  clip.morphTargetCount = source.morphTargetCount;
+  clip.morphWeights = source.morphWeights;
+
+  size_t stride = source.trackStride;
+  size_t frames = clip.frameCount;
+  clip.constantRotations.assign(stride * 4, 0.0f);
+  clip.constantTranslations.assign(stride * 3, 0.0f);
+  clip.constantScales.assign(stride * 3, 1.0f);
+  // padding lanes hold the identity
+  for (size_t track = source.trackNodes.size(); track < stride; track++)
+    clip.constantRotations[stride * 3 + track] = 1.0f;
+  if (frames == 0)
+    return clip;
+
+  // tracks that never leave their first key become constants
+  std::vector<uint16_t> rotationTracks, translationTracks, scaleTracks;
+  for (size_t track = 0; track < source.trackNodes.size(); track++) {
+    glm::vec4 rotation = rotationAt(source, 0, track);
+    glm::vec3 translation = vectorAt(source.translations, stride, 0, track);
+    glm::vec3 scale = vectorAt(source.scales, stride, 0, track);
+    for (int c = 0; c < 4; c++)
+      clip.constantRotations[c * stride + track] = rotation[c];
+    for (int c = 0; c < 3; c++) {
+      clip.constantTranslations[c * stride + track] = translation[c];
+      clip.constantScales[c * stride + track] = scale[c];
+    }
+
+    bool rotates = false, moves = false, scales = false;
+    for (size_t frame = 1; frame < frames; frame++) {
+      rotates = rotates || rotationError(rotationAt(source, frame, track), rotation) > settings.rotationTolerance;
+      moves = moves || glm::length(vectorAt(source.translations, stride, frame, track) - translation) > settings.translationTolerance;
+      scales = scales || glm::length(vectorAt(source.scales, stride, frame, track) - scale) > settings.scaleTolerance;
+    }
+    if (rotates)
+      rotationTracks.push_back((uint16_t)track);
+    if (moves)
+      translationTracks.push_back((uint16_t)track);
+    if (scales)
+      scaleTracks.push_back((uint16_t)track);
+  }
+
+  // greedily stretch every segment as far as all changing tracks can interpolate the frames inside it
+  clip.keyFrames.push_back(0);
+  size_t start = 0;
+  while (start + 1 < frames) {
+    size_t end = start + 1;
+    while (end + 1 < frames) {
+      size_t candidate = end + 1;
+      bool fits = true;
+      for (size_t frame = start + 1; frame < candidate && fits; frame++) {
+        float t = (float)(frame - start) / (float)(candidate - start);
+        for (uint16_t track : rotationTracks) {
+          glm::vec4 blended = nlerp(rotationAt(source, start, track), rotationAt(source, candidate, track), t);
+          if (rotationError(blended, rotationAt(source, frame, track)) > settings.rotationTolerance) {
+            fits = false;
+            break;
+          }
+        }
+        for (size_t i = 0; i < translationTracks.size() && fits; i++) {
+          glm::vec3 a = vectorAt(source.translations, stride, start, translationTracks[i]);
+          glm::vec3 b = vectorAt(source.translations, stride, candidate, translationTracks[i]);
+          fits = glm::length(a + (b - a) * t - vectorAt(source.translations, stride, frame, translationTracks[i])) <= settings.translationTolerance;
+        }
+        for (size_t i = 0; i < scaleTracks.size() && fits; i++) {
+          glm::vec3 a = vectorAt(source.scales, stride, start, scaleTracks[i]);
+          glm::vec3 b = vectorAt(source.scales, stride, candidate, scaleTracks[i]);
+          fits = glm::length(a + (b - a) * t - vectorAt(source.scales, stride, frame, scaleTracks[i])) <= settings.scaleTolerance;
+        }
+      }
+      if (!fits)
+        break;
+      end = candidate;
+    }
+    clip.keyFrames.push_back((uint16_t)end);
+    start = end;
+  }
+
+  // quantize the kept keys of the changing tracks
+  size_t keys = clip.keyFrames.size();
+  clip.rotations.tracks = rotationTracks;
+  clip.rotations.stride = (uint32_t)((rotationTracks.size() + 3) & ~(size_t)3);
+  // padding lanes decode to the identity: three zeros and the rebuilt w
+  clip.rotations.keys.assign(keys * clip.rotations.stride * 3, 0);
+  for (size_t key = 0; key < keys; key++) {
+    uint16_t* words = &clip.rotations.keys[key * clip.rotations.stride * 3];
+    for (size_t lane = 0; lane < clip.rotations.stride; lane++) {
+      glm::vec4 rotation = lane < rotationTracks.size() ? rotationAt(source, clip.keyFrames[key], rotationTracks[lane]) : glm::vec4(0, 0, 0, 1);
+      uint16_t encoded[3];
+      encodeRotation(glm::normalize(rotation), encoded);
+      for (int c = 0; c < 3; c++)
+        words[c * clip.rotations.stride + lane] = encoded[c];
+    }
+  }
+
+  struct VectorChannel {
+    const std::vector<float>* values;
+    const std::vector<uint16_t>* tracks;
+    AnimationChannel* channel;
+  };
+  VectorChannel vectorChannels[] = {{&source.translations, &translationTracks, &clip.translations},
+                                    {&source.scales, &scaleTracks, &clip.scales}};
+  for (VectorChannel& vectors : vectorChannels) {
+    AnimationChannel& channel = *vectors.channel;
+    channel.tracks = *vectors.tracks;
+    channel.stride = (uint32_t)((channel.tracks.size() + 3) & ~(size_t)3);
+    size_t channelStride = channel.stride;
+    channel.rangeMin.assign(channelStride * 3, 0.0f);
+    channel.rangeExtent.assign(channelStride * 3, 0.0f);
+    channel.keys.assign(keys * channelStride * 3, 0);
+
+    // the range covers every resampled frame, not just the kept ones
+    for (size_t lane = 0; lane < channel.tracks.size(); lane++) {
+      glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+      for (size_t frame = 0; frame < frames; frame++) {
+        glm::vec3 value = vectorAt(*vectors.values, stride, frame, channel.tracks[lane]);
+        min = glm::min(min, value);
+        max = glm::max(max, value);
+      }
+      for (int c = 0; c < 3; c++) {
+        channel.rangeMin[c * channelStride + lane] = min[c];
+        channel.rangeExtent[c * channelStride + lane] = max[c] - min[c];
+      }
+    }
+    for (size_t key = 0; key < keys; key++) {
+      uint16_t* words = &channel.keys[key * channelStride * 3];
+      for (size_t lane = 0; lane < channel.tracks.size(); lane++) {
+        glm::vec3 value = vectorAt(*vectors.values, stride, clip.keyFrames[key], channel.tracks[lane]);
+        for (int c = 0; c < 3; c++)
+          words[c * channelStride + lane] = quantize(value[c], channel.rangeMin[c * channelStride + lane],
+                                                     channel.rangeExtent[c * channelStride + lane], 65535.0f);
+      }
+    }
+  }
+  return clip;
+}
+
+void ComputeSkinningPalette(const Model& model, const AnimationClip& clip, const AnimationPose& pose,
+                            std::vector<glm::mat4>& nodeMatrices, glm::mat4* palette) {
+  const TransformHierarchy& nodes = model.nodes;
+  nodeMatrices.assign(nodes.local.begin(), nodes.local.end());
+
+  size_t stride = clip.trackStride;
+  for (size_t track = 0; track < clip.TrackCount(); track++) {
+    uint32_t node = clip.trackNodes[track];
+    if (node >= nodeMatrices.size())
+      continue;
+    glm::quat rotation(pose.rotations[stride * 3 + track], pose.rotations[track], pose.rotations[stride + track],
+                       pose.rotations[stride * 2 + track]);
+    glm::mat4 matrix = glm::mat4_cast(rotation);
+    matrix[0] *= pose.scales[track];
+    matrix[1] *= pose.scales[stride + track];
+    matrix[2] *= pose.scales[stride * 2 + track];
+    matrix[3] = glm::vec4(pose.translations[track], pose.translations[stride + track], pose.translations[stride * 2 + track], 1.0f);
+    nodeMatrices[node] = matrix;
+  }
+
+  // parents come first, so one pass turns local matrices into model space
+  for (size_t node = 0; node < nodeMatrices.size(); node++) {
+    uint32_t parent = nodes.parent[node];
+    if (parent != TRANSFORM_NO_PARENT)
+      nodeMatrices[node] = nodeMatrices[parent] * nodeMatrices[node];
+  }
+
+  for (size_t bone = 0; bone < model.boneNodes.size(); bone++)
+    palette[bone] = nodeMatrices[model.boneNodes[bone]] * model.boneOffsets[bone];
+}
+
+void Animator::Init() {
+  glGenBuffers(1, &paletteBuffer);
+  glGenTextures(1, &paletteTexture);
+  glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+  glBindTexture(GL_TEXTURE_BUFFER, paletteTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, paletteBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  bufferBones = 1;
+
+  threadScratch.resize(JobSystem::Get().ThreadCount());
+}
+
+void Animator::Shutdown() {
+  if (paletteBuffer)
+    glDeleteBuffers(1, &paletteBuffer);
+  if (paletteTexture)
+    glDeleteTextures(1, &paletteTexture);
+  paletteBuffer = paletteTexture = 0;
+  bufferBones = 0;
+  palettes.clear();
+  threadScratch.clear();
+}
+
+uint32_t Animator::Allocate(const Model& model) {
+  uint32_t offset = (uint32_t)palettes.size();
+  // starts out in the bind pose until the first Update
+  palettes.insert(palettes.end(), model.boneNodes.size(), glm::mat4(1.0f));
+  return offset;
+}
+
+void Animator::Update(World& world, float deltaTime) {
+  std::vector<size_t> counts(threadScratch.size(), 0);
+  world.ParallelEach<AnimatorComponent, MeshRendererComponent>(
+      [&](Entity, AnimatorComponent& animator, MeshRendererComponent& renderer) {
+        const Model* model = renderer.model;
+        if (!model || animator.clip >= model->animations.size() || animator.paletteOffset + model->boneNodes.size() > palettes.size())
+          return;
+
+        const AnimationClip& clip = model->animations[animator.clip];
+        animator.time += deltaTime * animator.speed;
+        if (clip.duration > 0.0f)
+          animator.time = std::fmod(animator.time, clip.duration);
+
+        Scratch& scratch = threadScratch[JobSystem::ThreadIndex()];
+        SampleAnimation(clip, animator.time, scratch.pose);
+        ComputeSkinningPalette(*model, clip, scratch.pose, scratch.nodeMatrices, &palettes[animator.paletteOffset]);
+        counts[JobSystem::ThreadIndex()]++;
+      },
+      ANIMATION_BATCH);
+
+  animatedCount = 0;
+  for (size_t count : counts)
+    animatedCount += count;
+
+  // one instance after the other, the library keeps track of which weights changed
+  world.Each<AnimatorComponent, MorphComponent, MeshRendererComponent>(
+      [&](Entity, AnimatorComponent& animator, MorphComponent& morph, MeshRendererComponent& renderer) {
+        const Model* model = renderer.model;
+        if (!model || animator.clip >= model->animations.size())
+          return;
+        const AnimationClip& clip = model->animations[animator.clip];
+        if (clip.morphWeights.empty() || clip.morphTargetCount != model->morphWeights.size())
+          return;
+        morphScratch.resize(clip.morphTargetCount);
+        SampleMorphWeights(clip, animator.time, morphScratch.data());
+        MorphTargetLibrary::Get().SetWeights(morph.weightOffset, morphScratch.data(), morphScratch.size());
+      });
+}
+
+void Animator::Upload() {
+  if (!paletteBuffer || palettes.empty())
+    return;
+
+  // orphan the old storage, last frame's draws may still read it
+  glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, palettes.size() * sizeof(glm::mat4), palettes.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  if (palettes.size() != bufferBones) {
+    Profiler::Get().TrackBufferMemory(((long long)palettes.size() - (long long)bufferBones) * (long long)sizeof(glm::mat4));
+    bufferBones = palettes.size();
+  }
+
+  glActiveTexture(GL_TEXTURE0 + ANIMATION_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, paletteTexture);
+  glActiveTexture(GL_TEXTURE0);
+  Profiler::Get().CountStateChange();
+}
+
+void Animator::Apply(Shader& shader) const {
+  shader.setInt("bonePalette", ANIMATION_TEXTURE_UNIT);
+}
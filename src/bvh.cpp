@@ -0,0 +1,342 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+// bins per axis for the SAH sweep in Rebuild
+static const int SAH_BINS = 16;
+
+DynamicBVH::DynamicBVH(float margin) : margin(margin) {}
+
+uint32_t DynamicBVH::allocateNode() {
+  uint32_t index;
+  if (freeList != BVH_NULL) {
+    index = freeList;
+    freeList = nodes[index].parent;
+  }
+  else {
+    index = (uint32_t)nodes.size();
+    nodes.push_back(Node());
+  }
+
+  Node& node = nodes[index];
+  node.box = AABB::Empty();
+  node.parent = BVH_NULL;
+  node.child[0] = node.child[1] = BVH_NULL;
+  node.height = 0;
+  node.userData = 0;
+  return index;
+}
+
+void DynamicBVH::freeNode(uint32_t index) {
+  nodes[index].parent = freeList;
+  nodes[index].height = BVH_NULL;
+  freeList = index;
+}
+
+uint32_t DynamicBVH::Insert(const AABB& bounds, uint64_t userData) {
+  uint32_t leaf = allocateNode();
+  nodes[leaf].box = { bounds.min - glm::vec3(margin), bounds.max + glm::vec3(margin) };
+  nodes[leaf].userData = userData;
+  insertLeaf(leaf);
+  proxyCount++;
+  return leaf;
+}
+
+void DynamicBVH::Remove(uint32_t proxy) {
+  removeLeaf(proxy);
+  freeNode(proxy);
+  proxyCount--;
+}
+
+bool DynamicBVH::Move(uint32_t proxy, const AABB& bounds) {
+  if (nodes[proxy].box.Contains(bounds))
+    return false;
+
+  // refit instead of reinserting, the rotations on the way up repair what the move made worse
+  nodes[proxy].box = { bounds.min - glm::vec3(margin), bounds.max + glm::vec3(margin) };
+  refitUpwards(nodes[proxy].parent);
+  return true;
+}
+
+void DynamicBVH::Clear() {
+  nodes.clear();
+  root = BVH_NULL;
+  freeList = BVH_NULL;
+  proxyCount = 0;
+}
+
+void DynamicBVH::insertLeaf(uint32_t leaf) {
+  if (root == BVH_NULL) {
+    root = leaf;
+    nodes[leaf].parent = BVH_NULL;
+    return;
+  }
+
+  // walk down towards the sibling that adds the least area. Pairing with the current node costs its
+  // union with the leaf, descending costs the growth of this node plus whatever the child adds.
+  const AABB& box = nodes[leaf].box;
+  uint32_t index = root;
+  while (!nodes[index].IsLeaf()) {
+    const Node& node = nodes[index];
+    float area = node.box.HalfArea();
+    float combinedArea = Union(node.box, box).HalfArea();
+    float cost = 2.0f * combinedArea;
+    float inheritance = 2.0f * (combinedArea - area);
+
+    float childCost[2];
+    for (int i = 0; i < 2; i++) {
+      const Node& child = nodes[node.child[i]];
+      float grown = Union(child.box, box).HalfArea();
+      childCost[i] = (child.IsLeaf() ? grown : grown - child.box.HalfArea()) + inheritance;
+    }
+
+    if (cost < childCost[0] && cost < childCost[1])
+      break;
+    index = childCost[0] <= childCost[1] ? node.child[0] : node.child[1];
+  }
+
+  // put a new parent above the sibling
+  uint32_t sibling = index;
+  uint32_t oldParent = nodes[sibling].parent;
+  uint32_t newParent = allocateNode();
+  nodes[newParent].parent = oldParent;
+  nodes[newParent].child[0] = sibling;
+  nodes[newParent].child[1] = leaf;
+  nodes[sibling].parent = newParent;
+  nodes[leaf].parent = newParent;
+
+  if (oldParent == BVH_NULL) {
+    root = newParent;
+  }
+  else {
+    Node& parent = nodes[oldParent];
+    parent.child[parent.child[0] == sibling ? 0 : 1] = newParent;
+  }
+
+  refitUpwards(newParent);
+}
+
+void DynamicBVH::removeLeaf(uint32_t leaf) {
+  if (leaf == root) {
+    root = BVH_NULL;
+    return;
+  }
+
+  // the sibling takes the parent's place
+  uint32_t parent = nodes[leaf].parent;
+  uint32_t grandParent = nodes[parent].parent;
+  uint32_t sibling = nodes[parent].child[0] == leaf ? nodes[parent].child[1] : nodes[parent].child[0];
+
+  if (grandParent == BVH_NULL) {
+    root = sibling;
+    nodes[sibling].parent = BVH_NULL;
+  }
+  else {
+    Node& node = nodes[grandParent];
+    node.child[node.child[0] == parent ? 0 : 1] = sibling;
+    nodes[sibling].parent = grandParent;
+  }
+  freeNode(parent);
+
+  if (grandParent != BVH_NULL)
+    refitUpwards(grandParent);
+}
+
+void DynamicBVH::updateNode(uint32_t index) {
+  Node& node = nodes[index];
+  const Node& a = nodes[node.child[0]];
+  const Node& b = nodes[node.child[1]];
+  node.box = Union(a.box, b.box);
+  node.height = 1 + std::max(a.height, b.height);
+}
+
+void DynamicBVH::refitUpwards(uint32_t index) {
+  while (index != BVH_NULL) {
+    updateNode(index);
+    rotate(index);
+    index = nodes[index].parent;
+  }
+}
+
+void DynamicBVH::rotate(uint32_t index) {
+  // Swaps a child of this node with a grandchild on the other side when that shrinks the other child.
+  // The node's own box doesn't change, only the child that gets a new pair of children.
+  Node& node = nodes[index];
+  uint32_t b = node.child[0];
+  uint32_t c = node.child[1];
+
+  float bestGain = 0.0f;
+  uint32_t swapChild = BVH_NULL;      // child of node that moves down
+  uint32_t swapGrandChild = BVH_NULL; // grandchild that moves up
+
+  for (int side = 0; side < 2; side++) {
+    uint32_t stay = side == 0 ? b : c;  // child that is swapped down
+    uint32_t other = side == 0 ? c : b; // child whose children are candidates
+    if (nodes[other].IsLeaf())
+      continue;
+
+    float area = nodes[other].box.HalfArea();
+    for (int g = 0; g < 2; g++) {
+      uint32_t up = nodes[other].child[g];
+      uint32_t remaining = nodes[other].child[1 - g];
+      float gain = area - Union(nodes[stay].box, nodes[remaining].box).HalfArea();
+      if (gain > bestGain) {
+        bestGain = gain;
+        swapChild = stay;
+        swapGrandChild = up;
+      }
+    }
+  }
+
+  if (swapChild == BVH_NULL)
+    return;
+
+  uint32_t otherChild = nodes[swapGrandChild].parent;
+  node.child[node.child[0] == swapChild ? 0 : 1] = swapGrandChild;
+  nodes[swapGrandChild].parent = index;
+
+  Node& other = nodes[otherChild];
+  other.child[other.child[0] == swapGrandChild ? 0 : 1] = swapChild;
+  nodes[swapChild].parent = otherChild;
+
+  updateNode(otherChild);
+  updateNode(index);
+}
+
+void DynamicBVH::Rebuild() {
+  if (proxyCount < 2)
+    return;
+
+  // Collect the leaves and throw every internal node away. The build partitions copies of the leaf
+  // boxes so the binning loops stream through memory instead of chasing leaves all over the node array.
+  struct BuildLeaf {
+    AABB box;
+    glm::vec3 center;
+    uint32_t leaf;
+  };
+
+  std::vector<BuildLeaf> leaves;
+  leaves.reserve(proxyCount);
+  for (uint32_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].height == 0)
+      leaves.push_back({nodes[i].box, nodes[i].box.Center(), i});
+    else if (nodes[i].height != BVH_NULL)
+      freeNode(i);
+  }
+
+  struct Task {
+    uint32_t begin;
+    uint32_t end;
+    uint32_t parent;
+    int slot;
+  };
+
+  std::vector<Task> tasks;
+  std::vector<uint32_t> internalNodes;
+  tasks.push_back({0, (uint32_t)leaves.size(), BVH_NULL, 0});
+
+  while (!tasks.empty()) {
+    Task task = tasks.back();
+    tasks.pop_back();
+
+    uint32_t index;
+    if (task.end - task.begin == 1) {
+      index = leaves[task.begin].leaf;
+    }
+    else {
+      AABB centerBounds = AABB::Empty();
+      for (uint32_t i = task.begin; i < task.end; i++)
+        centerBounds.Grow(leaves[i].center);
+
+      // sweep the bins of every axis and keep the cheapest split
+      int bestAxis = -1;
+      int bestSplit = 0;
+      float bestCost = FLT_MAX;
+      glm::vec3 extent = centerBounds.max - centerBounds.min;
+      for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0.0f)
+          continue;
+
+        AABB binBounds[SAH_BINS];
+        uint32_t binCount[SAH_BINS] = {};
+        for (int b = 0; b < SAH_BINS; b++)
+          binBounds[b] = AABB::Empty();
+
+        float scale = SAH_BINS / extent[axis];
+        for (uint32_t i = task.begin; i < task.end; i++) {
+          int bin = std::min(SAH_BINS - 1, (int)((leaves[i].center[axis] - centerBounds.min[axis]) * scale));
+          binCount[bin]++;
+          binBounds[bin].Grow(leaves[i].box);
+        }
+
+        // areas of everything left of each split, then sweep from the right
+        float leftArea[SAH_BINS - 1];
+        uint32_t leftCount[SAH_BINS - 1];
+        AABB left = AABB::Empty();
+        uint32_t count = 0;
+        for (int b = 0; b < SAH_BINS - 1; b++) {
+          left.Grow(binBounds[b]);
+          count += binCount[b];
+          leftArea[b] = count ? left.HalfArea() : 0.0f;
+          leftCount[b] = count;
+        }
+
+        AABB right = AABB::Empty();
+        count = 0;
+        for (int b = SAH_BINS - 1; b > 0; b--) {
+          right.Grow(binBounds[b]);
+          count += binCount[b];
+          if (!count || !leftCount[b - 1])
+            continue;
+          float cost = leftArea[b - 1] * leftCount[b - 1] + right.HalfArea() * count;
+          if (cost < bestCost) {
+            bestCost = cost;
+            bestAxis = axis;
+            bestSplit = b;
+          }
+        }
+      }
+
+      uint32_t middle;
+      if (bestAxis < 0) {
+        // all centers coincide, any split is as good as another
+        middle = task.begin + (task.end - task.begin) / 2;
+      }
+      else {
+        float scale = SAH_BINS / extent[bestAxis];
+        float minimum = centerBounds.min[bestAxis];
+        BuildLeaf* split = std::partition(leaves.data() + task.begin, leaves.data() + task.end, [&](const BuildLeaf& leaf) {
+          return std::min(SAH_BINS - 1, (int)((leaf.center[bestAxis] - minimum) * scale)) < bestSplit;
+        });
+        middle = (uint32_t)(split - leaves.data());
+      }
+
+      index = allocateNode();
+      internalNodes.push_back(index);
+      tasks.push_back({task.begin, middle, index, 0});
+      tasks.push_back({middle, task.end, index, 1});
+    }
+
+    nodes[index].parent = task.parent;
+    if (task.parent == BVH_NULL)
+      root = index;
+    else
+      nodes[task.parent].child[task.slot] = index;
+  }
+
+  // children are always created after their parent, so walking backwards fits every box bottom up
+  for (size_t i = internalNodes.size(); i-- > 0;)
+    updateNode(internalNodes[i]);
+}
+
+float DynamicBVH::Cost() const {
+  if (root == BVH_NULL)
+    return 0.0f;
+
+  float total = 0.0f;
+  for (const Node& node : nodes) {
+    if (node.height != BVH_NULL && node.height > 0)
+      total += node.box.HalfArea();
+  }
+  return total / std::max(nodes[root].box.HalfArea(), FLT_MIN);
+}
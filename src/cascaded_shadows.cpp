@@ -0,0 +1,276 @@
+#include "cascaded_shadows.h"
+#include "animation.h"
+#include "components.h"
+#include "profiler.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+// depth bias applied while rendering the casters, in slope and depth buffer units
+static const float SHADOW_SLOPE_BIAS = 2.0f;
+static const float SHADOW_CONSTANT_BIAS = 2.0f;
+
+static ShadowSettings clampSettings(ShadowSettings settings) {
+  settings.resolution = std::max(16, settings.resolution);
+  settings.cascadeCount = std::min(std::max(1, settings.cascadeCount), SHADOW_MAX_CASCADES);
+  settings.splitLambda = std::min(std::max(0.0f, settings.splitLambda), 1.0f);
+  settings.cachedCascades = std::min(std::max(0, settings.cachedCascades), settings.cascadeCount - 1);
+  settings.cacheInterval = std::max(1, settings.cacheInterval);
+  return settings;
+}
+
+bool CascadedShadowMap::Init(const ShadowSettings& shadowSettings) {
+  settings = clampSettings(shadowSettings);
+  depthShader.reset(new Shader("resources/shaders/shadowDepth.vs", "resources/shaders/shadowDepth.fs"));
+  glGenFramebuffers(1, &framebuffer);
+  initialized = createTexture();
+  invalidated = true;
+  return initialized;
+}
+
+void CascadedShadowMap::Shutdown() {
+  destroyTexture();
+  glDeleteFramebuffers(1, &framebuffer);
+  framebuffer = 0;
+  depthShader.reset();
+  initialized = enabled = false;
+}
+
+void CascadedShadowMap::Configure(const ShadowSettings& shadowSettings) {
+  settings = clampSettings(shadowSettings);
+  invalidated = true;
+  for (int i = 0; i < SHADOW_MAX_CASCADES; i++)
+    cascades[i].valid = false;
+
+  if (framebuffer != 0 && (settings.resolution != textureResolution || settings.cascadeCount != textureLayers)) {
+    destroyTexture();
+    initialized = createTexture();
+  }
+}
+
+bool CascadedShadowMap::createTexture() {
+  textureResolution = settings.resolution;
+  textureLayers = settings.cascadeCount;
+
+  // sampled with hardware comparison, every lookup returns how much of a 2x2 footprint is lit
+  glGenTextures(1, &depthTexture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, textureResolution, textureResolution, textureLayers, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  Profiler::Get().TrackTextureMemory((long long)textureResolution * textureResolution * textureLayers * 4);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (!complete)
+    std::cout << "ERROR::SHADOWS::Cascade framebuffer is not complete" << std::endl;
+  return complete;
+}
+
+void CascadedShadowMap::destroyTexture() {
+  if (depthTexture == 0)
+    return;
+  glDeleteTextures(1, &depthTexture);
+  Profiler::Get().TrackTextureMemory(-(long long)textureResolution * textureResolution * textureLayers * 4);
+  depthTexture = 0;
+  textureResolution = textureLayers = 0;
+}
+
+void CascadedShadowMap::Update(Camera& camera, float aspect, const glm::vec3& direction) {
+  enabled = initialized;
+  if (!enabled)
+    return;
+
+  glm::vec3 light = glm::normalize(direction);
+  if (glm::dot(light, lightDirection) < 0.99999f) {
+    lightDirection = light;
+    invalidated = true;
+  }
+
+  // the rotation into light space only depends on the light, so the texel grid stays put in the world
+  glm::vec3 up = std::abs(light.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+  glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), light, up);
+
+  float nearPlane = camera.Near;
+  float farPlane = std::max(std::min(camera.Far, settings.maxDistance), nearPlane * 2.0f);
+  float tanY = std::tan(glm::radians(camera.Zoom) * 0.5f);
+  float tanX = tanY * aspect;
+  float cornerSlope = tanX * tanX + tanY * tanY;   // squared distance of a slice corner from the axis per unit depth
+
+  float splitNear = nearPlane;
+  for (int i = 0; i < settings.cascadeCount; i++) {
+    // practical split scheme, a blend of logarithmic and uniform splits
+    float fraction = (float)(i + 1) / settings.cascadeCount;
+    float logSplit = nearPlane * std::pow(farPlane / nearPlane, fraction);
+    float uniformSplit = nearPlane + (farPlane - nearPlane) * fraction;
+    float splitFar = settings.splitLambda * logSplit + (1.0f - settings.splitLambda) * uniformSplit;
+
+    // smallest sphere around the slice, centered on the view axis where the near and far corners are
+    // equally far away. It only depends on the projection, so turning the camera never resizes it.
+    float centerDepth = std::min(0.5f * (splitNear + splitFar) * (1.0f + cornerSlope), splitFar);
+    float nearDistance = (centerDepth - splitNear) * (centerDepth - splitNear) + splitNear * splitNear * cornerSlope;
+    float farDistance = (splitFar - centerDepth) * (splitFar - centerDepth) + splitFar * splitFar * cornerSlope;
+    float radius = std::sqrt(std::max(nearDistance, farDistance));
+    // rounded up so float noise between frames can't change the texel size
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+    float texelSize = 2.0f * radius / settings.resolution;
+
+    // snap the center to whole texels, the cascade then only ever moves in texel steps
+    glm::vec3 center = glm::vec3(lightView * glm::vec4(camera.Position + camera.Front * centerDepth, 1.0f));
+    center.x = std::floor(center.x / texelSize) * texelSize;
+    center.y = std::floor(center.y / texelSize) * texelSize;
+
+    // light space looks down -Z. Casters in front of the near plane are clamped onto it while rendering.
+    glm::mat4 projection = glm::ortho(center.x - radius, center.x + radius, center.y - radius, center.y + radius,
+                                      -center.z - radius, -center.z + radius);
+
+    Cascade& cascade = cascades[i];
+    cascade.fitted = projection * lightView;
+    cascade.fittedTexelSize = texelSize;
+    cascade.splitFar = splitFar;
+    splitNear = splitFar;
+  }
+}
+
+void CascadedShadowMap::Render(World& world, const DynamicBVH& bvh, int width, int height) {
+  if (!enabled)
+    return;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(0, 0, textureResolution, textureResolution);
+  glEnable(GL_DEPTH_CLAMP);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_CONSTANT_BIAS);
+  depthShader->use();
+  depthShader->setInt("bonePalette", ANIMATION_TEXTURE_UNIT);
+
+  // the near cascades follow the camera every frame, the cached far ones take turns
+  unsigned int rendered = 0;
+  size_t drawn = 0;
+  int firstCached = settings.cascadeCount - settings.cachedCascades;
+  for (int i = 0; i < settings.cascadeCount; i++) {
+    Cascade& cascade = cascades[i];
+    bool due = invalidated || !cascade.valid || i < firstCached || (frame + i) % settings.cacheInterval == 0;
+    if (!due)
+      continue;
+
+    cascade.matrix = cascade.fitted;
+    cascade.texelSize = cascade.fittedTexelSize;
+    cascade.valid = true;
+    drawn += renderCascade(world, bvh, i);
+    rendered++;
+  }
+  invalidated = false;
+  frame++;
+
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDisable(GL_DEPTH_CLAMP);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, width, height);
+  Profiler::Get().CountShadows(rendered, (unsigned int)drawn);
+}
+
+size_t CascadedShadowMap::renderCascade(World& world, const DynamicBVH& bvh, int index) {
+  const Cascade& cascade = cascades[index];
+
+  // anything between the light and the cascade throws shadows into it, so the near plane is left out
+  Frustum frustum = Frustum::FromMatrix(cascade.matrix);
+  frustum.planes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+  // casters smaller than a few texels barely show, skipping them keeps the far cascades cheap
+  float minSize = settings.minCasterTexels * cascade.texelSize;
+  casters.clear();
+  bvh.QueryFrustum(frustum, [&](uint32_t, uint64_t userData) {
+    Entity entity = EntityFromBits(userData);
+    const BoundsComponent* bounds = world.Get<BoundsComponent>(entity);
+    if (!bounds)
+      return;
+    float size = glm::length(bounds->world.max - bounds->world.min);
+    if (size >= minSize)
+      casters.push_back({entity, size});
+  });
+
+  if (casters.size() > settings.maxCastersPerCascade) {
+    std::nth_element(casters.begin(), casters.begin() + settings.maxCastersPerCascade, casters.end(),
+                     [](const Caster& a, const Caster& b) { return a.size > b.size; });
+    casters.resize(settings.maxCastersPerCascade);
+  }
+
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, index);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  depthShader->setMat4("lightViewProjection", cascade.matrix);
+
+  size_t drawn = 0;
+  for (const Caster& caster : casters) {
+    const MeshRendererComponent* renderer = world.Get<MeshRendererComponent>(caster.entity);
+    const WorldTransformComponent* transform = world.Get<WorldTransformComponent>(caster.entity);
+    if (!renderer || !transform || !renderer->model || renderer->model->meshes.empty())
+      continue;
+    const AnimatorComponent* animator = world.Get<AnimatorComponent>(caster.entity);
+    renderer->model->Draw(*depthShader, transform->matrix, animator ? (int)animator->paletteOffset : -1);
+    drawn++;
+  }
+  return drawn;
+}
+
+const CascadedShadowMap::ShaderUniforms& CascadedShadowMap::uniformsOf(const Shader& shader) const {
+  ShaderUniforms* uniforms = nullptr;
+  for (ShaderUniforms& candidate : shaderUniforms) {
+    if (candidate.shader == &shader)
+      uniforms = &candidate;
+  }
+  if (uniforms && uniforms->program == shader.ID)
+    return *uniforms;
+  if (!uniforms) {
+    shaderUniforms.emplace_back();
+    uniforms = &shaderUniforms.back();
+  }
+
+  uniforms->shader = &shader;
+  uniforms->program = shader.ID;
+  uniforms->shadowMap = glGetUniformLocation(shader.ID, "shadowMap");
+  uniforms->cascadeCount = glGetUniformLocation(shader.ID, "shadowCascadeCount");
+  uniforms->texel = glGetUniformLocation(shader.ID, "shadowMapTexel");
+  for (int i = 0; i < SHADOW_MAX_CASCADES; i++) {
+    std::string index = "[" + std::to_string(i) + "]";
+    uniforms->matrices[i] = glGetUniformLocation(shader.ID, ("shadowMatrices" + index).c_str());
+    uniforms->splits[i] = glGetUniformLocation(shader.ID, ("shadowSplits" + index).c_str());
+    uniforms->texelSizes[i] = glGetUniformLocation(shader.ID, ("shadowTexelSizes" + index).c_str());
+  }
+  return *uniforms;
+}
+
+void CascadedShadowMap::Apply(Shader& shader) const {
+  glActiveTexture(GL_TEXTURE0 + SHADOW_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+  glActiveTexture(GL_TEXTURE0);
+  Profiler::Get().CountStateChange();
+
+  // the sampler points at its own unit even without shadows, it must never share one with a 2D sampler
+  const ShaderUniforms& uniforms = uniformsOf(shader);
+  glUniform1i(uniforms.shadowMap, SHADOW_TEXTURE_UNIT);
+  glUniform1i(uniforms.cascadeCount, enabled ? settings.cascadeCount : 0);
+  if (!enabled)
+    return;
+
+  glUniform1f(uniforms.texel, 1.0f / textureResolution);
+  for (int i = 0; i < settings.cascadeCount; i++) {
+    glUniformMatrix4fv(uniforms.matrices[i], 1, GL_FALSE, &cascades[i].matrix[0][0]);
+    glUniform1f(uniforms.splits[i], cascades[i].splitFar);
+    glUniform1f(uniforms.texelSizes[i], cascades[i].texelSize);
+  }
+}
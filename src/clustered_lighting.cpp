@@ -0,0 +1,281 @@
+#include "clustered_lighting.h"
+#include "components.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "shadow_atlas.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLUSTERED_LIGHTING_SSE 1
+#include <emmintrin.h>
+#endif
+
+static_assert((CLUSTER_X * CLUSTER_Y) % 4 == 0, "clusters of a slice are tested four at a time");
+static_assert(CLUSTER_MAX_LIGHTS <= 65536, "light indices are 16 bit");
+
+static const int TILES = CLUSTER_X * CLUSTER_Y;
+
+void ClusteredLighting::Init() {
+  glGenBuffers(1, &lightBuffer);
+  glGenBuffers(1, &clusterBuffer);
+  glGenBuffers(1, &indexBuffer);
+  glGenTextures(1, &lightTexture);
+  glGenTextures(1, &clusterTexture);
+  glGenTextures(1, &indexTexture);
+
+  // the texture buffers keep pointing at their buffers while the contents are replaced every frame
+  glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(GpuLight), NULL, GL_STREAM_DRAW);
+  glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, ClusterCount * sizeof(glm::uvec2), NULL, GL_STREAM_DRAW);
+  glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusterBuffer);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(uint16_t), NULL, GL_STREAM_DRAW);
+  glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, indexBuffer);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusteredLighting::Shutdown() {
+  GLuint buffers[] = {lightBuffer, clusterBuffer, indexBuffer};
+  GLuint textures[] = {lightTexture, clusterTexture, indexTexture};
+  glDeleteBuffers(3, buffers);
+  glDeleteTextures(3, textures);
+  lightBuffer = clusterBuffer = indexBuffer = 0;
+  lightTexture = clusterTexture = indexTexture = 0;
+}
+
+void ClusteredLighting::SetProjection(const glm::mat4& matrix, float nearDistance, float farDistance) {
+  if (matrix == projection && nearDistance == nearPlane && farDistance == farPlane && !slices.empty())
+    return;
+  projection = matrix;
+  nearPlane = nearDistance;
+  farPlane = farDistance;
+
+  // a point at view depth d and NDC (x, y) sits at (x * d / P00, y * d / P11, -d)
+  float inverseX = 1.0f / matrix[0][0];
+  float inverseY = 1.0f / matrix[1][1];
+  slices.resize(CLUSTER_Z);
+  for (int z = 0; z < CLUSTER_Z; z++) {
+    SliceBounds& slice = slices[z];
+    float sliceNear = nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTER_Z);
+    float sliceFar = nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / CLUSTER_Z);
+    slice.minZ = -sliceFar;
+    slice.maxZ = -sliceNear;
+
+    for (int y = 0; y < CLUSTER_Y; y++) {
+      float ndcY0 = -1.0f + 2.0f * y / CLUSTER_Y, ndcY1 = -1.0f + 2.0f * (y + 1) / CLUSTER_Y;
+      for (int x = 0; x < CLUSTER_X; x++) {
+        float ndcX0 = -1.0f + 2.0f * x / CLUSTER_X, ndcX1 = -1.0f + 2.0f * (x + 1) / CLUSTER_X;
+        int tile = y * CLUSTER_X + x;
+        // the tile edges are lines through the eye, so the extremes sit at the near or far end
+        slice.minX[tile] = std::min(ndcX0 * sliceNear, ndcX0 * sliceFar) * inverseX;
+        slice.maxX[tile] = std::max(ndcX1 * sliceNear, ndcX1 * sliceFar) * inverseX;
+        slice.minY[tile] = std::min(ndcY0 * sliceNear, ndcY0 * sliceFar) * inverseY;
+        slice.maxY[tile] = std::max(ndcY1 * sliceNear, ndcY1 * sliceFar) * inverseY;
+      }
+    }
+  }
+}
+
+void ClusteredLighting::Update(World& world, const glm::mat4& view, const glm::mat4& matrix, float nearDistance, float farDistance,
+                               const ShadowAtlas* shadowAtlas) {
+  SetProjection(matrix, nearDistance, farDistance);
+
+  lights.clear();
+  viewSpheres.clear();
+  directionalDirections.clear();
+  directionalColors.clear();
+  world.Each<LightComponent, WorldTransformComponent>([&](Entity entity, LightComponent& light, WorldTransformComponent& transform) {
+    // lights shine down their entity's -Z
+    glm::vec3 direction = glm::normalize(-glm::vec3(transform.matrix[2]));
+    glm::vec3 color = light.color * light.intensity;
+    if (light.type == LIGHT_DIRECTIONAL) {
+      if (directionalDirections.size() < CLUSTER_MAX_DIRECTIONAL_LIGHTS) {
+        directionalDirections.push_back(direction);
+        directionalColors.push_back(color);
+      }
+      return;
+    }
+    if (lights.size() >= CLUSTER_MAX_LIGHTS)
+      return;
+
+    // point lights get cone cosines that make the spot factor 1 everywhere
+    glm::vec3 position(transform.matrix[3]);
+    float cosInner = -2.0f, cosOuter = -3.0f;
+    if (light.type == LIGHT_SPOT) {
+      cosInner = std::cos(glm::radians(light.innerAngle));
+      cosOuter = std::cos(glm::radians(std::max(light.outerAngle, light.innerAngle + 0.01f)));
+    }
+    float shadowFace = shadowAtlas ? (float)shadowAtlas->FirstFace(entity) : -1.0f;
+    glm::vec4 shadow(shadowFace, light.type == LIGHT_POINT ? 1.0f : 0.0f, 0.0f, 0.0f);
+    lights.push_back({glm::vec4(position, light.range), glm::vec4(color, cosInner), glm::vec4(direction, cosOuter), shadow});
+    viewSpheres.push_back(glm::vec4(glm::vec3(view * glm::vec4(position, 1.0f)), light.range));
+  });
+  lightCount = lights.size();
+
+  Bin(viewSpheres.data(), viewSpheres.size());
+
+  clusterData.resize(ClusterCount);
+  for (int i = 0; i < ClusterCount; i++)
+    clusterData[i] = glm::uvec2(clusterOffsets[i], clusterCounts[i]);
+
+  // orphan and refill, the driver hands out fresh storage if the GPU still reads last frame's
+  glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(1, lights.size()) * sizeof(GpuLight), NULL, GL_STREAM_DRAW);
+  if (!lights.empty())
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, lights.size() * sizeof(GpuLight), lights.data());
+
+  glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, ClusterCount * sizeof(glm::uvec2), clusterData.data(), GL_STREAM_DRAW);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(1, lightIndices.size()) * sizeof(uint16_t), NULL, GL_STREAM_DRAW);
+  if (!lightIndices.empty())
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, lightIndices.size() * sizeof(uint16_t), lightIndices.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  Profiler::Get().CountLights((unsigned int)(lights.size() + directionalDirections.size()), (unsigned int)lightIndices.size());
+}
+
+void ClusteredLighting::Bin(const glm::vec4* spheres, size_t count) {
+  clusterLights.resize((size_t)ClusterCount * CLUSTER_MAX_LIGHTS_PER_CLUSTER);
+  clusterCounts.assign(ClusterCount, 0);
+  clusterOffsets.resize(ClusterCount);
+
+  // every slice is its own job and only writes its own clusters
+  if (count > 0 && !slices.empty()) {
+    JobSystem::Get().ParallelFor(CLUSTER_Z, 1, [&](size_t begin, size_t end) {
+      for (size_t slice = begin; slice < end; slice++)
+        binSlice((int)slice, spheres, count);
+    });
+  }
+
+  // compact the fixed size lists into one index buffer
+  uint32_t total = 0;
+  for (int i = 0; i < ClusterCount; i++) {
+    clusterOffsets[i] = total;
+    total += clusterCounts[i];
+  }
+  lightIndices.resize(total);
+  for (int i = 0; i < ClusterCount; i++) {
+    if (clusterCounts[i] > 0)
+      std::memcpy(&lightIndices[clusterOffsets[i]], &clusterLights[(size_t)i * CLUSTER_MAX_LIGHTS_PER_CLUSTER],
+                  clusterCounts[i] * sizeof(uint16_t));
+  }
+}
+
+void ClusteredLighting::binSlice(int sliceIndex, const glm::vec4* spheres, size_t count) {
+  const SliceBounds& slice = slices[sliceIndex];
+  uint32_t* counts = &clusterCounts[(size_t)sliceIndex * TILES];
+  uint16_t* lists = &clusterLights[(size_t)sliceIndex * TILES * CLUSTER_MAX_LIGHTS_PER_CLUSTER];
+
+  for (size_t light = 0; light < count; light++) {
+    const glm::vec4& sphere = spheres[light];
+    float radius = sphere.w;
+
+    // the depth part of the distance is the same for the whole slice
+    float dz = std::max(std::max(slice.minZ - sphere.z, sphere.z - slice.maxZ), 0.0f);
+    float remaining = radius * radius - dz * dz;
+    if (remaining < 0.0f)
+      continue;
+
+#ifdef CLUSTERED_LIGHTING_SSE
+    __m128 centerX = _mm_set1_ps(sphere.x), centerY = _mm_set1_ps(sphere.y);
+    __m128 limit = _mm_set1_ps(remaining);
+    __m128 zero = _mm_setzero_ps();
+    for (int tile = 0; tile < TILES; tile += 4) {
+      __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(slice.minX + tile), centerX),
+                                        _mm_sub_ps(centerX, _mm_loadu_ps(slice.maxX + tile))), zero);
+      __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(slice.minY + tile), centerY),
+                                        _mm_sub_ps(centerY, _mm_loadu_ps(slice.maxY + tile))), zero);
+      int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), limit));
+      if (!mask)
+        continue;
+      for (int lane = 0; lane < 4; lane++) {
+        int cluster = tile + lane;
+        if ((mask & (1 << lane)) && counts[cluster] < CLUSTER_MAX_LIGHTS_PER_CLUSTER)
+          lists[cluster * CLUSTER_MAX_LIGHTS_PER_CLUSTER + counts[cluster]++] = (uint16_t)light;
+      }
+    }
+#else
+    for (int tile = 0; tile < TILES; tile++) {
+      float dx = std::max(std::max(slice.minX[tile] - sphere.x, sphere.x - slice.maxX[tile]), 0.0f);
+      float dy = std::max(std::max(slice.minY[tile] - sphere.y, sphere.y - slice.maxY[tile]), 0.0f);
+      if (dx * dx + dy * dy <= remaining && counts[tile] < CLUSTER_MAX_LIGHTS_PER_CLUSTER)
+        lists[tile * CLUSTER_MAX_LIGHTS_PER_CLUSTER + counts[tile]++] = (uint16_t)light;
+    }
+#endif
+  }
+}
+
+const ClusteredLighting::ShaderUniforms& ClusteredLighting::uniformsOf(const Shader& shader) const {
+  ShaderUniforms* uniforms = nullptr;
+  for (ShaderUniforms& candidate : shaderUniforms) {
+    if (candidate.shader == &shader)
+      uniforms = &candidate;
+  }
+  if (uniforms && uniforms->program == shader.ID)
+    return *uniforms;
+  if (!uniforms) {
+    shaderUniforms.emplace_back();
+    uniforms = &shaderUniforms.back();
+  }
+
+  uniforms->shader = &shader;
+  uniforms->program = shader.ID;
+  uniforms->lights = glGetUniformLocation(shader.ID, "clusterLights");
+  uniforms->ranges = glGetUniformLocation(shader.ID, "clusterRanges");
+  uniforms->indices = glGetUniformLocation(shader.ID, "clusterIndices");
+  uniforms->grid = glGetUniformLocation(shader.ID, "clusterGrid");
+  uniforms->screenSize = glGetUniformLocation(shader.ID, "clusterScreenSize");
+  uniforms->nearPlane = glGetUniformLocation(shader.ID, "clusterNear");
+  uniforms->sliceScale = glGetUniformLocation(shader.ID, "clusterSliceScale");
+  uniforms->directionalCount = glGetUniformLocation(shader.ID, "directionalLightCount");
+  for (int i = 0; i < CLUSTER_MAX_DIRECTIONAL_LIGHTS; i++) {
+    std::string index = "[" + std::to_string(i) + "]";
+    uniforms->directionalDirections[i] = glGetUniformLocation(shader.ID, ("directionalLightDirections" + index).c_str());
+    uniforms->directionalColors[i] = glGetUniformLocation(shader.ID, ("directionalLightColors" + index).c_str());
+  }
+  return *uniforms;
+}
+
+void ClusteredLighting::Apply(Shader& shader, int width, int height) const {
+  glActiveTexture(GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+  glActiveTexture(GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT + 1);
+  glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+  glActiveTexture(GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT + 2);
+  glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+  glActiveTexture(GL_TEXTURE0);
+  Profiler::Get().CountStateChange(3);
+
+  const ShaderUniforms& uniforms = uniformsOf(shader);
+  glUniform1i(uniforms.lights, CLUSTER_TEXTURE_UNIT);
+  glUniform1i(uniforms.ranges, CLUSTER_TEXTURE_UNIT + 1);
+  glUniform1i(uniforms.indices, CLUSTER_TEXTURE_UNIT + 2);
+  glUniform3i(uniforms.grid, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+  glUniform2f(uniforms.screenSize, (float)width, (float)height);
+  glUniform1f(uniforms.nearPlane, nearPlane);
+  // slice = log(depth / near) * sliceScale
+  glUniform1f(uniforms.sliceScale, CLUSTER_Z / std::log(farPlane / nearPlane));
+
+  glUniform1i(uniforms.directionalCount, (int)directionalDirections.size());
+  for (size_t i = 0; i < directionalDirections.size(); i++) {
+    glUniform3fv(uniforms.directionalDirections[i], 1, &directionalDirections[i][0]);
+    glUniform3fv(uniforms.directionalColors[i], 1, &directionalColors[i][0]);
+  }
+}
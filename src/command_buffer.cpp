@@ -0,0 +1,211 @@
+#include "command_buffer.h"
+#include "profiler.h"
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+template <typename T>
+T& CommandBuffer::push(CommandType type) {
+  static_assert(sizeof(T) % 4 == 0, "commands keep the buffer 4 byte aligned");
+  size_t offset = data.size();
+  data.resize(offset + sizeof(T));
+  T& command = *reinterpret_cast<T*>(&data[offset]);
+  command.header.type = (uint16_t)type;
+  command.header.size = (uint16_t)sizeof(T);
+  commandCount++;
+  return command;
+}
+
+void CommandBuffer::Clear() {
+  data.clear();
+  commandCount = 0;
+  rangeCounts.clear();
+  rangeOffsets.clear();
+}
+
+void CommandBuffer::SetMat4(int32_t location, const glm::mat4& value) {
+  SetMat4Command& command = push<SetMat4Command>(COMMAND_SET_MAT4);
+  command.location = location;
+  memcpy(command.value, &value[0][0], sizeof(command.value));
+}
+
+void CommandBuffer::SetFloat(int32_t location, float value) {
+  SetFloatCommand& command = push<SetFloatCommand>(COMMAND_SET_FLOAT);
+  command.location = location;
+  command.value = value;
+}
+
+void CommandBuffer::SetInt(int32_t location, int32_t value) {
+  SetIntCommand& command = push<SetIntCommand>(COMMAND_SET_INT);
+  command.location = location;
+  command.value = value;
+}
+
+void CommandBuffer::BindTexture(uint32_t unit, uint32_t texture) {
+  BindTextureCommand& command = push<BindTextureCommand>(COMMAND_BIND_TEXTURE);
+  command.unit = unit;
+  command.texture = texture;
+}
+
+void CommandBuffer::BindUniformBuffer(uint32_t binding, uint32_t buffer, uint32_t offset, uint32_t size) {
+  BindUniformBufferCommand& command = push<BindUniformBufferCommand>(COMMAND_BIND_UNIFORM_BUFFER);
+  command.binding = binding;
+  command.buffer = buffer;
+  command.offset = offset;
+  command.size = size;
+}
+
+void CommandBuffer::SetCullFace(uint32_t face) {
+  SetCullFaceCommand& command = push<SetCullFaceCommand>(COMMAND_SET_CULL_FACE);
+  command.face = face;
+}
+
+void CommandBuffer::DrawIndexed(uint32_t vertexArray, uint32_t indexCount, uint32_t instanceCount) {
+  DrawIndexedCommand& command = push<DrawIndexedCommand>(COMMAND_DRAW_INDEXED);
+  command.vertexArray = vertexArray;
+  command.indexCount = indexCount;
+  command.instanceCount = instanceCount;
+}
+
+void CommandBuffer::DrawIndexedRanges(uint32_t vertexArray) {
+  openRanges = data.size();
+  DrawIndexedRangesCommand& command = push<DrawIndexedRangesCommand>(COMMAND_DRAW_INDEXED_RANGES);
+  command.vertexArray = vertexArray;
+  command.firstRange = (uint32_t)rangeCounts.size();
+  command.rangeCount = 0;
+}
+
+void CommandBuffer::AddRange(uint32_t firstIndex, uint32_t indexCount) {
+  DrawIndexedRangesCommand& command = *reinterpret_cast<DrawIndexedRangesCommand*>(&data[openRanges]);
+  uintptr_t offset = firstIndex * sizeof(uint32_t);
+  if (command.rangeCount > 0 && (uintptr_t)rangeOffsets.back() + rangeCounts.back() * sizeof(uint32_t) == offset) {
+    rangeCounts.back() += (int32_t)indexCount;
+    return;
+  }
+  rangeCounts.push_back((int32_t)indexCount);
+  rangeOffsets.push_back((const void*)offset);
+  command.rangeCount++;
+}
+
+void CommandBuffer::Replay(const std::vector<CommandBuffer>& buffers) {
+  // what the previous command left bound, unknown until the first bind
+  const uint32_t unknown = 0xFFFFFFFF;
+  uint32_t vertexArray = unknown;
+  uint32_t activeUnit = unknown;
+  uint32_t cullFace = unknown;
+  uint32_t textures[COMMAND_TEXTURE_UNITS];
+  for (int i = 0; i < COMMAND_TEXTURE_UNITS; i++)
+    textures[i] = unknown;
+  uint32_t uniformBuffers[COMMAND_UNIFORM_BINDINGS];
+  uint32_t uniformOffsets[COMMAND_UNIFORM_BINDINGS];
+  for (int i = 0; i < COMMAND_UNIFORM_BINDINGS; i++)
+    uniformBuffers[i] = uniformOffsets[i] = unknown;
+
+  unsigned int stateChanges = 0;
+  for (const CommandBuffer& buffer : buffers) {
+    const uint8_t* cursor = buffer.data.data();
+    const uint8_t* end = cursor + buffer.data.size();
+    while (cursor < end) {
+      const CommandHeader* header = reinterpret_cast<const CommandHeader*>(cursor);
+      switch (header->type) {
+        case COMMAND_SET_MAT4: {
+          const SetMat4Command* command = reinterpret_cast<const SetMat4Command*>(cursor);
+          glUniformMatrix4fv(command->location, 1, GL_FALSE, command->value);
+          break;
+        }
+        case COMMAND_SET_FLOAT: {
+          const SetFloatCommand* command = reinterpret_cast<const SetFloatCommand*>(cursor);
+          glUniform1f(command->location, command->value);
+          break;
+        }
+        case COMMAND_SET_INT: {
+          const SetIntCommand* command = reinterpret_cast<const SetIntCommand*>(cursor);
+          glUniform1i(command->location, command->value);
+          break;
+        }
+        case COMMAND_BIND_TEXTURE: {
+          const BindTextureCommand* command = reinterpret_cast<const BindTextureCommand*>(cursor);
+          bool tracked = command->unit < COMMAND_TEXTURE_UNITS;
+          if (tracked && textures[command->unit] == command->texture)
+            break;
+          if (activeUnit != command->unit) {
+            glActiveTexture(GL_TEXTURE0 + command->unit);
+            activeUnit = command->unit;
+          }
+          glBindTexture(GL_TEXTURE_2D, command->texture);
+          if (tracked)
+            textures[command->unit] = command->texture;
+          stateChanges++;
+          break;
+        }
+        case COMMAND_BIND_UNIFORM_BUFFER: {
+          const BindUniformBufferCommand* command = reinterpret_cast<const BindUniformBufferCommand*>(cursor);
+          bool tracked = command->binding < COMMAND_UNIFORM_BINDINGS;
+          if (tracked && uniformBuffers[command->binding] == command->buffer && uniformOffsets[command->binding] == command->offset)
+            break;
+          glBindBufferRange(GL_UNIFORM_BUFFER, command->binding, command->buffer, command->offset, command->size);
+          if (tracked) {
+            uniformBuffers[command->binding] = command->buffer;
+            uniformOffsets[command->binding] = command->offset;
+          }
+          stateChanges++;
+          break;
+        }
+        case COMMAND_SET_CULL_FACE: {
+          const SetCullFaceCommand* command = reinterpret_cast<const SetCullFaceCommand*>(cursor);
+          if (cullFace == command->face)
+            break;
+          if (command->face == 0)
+            glDisable(GL_CULL_FACE);
+          else {
+            if (cullFace == 0 || cullFace == unknown)
+              glEnable(GL_CULL_FACE);
+            glCullFace(command->face);
+          }
+          cullFace = command->face;
+          stateChanges++;
+          break;
+        }
+        case COMMAND_DRAW_INDEXED: {
+          const DrawIndexedCommand* command = reinterpret_cast<const DrawIndexedCommand*>(cursor);
+          if (vertexArray != command->vertexArray) {
+            glBindVertexArray(command->vertexArray);
+            vertexArray = command->vertexArray;
+            stateChanges++;
+          }
+          if (command->instanceCount == 1)
+            glDrawElements(GL_TRIANGLES, command->indexCount, GL_UNSIGNED_INT, 0);
+          else
+            glDrawElementsInstanced(GL_TRIANGLES, command->indexCount, GL_UNSIGNED_INT, 0, command->instanceCount);
+          Profiler::Get().CountDraw(command->indexCount / 3 * (unsigned long long)command->instanceCount);
+          break;
+        }
+        case COMMAND_DRAW_INDEXED_RANGES: {
+          const DrawIndexedRangesCommand* command = reinterpret_cast<const DrawIndexedRangesCommand*>(cursor);
+          if (command->rangeCount == 0)
+            break;
+          if (vertexArray != command->vertexArray) {
+            glBindVertexArray(command->vertexArray);
+            vertexArray = command->vertexArray;
+            stateChanges++;
+          }
+          const int32_t* counts = &buffer.rangeCounts[command->firstRange];
+          glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, &buffer.rangeOffsets[command->firstRange], command->rangeCount);
+          unsigned long long indices = 0;
+          for (uint32_t i = 0; i < command->rangeCount; i++)
+            indices += counts[i];
+          Profiler::Get().CountDraw(indices / 3);
+          break;
+        }
+      }
+      cursor += header->size;
+    }
+  }
+
+  glBindVertexArray(0);
+  glActiveTexture(GL_TEXTURE0);
+  if (cullFace != 0 && cullFace != unknown)
+    glDisable(GL_CULL_FACE);
+  Profiler::Get().CountStateChange(stateChanges);
+}
@@ -0,0 +1,208 @@
+#include "ecs.h"
+
+#include <iostream>
+#include <stdexcept>
+
+static std::vector<size_t>& componentSizes() {
+  static std::vector<size_t> sizes;
+  return sizes;
+}
+
+uint32_t ComponentRegistry::Register(size_t size) {
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::vector<size_t>& sizes = componentSizes();
+  if (sizes.size() >= ECS_MAX_COMPONENTS)
+    throw std::runtime_error("ERROR::ECS::Too many component types, raise ECS_MAX_COMPONENTS");
+  sizes.push_back(size);
+  return (uint32_t)(sizes.size() - 1);
+}
+
+size_t ComponentRegistry::Size(uint32_t id) {
+  return componentSizes()[id];
+}
+
+Archetype::Archetype(ComponentMask mask) : mask(mask) {
+  for (int i = 0; i < ECS_MAX_COMPONENTS; i++)
+    columnIndex[i] = -1;
+
+  for (uint32_t id = 0; id < ECS_MAX_COMPONENTS; id++) {
+    if (mask & (ComponentMask(1) << id)) {
+      columnIndex[id] = (int)componentIds.size();
+      componentIds.push_back(id);
+      componentSizes.push_back(ComponentRegistry::Size(id));
+    }
+  }
+  columns.resize(componentIds.size());
+}
+
+uint32_t Archetype::Push(Entity entity) {
+  uint32_t row = (uint32_t)entities.size();
+  entities.push_back(entity);
+  for (size_t c = 0; c < columns.size(); c++)
+    columns[c].resize(columns[c].size() + componentSizes[c]);
+  return row;
+}
+
+Entity Archetype::SwapRemove(uint32_t row) {
+  uint32_t last = (uint32_t)entities.size() - 1;
+  Entity moved = NullEntity;
+
+  if (row != last) {
+    for (size_t c = 0; c < columns.size(); c++) {
+      size_t size = componentSizes[c];
+      std::memcpy(columns[c].data() + row * size, columns[c].data() + last * size, size);
+    }
+    entities[row] = entities[last];
+    moved = entities[row];
+  }
+
+  entities.pop_back();
+  for (size_t c = 0; c < columns.size(); c++)
+    columns[c].resize(columns[c].size() - componentSizes[c]);
+  return moved;
+}
+
+void Archetype::Reserve(size_t count) {
+  entities.reserve(count);
+  for (size_t c = 0; c < columns.size(); c++)
+    columns[c].reserve(count * componentSizes[c]);
+}
+
+World::World() {
+  // the empty archetype holds entities without components
+  getArchetype(0);
+}
+
+World::~World() = default;
+
+Entity World::allocateEntity() {
+  uint32_t index;
+  if (!freeIndices.empty()) {
+    index = freeIndices.back();
+    freeIndices.pop_back();
+  }
+  else {
+    index = (uint32_t)records.size();
+    records.push_back({nullptr, 0, 0});
+  }
+  aliveCount++;
+  return {index, records[index].generation};
+}
+
+Entity World::Create() {
+  Archetype* archetype = getArchetype(0);
+  Entity entity = allocateEntity();
+  records[entity.index].archetype = archetype;
+  records[entity.index].row = archetype->Push(entity);
+  return entity;
+}
+
+bool World::IsAlive(Entity entity) const {
+  return entity.index < records.size() && records[entity.index].generation == entity.generation &&
+         records[entity.index].archetype != nullptr;
+}
+
+void World::Destroy(Entity entity) {
+  if (!IsAlive(entity))
+    return;
+
+  EntityRecord& record = records[entity.index];
+  Entity moved = record.archetype->SwapRemove(record.row);
+  if (moved != NullEntity)
+    records[moved.index].row = record.row;
+
+  record.archetype = nullptr;
+  record.generation++;
+  freeIndices.push_back(entity.index);
+  aliveCount--;
+}
+
+Archetype* World::getArchetype(ComponentMask mask) {
+  std::unordered_map<ComponentMask, Archetype*>::iterator it = archetypeByMask.find(mask);
+  if (it != archetypeByMask.end())
+    return it->second;
+
+  archetypes.push_back(std::unique_ptr<Archetype>(new Archetype(mask)));
+  Archetype* archetype = archetypes.back().get();
+  archetypeByMask[mask] = archetype;
+  return archetype;
+}
+
+Archetype* World::nextArchetype(Archetype* from, uint32_t componentId, bool add) {
+  std::unordered_map<uint32_t, Archetype*>& edges = add ? from->addEdges : from->removeEdges;
+  std::unordered_map<uint32_t, Archetype*>::iterator it = edges.find(componentId);
+  if (it != edges.end())
+    return it->second;
+
+  ComponentMask bit = ComponentMask(1) << componentId;
+  Archetype* to = getArchetype(add ? (from->mask | bit) : (from->mask & ~bit));
+  edges[componentId] = to;
+  return to;
+}
+
+void World::moveEntity(Entity entity, Archetype* to) {
+  EntityRecord& record = records[entity.index];
+  Archetype* from = record.archetype;
+  uint32_t fromRow = record.row;
+  uint32_t toRow = to->Push(entity);
+
+  // copy every component both archetypes share, new ones stay zeroed
+  for (uint32_t id : to->componentIds) {
+    if (from->columnIndex[id] >= 0)
+      std::memcpy(to->ComponentData(id, toRow), from->ComponentData(id, fromRow), ComponentRegistry::Size(id));
+  }
+
+  Entity moved = from->SwapRemove(fromRow);
+  if (moved != NullEntity)
+    records[moved.index].row = fromRow;
+
+  record.archetype = to;
+  record.row = toRow;
+}
+
+const std::vector<Archetype*>& World::match(ComponentMask mask) {
+  std::lock_guard<std::mutex> lock(queryMutex);
+
+  // archetypes are never removed, so only the ones created since the last query need checking
+  QueryCache& query = queries[mask];
+  for (; query.archetypesSeen < archetypes.size(); query.archetypesSeen++) {
+    Archetype* archetype = archetypes[query.archetypesSeen].get();
+    if ((archetype->mask & mask) == mask)
+      query.archetypes.push_back(archetype);
+  }
+  return query.archetypes;
+}
+
+void World::AddSystem(const char* name, ComponentMask reads, ComponentMask writes, std::function<void(World&, float)> fn) {
+  systems.push_back({name, reads, writes, fn});
+}
+
+void World::RunSystems(float deltaTime) {
+  size_t stageBegin = 0;
+  while (stageBegin < systems.size()) {
+    // grow the stage while the next system doesn't conflict with anything already in it
+    ComponentMask stageReads = systems[stageBegin].reads;
+    ComponentMask stageWrites = systems[stageBegin].writes;
+    size_t stageEnd = stageBegin + 1;
+    for (; stageEnd < systems.size(); stageEnd++) {
+      const System& system = systems[stageEnd];
+      if ((system.writes & (stageReads | stageWrites)) || (system.reads & stageWrites))
+        break;
+      stageReads |= system.reads;
+      stageWrites |= system.writes;
+    }
+
+    if (stageEnd - stageBegin == 1) {
+      systems[stageBegin].fn(*this, deltaTime);
+    }
+    else {
+      JobSystem::Get().ParallelFor(stageEnd - stageBegin, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+          systems[stageBegin + i].fn(*this, deltaTime);
+      });
+    }
+    stageBegin = stageEnd;
+  }
+}
@@ -0,0 +1,72 @@
+#include "file_watcher.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::~FileWatcher() {
+  Shutdown();
+}
+
+bool FileWatcher::Init(const std::string& watchedDirectory) {
+  Shutdown();
+  directory = watchedDirectory;
+#ifdef __linux__
+  descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (descriptor < 0) {
+    std::cout << "ERROR::FILE_WATCHER::inotify_init1 failed: " << strerror(errno) << std::endl;
+    return false;
+  }
+  watch = inotify_add_watch(descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (watch < 0) {
+    std::cout << "ERROR::FILE_WATCHER::Can't watch " << directory << ": " << strerror(errno) << std::endl;
+    Shutdown();
+    return false;
+  }
+  return true;
+#else
+  std::cout << "File watching is only implemented with inotify, " << directory << " is not watched" << std::endl;
+  return false;
+#endif
+}
+
+void FileWatcher::Shutdown() {
+#ifdef __linux__
+  if (descriptor >= 0)
+    close(descriptor);
+#endif
+  descriptor = -1;
+  watch = -1;
+}
+
+bool FileWatcher::Poll(std::vector<std::string>& changed) {
+  changed.clear();
+#ifdef __linux__
+  if (descriptor < 0)
+    return false;
+
+  // events are variable length, the buffer is aligned for the struct they start with
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    ssize_t length = read(descriptor, buffer, sizeof(buffer));
+    if (length <= 0)
+      break;
+    for (char* cursor = buffer; cursor < buffer + length;) {
+      const inotify_event* event = reinterpret_cast<const inotify_event*>(cursor);
+      if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+        std::string path = directory + "/" + event->name;
+        if (std::find(changed.begin(), changed.end(), path) == changed.end())
+          changed.push_back(path);
+      }
+      cursor += sizeof(inotify_event) + event->len;
+    }
+  }
+#endif
+  return !changed.empty();
+}
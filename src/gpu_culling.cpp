@@ -0,0 +1,720 @@
+#include "gpu_culling.h"
+#include "components.h"
+#include "material.h"
+#include "profiler.h"
+#include "program_cache.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+
+namespace {
+
+struct StageSource {
+  GLenum type;
+  std::string source;
+  const char* name;
+};
+
+GLuint compileStage(const StageSource& stage) {
+  const char* code = stage.source.c_str();
+  GLuint shader = glCreateShader(stage.type);
+  glShaderSource(shader, 1, &code, NULL);
+  glCompileShader(shader);
+
+  int success;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+  if (!success) {
+    char infoLog[1024];
+    glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+    std::cout << "ERROR::GPU_CULLING::" << stage.name << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+// builds a program from its stages, or loads it from the program cache. Varyings are captured interleaved
+// if given.
+GLuint buildProgram(const std::vector<StageSource>& sources, const char* const* varyings = nullptr, int varyingCount = 0) {
+  std::vector<std::string> keyParts;
+  for (const StageSource& source : sources)
+    keyParts.push_back(std::to_string(source.type) + "\n" + source.source);
+  for (int i = 0; i < varyingCount; i++)
+    keyParts.push_back(varyings[i]);
+  ProgramCache& cache = ProgramCache::Get();
+  uint64_t cacheKey = cache.Key(keyParts);
+  GLuint program = cache.Load(cacheKey);
+  if (program != 0)
+    return program;
+
+  std::vector<GLuint> stages;
+  for (const StageSource& source : sources)
+    stages.push_back(compileStage(source));
+  for (GLuint stage : stages) {
+    if (stage == 0) {
+      for (GLuint other : stages)
+        glDeleteShader(other);
+      return 0;
+    }
+  }
+
+  program = glCreateProgram();
+  for (GLuint stage : stages)
+    glAttachShader(program, stage);
+  if (varyingCount > 0)
+    glTransformFeedbackVaryings(program, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+  cache.PrepareLink(program);
+  glLinkProgram(program);
+  for (GLuint stage : stages)
+    glDeleteShader(stage);
+
+  int success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    char infoLog[1024];
+    glGetProgramInfoLog(program, sizeof(infoLog), NULL, infoLog);
+    std::cout << "ERROR::GPU_CULLING::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    glDeleteProgram(program);
+    return 0;
+  }
+  cache.Store(cacheKey, program);
+  return program;
+}
+
+} // namespace
+
+bool GpuCuller::Init() {
+  if (initialized)
+    return true;
+
+  hizProgram = buildProgram({{GL_VERTEX_SHADER, Shader::Preprocess("resources/shaders/hizReduce.vs"), "HIZ_VERTEX"},
+                             {GL_FRAGMENT_SHADER, Shader::Preprocess("resources/shaders/hizReduce.fs"), "HIZ_FRAGMENT"}});
+
+  // the compute path needs GL 4.3, everything else runs the transform feedback shaders
+  useCompute = GLAD_GL_VERSION_4_3 != 0;
+  if (useCompute) {
+    cullProgram = buildProgram({{GL_COMPUTE_SHADER, Shader::Preprocess("resources/shaders/cullInstances.comp"), "CULL_COMPUTE"}});
+    clusterProgram = buildProgram({{GL_COMPUTE_SHADER, Shader::Preprocess("resources/shaders/cullClusters.comp"), "CLUSTER_COMPUTE"}});
+    if (clusterProgram == 0)
+      std::cout << "WARNING::GPU_CULLING::Meshlet culling failed to build, meshes are drawn whole" << std::endl;
+    useDrawCount = GLAD_GL_VERSION_4_6 != 0;
+  }
+  else {
+    static const char* const varyings[] = {"outModel0", "outModel1", "outModel2", "outModel3"};
+    cullProgram = buildProgram({{GL_VERTEX_SHADER, Shader::Preprocess("resources/shaders/cullInstances.vs"), "CULL_VERTEX"},
+                                {GL_GEOMETRY_SHADER, Shader::Preprocess("resources/shaders/cullInstances.gs"), "CULL_GEOMETRY"}},
+                               varyings, 4);
+  }
+
+  if (hizProgram == 0 || cullProgram == 0) {
+    std::cout << "ERROR::GPU_CULLING::Shaders failed to build, GPU culling is disabled" << std::endl;
+    Shutdown();
+    return false;
+  }
+
+  cullUniforms = findCullUniforms(cullProgram);
+  instanceCountUniform = glGetUniformLocation(cullProgram, "instanceCount");
+  hizSourceUniform = glGetUniformLocation(hizProgram, "source");
+  hizCopyDepthUniform = glGetUniformLocation(hizProgram, "copyDepth");
+  if (clusterProgram) {
+    clusterCullUniforms = findCullUniforms(clusterProgram);
+    clusterUniforms.meshTransform = glGetUniformLocation(clusterProgram, "meshTransform");
+    clusterUniforms.visibleFirst = glGetUniformLocation(clusterProgram, "visibleFirst");
+    clusterUniforms.instanceCommand = glGetUniformLocation(clusterProgram, "instanceCommand");
+    clusterUniforms.firstMeshlet = glGetUniformLocation(clusterProgram, "firstMeshlet");
+    clusterUniforms.meshletCount = glGetUniformLocation(clusterProgram, "meshletCount");
+    clusterUniforms.firstCommand = glGetUniformLocation(clusterProgram, "firstCommand");
+    clusterUniforms.counter = glGetUniformLocation(clusterProgram, "counter");
+    clusterUniforms.cameraPosition = glGetUniformLocation(clusterProgram, "cameraPosition");
+  }
+
+  glGenVertexArrays(1, &emptyVAO);
+  std::cout << "GPU culling uses " << (useCompute ? "compute shaders" : "transform feedback") << std::endl;
+  initialized = true;
+  return true;
+}
+
+void GpuCuller::Shutdown() {
+  destroyBuffers();
+  destroyHiZ();
+  if (cullProgram)
+    glDeleteProgram(cullProgram);
+  if (clusterProgram)
+    glDeleteProgram(clusterProgram);
+  if (hizProgram)
+    glDeleteProgram(hizProgram);
+  if (emptyVAO)
+    glDeleteVertexArrays(1, &emptyVAO);
+  cullProgram = clusterProgram = hizProgram = emptyVAO = 0;
+  initialized = false;
+}
+
+void GpuCuller::destroyBuffers() {
+  GLuint buffers[] = {instanceBuffer, visibleBuffer, batchBuffer, commandBuffer, commandTemplate, meshletBuffer, clusterCommandBuffer,
+                      clusterCounterBuffer};
+  for (GLuint buffer : buffers) {
+    if (buffer)
+      glDeleteBuffers(1, &buffer);
+  }
+  for (GLuint& buffer : readbackBuffers) {
+    if (buffer)
+      glDeleteBuffers(1, &buffer);
+    buffer = 0;
+  }
+  for (GLuint& buffer : clusterReadbackBuffers) {
+    if (buffer)
+      glDeleteBuffers(1, &buffer);
+    buffer = 0;
+  }
+  if (!queries.empty())
+    glDeleteQueries((GLsizei)queries.size(), queries.data());
+  if (cullVAO)
+    glDeleteVertexArrays(1, &cullVAO);
+  if (instanceCount > 0)
+    Profiler::Get().TrackBufferMemory(-(long long)(instanceCount * (sizeof(GpuInstance) + sizeof(glm::mat4))));
+  if (!clusterDraws.empty())
+    Profiler::Get().TrackBufferMemory(-(long long)(meshletCount * sizeof(GpuMeshlet) + clusterCommandCount * sizeof(DrawCommand)));
+
+  instanceBuffer = visibleBuffer = batchBuffer = commandBuffer = commandTemplate = cullVAO = 0;
+  meshletBuffer = clusterCommandBuffer = clusterCounterBuffer = 0;
+  queries.clear();
+  batches.clear();
+  movable.clear();
+  instances.clear();
+  clusterDraws.clear();
+  instanceCount = visibleCount = commandCount = 0;
+  clusterCommandCount = meshletCount = testedClusters = visibleClusters = 0;
+  culledClusters = false;
+  frame = 0;
+}
+
+void GpuCuller::destroyHiZ() {
+  if (hizTexture)
+    glDeleteTextures(1, &hizTexture);
+  if (hizFramebuffer)
+    glDeleteFramebuffers(1, &hizFramebuffer);
+  if (hizWidth > 0)
+    Profiler::Get().TrackTextureMemory(-(long long)hizWidth * hizHeight * 4 * 4 / 3);
+
+  hizTexture = hizFramebuffer = 0;
+  hizWidth = hizHeight = hizLevels = 0;
+  hizValid = false;
+}
+
+void GpuCuller::Build(World& world, uint32_t excludeFlags) {
+  if (!initialized)
+    return;
+  destroyBuffers();
+
+  // group by model and material, every group becomes one batch of instanced draws
+  std::map<std::pair<Model*, uint32_t>, std::vector<Entity>> groups;
+  world.Each<MeshRendererComponent, WorldTransformComponent, BoundsComponent>(
+      [&](Entity entity, MeshRendererComponent& renderer, WorldTransformComponent&, BoundsComponent&) {
+        if (renderer.model && !renderer.model->meshes.empty() && !(renderer.flags & excludeFlags))
+          groups[std::make_pair(renderer.model, renderer.material)].push_back(entity);
+      });
+  if (groups.empty())
+    return;
+
+  std::vector<GpuBatch> gpuBatches;
+  std::vector<DrawCommand> commands;
+  for (const auto& group : groups) {
+    Batch batch;
+    batch.model = group.first.first;
+    batch.material = group.first.second;
+    batch.first = (uint32_t)instances.size();
+    batch.count = (uint32_t)group.second.size();
+    batch.firstCommand = (uint32_t)commands.size();
+    batch.visible = batch.count;
+    batch.mirrored = false;
+
+    uint32_t batchIndex = (uint32_t)batches.size();
+    float batchBits;
+    std::memcpy(&batchBits, &batchIndex, sizeof(float));
+    for (Entity entity : group.second) {
+      const AABB& bounds = world.Get<BoundsComponent>(entity)->world;
+      const glm::mat4& matrix = world.Get<WorldTransformComponent>(entity)->matrix;
+      if (world.Has<TransformComponent>(entity))
+        movable.push_back({entity, (uint32_t)instances.size()});
+      batch.mirrored = batch.mirrored || glm::determinant(glm::mat3(matrix)) < 0.0f;
+      instances.push_back({matrix, glm::vec4(bounds.min, batchBits), glm::vec4(bounds.max, 0.0f)});
+    }
+
+    for (const Mesh& mesh : batch.model->meshes)
+      commands.push_back({(uint32_t)mesh.indices.size(), 0, 0, 0, batch.first});
+    gpuBatches.push_back({batch.first, batch.firstCommand, (uint32_t)batch.model->meshes.size(), 0});
+    batches.push_back(batch);
+  }
+  instanceCount = instances.size();
+  commandCount = commands.size();
+  visibleCount = instanceCount;
+
+  glGenBuffers(1, &instanceBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(GpuInstance), instances.data(), GL_DYNAMIC_DRAW);
+
+  glGenBuffers(1, &visibleBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+  glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), NULL, GL_DYNAMIC_COPY);
+  Profiler::Get().TrackBufferMemory((long long)(instanceCount * (sizeof(GpuInstance) + sizeof(glm::mat4))));
+
+  if (useCompute) {
+    glGenBuffers(1, &batchBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batchBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gpuBatches.size() * sizeof(GpuBatch), gpuBatches.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &commandTemplate);
+    glBindBuffer(GL_COPY_READ_BUFFER, commandTemplate);
+    glBufferData(GL_COPY_READ_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand), NULL, GL_DYNAMIC_COPY);
+
+    glGenBuffers(GPU_CULLING_READBACK_FRAMES, readbackBuffers);
+    for (GLuint buffer : readbackBuffers) {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+      glBufferData(GL_COPY_WRITE_BUFFER, commands.size() * sizeof(DrawCommand), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    if (clusterProgram)
+      buildClusterDraws();
+  }
+  else {
+    // the instance records feed the culling vertex shader: matrix at 0-3, bounds at 4 and 5
+    glGenVertexArrays(1, &cullVAO);
+    glBindVertexArray(cullVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (int column = 0; column < 4; column++) {
+      glEnableVertexAttribArray(column);
+      glVertexAttribPointer(column, 4, GL_FLOAT, GL_FALSE, sizeof(GpuInstance), (void*)(column * sizeof(glm::vec4)));
+    }
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(GpuInstance), (void*)offsetof(GpuInstance, boundsMin));
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(GpuInstance), (void*)offsetof(GpuInstance, boundsMax));
+    glBindVertexArray(0);
+
+    queries.resize(batches.size());
+    glGenQueries((GLsizei)queries.size(), queries.data());
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  std::cout << "GPU culling: " << instanceCount << " instances in " << batches.size() << " batches ("
+            << movable.size() << " movable), " << clusterDraws.size() << " meshes culled per meshlet" << std::endl;
+}
+
+void GpuCuller::buildClusterDraws() {
+  // meshes shared between batches share their meshlets
+  std::vector<GpuMeshlet> meshlets;
+  std::map<const Mesh*, uint32_t> firstMeshlets;
+  for (size_t b = 0; b < batches.size(); b++) {
+    Batch& batch = batches[b];
+    batch.clusterDraws.assign(batch.model->meshes.size(), -1);
+    for (size_t i = 0; i < batch.model->meshes.size(); i++) {
+      const Mesh& mesh = batch.model->meshes[i];
+      size_t commands = (size_t)batch.count * mesh.meshlets.size();
+      if (mesh.meshlets.size() < MESHLET_MIN_COUNT || clusterCommandCount + commands > GPU_CULLING_MAX_CLUSTER_COMMANDS)
+        continue;
+
+      auto found = firstMeshlets.find(&mesh);
+      if (found == firstMeshlets.end()) {
+        found = firstMeshlets.emplace(&mesh, (uint32_t)meshlets.size()).first;
+        for (size_t m = 0; m < mesh.meshlets.size(); m++) {
+          // two sided meshes show their back faces, a cutoff of 1 never culls
+          const MeshletBounds& bounds = mesh.meshletBounds[m];
+          glm::vec4 cone = mesh.twoSided ? glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) : glm::vec4(bounds.coneAxis, bounds.coneCutoff);
+          meshlets.push_back({glm::vec4(bounds.center, bounds.radius), cone,
+                              mesh.meshlets[m].firstIndex, mesh.meshlets[m].triangleCount * 3, {0, 0}});
+        }
+      }
+
+      batch.clusterDraws[i] = (int)clusterDraws.size();
+      ClusterDraw draw;
+      draw.batch = (uint32_t)b;
+      draw.mesh = (uint32_t)i;
+      draw.firstMeshlet = found->second;
+      draw.meshletCount = (uint32_t)mesh.meshlets.size();
+      draw.firstCommand = (uint32_t)clusterCommandCount;
+      draw.visible = (unsigned int)commands;
+      draw.triangles = (unsigned long long)batch.count * (mesh.indices.size() / 3);
+      clusterDraws.push_back(draw);
+      clusterCommandCount += commands;
+    }
+  }
+  if (clusterDraws.empty())
+    return;
+  meshletCount = meshlets.size();
+
+  glGenBuffers(1, &meshletBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshletBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.size() * sizeof(GpuMeshlet), meshlets.data(), GL_STATIC_DRAW);
+
+  glGenBuffers(1, &clusterCommandBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterCommandBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, clusterCommandCount * sizeof(DrawCommand), NULL, GL_DYNAMIC_COPY);
+
+  glGenBuffers(1, &clusterCounterBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterCounterBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, clusterDraws.size() * 2 * sizeof(uint32_t), NULL, GL_DYNAMIC_COPY);
+
+  glGenBuffers(GPU_CULLING_READBACK_FRAMES, clusterReadbackBuffers);
+  for (GLuint buffer : clusterReadbackBuffers) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, clusterDraws.size() * 2 * sizeof(uint32_t), NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  Profiler::Get().TrackBufferMemory((long long)(meshletCount * sizeof(GpuMeshlet) + clusterCommandCount * sizeof(DrawCommand)));
+}
+
+void GpuCuller::Update(World& world) {
+  if (movable.empty())
+    return;
+
+  // patch the copy, then upload the slots from the first movable instance to the last in one go. The static
+  // ones in between go up unchanged.
+  uint32_t first = UINT32_MAX;
+  uint32_t last = 0;
+  for (const MovableInstance& instance : movable) {
+    const WorldTransformComponent* transform = world.Get<WorldTransformComponent>(instance.entity);
+    const BoundsComponent* bounds = world.Get<BoundsComponent>(instance.entity);
+    if (!transform || !bounds)
+      continue;
+
+    // the batch index bits in boundsMin.w stay as they are
+    GpuInstance& record = instances[instance.slot];
+    record.model = transform->matrix;
+    if (glm::determinant(glm::mat3(transform->matrix)) < 0.0f) {
+      uint32_t batchIndex;
+      std::memcpy(&batchIndex, &record.boundsMin.w, sizeof(uint32_t));
+      batches[batchIndex].mirrored = true;
+    }
+    std::memcpy(&record.boundsMin, &bounds->world.min, sizeof(glm::vec3));
+    std::memcpy(&record.boundsMax, &bounds->world.max, sizeof(glm::vec3));
+    first = std::min(first, instance.slot);
+    last = std::max(last, instance.slot);
+  }
+  if (first > last)
+    return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(GpuInstance), (last - first + 1) * sizeof(GpuInstance), &instances[first]);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GpuCuller::CullUniforms GpuCuller::findCullUniforms(GLuint program) {
+  CullUniforms uniforms;
+  uniforms.viewProjection = glGetUniformLocation(program, "viewProjection");
+  uniforms.hizViewProjection = glGetUniformLocation(program, "hizViewProjection");
+  uniforms.hizSize = glGetUniformLocation(program, "hizSize");
+  uniforms.hizLevels = glGetUniformLocation(program, "hizLevels");
+  uniforms.hizValid = glGetUniformLocation(program, "hizValid");
+  uniforms.hiz = glGetUniformLocation(program, "hiz");
+  return uniforms;
+}
+
+void GpuCuller::setCullUniforms(GLuint program, const CullUniforms& uniforms, const glm::mat4& viewProjection) {
+  glUseProgram(program);
+  glUniformMatrix4fv(uniforms.viewProjection, 1, GL_FALSE, glm::value_ptr(viewProjection));
+  glUniformMatrix4fv(uniforms.hizViewProjection, 1, GL_FALSE, glm::value_ptr(hizViewProjection));
+  glUniform2i(uniforms.hizSize, hizWidth, hizHeight);
+  glUniform1i(uniforms.hizLevels, hizLevels);
+  glUniform1i(uniforms.hizValid, hizValid ? 1 : 0);
+  glUniform1i(uniforms.hiz, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hizValid ? hizTexture : 0);
+  Profiler::Get().CountStateChange(2);
+}
+
+void GpuCuller::Cull(const glm::mat4& viewProjection, const glm::vec3& cameraPosition) {
+  if (!Ready())
+    return;
+  setCullUniforms(cullProgram, cullUniforms, viewProjection);
+
+  if (useCompute) {
+    // instance counts start at zero, every survivor adds itself to the commands of its batch
+    glBindBuffer(GL_COPY_READ_BUFFER, commandTemplate);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commandCount * sizeof(DrawCommand));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, batchBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibleBuffer);
+    glUniform1ui(instanceCountUniform, (GLuint)instanceCount);
+    glDispatchCompute((GLuint)((instanceCount + 63) / 64), 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT |
+                    GL_SHADER_STORAGE_BARRIER_BIT);
+
+    culledClusters = clusterCulling && !clusterDraws.empty();
+    if (culledClusters)
+      cullClusters(viewProjection, cameraPosition);
+
+    // keep a copy of the counts to read once the GPU is surely done with them
+    glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[frame % GPU_CULLING_READBACK_FRAMES]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commandCount * sizeof(DrawCommand));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  else {
+    // one transform feedback range and query per batch, so the survivors of each batch stay together
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(cullVAO);
+    for (size_t b = 0; b < batches.size(); b++) {
+      const Batch& batch = batches[b];
+      glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, visibleBuffer, batch.first * sizeof(glm::mat4),
+                        batch.count * sizeof(glm::mat4));
+      glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, queries[b]);
+      glBeginTransformFeedback(GL_POINTS);
+      glDrawArrays(GL_POINTS, batch.first, batch.count);
+      glEndTransformFeedback();
+      glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+    }
+    glBindVertexArray(0);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+  }
+
+  readVisibleCounts();
+  frame++;
+}
+
+void GpuCuller::cullClusters(const glm::mat4& viewProjection, const glm::vec3& cameraPosition) {
+  // every mesh appends from its first command on. Without a GPU draw count the commands past the last one
+  // written are drawn as well, zeroed they draw nothing.
+  if (!useDrawCount) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterCommandBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterCounterBuffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  setCullUniforms(clusterProgram, clusterCullUniforms, viewProjection);
+  glUniform3fv(clusterUniforms.cameraPosition, 1, glm::value_ptr(cameraPosition));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, commandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, meshletBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, clusterCommandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, clusterCounterBuffer);
+
+  for (size_t d = 0; d < clusterDraws.size(); d++) {
+    const ClusterDraw& draw = clusterDraws[d];
+    const Batch& batch = batches[draw.batch];
+    Model& model = *batch.model;
+    model.nodes.Update();
+    glm::mat4 transform = draw.mesh < model.meshNodes.size() ? model.nodes.GetWorld(model.meshNodes[draw.mesh]) : glm::mat4(1.0f);
+    glUniformMatrix4fv(clusterUniforms.meshTransform, 1, GL_FALSE, glm::value_ptr(transform));
+    glUniform1ui(clusterUniforms.visibleFirst, batch.first);
+    glUniform1ui(clusterUniforms.instanceCommand, batch.firstCommand);
+    glUniform1ui(clusterUniforms.firstMeshlet, draw.firstMeshlet);
+    glUniform1ui(clusterUniforms.meshletCount, draw.meshletCount);
+    glUniform1ui(clusterUniforms.firstCommand, draw.firstCommand);
+    glUniform1ui(clusterUniforms.counter, (GLuint)d);
+    glDispatchCompute((GLuint)(((size_t)batch.count * draw.meshletCount + 63) / 64), 1, 1);
+  }
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, clusterCounterBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, clusterReadbackBuffers[frame % GPU_CULLING_READBACK_FRAMES]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, clusterDraws.size() * 2 * sizeof(uint32_t));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GpuCuller::readVisibleCounts() {
+  visibleCount = 0;
+  if (useCompute) {
+    // the oldest copy in the ring, written GPU_CULLING_READBACK_FRAMES - 1 frames ago
+    if (frame + 1 < GPU_CULLING_READBACK_FRAMES) {
+      for (const Batch& batch : batches)
+        visibleCount += batch.visible;
+      return;
+    }
+    readbackCommands.resize(commandCount);
+    glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffers[(frame + 1) % GPU_CULLING_READBACK_FRAMES]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, commandCount * sizeof(DrawCommand), readbackCommands.data());
+    for (Batch& batch : batches) {
+      batch.visible = readbackCommands[batch.firstCommand].instanceCount;
+      visibleCount += batch.visible;
+    }
+
+    // the meshlets tested are the survivors' meshlets, the drawn ones come from the counters of the same frame
+    testedClusters = visibleClusters = 0;
+    if (culledClusters) {
+      readbackCounters.resize(clusterDraws.size() * 2);
+      glBindBuffer(GL_COPY_READ_BUFFER, clusterReadbackBuffers[(frame + 1) % GPU_CULLING_READBACK_FRAMES]);
+      glGetBufferSubData(GL_COPY_READ_BUFFER, 0, readbackCounters.size() * sizeof(uint32_t), readbackCounters.data());
+      for (size_t d = 0; d < clusterDraws.size(); d++) {
+        ClusterDraw& draw = clusterDraws[d];
+        draw.visible = readbackCounters[d * 2];
+        draw.triangles = readbackCounters[d * 2 + 1];
+        testedClusters += (size_t)batches[draw.batch].visible * draw.meshletCount;
+        visibleClusters += draw.visible;
+      }
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  }
+  else {
+    // waits for the culling draws issued just before, the price of not having indirect draws
+    for (size_t b = 0; b < batches.size(); b++) {
+      GLuint written = 0;
+      glGetQueryObjectuiv(queries[b], GL_QUERY_RESULT, &written);
+      batches[b].visible = written;
+      visibleCount += written;
+    }
+  }
+}
+
+const GpuCuller::ShaderUniforms& GpuCuller::uniformsOf(const Shader& shader) {
+  ShaderUniforms* uniforms = nullptr;
+  for (ShaderUniforms& candidate : shaderUniforms) {
+    if (candidate.shader == &shader)
+      uniforms = &candidate;
+  }
+  if (uniforms && uniforms->program == shader.ID)
+    return *uniforms;
+  if (!uniforms) {
+    shaderUniforms.emplace_back();
+    uniforms = &shaderUniforms.back();
+  }
+
+  uniforms->shader = &shader;
+  uniforms->program = shader.ID;
+  uniforms->meshTransform = glGetUniformLocation(shader.ID, "meshTransform");
+  return *uniforms;
+}
+
+void GpuCuller::Draw(Shader& shader) {
+  if (!Ready())
+    return;
+
+  GLint meshTransform = uniformsOf(shader).meshTransform;
+
+  if (useCompute)
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  if (culledClusters && useDrawCount)
+    glBindBuffer(GL_PARAMETER_BUFFER, clusterCounterBuffer);
+
+  for (const Batch& batch : batches) {
+    // a batch that was empty on the transform feedback path really is, the compute counts are only a few frames old
+    if (!useCompute && batch.visible == 0)
+      continue;
+
+    Model& model = *batch.model;
+    model.nodes.Update();
+    for (size_t i = 0; i < model.meshes.size(); i++) {
+      Mesh& mesh = model.meshes[i];
+      MaterialLibrary::Get().Bind(batch.material != MATERIAL_NONE ? batch.material : mesh.material);
+      // a batch can't cull front faces for some instances and back faces for others
+      if (batch.mirrored)
+        glDisable(GL_CULL_FACE);
+      else
+        mesh.SetFaceCulling(false);
+      glm::mat4 transform = i < model.meshNodes.size() ? model.nodes.GetWorld(model.meshNodes[i]) : glm::mat4(1.0f);
+      glUniformMatrix4fv(meshTransform, 1, GL_FALSE, glm::value_ptr(transform));
+      int cluster = culledClusters && i < batch.clusterDraws.size() ? batch.clusterDraws[i] : -1;
+      if (cluster >= 0) {
+        // one command per surviving meshlet, each places itself with the survivor it belongs to
+        const ClusterDraw& draw = clusterDraws[cluster];
+        unsigned int maxDraws = batch.count * draw.meshletCount;
+        mesh.SetInstanceBuffer(visibleBuffer, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, clusterCommandBuffer);
+        if (useDrawCount)
+          mesh.MultiDrawIndirectCount(draw.firstCommand * sizeof(DrawCommand), cluster * 2 * sizeof(uint32_t), maxDraws, draw.triangles);
+        else
+          mesh.MultiDrawIndirect(draw.firstCommand * sizeof(DrawCommand), maxDraws, draw.triangles);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+      }
+      else if (useCompute) {
+        // baseInstance of the command moves the instance attributes to the batch
+        mesh.SetInstanceBuffer(visibleBuffer, 0);
+        mesh.DrawIndirect((batch.firstCommand + i) * sizeof(DrawCommand), batch.visible);
+      }
+      else {
+        mesh.SetInstanceBuffer(visibleBuffer, batch.first * sizeof(glm::mat4));
+        mesh.DrawInstanced(batch.visible);
+      }
+    }
+  }
+
+  if (useCompute)
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  if (culledClusters && useDrawCount)
+    glBindBuffer(GL_PARAMETER_BUFFER, 0);
+  glDisable(GL_CULL_FACE);
+}
+
+void GpuCuller::BuildHiZ(GLuint depthTexture, int width, int height, const glm::mat4& viewProjection) {
+  if (!initialized || depthTexture == 0 || width <= 0 || height <= 0)
+    return;
+
+  if (width != hizWidth || height != hizHeight) {
+    destroyHiZ();
+    hizWidth = width;
+    hizHeight = height;
+    hizLevels = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+
+    // every level halves the previous one rounding up, so texel x of level n covers pixels x << n onwards
+    glGenTextures(1, &hizTexture);
+    glBindTexture(GL_TEXTURE_2D, hizTexture);
+    for (int level = 0, w = width, h = height; level < hizLevels; level++, w = (w + 1) / 2, h = (h + 1) / 2)
+      glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hizLevels - 1);
+    glGenFramebuffers(1, &hizFramebuffer);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    Profiler::Get().TrackTextureMemory((long long)width * height * 4 * 4 / 3);
+  }
+
+  // level 0 copies the depth, every further level keeps the farthest of the 2x2 texels below it
+  glBindFramebuffer(GL_FRAMEBUFFER, hizFramebuffer);
+  glUseProgram(hizProgram);
+  glUniform1i(hizSourceUniform, 0);
+  glBindVertexArray(emptyVAO);
+  glDisable(GL_DEPTH_TEST);
+  glActiveTexture(GL_TEXTURE0);
+
+  for (int level = 0, w = width, h = height; level < hizLevels; level++, w = (w + 1) / 2, h = (h + 1) / 2) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hizTexture, level);
+    glViewport(0, 0, w, h);
+    if (level == 0) {
+      glBindTexture(GL_TEXTURE_2D, depthTexture);
+      glUniform1i(hizCopyDepthUniform, 1);
+    }
+    else {
+      // only the level below is readable while this one is written, which avoids a feedback loop
+      glBindTexture(GL_TEXTURE_2D, hizTexture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+      glUniform1i(hizCopyDepthUniform, 0);
+    }
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    Profiler::Get().CountDraw(1);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, hizTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hizLevels - 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindVertexArray(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, width, height);
+  glEnable(GL_DEPTH_TEST);
+
+  hizViewProjection = viewProjection;
+  hizValid = true;
+}
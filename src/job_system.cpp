@@ -0,0 +1,127 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+static thread_local unsigned int t_threadIndex = 0;
+static thread_local bool t_insideJob = false;
+
+JobSystem& JobSystem::Get() {
+  static JobSystem jobSystem;
+  return jobSystem;
+}
+
+JobSystem::~JobSystem() {
+  Shutdown();
+}
+
+unsigned int JobSystem::ThreadIndex() {
+  return t_threadIndex;
+}
+
+void JobSystem::Init(unsigned int workerCount) {
+  if (running)
+    return;
+
+  if (workerCount == 0) {
+    unsigned int cores = std::thread::hardware_concurrency();
+    workerCount = cores > 1 ? cores - 1 : 0;
+  }
+
+  running = true;
+  workers.reserve(workerCount);
+  for (unsigned int i = 0; i < workerCount; i++)
+    workers.emplace_back(&JobSystem::workerLoop, this, i + 1);
+}
+
+void JobSystem::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running)
+      return;
+    running = false;
+  }
+  wake.notify_all();
+  for (std::thread& worker : workers)
+    worker.join();
+  workers.clear();
+}
+
+void JobSystem::workerLoop(unsigned int index) {
+  t_threadIndex = index;
+  unsigned long long seenGeneration = 0;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [&] { return !running || generation != seenGeneration; });
+    if (!running)
+      return;
+    seenGeneration = generation;
+
+    // the job may already be finished by the time a slow worker wakes up
+    if (!job)
+      continue;
+
+    activeWorkers++;
+    lock.unlock();
+    runBatches();
+    lock.lock();
+    activeWorkers--;
+    if (activeWorkers == 0)
+      done.notify_all();
+  }
+}
+
+void JobSystem::runBatches() {
+  bool wasInside = t_insideJob;
+  t_insideJob = true;
+
+  size_t batchCount = (jobCount + jobBatch - 1) / jobBatch;
+  while (true) {
+    size_t batch = nextBatch.fetch_add(1, std::memory_order_relaxed);
+    if (batch >= batchCount)
+      break;
+
+    size_t begin = batch * jobBatch;
+    size_t end = std::min(jobCount, begin + jobBatch);
+    (*job)(begin, end);
+
+    if (batchesLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lock(mutex);
+      done.notify_all();
+    }
+  }
+
+  t_insideJob = wasInside;
+}
+
+void JobSystem::ParallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)>& fn) {
+  if (count == 0)
+    return;
+
+  // aim for a few batches per thread so uneven work still balances
+  size_t threads = ThreadCount();
+  size_t batch = std::max<size_t>(std::max<size_t>(minBatch, 1), (count + threads * 4 - 1) / (threads * 4));
+
+  if (workers.empty() || t_insideJob || batch >= count) {
+    fn(0, count);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &fn;
+    jobCount = count;
+    jobBatch = batch;
+    nextBatch.store(0, std::memory_order_relaxed);
+    batchesLeft.store((count + batch - 1) / batch, std::memory_order_relaxed);
+    generation++;
+  }
+  wake.notify_all();
+
+  // the calling thread works on the batches too
+  runBatches();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&] { return batchesLeft.load(std::memory_order_acquire) == 0 && activeWorkers == 0; });
+  job = nullptr;
+}
@@ -12,7 +12,13 @@ namespace fs = std::filesystem;
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <map>
+#include <random>
+#include <vector>
 
 // ImGui includes
 #include "imgui.h"
@@ -25,10 +31,36 @@ namespace fs = std::filesystem;
 #include "stb_image.h"
 #include "camera.h"
 #include "model.h"
+#include "profiler.h"
+#include "job_system.h"
+#include "primitives.h"
+#include "scene.h"
+#include "scene_binary.h"
+#include "ecs.h"
+#include "components.h"
+#include "systems.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "gpu_culling.h"
+#include "clustered_lighting.h"
+#include "cascaded_shadows.h"
+#include "shadow_atlas.h"
+#include "outline.h"
+#include "render_graph.h"
+#include "command_buffer.h"
+#include "program_cache.h"
+#include "shader_variants.h"
+#include "file_watcher.h"
+#include "material.h"
+#include "animation.h"
+#include "vertex_animation.h"
+#include "morph_targets.h"
+#include "meshlets.h"
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void processInput(GLFWwindow *window);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 
 // settings
@@ -48,91 +80,149 @@ float lastY = SCR_HEIGHT / 2.0;
 bool firstMouse = true;
 float fov = 45.0f;
 
-// Model control variables
-glm::vec3 modelPosition(0.0f, 0.0f, 0.0f);
-glm::vec3 modelRotation(0.0f, 0.0f, 0.0f);
-float modelScale = 0.5f;
-glm::vec3 clearColor(0.1f, 0.1f, 0.1f);
+// cursor position as last reported to mouse_callback, and whether the cursor is captured (Tab toggles)
+double cursorX = 0.0;
+double cursorY = 0.0;
+bool mouseCaptured = true;
 
-// light pos
-// glm::vec3 lightPos(0.5f, 0.0f, 2.0f);
-glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+// object picked with the left mouse button, outlined while selected
+Entity selectedEntity = NullEntity;
+ModelHit selectedHit;
+double pickMicroseconds = 0.0;
 
-// Vertices coordinates
-GLfloat vertices[] =
-    { //     COORDINATES    /    TexCoord
-        -1.0f, 0.0f, 1.0f, 0.0f, 0.0f,
-        -1.0f, 0.0f, -1.0f, 0.0f, 1.0f,
-        1.0f, 0.0f, -1.0f, 1.0f, 1.0f,
-        1.0f, 0.0f, 1.0f, 1.0f, 0.0f};
+glm::vec3 clearColor(0.1f, 0.1f, 0.1f);
 
-// Indices for vertices order
-GLuint indices[] =
-    {
-        0, 1, 2,
-        0, 2, 3
-    };
-
-float cubeVertices[] = {
-    // positions          // texture Coords
-    -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-     0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-     0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-
-    -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-
-    0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-    0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-    0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-    0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-    0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-    0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-     0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-
-    -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
+// stats overlay, toggled with F1
+bool showStats = true;
+
+// every object in the scene is an entity, instances are spawned gradually as the scene comes in
+World world;
+size_t spawnedInstances = 0;
+size_t spawnedLights = 0;
+const size_t SPAWN_BUDGET = 65536; // instances turned into entities per frame
+
+// spatial index over every mesh renderer entity, rebuilt once the whole scene has been spawned
+DynamicBVH sceneBVH(0.1f);
+bool sceneBVHBuilt = false;
+std::vector<Entity> visibleEntities;
+
+// CPU occlusion culling of the frustum culled entities, toggled with F2
+OcclusionCuller occlusionCuller;
+bool occlusionEnabled = true;
+std::vector<AABB> occlusionBoxes;
+std::vector<uint8_t> occlusionVisible;
+
+// GPU culling against the previous frame's depth, toggled with F3. Outlined instances stay on the CPU path
+// above because the outline mask is set per draw.
+GpuCuller gpuCuller;
+bool gpuCulling = false;
+std::vector<Entity> cpuDrawnEntities;
+
+// large static meshes are culled meshlet by meshlet on whichever path draws them, toggled with F6
+bool meshletCulling = true;
+
+// point and spot lights binned into view clusters every frame, F4 adds a handful of random ones
+ClusteredLighting clusteredLighting;
+const size_t DEMO_LIGHT_BATCH = 64;
+
+// cascaded shadow maps of the first directional light, F5 toggles all shadows
+CascadedShadowMap shadowMap;
+bool shadowsEnabled = true;
+
+// point and spot light shadows, static geometry is cached and only moving objects re-render
+ShadowAtlas shadowAtlas;
+
+// the scene renders offscreen with an outline mask, one full screen pass draws the outlines
+OutlinePass outlinePass;
+
+// draws of the CPU culled entities, recorded on every thread into a few buffers each and replayed in order.
+// Uniform locations are looked up once, recording can't make GL calls. Animated instances go into their own
+// buffers, replayed with the skinning shader, which also applies their morph targets.
+struct DrawLocations
+{
+  GLint model = -1;
+  GLint outlined = -1;
+  GLint boneOffset = -1;
+  GLint morphRangeBase = -1;
+  GLint morphWeightBase = -1;
 };
 
-
-int main()
+// what the recording threads cull meshlets against, and how many they culled into each buffer
+struct MeshletCulling
+{
+  bool enabled = false;
+  Frustum frustum;
+  glm::vec3 eye;
+};
+struct MeshletCounts
+{
+  unsigned int culled = 0;
+  unsigned int tested = 0;
+};
+std::vector<MeshletCounts> meshletCounts;
+std::vector<CommandBuffer> sceneCommands;
+std::vector<CommandBuffer> skinnedCommands;
+const size_t COMMAND_BUFFERS_PER_THREAD = 4;
+DrawLocations sceneLocations;
+DrawLocations skinnedLocations;
+
+// clips of animated instances, sampled on the worker threads every frame into one bone palette buffer
+Animator animator;
+
+// crowds play their clips back from baked vertex animation textures, the CPU does nothing per instance
+CrowdRenderer crowdRenderer;
+
+// shaders edited on disk recompile while the old programs keep drawing and swap in once they have linked
+FileWatcher shaderWatcher;
+std::vector<std::string> changedShaderFiles;
+
+// the frame's passes, rebuilt every frame. Offscreen targets come from its pool and share textures once dead.
+RenderGraph renderGraph;
+
+// scene description and the GPU resources created for it. JSON scenes are streamed into `scene`,
+// compiled .scnb scenes are memory mapped and used in place.
+Scene scene;
+SceneLoader sceneLoader;
+MappedScene mappedScene;
+bool useMappedScene = false;
+bool sceneComplete = false;
+std::deque<Model> sceneModels;           // one per scene.models entry, a deque keeps Model* stable
+std::vector<uint32_t> sceneMaterials;    // MaterialLibrary index per scene.materials entry
+std::map<std::string, unsigned int> loadedTextures;
+
+template <typename Source>
+void loadSceneResources(const Source &source);
+template <typename Source>
+unsigned int loadSceneTexture(const Source &source, uint32_t path);
+template <typename Source>
+void spawnSceneLights(const Source &source);
+void spawnSceneInstances();
+void spawnDemoLights(size_t count);
+void recordInstance(CommandBuffer &commands, const DrawLocations &locations, const glm::mat4 &transform, Model *model, uint32_t material,
+                    bool outlined, int boneOffset, int morphOffset, const MeshletCulling &meshlets, MeshletCounts &counts);
+glm::mat4 cameraProjection();
+void pickEntity(GLFWwindow *window);
+
+int main(int argc, char **argv)
 {
 
   // glfw: initialize and configure
   // ------------------------------
   glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-  // glfw window creation
-  // --------------------
+  // glfw window creation, GL 4.3 enables compute shader culling and 3.3 is the minimum
+  // ----------------------------------------------------------------------------------
   GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
   if (window == NULL)
+  {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+  }
+  if (window == NULL)
   {
     std::cout << "Failed to create GLFW window" << std::endl;
     glfwTerminate();
@@ -141,6 +231,7 @@ int main()
   glfwMakeContextCurrent(window);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
   glfwSetCursorPosCallback(window, mouse_callback);
+  glfwSetMouseButtonCallback(window, mouse_button_callback);
   glfwSetScrollCallback(window, scroll_callback);
 
   // tell GLFW to capture our mouse
@@ -170,6 +261,13 @@ int main()
   ImGui_ImplGlfw_InitForOpenGL(window, true);
   ImGui_ImplOpenGL3_Init(glsl_version);
 
+  // GPU timer queries for the stats overlay
+  Profiler::Get().Init();
+
+  // worker threads for parallel engine systems
+  JobSystem::Get().Init();
+  occlusionCuller.Init();
+
   // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
   stbi_set_flip_vertically_on_load(true);
 
@@ -177,235 +275,739 @@ int main()
   // -----------------------------
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LESS);
-  glEnable(GL_STENCIL_TEST);
-  glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE); 
 
 
   // build and compile shaders
   // -------------------------
-  Shader ourShader("resources/shaders/vertexShader.vs", "resources/shaders/fragmentShader.fs");
-  Shader outlineShader("resources/shaders/vertexShader.vs", "resources/shaders/outlineShader.fs");
+  std::chrono::steady_clock::time_point shaderStart = std::chrono::steady_clock::now();
+  ProgramCache::Get().Init();
+  Shader::EnableParallelCompile((GLADloadproc)glfwGetProcAddress);
+
+  // every scene shader variant starts compiling at once, with parallel compilation the driver works on them
+  // while the other shaders are built, and only the ones the first frame draws with are waited for
+  ShaderVariants sceneShaders("resources/shaders/vertexShader.vs", "resources/shaders/fragmentShader.fs");
+  sceneShaders.Request(SHADER_SHADOWS);
+  sceneShaders.Request(SHADER_INSTANCED | SHADER_SHADOWS);
+  sceneShaders.Request(0);
+  sceneShaders.Request(SHADER_INSTANCED);
+  gpuCuller.Init();
+  clusteredLighting.Init();
+  shadowMap.Init();
+  shadowAtlas.Init();
+  outlinePass.Init();
+  sceneShaders.Get(SHADER_SHADOWS);
+  sceneShaders.Get(SHADER_INSTANCED | SHADER_SHADOWS);
+  double shaderMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStart).count();
+  std::cout << "Shaders ready in " << shaderMilliseconds << " ms, " << ProgramCache::Get().Hits() << " programs from the cache, "
+            << ProgramCache::Get().Misses() << " compiled" << (Shader::ParallelCompile() ? " in parallel" : "") << ", "
+            << sceneShaders.PendingCount() << " still compiling" << std::endl;
+  renderGraph.Init();
+  shaderWatcher.Init("resources/shaders");
+  MaterialLibrary::Get().Init();
+  MorphTargetLibrary::Get().Init();
+  animator.Init();
+
+
+  // engine systems and the entity following the camera
+  // ---------------------------------------------------
+  RegisterEngineSystems(world, sceneBVH);
+  world.Create(CameraComponent{&camera, camera.Near, camera.Far}, MakeTransform(camera.Position), WorldTransformComponent{glm::mat4(1.0f)});
+
+  // start streaming the scene, the first frames render whatever has been parsed so far
+  // ------------------------------------------------------------------------------------
+  std::string scenePath = argc > 1 ? argv[1] : "resources/scenes/default.json";
+  if (scenePath.size() > 5 && scenePath.compare(scenePath.size() - 5, 5, ".scnb") == 0)
+  {
+    useMappedScene = mappedScene.Open(scenePath);
+    if (useMappedScene)
+    {
+      loadSceneResources(mappedScene);
+      world.Reserve<WorldTransformComponent, MeshRendererComponent, BoundsComponent>(mappedScene.InstanceCount());
+    }
+    sceneComplete = true;
+  }
+  else if (!sceneLoader.Start(scenePath))
+  {
+    sceneComplete = true;
+  }
 
+  // render loop
+  // -----------
+  while (!glfwWindowShouldClose(window))
+  {
+    // input
+    // -----
+    processInput(window);
 
-  // VAO, VBO and EBO for plane geometry
-  GLuint planeVAO, planeVBO, planeEBO, cubeVAO, cubeVBO;
-  glGenVertexArrays(1, &planeVAO);
-  glGenBuffers(1, &planeVBO);
-  glGenBuffers(1, &planeEBO);
+    float currentFrame = static_cast<float>(glfwGetTime());
+    deltaTime = currentFrame - lastFrame;
+    lastFrame = currentFrame;
 
-  glBindVertexArray(planeVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    Profiler::Get().BeginFrame();
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeEBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    // start the Dear ImGui frame
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
 
-  // Position attribute
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)0);
+    // recompile the shaders that use an edited file, and swap in the ones that finished
+    if (shaderWatcher.Poll(changedShaderFiles))
+      Shader::ReloadChanged(changedShaderFiles);
+    Shader::FinishReloads();
 
-  // Color attribute
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
+    // pick up whatever the scene loader parsed since the last frame
+    if (!sceneComplete)
+    {
+      sceneComplete = sceneLoader.Poll(scene);
+      loadSceneResources(scene);
+    }
+    spawnSceneInstances();
+    MaterialLibrary::Get().Upload();
 
-  // unbind the VAO and VBO
-  glBindVertexArray(0);
+    // objects went in one by one while streaming, give the tree a proper SAH build once it's all there
+    if (sceneComplete && !sceneBVHBuilt && spawnedInstances == (useMappedScene ? mappedScene.InstanceCount() : scene.instances.size()))
+    {
+      sceneBVH.Rebuild();
+      sceneBVHBuilt = true;
+
+      gpuCuller.Build(world, INSTANCE_OUTLINE | INSTANCE_ANIMATED | INSTANCE_CROWD);
+      crowdRenderer.Build(world);
+      cpuDrawnEntities.clear();
+      world.Each<MeshRendererComponent>([&](Entity entity, MeshRendererComponent &renderer) {
+        if ((renderer.flags & (INSTANCE_OUTLINE | INSTANCE_ANIMATED)) && !(renderer.flags & INSTANCE_CROWD))
+          cpuDrawnEntities.push_back(entity);
+      });
+    }
 
-  // Cube set VAO and VBO
-  glGenVertexArrays(1, &cubeVAO);
-  glGenBuffers(1, &cubeVBO);
+    // update entities
+    world.RunSystems(deltaTime);
 
-  glBindVertexArray(cubeVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
+    // sample every animated instance in parallel, outside the systems so it gets all the worker threads
+    animator.Update(world, deltaTime);
+    animator.Upload();
+    MorphTargetLibrary::Get().Upload();
 
-  // Position attribute
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)0);
+    // render
+    // ------
+    Profiler::Get().BeginPass("Culling");
+    glm::mat4 view = camera.GetViewMatrix();
+    glm::mat4 projection = cameraProjection();
 
-  // Texture attribute
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
+    bool useGpuCulling = gpuCulling && gpuCuller.Ready();
+    if (useGpuCulling)
+    {
+      // the GPU tests every batched instance, only the few drawn one by one are culled here
+      gpuCuller.Update(world);
+      gpuCuller.Cull(projection * view, camera.Position);
+
+      Frustum frustum = Frustum::FromMatrix(projection * view);
+      visibleEntities.clear();
+      for (Entity entity : cpuDrawnEntities)
+      {
+        if (world.IsAlive(entity) && frustum.Overlaps(world.Get<BoundsComponent>(entity)->world))
+          visibleEntities.push_back(entity);
+      }
+
+      // drawn before its batch so it is the one that writes the outline mask
+      bool selectedListed = std::find(visibleEntities.begin(), visibleEntities.end(), selectedEntity) != visibleEntities.end();
+      if (world.IsAlive(selectedEntity) && world.Has<MeshRendererComponent>(selectedEntity) && !selectedListed)
+        visibleEntities.push_back(selectedEntity);
+    }
+    else
+    {
+      // frustum culling against the scene BVH
+      visibleEntities.clear();
+      sceneBVH.QueryFrustum(Frustum::FromMatrix(projection * view), [&](uint32_t, uint64_t userData) {
+        visibleEntities.push_back(EntityFromBits(userData));
+      });
+      Profiler::Get().CountCulled((unsigned int)(sceneBVH.ProxyCount() - visibleEntities.size()));
+
+      // occlusion culling, occluders in view are rasterized on the CPU and every visible box is tested against them
+      if (occlusionEnabled)
+      {
+        occlusionCuller.BeginFrame(projection * view);
+        for (Entity entity : visibleEntities)
+        {
+          const MeshRendererComponent *renderer = world.Get<MeshRendererComponent>(entity);
+          if (renderer->flags & INSTANCE_OCCLUDER)
+            occlusionCuller.AddOccluder(renderer->model->occluder, world.Get<WorldTransformComponent>(entity)->matrix);
+        }
+
+        if (occlusionCuller.OccluderCount() > 0)
+        {
+          occlusionCuller.Render();
+          occlusionBoxes.resize(visibleEntities.size());
+          occlusionVisible.resize(visibleEntities.size());
+          for (size_t i = 0; i < visibleEntities.size(); i++)
+            occlusionBoxes[i] = world.Get<BoundsComponent>(visibleEntities[i])->world;
+          size_t occluded = occlusionCuller.Cull(occlusionBoxes.data(), occlusionBoxes.size(), occlusionVisible.data());
+          Profiler::Get().CountOccluded((unsigned int)occluded, (unsigned int)visibleEntities.size());
+
+          size_t kept = 0;
+          for (size_t i = 0; i < visibleEntities.size(); i++)
+          {
+            if (occlusionVisible[i])
+              visibleEntities[kept++] = visibleEntities[i];
+          }
+          visibleEntities.resize(kept);
+        }
+      }
+    }
 
-  // unbind the VAO and VBO
-  glBindVertexArray(0);
+    // scene shaders without the shadow lookups while shadows are off, with whatever the loaded materials
+    // need, the shadowed ones stand in until they have compiled. Recording needs the uniform locations of the
+    // one the draws are replayed with.
+    uint32_t sceneFeatures = MaterialLibrary::Get().Features() | (shadowsEnabled ? (uint32_t)SHADER_SHADOWS : 0u);
+    Shader &ourShader = sceneShaders.GetOrFallback(sceneFeatures, SHADER_SHADOWS);
+    Shader &instancedShader = sceneShaders.GetOrFallback(SHADER_INSTANCED | sceneFeatures, SHADER_INSTANCED | SHADER_SHADOWS);
+    sceneLocations.model = glGetUniformLocation(ourShader.ID, "model");
+    sceneLocations.outlined = glGetUniformLocation(ourShader.ID, "outlined");
+    Shader *skinnedShader = nullptr;
+    if (animator.AnimatedCount() > 0)
+    {
+      uint32_t morphFeatures = MorphTargetLibrary::Get().InstanceCount() > 0 ? (uint32_t)SHADER_MORPH_TARGETS : 0u;
+      skinnedShader = &sceneShaders.GetOrFallback(SHADER_SKINNED | morphFeatures | sceneFeatures, SHADER_SKINNED | SHADER_SHADOWS);
+      skinnedLocations.model = glGetUniformLocation(skinnedShader->ID, "model");
+      skinnedLocations.outlined = glGetUniformLocation(skinnedShader->ID, "outlined");
+      skinnedLocations.boneOffset = glGetUniformLocation(skinnedShader->ID, "boneOffset");
+      skinnedLocations.morphRangeBase = glGetUniformLocation(skinnedShader->ID, "morphRangeBase");
+      skinnedLocations.morphWeightBase = glGetUniformLocation(skinnedShader->ID, "morphWeightBase");
+    }
+    Shader *crowdShader = nullptr;
+    if (crowdRenderer.Ready())
+      crowdShader = &sceneShaders.GetOrFallback(SHADER_INSTANCED | SHADER_VERTEX_ANIMATION | sceneFeatures,
+                                                SHADER_INSTANCED | SHADER_VERTEX_ANIMATION | SHADER_SHADOWS);
+
+    // record the draws of what survived culling on every thread, the scene pass only replays them
+    for (Model &model : sceneModels)
+      model.nodes.Update();
+    sceneCommands.resize(JobSystem::Get().ThreadCount() * COMMAND_BUFFERS_PER_THREAD);
+    skinnedCommands.resize(sceneCommands.size());
+    meshletCounts.assign(sceneCommands.size(), MeshletCounts());
+    MeshletCulling meshlets;
+    meshlets.enabled = meshletCulling;
+    meshlets.frustum = Frustum::FromMatrix(projection * view);
+    meshlets.eye = camera.Position;
+    size_t entitiesPerBuffer = (visibleEntities.size() + sceneCommands.size() - 1) / sceneCommands.size();
+    JobSystem::Get().ParallelFor(sceneCommands.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t buffer = begin; buffer < end; buffer++)
+      {
+        sceneCommands[buffer].Clear();
+        skinnedCommands[buffer].Clear();
+        size_t first = std::min(buffer * entitiesPerBuffer, visibleEntities.size());
+        size_t last = std::min(first + entitiesPerBuffer, visibleEntities.size());
+        for (size_t i = first; i < last; i++)
+        {
+          // outlined instances write 1 into the outline mask
+          Entity entity = visibleEntities[i];
+          const MeshRendererComponent *renderer = world.Get<MeshRendererComponent>(entity);
+          bool outlined = (renderer->flags & INSTANCE_OUTLINE) != 0 || entity == selectedEntity;
+          const glm::mat4 &transform = world.Get<WorldTransformComponent>(entity)->matrix;
+          const AnimatorComponent *animation = skinnedShader ? world.Get<AnimatorComponent>(entity) : nullptr;
+          const MorphComponent *morph = animation ? world.Get<MorphComponent>(entity) : nullptr;
+          if (animation)
+            recordInstance(skinnedCommands[buffer], skinnedLocations, transform, renderer->model, renderer->material, outlined,
+                           (int)animation->paletteOffset, morph ? (int)morph->weightOffset : -1, meshlets, meshletCounts[buffer]);
+          else
+            recordInstance(sceneCommands[buffer], sceneLocations, transform, renderer->model, renderer->material, outlined, -1, -1,
+                           meshlets, meshletCounts[buffer]);
+        }
+      }
+    });
+    Profiler::Get().CountVisible((unsigned int)visibleEntities.size());
+    for (const MeshletCounts &counts : meshletCounts)
+      Profiler::Get().CountMeshlets(counts.culled, counts.tested);
+
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    // a minimized window still gets a frame, with a target the smallest size there is
+    RenderTargetDesc sceneTarget = {std::max(framebufferWidth, 1), std::max(framebufferHeight, 1), GL_RGBA8};
+    RenderTargetDesc maskTarget = {sceneTarget.width, sceneTarget.height, GL_R8};
+    RenderTargetDesc depthTarget = {sceneTarget.width, sceneTarget.height, GL_DEPTH24_STENCIL8};
+
+    // the frame's passes, the shadow maps and light buffers belong to their systems and only order the passes
+    renderGraph.Reset();
+    RenderResource backbuffer = renderGraph.ImportBackbuffer(framebufferWidth, framebufferHeight);
+    RenderResource atlasShadows = renderGraph.Import("shadow atlas");
+    RenderResource lightClusters = renderGraph.Import("light clusters");
+    RenderResource cascades = renderGraph.Import("shadow cascades");
+    RenderResource sceneColor = RENDER_RESOURCE_NONE;
+    RenderResource outlineMask = RENDER_RESOURCE_NONE;
+    RenderResource sceneDepth = RENDER_RESOURCE_NONE;
+
+    // tiles of the shadowed point and spot lights in view
+    renderGraph.AddPass("Shadow Atlas",
+      [&](RenderGraph::PassBuilder &pass) {
+        atlasShadows = pass.Write(atlasShadows);
+      },
+      [&](const RenderGraph &) {
+        if (shadowsEnabled)
+          shadowAtlas.Update(world, sceneBVH, projection * view, camera.Position, projection[1][1], framebufferWidth, framebufferHeight);
+      });
+
+    // bin every light into the clusters of this view
+    renderGraph.AddPass("Lights",
+      [&](RenderGraph::PassBuilder &pass) {
+        pass.Read(atlasShadows);
+        lightClusters = pass.Write(lightClusters);
+      },
+      [&](const RenderGraph &) {
+        clusteredLighting.Update(world, view, projection, camera.Near, camera.Far, shadowsEnabled ? &shadowAtlas : nullptr);
+      });
+
+    // cascades of the first directional light, the far ones only every few frames
+    renderGraph.AddPass("Shadows",
+      [&](RenderGraph::PassBuilder &pass) {
+        pass.Read(lightClusters);
+        cascades = pass.Write(cascades);
+      },
+      [&](const RenderGraph &) {
+        const std::vector<glm::vec3> &sunDirections = clusteredLighting.DirectionalDirections();
+        if (shadowsEnabled && !sunDirections.empty())
+        {
+          shadowMap.Update(camera, (float)SCR_WIDTH / (float)SCR_HEIGHT, sunDirections[0]);
+          shadowMap.Render(world, sceneBVH, framebufferWidth, framebufferHeight);
+        }
+        else
+        {
+          shadowMap.Disable();
+        }
+      });
+
+    renderGraph.AddPass("Scene",
+      [&](RenderGraph::PassBuilder &pass) {
+        pass.Read(atlasShadows);
+        pass.Read(lightClusters);
+        pass.Read(cascades);
+        sceneColor = pass.Create("scene color", sceneTarget, glm::vec4(clearColor, 1.0f));
+        outlineMask = pass.Create("outline mask", maskTarget, glm::vec4(0.0f));
+        sceneDepth = pass.Create("scene depth", depthTarget, glm::vec4(1.0f));
+      },
+      [&](const RenderGraph &) {
+        ourShader.use();
+        ourShader.setMat4("projection", projection);
+        ourShader.setMat4("view", view);
+        ourShader.setVec3("viewPos", camera.Position);
+        clusteredLighting.Apply(ourShader, framebufferWidth, framebufferHeight);
+        shadowMap.Apply(ourShader);
+        shadowAtlas.Apply(ourShader);
+        MaterialLibrary::Get().Apply(ourShader);
+        CommandBuffer::Replay(sceneCommands);
+
+        // animated instances, skinned from the palettes
+        if (skinnedShader)
+        {
+          skinnedShader->use();
+          skinnedShader->setMat4("projection", projection);
+          skinnedShader->setMat4("view", view);
+          skinnedShader->setVec3("viewPos", camera.Position);
+          clusteredLighting.Apply(*skinnedShader, framebufferWidth, framebufferHeight);
+          shadowMap.Apply(*skinnedShader);
+          shadowAtlas.Apply(*skinnedShader);
+          MaterialLibrary::Get().Apply(*skinnedShader);
+          animator.Apply(*skinnedShader);
+          MorphTargetLibrary::Get().Apply(*skinnedShader);
+          CommandBuffer::Replay(skinnedCommands);
+        }
+
+        // crowds, one instanced draw per mesh of every model and material
+        if (crowdShader)
+        {
+          crowdShader->use();
+          crowdShader->setFloat("outlined", 0.0f);
+          crowdShader->setMat4("projection", projection);
+          crowdShader->setMat4("view", view);
+          crowdShader->setVec3("viewPos", camera.Position);
+          clusteredLighting.Apply(*crowdShader, framebufferWidth, framebufferHeight);
+          shadowMap.Apply(*crowdShader);
+          shadowAtlas.Apply(*crowdShader);
+          MaterialLibrary::Get().Apply(*crowdShader);
+          crowdRenderer.Draw(*crowdShader, projection * view, currentFrame);
+          Profiler::Get().CountVisible((unsigned int)crowdRenderer.VisibleCount());
+        }
+
+        // everything the GPU kept
+        if (useGpuCulling)
+        {
+          instancedShader.use();
+          instancedShader.setFloat("outlined", 0.0f);
+          instancedShader.setMat4("projection", projection);
+          instancedShader.setMat4("view", view);
+          instancedShader.setVec3("viewPos", camera.Position);
+          clusteredLighting.Apply(instancedShader, framebufferWidth, framebufferHeight);
+          shadowMap.Apply(instancedShader);
+          shadowAtlas.Apply(instancedShader);
+          MaterialLibrary::Get().Apply(instancedShader);
+          gpuCuller.Draw(instancedShader);
+          Profiler::Get().CountVisible((unsigned int)gpuCuller.VisibleCount());
+          Profiler::Get().CountCulled((unsigned int)(gpuCuller.InstanceCount() - gpuCuller.VisibleCount()));
+          Profiler::Get().CountMeshlets((unsigned int)(gpuCuller.TestedClusterCount() - gpuCuller.VisibleClusterCount()),
+                                        (unsigned int)gpuCuller.TestedClusterCount());
+        }
+      });
+
+    // the depth pyramid next frame's culling tests against, nothing this frame reads it
+    if (useGpuCulling)
+    {
+      renderGraph.AddPass("HiZ",
+        [&](RenderGraph::PassBuilder &pass) {
+          pass.Read(sceneDepth);
+          pass.SideEffect();
+        },
+        [&](const RenderGraph &graph) {
+          gpuCuller.BuildHiZ(graph.Texture(sceneDepth), framebufferWidth, framebufferHeight, projection * view);
+        });
+    }
 
-  // Load texture for plane
-  // ----------------------
-  unsigned int material_diffuse0;
-  glGenTextures(1, &material_diffuse0);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, material_diffuse0);
+    // copy the scene to the window with the edges of the outline mask drawn in
+    renderGraph.AddPass("Outline",
+      [&](RenderGraph::PassBuilder &pass) {
+        pass.Read(sceneColor);
+        pass.Read(outlineMask);
+        backbuffer = pass.Write(backbuffer);
+      },
+      [&](const RenderGraph &graph) {
+        outlinePass.Resolve(graph.Texture(sceneColor), graph.Texture(outlineMask));
+      });
+
+    // stats overlay
+    renderGraph.AddPass("ImGui",
+      [&](RenderGraph::PassBuilder &pass) {
+        backbuffer = pass.Write(backbuffer);
+      },
+      [&](const RenderGraph &) {
+        if (showStats)
+          Profiler::Get().DrawOverlay(&showStats);
+        if (world.IsAlive(selectedEntity))
+        {
+          ImGui::Begin("Selection");
+          ImGui::Text("Entity %u (generation %u)", selectedEntity.index, selectedEntity.generation);
+          ImGui::Text("Mesh %u, triangle %u", selectedHit.mesh, selectedHit.triangle);
+          ImGui::Text("Barycentrics %.3f %.3f %.3f", 1.0f - selectedHit.u - selectedHit.v, selectedHit.u, selectedHit.v);
+          ImGui::Text("Distance %.3f, picked in %.1f us", selectedHit.distance, pickMicroseconds);
+          ImGui::End();
+        }
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      });
+
+    if (renderGraph.Compile())
+      renderGraph.Execute();
+
+    Profiler::Get().EndFrame();
 
-  // Set texture parameters
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved
+    // etc.)
+    // -------------------------------------------------------------------------------
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+  }
 
-  std::string parentDir = (fs::current_path().fs::path::parent_path()).string();
-  std::cout << "Parent directory: " << parentDir << std::endl;
+  // Cleanup scene textures
+  for (std::map<std::string, unsigned int>::iterator it = loadedTextures.begin(); it != loadedTextures.end(); ++it)
+    glDeleteTextures(1, &it->second);
+
+  JobSystem::Get().Shutdown();
+  gpuCuller.Shutdown();
+  clusteredLighting.Shutdown();
+  shadowMap.Shutdown();
+  shadowAtlas.Shutdown();
+  outlinePass.Shutdown();
+  renderGraph.Shutdown();
+  shaderWatcher.Shutdown();
+  MaterialLibrary::Get().Shutdown();
+  MorphTargetLibrary::Get().Shutdown();
+  animator.Shutdown();
+  crowdRenderer.Shutdown();
+  sceneShaders.Clear();
+  Profiler::Get().Shutdown();
+  ImGui_ImplOpenGL3_Shutdown();
+  ImGui_ImplGlfw_Shutdown();
+  ImGui::DestroyContext();
 
-  // Load image, create diffuse texture and generate mipmaps
-  int width, height, nrChannels;
-  stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-  
-  unsigned char *data = stbi_load((parentDir + "/resources/metal.png").c_str(), &width, &height, &nrChannels, 0);
+  glfwTerminate();
+  return 0;
+}
 
-  if (data)
+// creates the GPU side of models and materials added to the scene since the last call
+// ---------------------------------------------------------------------------------------------------------
+template <typename Source>
+void loadSceneResources(const Source &source)
+{
+  for (size_t i = sceneModels.size(); i < source.models.size(); i++)
   {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    std::cout << "Texture loaded successfully" << std::endl;
+    const SceneModel &desc = source.models[i];
+    if (desc.primitive == PRIMITIVE_PLANE)
+    {
+      sceneModels.push_back(Model());
+      sceneModels.back().meshes.push_back(CreatePlaneMesh());
+      sceneModels.back().ComputeBounds();
+      sceneModels.back().BuildOccluder();
+    }
+    else if (desc.primitive == PRIMITIVE_CUBE)
+    {
+      sceneModels.push_back(Model());
+      sceneModels.back().meshes.push_back(CreateCubeMesh());
+      sceneModels.back().ComputeBounds();
+      sceneModels.back().BuildOccluder();
+    }
+    else
+    {
+      try
+      {
+        sceneModels.push_back(Model(std::string("resources/") + source.GetString(desc.path)));
+      }
+      catch (const std::exception &e)
+      {
+        // keep the indices in sync, the instance just won't draw anything
+        std::cout << "WARNING::SCENE::Failed to load model " << source.GetString(desc.path) << ": " << e.what() << std::endl;
+        sceneModels.push_back(Model());
+      }
+    }
   }
-  else
+
+  for (size_t i = sceneMaterials.size(); i < source.materials.size(); i++)
   {
-    std::cout << "Failed to load texture" << std::endl;
+    const SceneMaterial &desc = source.materials[i];
+    Material material;
+    material.parameters.diffuse = glm::vec4(desc.color, 1.0f);
+    material.parameters.specular.w = desc.shininess;
+    material.textures[MATERIAL_DIFFUSE_MAP] = loadSceneTexture(source, desc.diffuseMap);
+    material.textures[MATERIAL_SPECULAR_MAP] = loadSceneTexture(source, desc.specularMap);
+    sceneMaterials.push_back(MaterialLibrary::Get().Add(material));
   }
 
-  // Free image data
-  stbi_image_free(data);
-
-
-  // Texture for cube
-  unsigned int cubeTexture;
-  glGenTextures(1, &cubeTexture);
-  glBindTexture(GL_TEXTURE_2D, cubeTexture);
+  spawnSceneLights(source);
+}
 
-  // Set texture parameters
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// loads a texture relative to resources once, 0 for SCENE_NONE or a texture that failed to load
+// ---------------------------------------------------------------------------------------------------------
+template <typename Source>
+unsigned int loadSceneTexture(const Source &source, uint32_t path)
+{
+  if (path == SCENE_NONE)
+    return 0;
 
-  // Load image, create diffuse texture and generate mipmaps
-  data = stbi_load((parentDir + "/resources/marble.jpg").c_str(), &width, &height, &nrChannels, 0);
+  std::string file = source.GetString(path);
+  std::map<std::string, unsigned int>::iterator it = loadedTextures.find(file);
+  if (it != loadedTextures.end())
+    return it->second;
 
-  if (data)
+  unsigned int texture = 0;
+  try
   {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    std::cout << "Texture loaded successfully" << std::endl;
+    texture = TextureFromFile(file.c_str(), "resources");
   }
-  else
+  catch (const std::exception &e)
   {
-    std::cout << "Failed to load texture" << std::endl;
+    std::cout << "WARNING::SCENE::Failed to load texture " << file << ": " << e.what() << std::endl;
   }
+  loadedTextures[file] = texture;
+  return texture;
+}
 
-  // Free image data
-  stbi_image_free(data);
+// turns scene lights added since the last call into entities
+// ---------------------------------------------------------------------------------------------------------
+template <typename Source>
+void spawnSceneLights(const Source &source)
+{
+  for (; spawnedLights < source.lights.size(); spawnedLights++)
+  {
+    const SceneLight &desc = source.lights[spawnedLights];
+    LightComponent light = {desc.type, desc.color, desc.intensity, desc.range, desc.innerAngle, desc.outerAngle, true};
 
-  // shader configuration
-  // --------------------
-  ourShader.use();
-  ourShader.setInt("texture_diffuse0", 0);
+    // lights shine down -Z, rotate that onto the described direction (half a turn around Y for +Z)
+    glm::quat rotation(1.0f, 0.0f, 0.0f, 0.0f);
+    if (glm::length(desc.direction) > 0.0f)
+    {
+      glm::vec3 direction = glm::normalize(desc.direction);
+      if (direction.z > 0.9999f)
+        rotation = glm::quat(0.0f, 0.0f, 1.0f, 0.0f);
+      else
+        rotation = glm::quat(glm::vec3(0.0f, 0.0f, -1.0f), direction);
+    }
 
+    world.Create(light, MakeTransform(desc.position, rotation), WorldTransformComponent{glm::mat4(1.0f)});
+  }
+}
 
-  // render loop
-  // -----------
-  while (!glfwWindowShouldClose(window))
+// scatters colored point lights in a box around the camera, for checking how lighting scales
+// ---------------------------------------------------------------------------------------------------------
+void spawnDemoLights(size_t count)
+{
+  static std::mt19937 rng(42);
+  std::uniform_real_distribution<float> offset(-10.0f, 10.0f);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  for (size_t i = 0; i < count; i++)
   {
-    // input
-    // -----
-    processInput(window);
+    glm::vec3 position = camera.Position + glm::vec3(offset(rng), offset(rng) * 0.3f, offset(rng));
+    glm::vec3 color = glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.8f + glm::vec3(0.2f);
+    LightComponent light = {LIGHT_POINT, color, 2.0f, 2.0f + unit(rng) * 3.0f, 0.0f, 0.0f, false};
+    world.Create(light, MakeTransform(position), WorldTransformComponent{glm::mat4(1.0f)});
+  }
+  std::cout << "Added " << count << " point lights" << std::endl;
+}
 
-    float currentFrame = static_cast<float>(glfwGetTime());
-    deltaTime = currentFrame - lastFrame;
-    lastFrame = currentFrame;
+// turns up to SPAWN_BUDGET scene instances into static entities and adds them to the scene BVH. They only
+// get a world matrix, no TransformComponent, so the transform and bounds updates never touch them. Shadow
+// tiles rendered before they came in are rendered again.
+// ---------------------------------------------------------------------------------------------------------
+void spawnSceneInstances()
+{
+  size_t total = useMappedScene ? mappedScene.InstanceCount() : scene.instances.size();
+  size_t end = std::min(total, spawnedInstances + SPAWN_BUDGET);
+  AABB staticBounds = AABB::Empty();
 
-    // render
-    // ------
-    glClearColor(clearColor.r, clearColor.g, clearColor.b, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  for (; spawnedInstances < end; spawnedInstances++)
+  {
+    size_t i = spawnedInstances;
+    const glm::mat4 &transform = useMappedScene ? mappedScene.transforms[i] : scene.instances[i].transform;
+    uint32_t modelIndex = useMappedScene ? mappedScene.modelIds[i] : scene.instances[i].model;
+    uint32_t materialIndex = useMappedScene ? mappedScene.materialIds[i] : scene.instances[i].material;
+    uint32_t flags = useMappedScene ? mappedScene.flags[i] : scene.instances[i].flags;
+
+    Model *model = modelIndex < sceneModels.size() ? &sceneModels[modelIndex] : nullptr;
+    BoundsComponent bounds = {model ? TransformAABB(model->bounds, transform) : AABB::Empty(), BVH_NULL};
+    uint32_t material = materialIndex < sceneMaterials.size() ? sceneMaterials[materialIndex] : MATERIAL_NONE;
+    const VertexAnimation *bake = (flags & INSTANCE_CROWD) && model ? crowdRenderer.Bake(*model) : nullptr;
+    if (!bake)
+      flags &= ~INSTANCE_CROWD;
+    Entity entity = NullEntity;
+    if (bake)
+    {
+      // every crowd instance picks a clip and a start time, the crowd renderer plays it from there on the GPU.
+      // Bounds cover every baked frame. Crowds aren't in the BVH, the crowd renderer culls whole batches.
+      uint32_t clip = (uint32_t)(i % bake->clips.size());
+      float phase = std::fmod((float)i * 0.618034f, 1.0f) * bake->clips[clip].duration;
+      bounds.world = TransformAABB(bake->bounds, transform);
+      entity = world.Create(WorldTransformComponent{transform}, MeshRendererComponent{model, material, flags}, bounds,
+                            VertexAnimationComponent{clip, phase, 1.0f});
+    }
+    else if ((flags & INSTANCE_ANIMATED) && model && !model->animations.empty() && !model->boneNodes.empty())
+    {
+      // start each instance somewhere else in the clip so crowds don't move in lockstep
+      float phase = std::fmod((float)i * 0.618034f, 1.0f) * model->animations[0].duration;
+      AnimatorComponent animation = {0, phase, 1.0f, animator.Allocate(*model)};
+      entity = world.Create(WorldTransformComponent{transform}, MeshRendererComponent{model, material, flags}, bounds, animation);
+      if (!model->morphWeights.empty())
+        world.Add(entity, MorphComponent{MorphTargetLibrary::Get().Allocate(model->morphWeights.data(), model->morphWeights.size())});
+    }
+    else
+    {
+      entity = world.Create(WorldTransformComponent{transform}, MeshRendererComponent{model, material, flags}, bounds);
+    }
+    if (!bounds.world.IsEmpty() && !bake)
+      world.Get<BoundsComponent>(entity)->proxy = sceneBVH.Insert(bounds.world, EntityToBits(entity));
+    if (!bake && !world.Has<AnimatorComponent>(entity))
+      staticBounds.Grow(bounds.world);
+  }
+  shadowAtlas.InvalidateStatic(staticBounds);
+}
 
-    outlineShader.use();
-    glm::mat4 model = glm::mat4(1.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    outlineShader.setMat4("view", view);
-    outlineShader.setMat4("projection", projection);
-
-    ourShader.use();
-    // view/projection transformations
-    projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    view = camera.GetViewMatrix();
-    ourShader.setMat4("projection", projection);
-    ourShader.setMat4("view", view);
-
-    glStencilMask(0x00);
-
-    // Render plane
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, -1.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(2.5f, 2.5f, 2.5f));
-    ourShader.setMat4("model", model);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, material_diffuse0);
-    glBindVertexArray(planeVAO);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-
-
-    
-    glStencilFunc(GL_ALWAYS, 1, 0xFF); 
-    glStencilMask(0xFF); 
-
-    // Render cube
-    glBindVertexArray(cubeVAO);
-    glBindTexture(GL_TEXTURE_2D, cubeTexture);
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(-1.0f, 0.0f, -1.0f));
-    ourShader.setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(2.0f, 0.0f, 0.0f));
-    ourShader.setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-
-    glStencilFunc(GL_NOTEQUAL, 1, 0xFF); 
-    glStencilMask(0x00); 
-    glDisable(GL_DEPTH_TEST);
-    
-    outlineShader.use();
-
-    // Render scaled up cube
-    glBindVertexArray(cubeVAO);
-    glBindTexture(GL_TEXTURE_2D, cubeTexture);
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(-1.0f, 0.0f, -1.0f));
-    model = glm::scale(model, glm::vec3(1.1f));
-    outlineShader.setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(2.0f, 0.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(1.1f));
-    outlineShader.setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-
-    glStencilMask(0xFF);
-    glStencilFunc(GL_ALWAYS, 0, 0xFF);
-    glEnable(GL_DEPTH_TEST);
+// records the draws of a single scene instance with its materials bound, safe to call from any thread.
+// Animated instances pass the first bone of their palette, their skinned meshes are placed by the bones,
+// and the first of their morph weights if they have any. Closed meshes are drawn with back face culling,
+// and the static ones with enough meshlets only draw the meshlets that are in view and face the camera,
+// with one multi draw.
+// ---------------------------------------------------------------------------------------------------------
+void recordInstance(CommandBuffer &commands, const DrawLocations &locations, const glm::mat4 &transform, Model *model, uint32_t material,
+                    bool outlined, int boneOffset, int morphOffset, const MeshletCulling &meshlets, MeshletCounts &counts)
+{
+  if (!model || model->meshes.empty())
+    return;
 
+  commands.SetFloat(locations.outlined, outlined ? 1.0f : 0.0f);
+  if (boneOffset >= 0)
+    commands.SetInt(locations.boneOffset, boneOffset);
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved
-    // etc.)
-    // -------------------------------------------------------------------------------
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+  // same as Model::Draw, the node matrices were updated before recording started
+  for (size_t i = 0; i < model->meshes.size(); i++)
+  {
+    const Mesh &mesh = model->meshes[i];
+    glm::mat4 meshTransform = transform;
+    if (i < model->meshNodes.size() && !(boneOffset >= 0 && mesh.skinned))
+      meshTransform = transform * model->nodes.GetWorld(model->meshNodes[i]);
+    commands.SetMat4(locations.model, meshTransform);
+    // closed meshes drop their back faces, a mirroring transform turns the winding around
+    if (mesh.twoSided)
+      commands.SetCullFace(0);
+    else
+      commands.SetCullFace(glm::determinant(glm::mat3(meshTransform)) < 0.0f ? GL_FRONT : GL_BACK);
+    if (locations.morphWeightBase >= 0)
+    {
+      bool morphed = morphOffset >= 0 && mesh.morphTargets.targetCount > 0;
+      commands.SetInt(locations.morphRangeBase, morphed ? (int)mesh.morphTargets.rangeBase : 0);
+      commands.SetInt(locations.morphWeightBase, morphed ? morphOffset + (int)mesh.morphTargets.firstTarget : -1);
+    }
+    // the replay skips the binds when consecutive meshes share a material
+    MaterialLibrary::Get().Record(commands, material != MATERIAL_NONE ? material : mesh.material);
+
+    // animated meshes move away from the bounds their meshlets were built with
+    if (meshlets.enabled && boneOffset < 0 && mesh.meshlets.size() >= MESHLET_MIN_COUNT)
+    {
+      MeshletView view = MeshletView::FromTransform(meshlets.frustum, meshlets.eye, meshTransform, mesh.twoSided);
+      commands.DrawIndexedRanges(mesh.VAO);
+      for (size_t m = 0; m < mesh.meshlets.size(); m++)
+      {
+        if (view.Visible(mesh.meshletBounds[m]))
+          commands.AddRange(mesh.meshlets[m].firstIndex, mesh.meshlets[m].triangleCount * 3);
+        else
+          counts.culled++;
+      }
+      counts.tested += (unsigned int)mesh.meshlets.size();
+    }
+    else
+    {
+      commands.DrawIndexed(mesh.VAO, (uint32_t)mesh.indices.size());
+    }
   }
+}
 
-  // Cleanup plane geometry
-  glDeleteVertexArrays(1, &planeVAO);
-  glDeleteBuffers(1, &planeVBO);
-  glDeleteBuffers(1, &planeEBO);
-  glDeleteTextures(1, &material_diffuse0);  
+// projection used for rendering and for turning the cursor into a ray
+// ---------------------------------------------------------------------------------------------------------
+glm::mat4 cameraProjection()
+{
+  return glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, camera.Near, camera.Far);
+}
 
-  glfwTerminate();
-  return 0;
+// selects the closest object under the cursor, or under the screen center while the cursor is captured
+// ---------------------------------------------------------------------------------------------------------
+void pickEntity(GLFWwindow *window)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  int width, height;
+  glfwGetWindowSize(window, &width, &height);
+  float x = 0.0f, y = 0.0f;
+  if (!mouseCaptured && width > 0 && height > 0)
+  {
+    x = 2.0f * (float)cursorX / (float)width - 1.0f;
+    y = 1.0f - 2.0f * (float)cursorY / (float)height;
+  }
+
+  // unproject the cursor onto the near and far planes
+  glm::mat4 inverseViewProjection = glm::inverse(cameraProjection() * camera.GetViewMatrix());
+  glm::vec4 nearPoint = inverseViewProjection * glm::vec4(x, y, -1.0f, 1.0f);
+  glm::vec4 farPoint = inverseViewProjection * glm::vec4(x, y, 1.0f, 1.0f);
+  glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+  Ray ray(origin, glm::normalize(glm::vec3(farPoint) / farPoint.w - origin));
+
+  // the scene BVH finds candidate objects front to back, their triangle BVHs give the exact hit
+  selectedEntity = NullEntity;
+  sceneBVH.Raycast(ray, FLT_MAX, [&](uint32_t, uint64_t userData, float maxT) {
+    Entity entity = EntityFromBits(userData);
+    const MeshRendererComponent *renderer = world.Get<MeshRendererComponent>(entity);
+    const WorldTransformComponent *transform = world.Get<WorldTransformComponent>(entity);
+    ModelHit hit;
+    if (!renderer || !transform || !renderer->model || !renderer->model->Raycast(ray, transform->matrix, maxT, hit))
+      return maxT;
+
+    selectedEntity = entity;
+    selectedHit = hit;
+    return hit.distance;
+  });
+
+  pickMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this
@@ -419,7 +1021,6 @@ void processInput(GLFWwindow *window)
     glfwSetWindowShouldClose(window, true);
 
   // Toggle mouse cursor for ImGui interaction with Tab key
-  static bool mouseCaptured = true;
   static double lastTabPress = 0.0;
   if (glfwGetKey(window, GLFW_KEY_TAB) == GLFW_PRESS)
   {
@@ -433,6 +1034,81 @@ void processInput(GLFWwindow *window)
     }
   }
 
+  // Toggle the stats overlay with F1
+  static double lastF1Press = 0.0;
+  if (glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS)
+  {
+    double currentTime = glfwGetTime();
+    if (currentTime - lastF1Press > 0.5)
+    {
+      showStats = !showStats;
+      lastF1Press = currentTime;
+    }
+  }
+
+  // Toggle occlusion culling with F2
+  static double lastF2Press = 0.0;
+  if (glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS)
+  {
+    double currentTime = glfwGetTime();
+    if (currentTime - lastF2Press > 0.5)
+    {
+      occlusionEnabled = !occlusionEnabled;
+      lastF2Press = currentTime;
+    }
+  }
+
+  // Switch between CPU and GPU culling with F3
+  static double lastF3Press = 0.0;
+  if (glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS)
+  {
+    double currentTime = glfwGetTime();
+    if (currentTime - lastF3Press > 0.5)
+    {
+      gpuCulling = !gpuCulling;
+      // the pyramid is from whenever GPU culling last ran
+      gpuCuller.InvalidateHiZ();
+      lastF3Press = currentTime;
+    }
+  }
+
+  // Add random point lights around the camera with F4
+  static double lastF4Press = 0.0;
+  if (glfwGetKey(window, GLFW_KEY_F4) == GLFW_PRESS)
+  {
+    double currentTime = glfwGetTime();
+    if (currentTime - lastF4Press > 0.5)
+    {
+      spawnDemoLights(DEMO_LIGHT_BATCH);
+      lastF4Press = currentTime;
+    }
+  }
+
+  // Toggle directional light shadows with F5
+  static double lastF5Press = 0.0;
+  if (glfwGetKey(window, GLFW_KEY_F5) == GLFW_PRESS)
+  {
+    double currentTime = glfwGetTime();
+    if (currentTime - lastF5Press > 0.5)
+    {
+      shadowsEnabled = !shadowsEnabled;
+      lastF5Press = currentTime;
+    }
+  }
+
+  // Toggle meshlet culling with F6
+  static double lastF6Press = 0.0;
+  if (glfwGetKey(window, GLFW_KEY_F6) == GLFW_PRESS)
+  {
+    double currentTime = glfwGetTime();
+    if (currentTime - lastF6Press > 0.5)
+    {
+      meshletCulling = !meshletCulling;
+      gpuCuller.SetClusterCulling(meshletCulling);
+      lastF6Press = currentTime;
+    }
+  }
+
   if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
     camera.ProcessKeyboard(FORWARD, deltaTime);
   if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -445,6 +1121,9 @@ void processInput(GLFWwindow *window)
 
 void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
 {
+  cursorX = xposIn;
+  cursorY = yposIn;
+
   // Skip camera movement when ImGui wants to capture mouse
   ImGuiIO &io = ImGui::GetIO();
   if (io.WantCaptureMouse)
@@ -468,6 +1147,17 @@ void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
   camera.ProcessMouseMovement(xoffset, yoffset);
 }
 
+// Left click picks the object under the cursor
+// ---------------------------------------------------------------------------------------------------------
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+  if (ImGui::GetIO().WantCaptureMouse)
+    return;
+
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    pickEntity(window);
+}
+
 // Zoom callback
 // -------------
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
@@ -0,0 +1,99 @@
+#include "material.h"
+#include "command_buffer.h"
+#include "profiler.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+MaterialLibrary& MaterialLibrary::Get() {
+  static MaterialLibrary library;
+  return library;
+}
+
+void MaterialLibrary::Init() {
+  GLint alignment = 256;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  stride = (sizeof(MaterialParameters) + alignment - 1) / alignment * alignment;
+  glGenBuffers(1, &buffer);
+  capacity = uploaded = 0;
+
+  if (materials.empty())
+    materials.push_back(Material());
+  Upload();
+}
+
+void MaterialLibrary::Shutdown() {
+  if (buffer)
+    glDeleteBuffers(1, &buffer);
+  Profiler::Get().TrackBufferMemory(-(long long)(capacity * stride));
+  buffer = 0;
+  capacity = uploaded = 0;
+}
+
+uint32_t MaterialLibrary::Add(const Material& material) {
+  // the default has to be first, even for materials added before Init
+  if (materials.empty())
+    materials.push_back(Material());
+
+  Material added = material;
+  for (int slot = 0; slot < MATERIAL_TEXTURE_SLOTS; slot++)
+    added.parameters.maps[slot] = added.textures[slot] != 0 ? 1.0f : 0.0f;
+  materials.push_back(added);
+  features |= added.features;
+  return (uint32_t)materials.size() - 1;
+}
+
+void MaterialLibrary::Upload() {
+  if (buffer == 0 || uploaded == materials.size())
+    return;
+
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  if (materials.size() > capacity) {
+    // grow to twice the size and upload everything again, materials mostly come in while a scene loads
+    Profiler::Get().TrackBufferMemory(-(long long)(capacity * stride));
+    capacity = std::max(materials.size(), capacity * 2);
+    glBufferData(GL_UNIFORM_BUFFER, capacity * stride, NULL, GL_STATIC_DRAW);
+    Profiler::Get().TrackBufferMemory((long long)(capacity * stride));
+    uploaded = 0;
+  }
+
+  std::vector<unsigned char> blocks((materials.size() - uploaded) * stride, 0);
+  for (size_t i = uploaded; i < materials.size(); i++)
+    memcpy(&blocks[(i - uploaded) * stride], &materials[i].parameters, sizeof(MaterialParameters));
+  glBufferSubData(GL_UNIFORM_BUFFER, uploaded * stride, blocks.size(), blocks.data());
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  uploaded = materials.size();
+}
+
+void MaterialLibrary::Apply(Shader& shader) const {
+  GLuint block = glGetUniformBlockIndex(shader.ID, "MaterialBlock");
+  if (block != GL_INVALID_INDEX)
+    glUniformBlockBinding(shader.ID, block, MATERIAL_UNIFORM_BINDING);
+  shader.setInt("texture_diffuse0", MATERIAL_DIFFUSE_MAP);
+  shader.setInt("texture_specular0", MATERIAL_SPECULAR_MAP);
+  shader.setInt("texture_normal0", MATERIAL_NORMAL_MAP);
+}
+
+void MaterialLibrary::Bind(uint32_t index) const {
+  if (index >= materials.size())
+    index = MATERIAL_DEFAULT;
+  const Material& material = materials[index];
+  glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_UNIFORM_BINDING, buffer, index * stride, sizeof(MaterialParameters));
+  for (int slot = 0; slot < MATERIAL_TEXTURE_SLOTS; slot++) {
+    glActiveTexture(GL_TEXTURE0 + slot);
+    glBindTexture(GL_TEXTURE_2D, material.textures[slot]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  Profiler::Get().CountStateChange(1 + MATERIAL_TEXTURE_SLOTS);
+}
+
+void MaterialLibrary::Record(CommandBuffer& commands, uint32_t index) const {
+  if (index >= materials.size())
+    index = MATERIAL_DEFAULT;
+  const Material& material = materials[index];
+  commands.BindUniformBuffer(MATERIAL_UNIFORM_BINDING, buffer, (uint32_t)(index * stride), (uint32_t)sizeof(MaterialParameters));
+  for (int slot = 0; slot < MATERIAL_TEXTURE_SLOTS; slot++)
+    commands.BindTexture((uint32_t)slot, material.textures[slot]);
+}
@@ -0,0 +1,246 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+const uint32_t NO_TRIANGLE = 0xFFFFFFFF;
+
+inline const glm::vec3& vertexPosition(const glm::vec3* positions, size_t stride, unsigned int vertex) {
+    return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const unsigned char*>(positions) + vertex * stride);
+}
+
+// bounding sphere and normal cone of a meshlet's triangles
+MeshletBounds computeBounds(const glm::vec3* positions, size_t stride, const unsigned int* indices, uint32_t triangleCount) {
+    AABB box = AABB::Empty();
+    for (uint32_t i = 0; i < triangleCount * 3; i++)
+      box.Grow(vertexPosition(positions, stride, indices[i]));
+
+    MeshletBounds bounds;
+    bounds.center = box.Center();
+    bounds.radius = 0.0f;
+    for (uint32_t i = 0; i < triangleCount * 3; i++)
+      bounds.radius = std::max(bounds.radius, glm::length(vertexPosition(positions, stride, indices[i]) - bounds.center));
+
+    // without a cone the test can never pass: the axis is zero and the cutoff 1
+    bounds.coneAxis = glm::vec3(0.0f);
+    bounds.coneCutoff = 1.0f;
+
+    glm::vec3 normals[MESHLET_MAX_TRIANGLES];
+    uint32_t normalCount = 0;
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+      const glm::vec3& a = vertexPosition(positions, stride, indices[t * 3]);
+      const glm::vec3& b = vertexPosition(positions, stride, indices[t * 3 + 1]);
+      const glm::vec3& c = vertexPosition(positions, stride, indices[t * 3 + 2]);
+      glm::vec3 normal = glm::cross(b - a, c - a);
+      float length = glm::length(normal);
+      // degenerate triangles face nowhere and never show
+      if (length <= 0.0f)
+        continue;
+      normals[normalCount++] = normal / length;
+      axis += normal / length;
+    }
+
+    float axisLength = glm::length(axis);
+    if (normalCount == 0 || axisLength < 1e-6f)
+      return bounds;
+    axis /= axisLength;
+
+    float minDot = 1.0f;
+    for (uint32_t i = 0; i < normalCount; i++)
+      minDot = std::min(minDot, glm::dot(normals[i], axis));
+    // spread over more than a hemisphere, some triangle faces every eye
+    if (minDot <= 0.0f)
+      return bounds;
+
+    // every normal is within acos(minDot) of the axis, so all of them face away once the view direction is
+    // within 90 degrees minus that of the axis: cos(90 - angle) = sin(angle)
+    bounds.coneAxis = axis;
+    bounds.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    return bounds;
+}
+
+} // namespace
+
+void BuildMeshlets(const glm::vec3* positions, size_t stride, size_t vertexCount, std::vector<unsigned int>& indices,
+                   std::vector<Meshlet>& meshlets, std::vector<MeshletBounds>& bounds) {
+    meshlets.clear();
+    bounds.clear();
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || vertexCount == 0)
+      return;
+
+    // triangles around every vertex
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+      adjacencyOffsets[indices[i] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+      adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<uint32_t> liveTriangles(vertexCount);  // triangles around the vertex not in a meshlet yet
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++) {
+      for (int k = 0; k < 3; k++) {
+        unsigned int vertex = indices[t * 3 + k];
+        adjacency[fill[vertex]++] = (uint32_t)t;
+        liveTriangles[vertex]++;
+      }
+    }
+
+    std::vector<glm::vec3> centroids(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+      centroids[t] = (vertexPosition(positions, stride, indices[t * 3]) + vertexPosition(positions, stride, indices[t * 3 + 1]) +
+                      vertexPosition(positions, stride, indices[t * 3 + 2])) / 3.0f;
+    }
+
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> vertexMeshlet(vertexCount, 0xFFFFFFFF);  // last meshlet that took the vertex
+    std::vector<uint32_t> meshletVertices;
+    meshletVertices.reserve(MESHLET_MAX_VERTICES);
+    std::vector<unsigned int> ordered;
+    ordered.reserve(triangleCount * 3);
+
+    Meshlet current = {0, 0, 0};
+    glm::vec3 centroidSum(0.0f);
+    size_t scan = 0;  // no triangle before it is left
+
+    for (size_t done = 0; done < triangleCount; done++) {
+      uint32_t meshletIndex = (uint32_t)meshlets.size();
+      bool full = current.triangleCount >= MESHLET_MAX_TRIANGLES;
+      glm::vec3 center = current.triangleCount > 0 ? centroidSum / (float)current.triangleCount : glm::vec3(0.0f);
+
+      // the neighbour that adds the fewest vertices. On a tie the one closest to the meshlet's center wins,
+      // weighted by how many triangles its vertices still have: finishing off vertices keeps them out of the
+      // next meshlet. A neighbour that doesn't fit seeds the next meshlet, so consecutive meshlets stay close.
+      uint32_t best = NO_TRIANGLE;
+      uint32_t neighbour = NO_TRIANGLE;
+      int bestAdded = 4;
+      float bestScore = FLT_MAX;
+      for (uint32_t vertex : meshletVertices) {
+        if (liveTriangles[vertex] == 0)
+          continue;
+        for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+          uint32_t triangle = adjacency[a];
+          if (emitted[triangle])
+            continue;
+          neighbour = triangle;
+          if (full)
+            break;
+
+          int added = 0;
+          for (int k = 0; k < 3; k++)
+            added += vertexMeshlet[indices[triangle * 3 + k]] != meshletIndex ? 1 : 0;
+          if (current.vertexCount + added > MESHLET_MAX_VERTICES)
+            continue;
+          glm::vec3 offset = centroids[triangle] - center;
+          uint32_t live = liveTriangles[indices[triangle * 3]] + liveTriangles[indices[triangle * 3 + 1]] +
+                          liveTriangles[indices[triangle * 3 + 2]];
+          float score = glm::dot(offset, offset) * (float)live;
+          if (added < bestAdded || (added == bestAdded && score < bestScore)) {
+            best = triangle;
+            bestAdded = added;
+            bestScore = score;
+          }
+        }
+        if (full && neighbour != NO_TRIANGLE)
+          break;
+      }
+
+      if (best == NO_TRIANGLE) {
+        if (current.triangleCount > 0) {
+          meshlets.push_back(current);
+          bounds.push_back(computeBounds(positions, stride, &ordered[current.firstIndex], current.triangleCount));
+          meshletIndex++;
+        }
+        current = {(uint32_t)ordered.size(), 0, 0};
+        centroidSum = glm::vec3(0.0f);
+        meshletVertices.clear();
+
+        if (neighbour == NO_TRIANGLE) {
+          while (emitted[scan])
+            scan++;
+          neighbour = (uint32_t)scan;
+        }
+        best = neighbour;
+      }
+
+      for (int k = 0; k < 3; k++) {
+        unsigned int vertex = indices[best * 3 + k];
+        ordered.push_back(vertex);
+        liveTriangles[vertex]--;
+        if (vertexMeshlet[vertex] != meshletIndex) {
+          vertexMeshlet[vertex] = meshletIndex;
+          meshletVertices.push_back(vertex);
+          current.vertexCount++;
+        }
+      }
+      emitted[best] = 1;
+      current.triangleCount++;
+      centroidSum += centroids[best];
+    }
+
+    meshlets.push_back(current);
+    bounds.push_back(computeBounds(positions, stride, &ordered[current.firstIndex], current.triangleCount));
+    indices.swap(ordered);
+}
+
+bool IsClosedMesh(const glm::vec3* positions, size_t stride, size_t vertexCount, const std::vector<unsigned int>& indices) {
+    if (indices.empty() || vertexCount == 0)
+      return false;
+
+    // vertices split for their normals or texture coordinates still share their edges
+    std::vector<uint32_t> order(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+      order[v] = (uint32_t)v;
+    auto less = [&](uint32_t a, uint32_t b) {
+      const glm::vec3& p = vertexPosition(positions, stride, a);
+      const glm::vec3& q = vertexPosition(positions, stride, b);
+      return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    std::vector<uint32_t> welded(vertexCount);
+    uint32_t id = 0;
+    for (size_t i = 0; i < vertexCount; i++) {
+      if (i > 0 && less(order[i - 1], order[i]))
+        id++;
+      welded[order[i]] = id;
+    }
+
+    // every directed edge once, and its reverse once as well
+    std::vector<uint64_t> edges;
+    edges.reserve(indices.size());
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t a = welded[indices[t + k]];
+        uint32_t b = welded[indices[t + (k + 1) % 3]];
+        edges.push_back((uint64_t)a << 32 | b);
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size(); i++) {
+      if (i > 0 && edges[i] == edges[i - 1])
+        return false;
+      uint64_t reverse = edges[i] << 32 | edges[i] >> 32;
+      if (!std::binary_search(edges.begin(), edges.end(), reverse))
+        return false;
+    }
+    return true;
+}
+
+MeshletView MeshletView::FromTransform(const Frustum& frustum, const glm::vec3& eye, const glm::mat4& transform, bool twoSided) {
+    MeshletView view;
+    // a world space plane p holds the points x with dot(p, transform * x) = 0, so it becomes transpose(transform) * p,
+    // normalized again so distances compare with the radii in mesh units
+    glm::mat4 transposed = glm::transpose(transform);
+    for (int i = 0; i < 6; i++) {
+      glm::vec4 plane = transposed * frustum.planes[i];
+      float length = glm::length(glm::vec3(plane));
+      view.planes[i] = length > 0.0f ? plane / length : plane;
+    }
+    view.eye = glm::vec3(glm::inverse(transform) * glm::vec4(eye, 1.0f));
+    view.cones = !twoSided && glm::determinant(glm::mat3(transform)) > 0.0f;
+    return view;
+}
@@ -1,6 +1,10 @@
 #include "model.h"
+#include "material.h"
 #include "mesh.h"
+#include "morph_targets.h"
+#include "profiler.h"
 #include "shader.h"
+#include "shader_variants.h"
 #include "stb_image.h"
 
 #include <assimp/Importer.hpp>
@@ -9,6 +13,8 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <assimp/types.h>
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -16,9 +22,7 @@
 #include <string>
 #include <vector>
 
-unsigned int TextureFromFile(const char *path, const std::string &directory);
-
-Model::Model(std::string const &path, bool gamma) : gammaCorrection(gamma) {
+Model::Model(std::string const &path, bool gamma) : bounds(AABB::Empty()), gammaCorrection(gamma) {
   std::cout << "Model constructor called with path: " << path << std::endl;
   try {
     loadModel(path);
@@ -36,14 +40,30 @@ Model::Model(std::string const &path, bool gamma) : gammaCorrection(gamma) {
 
 
 void Model::Draw(Shader &shader){
+  Draw(shader, glm::mat4(1.0f));
+}
+
+void Model::Draw(Shader &shader, const glm::mat4 &transform, int boneOffset){
   if (meshes.empty()) {
     std::cerr << "WARNING::MODEL::No meshes to draw" << std::endl;
     return;
   }
-  
+
+  // only recomputes nodes whose transform changed since the last draw
+  nodes.Update();
+  MaterialLibrary::Get().Apply(shader);
+  shader.setInt("boneOffset", boneOffset);
+
   try {
     for (unsigned int i=0; i< meshes.size(); i++) {
-      meshes[i].Draw(shader);
+      // meshes added by hand have no node and use the transform as is, skinned ones get placed by their bones
+      if (boneOffset >= 0 && meshes[i].skinned)
+        shader.setMat4("model", transform);
+      else if (i < meshNodes.size())
+        shader.setMat4("model", transform * nodes.GetWorld(meshNodes[i]));
+      else
+        shader.setMat4("model", transform);
+      meshes[i].Draw();
     }
   }
   catch (const std::exception& e) {
@@ -65,7 +85,8 @@ void Model::loadModel(std::string const &path){
   std::cout << "Creating Assimp importer..." << std::endl;
   Assimp::Importer importer;
   std::cout << "Reading file with Assimp..." << std::endl;
-  const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+  const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs |
+                                                 aiProcess_LimitBoneWeights | aiProcess_CalcTangentSpace);
   std::cout << "Assimp ReadFile completed" << std::endl;
 
   if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode){
@@ -87,7 +108,23 @@ void Model::loadModel(std::string const &path){
   
   try {
     std::cout << "Processing root node..." << std::endl;
-    processNode(scene->mRootNode, scene);
+    std::vector<std::pair<aiMesh*, uint32_t>> meshQueue;
+    processNode(scene->mRootNode, scene, TRANSFORM_NO_PARENT, meshQueue);
+    for (const std::pair<aiMesh*, uint32_t> &queued : meshQueue) {
+      meshes.push_back(processMesh(queued.first, scene, queued.second));
+      meshNodes.push_back(queued.second);
+    }
+    for (unsigned int i = 0; i < scene->mNumAnimations; i++) {
+      ResampledClip resampled = loadAnimation(scene->mAnimations[i]);
+      animations.push_back(CompressAnimation(resampled));
+      const AnimationClip &clip = animations.back();
+      size_t rawBytes = (resampled.rotations.size() + resampled.translations.size() + resampled.scales.size()) * sizeof(float);
+      std::cout << "CompressAnimation: " << clip.name << ", " << clip.keyFrames.size() << "/" << clip.frameCount << " frames kept, "
+                << rawBytes << " -> " << clip.Bytes() << " bytes" << std::endl;
+    }
+    nodes.Update();
+    ComputeBounds();
+    BuildOccluder();
     std::cout << "Node processing completed" << std::endl;
   }
   catch (const std::exception& e) {
@@ -97,23 +134,100 @@ void Model::loadModel(std::string const &path){
   }
 }
 
-void Model::processNode(aiNode *node, const aiScene *scene)
+int Model::FindNode(const std::string &name) const {
+  for (size_t i = 0; i < nodeNames.size(); i++) {
+    if (nodeNames[i] == name)
+      return (int)i;
+  }
+  return -1;
+}
+
+void Model::ComputeBounds() {
+  nodes.Update();
+  bounds = AABB::Empty();
+  for (size_t i = 0; i < meshes.size(); i++) {
+    if (i < meshNodes.size())
+      bounds.Grow(TransformAABB(meshes[i].bounds, nodes.GetWorld(meshNodes[i])));
+    else
+      bounds.Grow(meshes[i].bounds);
+  }
+}
+
+void Model::BuildOccluder(size_t maxTriangles) {
+  occluder.positions.clear();
+  occluder.indices.clear();
+
+  size_t triangles = 0;
+  for (const Mesh &mesh : meshes)
+    triangles += mesh.indices.size() / 3;
+  if (triangles == 0 || triangles > maxTriangles)
+    return;
+
+  nodes.Update();
+  for (size_t i = 0; i < meshes.size(); i++) {
+    glm::mat4 transform = i < meshNodes.size() ? nodes.GetWorld(meshNodes[i]) : glm::mat4(1.0f);
+    unsigned int first = (unsigned int)occluder.positions.size();
+    for (const Vertex &vertex : meshes[i].vertices)
+      occluder.positions.push_back(glm::vec3(transform * glm::vec4(vertex.Position, 1.0f)));
+    for (unsigned int index : meshes[i].indices)
+      occluder.indices.push_back(first + index);
+  }
+}
+
+bool Model::Raycast(const Ray &ray, const glm::mat4 &transform, float maxT, ModelHit &hit) const {
+  bool found = false;
+  for (size_t i = 0; i < meshes.size(); i++) {
+    if (meshes[i].bvh.Empty())
+      continue;
+
+    // move the ray into mesh space, the direction keeps its scale so distances stay comparable
+    glm::mat4 meshTransform = i < meshNodes.size() ? transform * nodes.GetWorld(meshNodes[i]) : transform;
+    glm::mat4 toMesh = glm::inverse(meshTransform);
+    Ray local(glm::vec3(toMesh * glm::vec4(ray.origin, 1.0f)), glm::vec3(toMesh * glm::vec4(ray.direction, 0.0f)));
+
+    TriangleHit triangleHit;
+    if (meshes[i].bvh.Raycast(local, maxT, triangleHit)) {
+      maxT = triangleHit.t;
+      hit.mesh = (uint32_t)i;
+      hit.triangle = triangleHit.triangle;
+      hit.u = triangleHit.u;
+      hit.v = triangleHit.v;
+      hit.distance = triangleHit.t;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void Model::SetNodeTransform(uint32_t node, const glm::mat4 &local) {
+  if (node >= nodes.Size()) {
+    std::cerr << "WARNING::MODEL::Invalid node index " << node << std::endl;
+    return;
+  }
+  nodes.SetLocal(node, local);
+}
+
+void Model::processNode(aiNode *node, const aiScene *scene, uint32_t parentNode, std::vector<std::pair<aiMesh*, uint32_t>> &meshQueue)
 {
-    // process all the node's meshes (if any)
+    // keep the node's transform, the recursion is depth first so the hierarchy stays parent sorted
+    uint32_t nodeIndex = nodes.AddNode(parentNode, AssimpToGlm(node->mTransformation));
+    nodeNames.push_back(node->mName.C_Str());
+
+    // queue all the node's meshes (if any)
     for(unsigned int i = 0; i < node->mNumMeshes; i++)
     {
         aiMesh *mesh = scene->mMeshes[node->mMeshes[i]]; 
-        meshes.push_back(processMesh(mesh, scene));			
+        meshQueue.push_back(std::make_pair(mesh, nodeIndex));
     }
     // then do the same for each of its children
     for(unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        Model::processNode(node->mChildren[i], scene);
+        Model::processNode(node->mChildren[i], scene, nodeIndex, meshQueue);
     }
 }  
 
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
+Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene, uint32_t meshNode) {
   std::cout << "processMesh: Starting..." << std::endl;
   
   if (!mesh) {
@@ -126,6 +240,8 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
   std::vector<Vertex> vertices;
   std::vector<unsigned int> indices;
   std::vector<Texture> textures;
+  uint32_t materialIndex = MATERIAL_DEFAULT;
+  bool twoSided = false;
 
   // Check if mesh has vertices
   if (mesh->mNumVertices == 0) {
@@ -141,7 +257,7 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
       std::cout << "processMesh: Processing vertex " << i << " of " << mesh->mNumVertices << std::endl;
     }
     
-    Vertex vertex;
+    Vertex vertex = {};
     glm::vec3 vector;
     
     // Check if mesh vertices are valid
@@ -248,6 +364,7 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
   }
 
   std::cout << "processMesh: Finished processing indices" << std::endl;
+  bool skinned = processBones(mesh, scene, meshNode, vertices);
   std::cout << "processMesh: Processing materials..." << std::endl;
 
   // process material from assimp data struct to our defined OpenGL data structure
@@ -280,17 +397,319 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
       // load specular map texture
       std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
       textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-    
+
+      // OBJ files list normal maps as bump maps, which assimp reads as height maps
+      std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_NORMALS, "texture_normal");
+      if (normalMaps.empty())
+        normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+      textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+
+      // meshes sharing an assimp material share its parameter block
+      if (materials.size() < scene->mNumMaterials)
+        materials.resize(scene->mNumMaterials, MATERIAL_NONE);
+      if (materials[mesh->mMaterialIndex] == MATERIAL_NONE)
+        materials[mesh->mMaterialIndex] = addMaterial(material, diffuseMaps, specularMaps, normalMaps);
+      materialIndex = materials[mesh->mMaterialIndex];
+
+      // leaves, cloth and the like are seen from both sides and never get their back faces culled
+      int twoSidedFlag = 0;
+      if (material->Get(AI_MATKEY_TWOSIDED, twoSidedFlag) == AI_SUCCESS)
+        twoSided = twoSidedFlag != 0;
     }
     catch (const std::exception& e) {
       std::cout << "WARNING::MODEL::Error loading textures: " << e.what() << std::endl;
     }
   }
 
+  MeshMorphTargets morphTargets = processMorphTargets(mesh, vertices);
+
   std::cout << "processMesh: Creating and returning mesh..." << std::endl;
   std::cout << "processMesh: Vertices: " << vertices.size() << ", Indices: " << indices.size() << ", Textures: " << textures.size() << std::endl;
   
-  return Mesh(vertices, indices, textures);
+  Mesh result(vertices, indices, textures, materialIndex, skinned, twoSided);
+  result.morphTargets = morphTargets;
+  return result;
+}
+
+MeshMorphTargets Model::processMorphTargets(aiMesh *mesh, const std::vector<Vertex> &vertices) {
+  MeshMorphTargets morphs;
+  if (mesh->mNumAnimMeshes == 0 || mesh->mAnimMeshes == nullptr)
+    return morphs;
+
+  morphs.firstTarget = (uint32_t)morphTargetNames.size();
+  morphs.targetCount = std::min(mesh->mNumAnimMeshes, (unsigned int)MORPH_MAX_MESH_TARGETS);
+  if (mesh->mNumAnimMeshes > MORPH_MAX_MESH_TARGETS)
+    std::cout << "WARNING::MODEL::Mesh has " << mesh->mNumAnimMeshes << " morph targets, only the first " << MORPH_MAX_MESH_TARGETS << " are kept" << std::endl;
+
+  // assimp stores whole target meshes, keep only the vertices a target actually moves
+  std::vector<MorphDelta> deltas;
+  for (uint32_t t = 0; t < morphs.targetCount; t++) {
+    const aiAnimMesh *target = mesh->mAnimMeshes[t];
+    // every target keeps its index, channels refer to them by position
+    morphTargetNames.push_back(target && target->mName.length > 0 ? target->mName.C_Str() : std::string(mesh->mName.C_Str()) + "." + std::to_string(t));
+    morphWeights.push_back(target ? target->mWeight : 0.0f);
+    if (!target || target->mNumVertices != vertices.size()) {
+      std::cout << "WARNING::MODEL::Morph target " << morphTargetNames.back() << " doesn't match its mesh" << std::endl;
+      continue;
+    }
+
+    for (uint32_t v = 0; v < vertices.size(); v++) {
+      glm::vec3 position(0.0f), normal(0.0f);
+      if (target->HasPositions())
+        position = glm::vec3(target->mVertices[v].x, target->mVertices[v].y, target->mVertices[v].z) - vertices[v].Position;
+      if (target->HasNormals())
+        normal = glm::vec3(target->mNormals[v].x, target->mNormals[v].y, target->mNormals[v].z) - vertices[v].Normal;
+      if (glm::length(position) > MORPH_DELTA_EPSILON || glm::length(normal) > MORPH_DELTA_EPSILON)
+        deltas.push_back({v, t, position, normal});
+    }
+  }
+
+  // the shader walks one run of deltas per vertex
+  std::stable_sort(deltas.begin(), deltas.end(), [](const MorphDelta &a, const MorphDelta &b) { return a.vertex < b.vertex; });
+  morphs.rangeBase = MorphTargetLibrary::Get().Add(deltas, (uint32_t)vertices.size());
+  morphs.deltaCount = (uint32_t)deltas.size();
+  std::cout << "processMorphTargets: " << morphs.targetCount << " targets, " << deltas.size() << " deltas of "
+            << (size_t)morphs.targetCount * vertices.size() << " vertices" << std::endl;
+  return morphs;
+}
+
+bool Model::processBones(aiMesh *mesh, const aiScene *scene, uint32_t meshNode, std::vector<Vertex> &vertices) {
+  if (!mesh->HasBones()) {
+    if (!scene->HasAnimations())
+      return false;
+    uint32_t bone = findOrAddBone(meshNode, glm::mat4(1.0f));
+    for (Vertex &vertex : vertices) {
+      vertex.m_BoneIDs[0] = (int)bone;
+      vertex.m_Weights[0] = 1.0f;
+    }
+    return true;
+  }
+
+  for (unsigned int b = 0; b < mesh->mNumBones; b++) {
+    const aiBone *bone = mesh->mBones[b];
+    int node = FindNode(bone->mName.C_Str());
+    if (node < 0) {
+      std::cout << "WARNING::MODEL::Bone " << bone->mName.C_Str() << " has no node" << std::endl;
+      continue;
+    }
+    uint32_t index = findOrAddBone((uint32_t)node, AssimpToGlm(bone->mOffsetMatrix));
+
+    // aiProcess_LimitBoneWeights leaves at most MAX_BONE_INFLUENCE per vertex, keep the heaviest if not
+    for (unsigned int w = 0; w < bone->mNumWeights; w++) {
+      const aiVertexWeight &weight = bone->mWeights[w];
+      if (weight.mVertexId >= vertices.size())
+        continue;
+      Vertex &vertex = vertices[weight.mVertexId];
+      int slot = 0;
+      for (int i = 1; i < MAX_BONE_INFLUENCE; i++) {
+        if (vertex.m_Weights[i] < vertex.m_Weights[slot])
+          slot = i;
+      }
+      if (weight.mWeight > vertex.m_Weights[slot]) {
+        vertex.m_BoneIDs[slot] = (int)index;
+        vertex.m_Weights[slot] = weight.mWeight;
+      }
+    }
+  }
+
+  // weights have to add up to one, vertices no bone reached stay where the mesh's node puts them
+  uint32_t rigid = 0xFFFFFFFFu;
+  for (Vertex &vertex : vertices) {
+    float total = 0.0f;
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+      total += vertex.m_Weights[i];
+    if (total > 0.0f) {
+      for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+        vertex.m_Weights[i] /= total;
+    }
+    else {
+      if (rigid == 0xFFFFFFFFu)
+        rigid = findOrAddBone(meshNode, glm::mat4(1.0f));
+      vertex.m_BoneIDs[0] = (int)rigid;
+      vertex.m_Weights[0] = 1.0f;
+    }
+  }
+  return true;
+}
+
+uint32_t Model::findOrAddBone(uint32_t node, const glm::mat4 &offset) {
+  for (size_t i = 0; i < boneNodes.size(); i++) {
+    if (boneNodes[i] == node && boneOffsets[i] == offset)
+      return (uint32_t)i;
+  }
+  boneNodes.push_back(node);
+  boneOffsets.push_back(offset);
+  return (uint32_t)boneNodes.size() - 1;
+}
+
+// value of an assimp key track at time (in ticks), linear between keys and clamped at both ends
+template <typename Key, typename Value, typename Lerp>
+static Value sampleKeys(const Key *keys, unsigned int count, double time, Value fallback, Lerp lerp) {
+  if (count == 0)
+    return fallback;
+  if (count == 1 || time <= keys[0].mTime)
+    return keys[0].mValue;
+  unsigned int next = 1;
+  while (next < count - 1 && keys[next].mTime < time)
+    next++;
+  const Key &a = keys[next - 1];
+  const Key &b = keys[next];
+  if (time >= b.mTime)
+    return b.mValue;
+  return lerp(a.mValue, b.mValue, (float)((time - a.mTime) / (b.mTime - a.mTime)));
+}
+
+// weight a morph key gives a target, targets the key doesn't list are at 0
+// seconds into the clip of a resampled frame, the frames split the duration evenly so the last one sits at it
+static double frameSeconds(const ResampledClip &clip, uint32_t frame) {
+  return clip.frameCount > 1 ? (double)clip.duration * frame / (clip.frameCount - 1) : 0.0;
+}
+
+static float morphKeyWeight(const aiMeshMorphKey &key, uint32_t target) {
+  for (unsigned int i = 0; i < key.mNumValuesAndWeights; i++) {
+    if (key.mValues[i] == target)
+      return (float)key.mWeights[i];
+  }
+  return 0.0f;
+}
+
+// weights of targetCount targets of a morph channel at time (in ticks), linear between keys and clamped at both ends
+static void sampleMorphKeys(const aiMeshMorphAnim *channel, double time, uint32_t targetCount, float *weights) {
+  const aiMeshMorphKey *keys = channel->mKeys;
+  unsigned int next = 1;
+  while (next < channel->mNumKeys - 1 && keys[next].mTime < time)
+    next++;
+  const aiMeshMorphKey &a = keys[channel->mNumKeys == 1 ? 0 : next - 1];
+  const aiMeshMorphKey &b = keys[channel->mNumKeys == 1 ? 0 : next];
+  float blend = 0.0f;
+  if (b.mTime > a.mTime)
+    blend = (float)std::min(std::max((time - a.mTime) / (b.mTime - a.mTime), 0.0), 1.0);
+  for (uint32_t t = 0; t < targetCount; t++) {
+    float from = morphKeyWeight(a, t);
+    weights[t] = from + (morphKeyWeight(b, t) - from) * blend;
+  }
+}
+
+ResampledClip Model::loadAnimation(const aiAnimation *animation) {
+  ResampledClip clip;
+  clip.name = animation->mName.C_Str();
+  double ticksPerSecond = animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+  clip.duration = (float)(animation->mDuration / ticksPerSecond);
+  clip.frameCount = (uint32_t)std::ceil(clip.duration * ANIMATION_SAMPLE_RATE) + 1;
+
+  std::vector<const aiNodeAnim*> channels;
+  for (unsigned int i = 0; i < animation->mNumChannels; i++) {
+    int node = FindNode(animation->mChannels[i]->mNodeName.C_Str());
+    if (node < 0)
+      continue;
+    channels.push_back(animation->mChannels[i]);
+    clip.trackNodes.push_back((uint32_t)node);
+  }
+  size_t stride = (channels.size() + 3) & ~(size_t)3;
+  clip.trackStride = (uint32_t)stride;
+
+  // padding lanes hold the identity so they interpolate to something harmless
+  clip.rotations.assign(clip.frameCount * stride * 4, 0.0f);
+  clip.translations.assign(clip.frameCount * stride * 3, 0.0f);
+  clip.scales.assign(clip.frameCount * stride * 3, 1.0f);
+  for (uint32_t frame = 0; frame < clip.frameCount; frame++) {
+    float *rotations = &clip.rotations[frame * stride * 4];
+    for (size_t track = channels.size(); track < stride; track++)
+      rotations[stride * 3 + track] = 1.0f;
+
+    double time = frameSeconds(clip, frame) * ticksPerSecond;
+    for (size_t track = 0; track < channels.size(); track++) {
+      const aiNodeAnim *channel = channels[track];
+      aiQuaternion rotation = sampleKeys(channel->mRotationKeys, channel->mNumRotationKeys, time, aiQuaternion(),
+          [](const aiQuaternion &a, const aiQuaternion &b, float t) {
+            aiQuaternion result;
+            aiQuaternion::Interpolate(result, a, b, t);
+            return result;
+          });
+      aiVector3D position = sampleKeys(channel->mPositionKeys, channel->mNumPositionKeys, time, aiVector3D(0.0f),
+          [](const aiVector3D &a, const aiVector3D &b, float t) { return a + (b - a) * t; });
+      aiVector3D scale = sampleKeys(channel->mScalingKeys, channel->mNumScalingKeys, time, aiVector3D(1.0f),
+          [](const aiVector3D &a, const aiVector3D &b, float t) { return a + (b - a) * t; });
+
+      // keep consecutive frames on the same hemisphere, the sampler only blends neighbours
+      if (frame > 0) {
+        const float *previous = &clip.rotations[(frame - 1) * stride * 4];
+        float dot = previous[track] * rotation.x + previous[stride + track] * rotation.y +
+                    previous[stride * 2 + track] * rotation.z + previous[stride * 3 + track] * rotation.w;
+        if (dot < 0.0f)
+          rotation = aiQuaternion(-rotation.w, -rotation.x, -rotation.y, -rotation.z);
+      }
+      rotations[track] = rotation.x;
+      rotations[stride + track] = rotation.y;
+      rotations[stride * 2 + track] = rotation.z;
+      rotations[stride * 3 + track] = rotation.w;
+
+      float *translations = &clip.translations[frame * stride * 3];
+      translations[track] = position.x;
+      translations[stride + track] = position.y;
+      translations[stride * 2 + track] = position.z;
+      float *scales = &clip.scales[frame * stride * 3];
+      scales[track] = scale.x;
+      scales[stride + track] = scale.y;
+      scales[stride * 2 + track] = scale.z;
+    }
+  }
+
+  // morph channels become dense weights of every target of the model on every frame, targets no channel
+  // drives keep their default weight
+  clip.morphTargetCount = (uint32_t)morphTargetNames.size();
+  for (unsigned int c = 0; c < animation->mNumMorphMeshChannels; c++) {
+    const aiMeshMorphAnim *channel = animation->mMorphMeshChannels[c];
+    if (!channel || channel->mNumKeys == 0)
+      continue;
+    // channels are named after the node of their meshes, some importers append "*" and a mesh index
+    std::string name = channel->mName.C_Str();
+    name = name.substr(0, name.find('*'));
+    for (size_t m = 0; m < meshes.size() && m < meshNodes.size(); m++) {
+      const MeshMorphTargets &targets = meshes[m].morphTargets;
+      if (targets.targetCount == 0 || nodeNames[meshNodes[m]] != name)
+        continue;
+      if (clip.morphWeights.empty()) {
+        for (uint32_t frame = 0; frame < clip.frameCount; frame++)
+          clip.morphWeights.insert(clip.morphWeights.end(), morphWeights.begin(), morphWeights.end());
+      }
+      for (uint32_t frame = 0; frame < clip.frameCount; frame++) {
+        double time = frameSeconds(clip, frame) * ticksPerSecond;
+        sampleMorphKeys(channel, time, targets.targetCount, &clip.morphWeights[frame * clip.morphTargetCount + targets.firstTarget]);
+      }
+    }
+  }
+
+  std::cout << "loadAnimation: " << clip.name << ", " << clip.duration << " s, " << channels.size() << " tracks"
+            << (clip.morphWeights.empty() ? "" : ", morph weights") << std::endl;
+  return clip;
+}
+
+uint32_t Model::addMaterial(aiMaterial *mat, const std::vector<Texture> &diffuseMaps, const std::vector<Texture> &specularMaps,
+                            const std::vector<Texture> &normalMaps) {
+  Material material;
+  aiColor3D color;
+  float value;
+  if (mat->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
+    material.parameters.diffuse = glm::vec4(color.r, color.g, color.b, 1.0f);
+  if (mat->Get(AI_MATKEY_OPACITY, value) == AI_SUCCESS)
+    material.parameters.diffuse.w = value;
+  if (mat->Get(AI_MATKEY_COLOR_SPECULAR, color) == AI_SUCCESS)
+    material.parameters.specular = glm::vec4(color.r, color.g, color.b, material.parameters.specular.w);
+  // files without a specular exponent get 0, which would light the whole hemisphere
+  if (mat->Get(AI_MATKEY_SHININESS, value) == AI_SUCCESS && value > 0.0f)
+    material.parameters.specular.w = value;
+
+  // the first map of each kind, the shader samples one
+  if (!diffuseMaps.empty())
+    material.textures[MATERIAL_DIFFUSE_MAP] = diffuseMaps[0].id;
+  if (!specularMaps.empty())
+    material.textures[MATERIAL_SPECULAR_MAP] = specularMaps[0].id;
+  if (!normalMaps.empty()) {
+    material.textures[MATERIAL_NORMAL_MAP] = normalMaps[0].id;
+    material.features |= SHADER_NORMAL_MAP;
+  }
+  return MaterialLibrary::Get().Add(material);
 }
 
 std::vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName) {
@@ -407,6 +826,8 @@ unsigned int TextureFromFile(const char *path, const std::string &directory){
     glBindTexture(GL_TEXTURE_2D, textureID);
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    // full mip chain adds roughly a third on top of the base level
+    Profiler::Get().TrackTextureMemory((long long)width * height * nrComponents * 4 / 3);
 
     // Set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
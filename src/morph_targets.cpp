@@ -0,0 +1,146 @@
+#include "morph_targets.h"
+#include "profiler.h"
+#include "shader.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+MorphTargetLibrary& MorphTargetLibrary::Get() {
+  static MorphTargetLibrary library;
+  return library;
+}
+
+void MorphTargetLibrary::Init() {
+  createBuffer(rangeBuffer, GL_RG32UI);
+  createBuffer(deltaBuffer, GL_RGBA16F);
+  createBuffer(weightBuffer, GL_R32F);
+  meshesDirty = true;
+  weightsResized = true;
+  Upload();
+}
+
+void MorphTargetLibrary::Shutdown() {
+  destroyBuffer(rangeBuffer);
+  destroyBuffer(deltaBuffer);
+  destroyBuffer(weightBuffer);
+}
+
+uint32_t MorphTargetLibrary::Add(const std::vector<MorphDelta>& meshDeltas, uint32_t vertexCount) {
+  uint32_t rangeBase = (uint32_t)(ranges.size() / 2);
+  ranges.resize(ranges.size() + vertexCount * 2, 0);
+
+  // deltas come sorted by vertex, so every vertex's deltas are one run
+  for (size_t i = 0; i < meshDeltas.size(); i++) {
+    const MorphDelta& delta = meshDeltas[i];
+    if (delta.vertex >= vertexCount)
+      continue;
+    uint32_t* range = &ranges[(rangeBase + delta.vertex) * 2];
+    if (range[1] == 0)
+      range[0] = (uint32_t)(deltas.size() / 8);
+    range[1]++;
+
+    uint16_t packed[8] = {glm::packHalf1x16(delta.position.x), glm::packHalf1x16(delta.position.y),
+                          glm::packHalf1x16(delta.position.z), glm::packHalf1x16((float)delta.target),
+                          glm::packHalf1x16(delta.normal.x), glm::packHalf1x16(delta.normal.y),
+                          glm::packHalf1x16(delta.normal.z), 0};
+    deltas.insert(deltas.end(), packed, packed + 8);
+  }
+  meshesDirty = true;
+  return rangeBase;
+}
+
+uint32_t MorphTargetLibrary::Allocate(const float* defaults, size_t count) {
+  uint32_t offset = (uint32_t)weights.size();
+  weights.insert(weights.end(), defaults, defaults + count);
+  weightsResized = true;
+  instanceCount++;
+  return offset;
+}
+
+void MorphTargetLibrary::SetWeights(uint32_t offset, const float* values, size_t count) {
+  if (offset + count > weights.size() || std::memcmp(&weights[offset], values, count * sizeof(float)) == 0)
+    return;
+
+  std::memcpy(&weights[offset], values, count * sizeof(float));
+  if (dirtyBegin == dirtyEnd) {
+    dirtyBegin = offset;
+    dirtyEnd = offset + count;
+  }
+  else {
+    dirtyBegin = std::min(dirtyBegin, (size_t)offset);
+    dirtyEnd = std::max(dirtyEnd, offset + count);
+  }
+}
+
+void MorphTargetLibrary::Upload() {
+  uploadedWeights = 0;
+  if (!weightBuffer.buffer)
+    return;
+
+  if (meshesDirty) {
+    uploadAll(rangeBuffer, ranges.data(), ranges.size() * sizeof(uint32_t));
+    uploadAll(deltaBuffer, deltas.data(), deltas.size() * sizeof(uint16_t));
+    meshesDirty = false;
+  }
+
+  if (weightsResized) {
+    uploadAll(weightBuffer, weights.data(), weights.size() * sizeof(float));
+    uploadedWeights = weights.size();
+    weightsResized = false;
+  }
+  else if (dirtyEnd > dirtyBegin) {
+    // only the span of instances whose weights moved, a face talking doesn't re-upload the crowd around it
+    glBindBuffer(GL_TEXTURE_BUFFER, weightBuffer.buffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, dirtyBegin * sizeof(float), (dirtyEnd - dirtyBegin) * sizeof(float), &weights[dirtyBegin]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    uploadedWeights = dirtyEnd - dirtyBegin;
+  }
+  dirtyBegin = dirtyEnd = 0;
+
+  glActiveTexture(GL_TEXTURE0 + MORPH_RANGE_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, rangeBuffer.texture);
+  glActiveTexture(GL_TEXTURE0 + MORPH_DELTA_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, deltaBuffer.texture);
+  glActiveTexture(GL_TEXTURE0 + MORPH_WEIGHT_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, weightBuffer.texture);
+  glActiveTexture(GL_TEXTURE0);
+  Profiler::Get().CountStateChange(3);
+}
+
+void MorphTargetLibrary::Apply(Shader& shader) const {
+  shader.setInt("morphRanges", MORPH_RANGE_TEXTURE_UNIT);
+  shader.setInt("morphDeltas", MORPH_DELTA_TEXTURE_UNIT);
+  shader.setInt("morphWeights", MORPH_WEIGHT_TEXTURE_UNIT);
+}
+
+void MorphTargetLibrary::createBuffer(Buffer& buffer, GLenum format) {
+  glGenBuffers(1, &buffer.buffer);
+  glGenTextures(1, &buffer.texture);
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer.buffer);
+  glBindTexture(GL_TEXTURE_BUFFER, buffer.texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, format, buffer.buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  buffer.bytes = 0;
+}
+
+void MorphTargetLibrary::destroyBuffer(Buffer& buffer) {
+  if (buffer.buffer)
+    glDeleteBuffers(1, &buffer.buffer);
+  if (buffer.texture)
+    glDeleteTextures(1, &buffer.texture);
+  Profiler::Get().TrackBufferMemory(-(long long)buffer.bytes);
+  buffer = Buffer();
+}
+
+void MorphTargetLibrary::uploadAll(Buffer& buffer, const void* data, size_t bytes) {
+  // an empty buffer still gets one texel so the texture stays complete
+  static const uint32_t empty[4] = {};
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer.buffer);
+  glBufferData(GL_TEXTURE_BUFFER, bytes > 0 ? bytes : sizeof(empty), bytes > 0 ? data : empty, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  Profiler::Get().TrackBufferMemory((long long)bytes - (long long)buffer.bytes);
+  buffer.bytes = bytes;
+}
@@ -0,0 +1,302 @@
+#include "occlusion.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE 1
+#include <emmintrin.h>
+#endif
+
+void OcclusionCuller::Init(int bufferWidth, int bufferHeight) {
+  width = (std::max(bufferWidth, 4) + 3) & ~3;
+  height = std::max(bufferHeight, 1);
+
+  // every level halves the previous one (rounding up) down to a single texel
+  levels.clear();
+  levelWidths.clear();
+  levelHeights.clear();
+  int levelWidth = width, levelHeight = height;
+  while (true) {
+    levels.push_back(std::vector<float>((size_t)levelWidth * levelHeight, 1.0f));
+    levelWidths.push_back(levelWidth);
+    levelHeights.push_back(levelHeight);
+    if (levelWidth == 1 && levelHeight == 1)
+      break;
+    levelWidth = (levelWidth + 1) / 2;
+    levelHeight = (levelHeight + 1) / 2;
+  }
+
+  threadTriangles.resize(JobSystem::Get().ThreadCount());
+  threadClip.resize(JobSystem::Get().ThreadCount());
+}
+
+void OcclusionCuller::BeginFrame(const glm::mat4& matrix) {
+  viewProjection = matrix;
+  occluders.clear();
+  for (std::vector<ScreenTriangle>& triangles : threadTriangles)
+    triangles.clear();
+  std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+}
+
+void OcclusionCuller::AddOccluder(const OccluderMesh& mesh, const glm::mat4& transform) {
+  if (!mesh.Empty())
+    occluders.push_back({&mesh, transform});
+}
+
+size_t OcclusionCuller::TriangleCount() const {
+  size_t count = 0;
+  for (const std::vector<ScreenTriangle>& triangles : threadTriangles)
+    count += triangles.size();
+  return count;
+}
+
+void OcclusionCuller::Render() {
+  if (levels.empty())
+    return;
+
+  // transform and clip every occluder into the list of the thread that handled it
+  JobSystem::Get().ParallelFor(occluders.size(), 4, [&](size_t begin, size_t end) {
+    std::vector<ScreenTriangle>& out = threadTriangles[JobSystem::ThreadIndex()];
+    std::vector<glm::vec4>& clip = threadClip[JobSystem::ThreadIndex()];
+    for (size_t i = begin; i < end; i++)
+      transformOccluder(occluders[i], clip, out);
+  });
+
+  // every job owns a band of rows, so no two jobs ever write the same pixel
+  size_t bands = (height + BandHeight - 1) / BandHeight;
+  JobSystem::Get().ParallelFor(bands, 1, [&](size_t begin, size_t end) {
+    for (size_t band = begin; band < end; band++) {
+      int rowBegin = (int)band * BandHeight;
+      int rowEnd = std::min(height, rowBegin + BandHeight);
+      for (const std::vector<ScreenTriangle>& triangles : threadTriangles) {
+        for (const ScreenTriangle& triangle : triangles) {
+          if (triangle.maxY >= rowBegin && triangle.minY < rowEnd)
+            rasterize(triangle, rowBegin, rowEnd);
+        }
+      }
+    }
+  });
+
+  buildPyramid();
+}
+
+void OcclusionCuller::transformOccluder(const Occluder& occluder, std::vector<glm::vec4>& clip,
+                                        std::vector<ScreenTriangle>& out) const {
+  glm::mat4 matrix = viewProjection * occluder.transform;
+  const OccluderMesh& mesh = *occluder.mesh;
+
+  // clip space positions, reused by every triangle sharing the vertex. resize only grows the thread's buffer.
+  clip.resize(mesh.positions.size());
+  for (size_t i = 0; i < mesh.positions.size(); i++)
+    clip[i] = matrix * glm::vec4(mesh.positions[i], 1.0f);
+
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    const glm::vec4& a = clip[mesh.indices[i]];
+    const glm::vec4& b = clip[mesh.indices[i + 1]];
+    const glm::vec4& c = clip[mesh.indices[i + 2]];
+
+    // trivially outside one of the side planes
+    if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+        (a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w))
+      continue;
+
+    // clip against the near plane (z = -w), which turns the triangle into a polygon of up to 4 vertices
+    const glm::vec4* input[3] = {&a, &b, &c};
+    glm::vec4 polygon[4];
+    int count = 0;
+    for (int v = 0; v < 3; v++) {
+      const glm::vec4& current = *input[v];
+      const glm::vec4& next = *input[(v + 1) % 3];
+      float currentDistance = current.z + current.w;
+      float nextDistance = next.z + next.w;
+      if (currentDistance >= 0.0f)
+        polygon[count++] = current;
+      if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+        polygon[count++] = glm::mix(current, next, currentDistance / (currentDistance - nextDistance));
+    }
+
+    for (int v = 2; v < count; v++)
+      addTriangle(polygon[0], polygon[v - 1], polygon[v], out);
+  }
+}
+
+void OcclusionCuller::addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, std::vector<ScreenTriangle>& out) const {
+  ScreenTriangle triangle;
+  const glm::vec4* clip[3] = {&a, &b, &c};
+  for (int i = 0; i < 3; i++) {
+    float w = std::max(clip[i]->w, 1e-6f);
+    triangle.v[i] = glm::vec3((clip[i]->x / w * 0.5f + 0.5f) * width, (clip[i]->y / w * 0.5f + 0.5f) * height,
+                              clip[i]->z / w * 0.5f + 0.5f);
+  }
+
+  // counter clockwise order so the edge functions are positive inside
+  float area = (triangle.v[1].x - triangle.v[0].x) * (triangle.v[2].y - triangle.v[0].y) -
+               (triangle.v[2].x - triangle.v[0].x) * (triangle.v[1].y - triangle.v[0].y);
+  if (std::fabs(area) < 1e-6f)
+    return;
+  if (area < 0.0f)
+    std::swap(triangle.v[1], triangle.v[2]);
+
+  // pixels whose centers can be covered
+  float minX = std::min(triangle.v[0].x, std::min(triangle.v[1].x, triangle.v[2].x));
+  float maxX = std::max(triangle.v[0].x, std::max(triangle.v[1].x, triangle.v[2].x));
+  float minY = std::min(triangle.v[0].y, std::min(triangle.v[1].y, triangle.v[2].y));
+  float maxY = std::max(triangle.v[0].y, std::max(triangle.v[1].y, triangle.v[2].y));
+  triangle.minX = std::max(0, (int)std::floor(minX));
+  triangle.maxX = std::min(width - 1, (int)std::ceil(maxX));
+  triangle.minY = std::max(0, (int)std::floor(minY));
+  triangle.maxY = std::min(height - 1, (int)std::ceil(maxY));
+  if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+    return;
+
+  out.push_back(triangle);
+}
+
+void OcclusionCuller::rasterize(const ScreenTriangle& triangle, int rowBegin, int rowEnd) {
+  const glm::vec3& v0 = triangle.v[0];
+  const glm::vec3& v1 = triangle.v[1];
+  const glm::vec3& v2 = triangle.v[2];
+
+  // edge functions e(x, y) = a * x + b * y + c, each one is zero on the edge opposite a vertex
+  float a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = v1.x * v2.y - v1.y * v2.x;
+  float a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = v2.x * v0.y - v2.y * v0.x;
+  float a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = v0.x * v1.y - v0.y * v1.x;
+  float area = a0 * v0.x + b0 * v0.y + c0;
+
+  // depth is affine in screen space, interpolate it as a plane z = za * x + zb * y + zc
+  float za = (a1 * (v1.z - v0.z) + a2 * (v2.z - v0.z)) / area;
+  float zb = (b1 * (v1.z - v0.z) + b2 * (v2.z - v0.z)) / area;
+  float zc = v0.z - za * v0.x - zb * v0.y;
+
+  int y0 = std::max(rowBegin, triangle.minY);
+  int y1 = std::min(rowEnd - 1, triangle.maxY);
+  int x0 = triangle.minX & ~3;
+  int x1 = triangle.maxX;
+  float* depth = levels[0].data();
+
+#ifdef OCCLUSION_SSE
+  // four pixels per step, the buffer width is a multiple of 4 so a step never leaves the row
+  __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  __m128 zero = _mm_setzero_ps();
+  for (int y = y0; y <= y1; y++) {
+    float py = y + 0.5f;
+    __m128 rowE0 = _mm_set1_ps(b0 * py + c0), rowE1 = _mm_set1_ps(b1 * py + c1), rowE2 = _mm_set1_ps(b2 * py + c2);
+    __m128 rowZ = _mm_set1_ps(zb * py + zc);
+    float* row = depth + (size_t)y * width;
+
+    for (int x = x0; x <= x1; x += 4) {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+      __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), rowE0);
+      __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), rowE1);
+      __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), rowE2);
+      __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+      if (_mm_movemask_ps(inside) == 0)
+        continue;
+
+      __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), rowZ);
+      __m128 current = _mm_loadu_ps(row + x);
+      __m128 closer = _mm_min_ps(current, z);
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, current)));
+    }
+  }
+#else
+  for (int y = y0; y <= y1; y++) {
+    float py = y + 0.5f;
+    float* row = depth + (size_t)y * width;
+    for (int x = x0; x <= x1; x++) {
+      float px = x + 0.5f;
+      if (a0 * px + b0 * py + c0 < 0.0f || a1 * px + b1 * py + c1 < 0.0f || a2 * px + b2 * py + c2 < 0.0f)
+        continue;
+      row[x] = std::min(row[x], za * px + zb * py + zc);
+    }
+  }
+#endif
+}
+
+void OcclusionCuller::buildPyramid() {
+  // each texel keeps the farthest depth of the four below it
+  for (size_t level = 1; level < levels.size(); level++) {
+    const std::vector<float>& source = levels[level - 1];
+    int sourceWidth = levelWidths[level - 1], sourceHeight = levelHeights[level - 1];
+    std::vector<float>& target = levels[level];
+    int targetWidth = levelWidths[level], targetHeight = levelHeights[level];
+
+    for (int y = 0; y < targetHeight; y++) {
+      int sy0 = y * 2, sy1 = std::min(y * 2 + 1, sourceHeight - 1);
+      for (int x = 0; x < targetWidth; x++) {
+        int sx0 = x * 2, sx1 = std::min(x * 2 + 1, sourceWidth - 1);
+        target[(size_t)y * targetWidth + x] =
+            std::max(std::max(source[(size_t)sy0 * sourceWidth + sx0], source[(size_t)sy0 * sourceWidth + sx1]),
+                     std::max(source[(size_t)sy1 * sourceWidth + sx0], source[(size_t)sy1 * sourceWidth + sx1]));
+      }
+    }
+  }
+}
+
+bool OcclusionCuller::IsVisible(const AABB& box) const {
+  if (levels.empty())
+    return true;
+
+  // a corner is one pick of min/max per axis, so its clip position is a sum of scaled matrix columns
+  glm::vec4 columnX[2] = {viewProjection[0] * box.min.x, viewProjection[0] * box.max.x};
+  glm::vec4 columnY[2] = {viewProjection[1] * box.min.y, viewProjection[1] * box.max.y};
+  glm::vec4 columnZ[2] = {viewProjection[2] * box.min.z + viewProjection[3], viewProjection[2] * box.max.z + viewProjection[3]};
+
+  float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minDepth = FLT_MAX;
+  for (int i = 0; i < 8; i++) {
+    glm::vec4 clip = columnX[i & 1] + columnY[(i >> 1) & 1] + columnZ[(i >> 2) & 1];
+
+    // in front of the near plane, the projection isn't usable
+    if (clip.z < -clip.w || clip.w <= 1e-6f)
+      return true;
+
+    float inverseW = 1.0f / clip.w;
+    float x = (clip.x * inverseW * 0.5f + 0.5f) * width;
+    float y = (clip.y * inverseW * 0.5f + 0.5f) * height;
+    minX = std::min(minX, x);
+    maxX = std::max(maxX, x);
+    minY = std::min(minY, y);
+    maxY = std::max(maxY, y);
+    minDepth = std::min(minDepth, clip.z * inverseW * 0.5f + 0.5f);
+  }
+
+  // outside the buffer is the frustum culler's business
+  if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+    return true;
+
+  int x0 = std::max(0, (int)minX), x1 = std::min(width - 1, (int)maxX);
+  int y0 = std::max(0, (int)minY), y1 = std::min(height - 1, (int)maxY);
+
+  // the level where the rectangle covers at most 2x2 texels
+  int level = 0;
+  while (level + 1 < (int)levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+    level++;
+
+  const std::vector<float>& pyramid = levels[level];
+  int levelWidth = levelWidths[level];
+  float maxDepth = 0.0f;
+  for (int y = y0 >> level; y <= (y1 >> level); y++) {
+    for (int x = x0 >> level; x <= (x1 >> level); x++)
+      maxDepth = std::max(maxDepth, pyramid[(size_t)y * levelWidth + x]);
+  }
+  return minDepth <= maxDepth;
+}
+
+size_t OcclusionCuller::Cull(const AABB* boxes, size_t count, uint8_t* visible) const {
+  std::vector<size_t> occluded(JobSystem::Get().ThreadCount(), 0);
+  JobSystem::Get().ParallelFor(count, 256, [&](size_t begin, size_t end) {
+    size_t rejected = 0;
+    for (size_t i = begin; i < end; i++) {
+      visible[i] = IsVisible(boxes[i]) ? 1 : 0;
+      rejected += 1 - visible[i];
+    }
+    occluded[JobSystem::ThreadIndex()] += rejected;
+  });
+
+  size_t total = 0;
+  for (size_t rejected : occluded)
+    total += rejected;
+  return total;
+}
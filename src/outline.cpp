@@ -0,0 +1,37 @@
+#include "outline.h"
+#include "profiler.h"
+
+void OutlinePass::Init() {
+  edgeShader.reset(new Shader("resources/shaders/fullscreen.vs", "resources/shaders/outline.fs"));
+  glGenVertexArrays(1, &emptyVAO);
+}
+
+void OutlinePass::Shutdown() {
+  if (emptyVAO)
+    glDeleteVertexArrays(1, &emptyVAO);
+  emptyVAO = 0;
+  edgeShader.reset();
+}
+
+void OutlinePass::Resolve(GLuint colorTexture, GLuint maskTexture) {
+  glDisable(GL_DEPTH_TEST);
+
+  edgeShader->use();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, colorTexture);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, maskTexture);
+  Profiler::Get().CountStateChange(2);
+  edgeShader->setInt("sceneColor", 0);
+  edgeShader->setInt("outlineMask", 1);
+  edgeShader->setVec3("outlineColor", color);
+  edgeShader->setInt("outlineWidth", OUTLINE_WIDTH);
+
+  glBindVertexArray(emptyVAO);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  Profiler::Get().CountDraw(1);
+  glBindVertexArray(0);
+
+  glActiveTexture(GL_TEXTURE0);
+  glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,62 @@
+#include "primitives.h"
+
+#include <vector>
+
+static Vertex makeVertex(glm::vec3 position, glm::vec3 normal, glm::vec2 texCoords) {
+  Vertex vertex = {};
+  vertex.Position = position;
+  vertex.Normal = normal;
+  vertex.TexCoords = texCoords;
+  return vertex;
+}
+
+Mesh CreatePlaneMesh() {
+  glm::vec3 up(0.0f, 1.0f, 0.0f);
+  std::vector<Vertex> vertices = {
+    makeVertex(glm::vec3(-1.0f, 0.0f,  1.0f), up, glm::vec2(0.0f, 0.0f)),
+    makeVertex(glm::vec3( 1.0f, 0.0f,  1.0f), up, glm::vec2(1.0f, 0.0f)),
+    makeVertex(glm::vec3( 1.0f, 0.0f, -1.0f), up, glm::vec2(1.0f, 1.0f)),
+    makeVertex(glm::vec3(-1.0f, 0.0f, -1.0f), up, glm::vec2(0.0f, 1.0f))
+  };
+  std::vector<unsigned int> indices = { 0, 1, 2, 0, 2, 3 };
+  return Mesh(vertices, indices, std::vector<Texture>());
+}
+
+Mesh CreateCubeMesh() {
+  // face normal, then the two axes spanning the face
+  const glm::vec3 faces[6][3] = {
+    { glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3( 1.0f, 0.0f,  0.0f), glm::vec3(0.0f, 1.0f,  0.0f) },
+    { glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(-1.0f, 0.0f,  0.0f), glm::vec3(0.0f, 1.0f,  0.0f) },
+    { glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3( 0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f,  0.0f) },
+    { glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3( 0.0f, 0.0f,  1.0f), glm::vec3(0.0f, 1.0f,  0.0f) },
+    { glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3( 1.0f, 0.0f,  0.0f), glm::vec3(0.0f, 0.0f, -1.0f) },
+    { glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3( 1.0f, 0.0f,  0.0f), glm::vec3(0.0f, 0.0f,  1.0f) }
+  };
+
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  vertices.reserve(24);
+  indices.reserve(36);
+
+  for (int f = 0; f < 6; f++) {
+    glm::vec3 normal = faces[f][0];
+    glm::vec3 u = faces[f][1];
+    glm::vec3 v = faces[f][2];
+    unsigned int base = (unsigned int)vertices.size();
+
+    vertices.push_back(makeVertex(0.5f * (normal - u - v), normal, glm::vec2(0.0f, 0.0f)));
+    vertices.push_back(makeVertex(0.5f * (normal + u - v), normal, glm::vec2(1.0f, 0.0f)));
+    vertices.push_back(makeVertex(0.5f * (normal + u + v), normal, glm::vec2(1.0f, 1.0f)));
+    vertices.push_back(makeVertex(0.5f * (normal - u + v), normal, glm::vec2(0.0f, 1.0f)));
+
+    // counter clockwise when looking at the face from outside
+    indices.push_back(base + 0);
+    indices.push_back(base + 1);
+    indices.push_back(base + 2);
+    indices.push_back(base + 0);
+    indices.push_back(base + 2);
+    indices.push_back(base + 3);
+  }
+
+  return Mesh(vertices, indices, std::vector<Texture>());
+}
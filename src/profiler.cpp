@@ -0,0 +1,286 @@
+#include "profiler.h"
+
+#include "imgui.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+// Allocation counters, updated by the global operator new replacements below
+static std::atomic<unsigned long long> g_allocationCount(0);
+static std::atomic<unsigned long long> g_allocatedBytes(0);
+
+// counts the allocation, then retries through the new handler like the default operator new. alignment 0
+// takes plain malloc, anything else memory freeAligned can release.
+static void* trackedAllocate(std::size_t size, std::size_t alignment) {
+  g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+  g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  if (size == 0)
+    size = 1;
+  while (true) {
+    void* ptr;
+    if (alignment == 0)
+      ptr = std::malloc(size);
+    else {
+#ifdef _MSC_VER
+      ptr = _aligned_malloc(size, alignment);
+#else
+      // aligned_alloc wants the size in whole alignments
+      ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+    }
+    if (ptr)
+      return ptr;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+static void freeAligned(void* ptr) {
+#ifdef _MSC_VER
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+void* operator new(std::size_t size) {
+  return trackedAllocate(size, 0);
+}
+
+void* operator new[](std::size_t size) {
+  return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+// over-aligned types, e.g. SIMD members, come through these
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  return trackedAllocate(size, (std::size_t)alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return trackedAllocate(size, (std::size_t)alignment);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  freeAligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  freeAligned(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+  freeAligned(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+  freeAligned(ptr);
+}
+
+Profiler& Profiler::Get() {
+  static Profiler profiler;
+  return profiler;
+}
+
+void Profiler::Init() {
+  if (initialized)
+    return;
+
+  for (int f = 0; f < PROFILER_QUERY_FRAMES; f++) {
+    for (int p = 0; p < PROFILER_MAX_PASSES; p++) {
+      glGenQueries(2, queryFrames[f].passes[p].queries);
+    }
+  }
+  frameStart = std::chrono::steady_clock::now();
+  initialized = true;
+}
+
+void Profiler::Shutdown() {
+  if (!initialized)
+    return;
+
+  for (int f = 0; f < PROFILER_QUERY_FRAMES; f++) {
+    for (int p = 0; p < PROFILER_MAX_PASSES; p++) {
+      glDeleteQueries(2, queryFrames[f].passes[p].queries);
+    }
+  }
+  initialized = false;
+}
+
+void Profiler::BeginFrame() {
+  frameIndex = (frameIndex + 1) % PROFILER_QUERY_FRAMES;
+
+  // the slot we are about to reuse was written PROFILER_QUERY_FRAMES frames ago, read it back first
+  resolveQueries();
+
+  QueryFrame& frame = queryFrames[frameIndex];
+  frame.passCount = 0;
+  frame.pending = false;
+  openPass = -1;
+
+  current = FrameStats();
+  allocationsAtFrameStart = g_allocationCount.load(std::memory_order_relaxed);
+  allocatedBytesAtFrameStart = g_allocatedBytes.load(std::memory_order_relaxed);
+}
+
+void Profiler::EndFrame() {
+  if (openPass >= 0)
+    EndPass();
+
+  current.allocations = g_allocationCount.load(std::memory_order_relaxed) - allocationsAtFrameStart;
+  current.allocatedBytes = g_allocatedBytes.load(std::memory_order_relaxed) - allocatedBytesAtFrameStart;
+  last = current;
+
+  queryFrames[frameIndex].pending = initialized && queryFrames[frameIndex].passCount > 0;
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  lastFrameMs = std::chrono::duration<float, std::milli>(now - frameStart).count();
+  frameStart = now;
+
+  frameHistory[historyOffset] = lastFrameMs;
+  historyOffset = (historyOffset + 1) % PROFILER_HISTORY;
+  if (historyCount < PROFILER_HISTORY)
+    historyCount++;
+}
+
+void Profiler::BeginPass(const char* name) {
+  if (openPass >= 0)
+    EndPass();
+
+  QueryFrame& frame = queryFrames[frameIndex];
+  if (frame.passCount >= PROFILER_MAX_PASSES)
+    return;
+
+  PassQuery& pass = frame.passes[frame.passCount];
+  pass.name = name;
+  pass.cpuMs = 0.0f;
+  pass.cpuStart = std::chrono::steady_clock::now();
+  if (initialized)
+    glQueryCounter(pass.queries[0], GL_TIMESTAMP);
+
+  openPass = frame.passCount++;
+}
+
+void Profiler::EndPass() {
+  if (openPass < 0)
+    return;
+
+  PassQuery& pass = queryFrames[frameIndex].passes[openPass];
+  if (initialized)
+    glQueryCounter(pass.queries[1], GL_TIMESTAMP);
+  pass.cpuMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - pass.cpuStart).count();
+
+  openPass = -1;
+}
+
+void Profiler::resolveQueries() {
+  QueryFrame& frame = queryFrames[frameIndex];
+  if (!frame.pending)
+    return;
+  frame.pending = false;
+
+  // never block on the driver, if the oldest frame is still not done we just skip its results
+  GLint available = 0;
+  glGetQueryObjectiv(frame.passes[frame.passCount - 1].queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+    return;
+
+  timingCount = frame.passCount;
+  for (int i = 0; i < frame.passCount; i++) {
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(frame.passes[i].queries[0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(frame.passes[i].queries[1], GL_QUERY_RESULT, &end);
+
+    timings[i].name = frame.passes[i].name;
+    timings[i].cpuMs = frame.passes[i].cpuMs;
+    timings[i].gpuMs = (float)((double)(end - start) / 1000000.0);
+  }
+}
+
+void Profiler::DrawOverlay(bool* open) {
+  ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_FirstUseEver);
+  ImGui::SetNextWindowBgAlpha(0.75f);
+  if (!ImGui::Begin("Stats", open, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav)) {
+    ImGui::End();
+    return;
+  }
+
+  // frame time graph, the history is a ring buffer so start plotting at the oldest entry
+  float maxMs = 0.0f;
+  float avgMs = 0.0f;
+  for (int i = 0; i < PROFILER_HISTORY; i++) {
+    if (frameHistory[i] > maxMs)
+      maxMs = frameHistory[i];
+    avgMs += frameHistory[i];
+  }
+  // slots not written yet are zero, they count towards neither
+  if (historyCount > 0)
+    avgMs /= historyCount;
+
+  char overlay[64];
+  std::snprintf(overlay, sizeof(overlay), "%.2f ms (avg %.2f, max %.2f)", lastFrameMs, avgMs, maxMs);
+  ImGui::PlotLines("##frametime", frameHistory, PROFILER_HISTORY, historyOffset, overlay, 0.0f, maxMs > 33.3f ? maxMs : 33.3f, ImVec2(320.0f, 60.0f));
+  ImGui::Text("%.1f FPS", lastFrameMs > 0.0f ? 1000.0f / lastFrameMs : 0.0f);
+
+  ImGui::Separator();
+  if (ImGui::BeginTable("passes", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+    ImGui::TableSetupColumn("Pass");
+    ImGui::TableSetupColumn("CPU ms");
+    ImGui::TableSetupColumn("GPU ms");
+    ImGui::TableHeadersRow();
+    for (int i = 0; i < timingCount; i++) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", timings[i].name);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", timings[i].cpuMs);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", timings[i].gpuMs);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::Separator();
+  unsigned int totalObjects = last.visibleObjects + last.culledObjects;
+  ImGui::Text("Draw calls:     %u", last.drawCalls);
+  ImGui::Text("State changes:  %u", last.stateChanges);
+  ImGui::Text("Triangles:      %llu", last.triangles);
+  ImGui::Text("Culled objects: %u / %u (%.1f%%)", last.culledObjects, totalObjects,
+              totalObjects > 0 ? 100.0f * last.culledObjects / totalObjects : 0.0f);
+  ImGui::Text("Lights:         %u (%u cluster entries)", last.lights, last.clusterLightIndices);
+  ImGui::Text("Shadows:        %u casters in %u maps", last.shadowCasters, last.shadowMaps);
+  ImGui::Text("Occluded:       %u / %u (%.1f%%)", last.occludedObjects, last.occlusionTested,
+              last.occlusionTested > 0 ? 100.0f * last.occludedObjects / last.occlusionTested : 0.0f);
+  ImGui::Text("Meshlets:       %u / %u culled (%.1f%%)", last.meshletsCulled, last.meshletsTested,
+              last.meshletsTested > 0 ? 100.0f * last.meshletsCulled / last.meshletsTested : 0.0f);
+
+  ImGui::Separator();
+  ImGui::Text("Texture memory: %.2f MB", textureBytes / (1024.0 * 1024.0));
+  ImGui::Text("Buffer memory:  %.2f MB", bufferBytes / (1024.0 * 1024.0));
+  ImGui::Text("Allocations:    %llu (%.1f KB) / frame", last.allocations, last.allocatedBytes / 1024.0);
+
+  ImGui::End();
+}
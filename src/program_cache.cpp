@@ -0,0 +1,165 @@
+#include "program_cache.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const uint32_t PROGRAM_CACHE_MAGIC = 0x4E494250;   // "PBIN"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+};
+
+// FNV-1a, with the length mixed in so parts can't run into each other
+uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+uint64_t hashString(uint64_t hash, const std::string& text) {
+  uint64_t length = text.size();
+  hash = hashBytes(hash, &length, sizeof(length));
+  return hashBytes(hash, text.data(), text.size());
+}
+
+std::string glString(GLenum name) {
+  const GLubyte* text = glGetString(name);
+  return text ? std::string((const char*)text) : std::string();
+}
+
+} // namespace
+
+ProgramCache& ProgramCache::Get() {
+  static ProgramCache cache;
+  return cache;
+}
+
+void ProgramCache::Init(const char* cacheDirectory) {
+  directory = cacheDirectory;
+  hits = misses = 0;
+
+  GLint formats = 0;
+  if (GLAD_GL_VERSION_4_1)
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  enabled = formats > 0;
+  if (!enabled) {
+    std::cout << "Program binary cache disabled, the driver can't return program binaries" << std::endl;
+    return;
+  }
+
+  driverHash = 14695981039346656037ull;
+  driverHash = hashString(driverHash, glString(GL_VENDOR));
+  driverHash = hashString(driverHash, glString(GL_RENDERER));
+  driverHash = hashString(driverHash, glString(GL_VERSION));
+
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    std::cout << "ERROR::PROGRAM_CACHE::Can't create " << directory << ": " << error.message() << std::endl;
+    enabled = false;
+  }
+}
+
+uint64_t ProgramCache::Key(const std::vector<std::string>& parts) const {
+  uint64_t hash = driverHash;
+  for (const std::string& part : parts)
+    hash = hashString(hash, part);
+  return hash;
+}
+
+std::string ProgramCache::pathFor(uint64_t key) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+  return directory + "/" + name;
+}
+
+GLuint ProgramCache::Load(uint64_t key) {
+  if (!enabled) {
+    misses++;
+    return 0;
+  }
+
+  std::string path = pathFor(key);
+  std::ifstream file(path, std::ios::binary);
+  CacheHeader header;
+  if (!file.good() || !file.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_CACHE_MAGIC ||
+      header.version != PROGRAM_CACHE_VERSION || header.key != key) {
+    misses++;
+    return 0;
+  }
+  // the binary is the rest of the file, a length that says otherwise is a truncated or damaged file
+  std::streampos start = file.tellg();
+  file.seekg(0, std::ios::end);
+  std::streamoff remaining = file.tellg() - start;
+  file.seekg(start);
+  if (header.length == 0 || remaining != (std::streamoff)header.length) {
+    misses++;
+    return 0;
+  }
+  std::vector<char> binary(header.length);
+  if (!file.read(binary.data(), binary.size())) {
+    misses++;
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+  int success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    // same driver strings but a binary it no longer takes, rebuild and overwrite it
+    glDeleteProgram(program);
+    file.close();
+    std::remove(path.c_str());
+    misses++;
+    return 0;
+  }
+  hits++;
+  return program;
+}
+
+void ProgramCache::PrepareLink(GLuint program) const {
+  if (enabled)
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void ProgramCache::Store(uint64_t key, GLuint program) {
+  if (!enabled)
+    return;
+
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+
+  // written under a temporary name first so a crash never leaves a truncated binary behind
+  std::string path = pathFor(key);
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    CacheHeader header = {PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, key, format, (uint32_t)length};
+    file.write((const char*)&header, sizeof(header));
+    file.write(binary.data(), length);
+    if (!file.good()) {
+      std::cout << "ERROR::PROGRAM_CACHE::Can't write " << temporary << std::endl;
+      return;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+}
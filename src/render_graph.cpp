@@ -0,0 +1,396 @@
+#include "render_graph.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <queue>
+
+static bool isDepthFormat(GLenum format) {
+  return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F ||
+         format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+static bool hasStencil(GLenum format) {
+  return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+// pixel transfer format and type glTexImage2D needs for an internal format, and its size in bytes
+static void transferFormat(GLenum internalFormat, GLenum& format, GLenum& type, int& bytes) {
+  switch (internalFormat) {
+    case GL_R8: format = GL_RED; type = GL_UNSIGNED_BYTE; bytes = 1; break;
+    case GL_RG8: format = GL_RG; type = GL_UNSIGNED_BYTE; bytes = 2; break;
+    case GL_R16F: format = GL_RED; type = GL_FLOAT; bytes = 2; break;
+    case GL_RG16F: format = GL_RG; type = GL_FLOAT; bytes = 4; break;
+    case GL_RGBA16F: format = GL_RGBA; type = GL_FLOAT; bytes = 8; break;
+    case GL_R32F: format = GL_RED; type = GL_FLOAT; bytes = 4; break;
+    case GL_RGBA32F: format = GL_RGBA; type = GL_FLOAT; bytes = 16; break;
+    case GL_R32UI: format = GL_RED_INTEGER; type = GL_UNSIGNED_INT; bytes = 4; break;
+    case GL_DEPTH_COMPONENT16: format = GL_DEPTH_COMPONENT; type = GL_UNSIGNED_SHORT; bytes = 2; break;
+    case GL_DEPTH_COMPONENT24: format = GL_DEPTH_COMPONENT; type = GL_UNSIGNED_INT; bytes = 4; break;
+    case GL_DEPTH_COMPONENT32F: format = GL_DEPTH_COMPONENT; type = GL_FLOAT; bytes = 4; break;
+    case GL_DEPTH24_STENCIL8: format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; bytes = 4; break;
+    case GL_DEPTH32F_STENCIL8: format = GL_DEPTH_STENCIL; type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV; bytes = 8; break;
+    default: format = GL_RGBA; type = GL_UNSIGNED_BYTE; bytes = 4; break;
+  }
+}
+
+static bool sameDesc(const RenderTargetDesc& a, const RenderTargetDesc& b) {
+  return a.width == b.width && a.height == b.height && a.format == b.format;
+}
+
+RenderResource RenderGraph::PassBuilder::Create(const char* name, const RenderTargetDesc& desc, const glm::vec4& clearValue) {
+  graph.resources.push_back({name, desc, clearValue, false, false, 0, -1, -1});
+  uint32_t resource = (uint32_t)graph.resources.size() - 1;
+  RenderResource version = graph.addVersion(resource, pass, RENDER_RESOURCE_NONE);
+  graph.passes[pass].writes.push_back(version);
+  graph.passes[pass].creates.push_back(resource);
+  return version;
+}
+
+RenderResource RenderGraph::PassBuilder::Read(RenderResource resource) {
+  graph.versions[resource].readers.push_back(pass);
+  graph.passes[pass].reads.push_back(resource);
+  return resource;
+}
+
+RenderResource RenderGraph::PassBuilder::Write(RenderResource resource) {
+  // writing on top keeps whatever is there, so the pass also reads the version it starts from
+  Read(resource);
+  uint32_t index = graph.versions[resource].resource;
+  RenderResource version = graph.addVersion(index, pass, resource);
+  graph.passes[pass].writes.push_back(version);
+  if (graph.resources[index].backbuffer)
+    graph.passes[pass].sideEffect = true;
+  return version;
+}
+
+void RenderGraph::PassBuilder::SideEffect() {
+  graph.passes[pass].sideEffect = true;
+}
+
+void RenderGraph::Init() {
+  frame = 0;
+}
+
+void RenderGraph::Shutdown() {
+  for (std::map<std::vector<GLuint>, GLuint>::iterator it = framebuffers.begin(); it != framebuffers.end(); ++it)
+    glDeleteFramebuffers(1, &it->second);
+  framebuffers.clear();
+
+  for (const PooledTexture& pooled : pool) {
+    GLenum format, type;
+    int bytes;
+    transferFormat(pooled.desc.format, format, type, bytes);
+    glDeleteTextures(1, &pooled.texture);
+    Profiler::Get().TrackTextureMemory(-(long long)pooled.desc.width * pooled.desc.height * bytes);
+  }
+  pool.clear();
+  Reset();
+}
+
+void RenderGraph::Reset() {
+  resources.clear();
+  versions.clear();
+  passes.clear();
+  order.clear();
+  culledPasses = 0;
+}
+
+RenderResource RenderGraph::addVersion(uint32_t resource, uint32_t writer, RenderResource previous) {
+  versions.push_back({resource, writer, previous, std::vector<uint32_t>()});
+  return (RenderResource)versions.size() - 1;
+}
+
+RenderResource RenderGraph::ImportBackbuffer(int width, int height) {
+  resources.push_back({"backbuffer", {width, height, GL_RGBA8}, glm::vec4(0.0f), true, true, 0, -1, -1});
+  return addVersion((uint32_t)resources.size() - 1, NO_PASS, RENDER_RESOURCE_NONE);
+}
+
+RenderResource RenderGraph::Import(const char* name, GLuint texture) {
+  resources.push_back({name, {0, 0, GL_NONE}, glm::vec4(0.0f), true, false, texture, -1, -1});
+  return addVersion((uint32_t)resources.size() - 1, NO_PASS, RENDER_RESOURCE_NONE);
+}
+
+void RenderGraph::AddPass(const char* name, const SetupFn& setup, const ExecuteFn& execute) {
+  passes.push_back({name, execute, std::vector<RenderResource>(), std::vector<RenderResource>(), std::vector<uint32_t>(), false, false});
+  PassBuilder builder(*this, (uint32_t)passes.size() - 1);
+  setup(builder);
+}
+
+bool RenderGraph::Compile() {
+  // keep what the side effects depend on, walking back from them through the versions they read
+  std::vector<uint8_t> needed(passes.size(), 0);
+  std::vector<uint32_t> stack;
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    if (passes[i].sideEffect) {
+      needed[i] = 1;
+      stack.push_back(i);
+    }
+  }
+  while (!stack.empty()) {
+    uint32_t pass = stack.back();
+    stack.pop_back();
+    for (RenderResource read : passes[pass].reads) {
+      uint32_t writer = versions[read].writer;
+      if (writer != NO_PASS && !needed[writer]) {
+        needed[writer] = 1;
+        stack.push_back(writer);
+      }
+    }
+  }
+
+  culledPasses = 0;
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    passes[i].culled = !needed[i];
+    culledPasses += passes[i].culled ? 1 : 0;
+  }
+
+  // a pass runs after the writers of what it reads, and after everyone reading a version it overwrites
+  std::vector<std::vector<uint32_t>> successors(passes.size());
+  std::vector<uint32_t> dependencies(passes.size(), 0);
+  for (uint32_t pass = 0; pass < passes.size(); pass++) {
+    if (passes[pass].culled)
+      continue;
+    for (RenderResource read : passes[pass].reads) {
+      uint32_t writer = versions[read].writer;
+      if (writer != NO_PASS && writer != pass) {
+        successors[writer].push_back(pass);
+        dependencies[pass]++;
+      }
+    }
+    for (RenderResource write : passes[pass].writes) {
+      RenderResource previous = versions[write].previous;
+      if (previous == RENDER_RESOURCE_NONE)
+        continue;
+      for (uint32_t reader : versions[previous].readers) {
+        if (reader != pass && !passes[reader].culled) {
+          successors[reader].push_back(pass);
+          dependencies[pass]++;
+        }
+      }
+    }
+  }
+
+  // independent passes keep the order they were added in
+  std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> ready;
+  size_t live = 0;
+  for (uint32_t pass = 0; pass < passes.size(); pass++) {
+    if (passes[pass].culled)
+      continue;
+    live++;
+    if (dependencies[pass] == 0)
+      ready.push(pass);
+  }
+  order.clear();
+  while (!ready.empty()) {
+    uint32_t pass = ready.top();
+    ready.pop();
+    order.push_back(pass);
+    for (uint32_t next : successors[pass]) {
+      if (--dependencies[next] == 0)
+        ready.push(next);
+    }
+  }
+  if (order.size() != live) {
+    std::cout << "ERROR::RENDER_GRAPH::Passes depend on each other in a cycle" << std::endl;
+    order.clear();
+    return false;
+  }
+
+  // transient targets live from the first to the last pass that touches any of their versions
+  for (Resource& resource : resources)
+    resource.firstPass = resource.lastPass = -1;
+  for (int i = 0; i < (int)order.size(); i++) {
+    const Pass& pass = passes[order[i]];
+    for (int list = 0; list < 2; list++) {
+      for (RenderResource handle : list == 0 ? pass.reads : pass.writes) {
+        Resource& resource = resources[versions[handle].resource];
+        if (resource.imported)
+          continue;
+        if (resource.firstPass < 0)
+          resource.firstPass = i;
+        resource.lastPass = i;
+      }
+    }
+  }
+  return true;
+}
+
+GLuint RenderGraph::acquireTexture(const RenderTargetDesc& desc) {
+  for (PooledTexture& pooled : pool) {
+    if (!pooled.inUse && sameDesc(pooled.desc, desc)) {
+      pooled.inUse = true;
+      pooled.lastUsed = frame;
+      return pooled.texture;
+    }
+  }
+
+  GLenum format, type;
+  int bytes;
+  transferFormat(desc.format, format, type, bytes);
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, format, type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  Profiler::Get().TrackTextureMemory((long long)desc.width * desc.height * bytes);
+
+  pool.push_back({desc, texture, true, frame});
+  return texture;
+}
+
+void RenderGraph::releaseTexture(GLuint texture) {
+  for (PooledTexture& pooled : pool) {
+    if (pooled.texture == texture) {
+      pooled.inUse = false;
+      pooled.lastUsed = frame;
+      return;
+    }
+  }
+}
+
+void RenderGraph::trimPool() {
+  // targets nobody asked for in a while, e.g. the old size after a resize
+  for (size_t i = 0; i < pool.size();) {
+    PooledTexture& pooled = pool[i];
+    if (pooled.inUse || frame - pooled.lastUsed <= RENDER_GRAPH_POOL_FRAMES) {
+      i++;
+      continue;
+    }
+
+    for (std::map<std::vector<GLuint>, GLuint>::iterator it = framebuffers.begin(); it != framebuffers.end();) {
+      if (std::find(it->first.begin(), it->first.end(), pooled.texture) != it->first.end()) {
+        glDeleteFramebuffers(1, &it->second);
+        it = framebuffers.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    GLenum format, type;
+    int bytes;
+    transferFormat(pooled.desc.format, format, type, bytes);
+    glDeleteTextures(1, &pooled.texture);
+    Profiler::Get().TrackTextureMemory(-(long long)pooled.desc.width * pooled.desc.height * bytes);
+    pool[i] = pool.back();
+    pool.pop_back();
+  }
+}
+
+GLuint RenderGraph::framebufferFor(const std::vector<GLuint>& colors, GLuint depth, bool depthStencil) {
+  std::vector<GLuint> key = colors;
+  key.push_back(depth);
+  std::map<std::vector<GLuint>, GLuint>::iterator it = framebuffers.find(key);
+  if (it != framebuffers.end())
+    return it->second;
+
+  GLuint framebuffer;
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  for (size_t i = 0; i < colors.size(); i++)
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i, GL_TEXTURE_2D, colors[i], 0);
+  if (depth != 0)
+    glFramebufferTexture2D(GL_FRAMEBUFFER, depthStencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+
+  std::vector<GLenum> drawBuffers;
+  for (size_t i = 0; i < colors.size(); i++)
+    drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + (GLenum)i);
+  if (drawBuffers.empty())
+    glDrawBuffer(GL_NONE);
+  else
+    glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cout << "ERROR::RENDER_GRAPH::Framebuffer is not complete" << std::endl;
+  framebuffers[key] = framebuffer;
+  return framebuffer;
+}
+
+void RenderGraph::bindTargets(const Pass& pass) {
+  // color attachments in the order the pass created or wrote them, which is the shader's output locations
+  std::vector<GLuint> colors;
+  std::vector<const Resource*> colorResources;
+  const Resource* depth = nullptr;
+  const Resource* backbuffer = nullptr;
+  for (RenderResource handle : pass.writes) {
+    const Resource& resource = resources[versions[handle].resource];
+    if (resource.backbuffer)
+      backbuffer = &resource;
+    else if (resource.imported)
+      continue;
+    else if (isDepthFormat(resource.desc.format))
+      depth = &resource;
+    else {
+      colors.push_back(resource.texture);
+      colorResources.push_back(&resource);
+    }
+  }
+
+  // passes that only write imported resources bind their own targets
+  if (backbuffer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, backbuffer->desc.width, backbuffer->desc.height);
+    return;
+  }
+  if (colors.empty() && !depth)
+    return;
+
+  GLuint framebuffer = framebufferFor(colors, depth ? depth->texture : 0, depth && hasStencil(depth->desc.format));
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  const RenderTargetDesc& size = depth ? depth->desc : colorResources[0]->desc;
+  glViewport(0, 0, size.width, size.height);
+
+  // fresh targets start out cleared, their pooled texture holds whatever the last user left
+  for (uint32_t created : pass.creates) {
+    const Resource& resource = resources[created];
+    if (&resource == depth) {
+      glDepthMask(GL_TRUE);
+      if (hasStencil(resource.desc.format))
+        glClearBufferfi(GL_DEPTH_STENCIL, 0, resource.clearValue.x, 0);
+      else
+        glClearBufferfv(GL_DEPTH, 0, &resource.clearValue.x);
+      continue;
+    }
+    for (size_t i = 0; i < colorResources.size(); i++) {
+      if (colorResources[i] == &resource)
+        glClearBufferfv(GL_COLOR, (GLint)i, &resource.clearValue.x);
+    }
+  }
+}
+
+void RenderGraph::Execute() {
+  for (int i = 0; i < (int)order.size(); i++) {
+    const Pass& pass = passes[order[i]];
+    for (Resource& resource : resources) {
+      if (!resource.imported && resource.firstPass == i)
+        resource.texture = acquireTexture(resource.desc);
+    }
+
+    Profiler::Get().BeginPass(pass.name);
+    bindTargets(pass);
+    pass.execute(*this);
+
+    // dead after this pass, the texture can back a later target of the same kind
+    for (Resource& resource : resources) {
+      if (!resource.imported && resource.lastPass == i)
+        releaseTexture(resource.texture);
+    }
+  }
+  Profiler::Get().EndPass();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  trimPool();
+  frame++;
+}
+
+GLuint RenderGraph::Texture(RenderResource resource) const {
+  return resources[versions[resource].resource].texture;
+}
+
+const RenderTargetDesc& RenderGraph::Desc(RenderResource resource) const {
+  return resources[versions[resource].resource].desc;
+}
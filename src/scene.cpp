@@ -0,0 +1,527 @@
+#include "scene.h"
+
+#include <json/json.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+const char* Scene::GetString(uint32_t offset) const {
+  if (offset == SCENE_NONE || offset >= strings.size())
+    return "";
+  return &strings[offset];
+}
+
+void Scene::Clear() {
+  materials.clear();
+  models.clear();
+  lights.clear();
+  instances.clear();
+  strings.clear();
+}
+
+// Streaming SAX handler. Nesting depth tells us where we are:
+//   1 - root object, 2 - section array, 3 - record object, 4 - vector field of a record
+class SceneSaxHandler {
+  public:
+    using json = nlohmann::json;
+
+    explicit SceneSaxHandler(SceneLoader& loader) : loader(loader) {
+      chunk = loader.acquireChunk();
+    }
+
+    bool null() { return !loader.cancelled.load(); }
+
+    bool boolean(bool value) {
+      if (depth == 3 && section == SECTION_INSTANCES &&
+          (currentKey == "outline" || currentKey == "occluder" || currentKey == "animated" || currentKey == "crowd")) {
+        uint32_t flag = currentKey == "outline" ? INSTANCE_OUTLINE : currentKey == "occluder" ? INSTANCE_OCCLUDER :
+                        currentKey == "animated" ? INSTANCE_ANIMATED : INSTANCE_CROWD;
+        if (value)
+          instance.flags |= flag;
+        else
+          instance.flags &= ~flag;
+      }
+      return !loader.cancelled.load();
+    }
+
+    bool number_integer(json::number_integer_t value) { return number((double)value); }
+    bool number_unsigned(json::number_unsigned_t value) { return number((double)value); }
+    bool number_float(json::number_float_t value, const json::string_t&) { return number(value); }
+
+    bool string(json::string_t& value) {
+      if (depth != 3)
+        return !loader.cancelled.load();
+
+      switch (section) {
+        case SECTION_MATERIALS:
+          if (currentKey == "name")
+            material.name = addString(value);
+          else if (currentKey == "diffuse")
+            material.diffuseMap = addString(value);
+          else if (currentKey == "specular")
+            material.specularMap = addString(value);
+          break;
+        case SECTION_MODELS:
+          if (currentKey == "name")
+            model.name = addString(value);
+          else if (currentKey == "path")
+            model.path = addString(value);
+          else if (currentKey == "primitive") {
+            if (value == "plane")
+              model.primitive = PRIMITIVE_PLANE;
+            else if (value == "cube")
+              model.primitive = PRIMITIVE_CUBE;
+            else
+              return fail("Unknown primitive '" + value + "'");
+          }
+          break;
+        case SECTION_LIGHTS:
+          if (currentKey == "type") {
+            if (value == "directional")
+              light.type = LIGHT_DIRECTIONAL;
+            else if (value == "point")
+              light.type = LIGHT_POINT;
+            else if (value == "spot")
+              light.type = LIGHT_SPOT;
+            else
+              return fail("Unknown light type '" + value + "'");
+          }
+          break;
+        case SECTION_INSTANCES:
+          if (currentKey == "model") {
+            std::unordered_map<std::string, uint32_t>::const_iterator it = modelNames.find(value);
+            if (it == modelNames.end())
+              return fail("Unknown model '" + value + "'");
+            instance.model = it->second;
+          }
+          else if (currentKey == "material") {
+            std::unordered_map<std::string, uint32_t>::const_iterator it = materialNames.find(value);
+            if (it == materialNames.end())
+              return fail("Unknown material '" + value + "'");
+            instance.material = it->second;
+          }
+          break;
+        default:
+          break;
+      }
+      return !loader.cancelled.load();
+    }
+
+    bool binary(json::binary_t&) { return !loader.cancelled.load(); }
+
+    bool start_object(std::size_t) {
+      depth++;
+      if (depth == 3)
+        beginRecord();
+      return !loader.cancelled.load();
+    }
+
+    bool end_object() {
+      if (depth == 3 && !endRecord())
+        return false;
+      depth--;
+      return !loader.cancelled.load();
+    }
+
+    bool start_array(std::size_t) {
+      depth++;
+      if (depth == 4)
+        numberCount = 0;
+      return !loader.cancelled.load();
+    }
+
+    bool end_array() {
+      if (depth == 4)
+        assignVector();
+      else if (depth == 2 && section != SECTION_INSTANCES && section != SECTION_NONE) {
+        // hand materials, models and lights over right away so the engine can start loading them
+        flush();
+      }
+      depth--;
+      return !loader.cancelled.load();
+    }
+
+    bool key(json::string_t& value) {
+      if (depth == 1) {
+        if (value == "materials")
+          section = SECTION_MATERIALS;
+        else if (value == "models")
+          section = SECTION_MODELS;
+        else if (value == "lights")
+          section = SECTION_LIGHTS;
+        else if (value == "instances")
+          section = SECTION_INSTANCES;
+        else
+          section = SECTION_NONE;
+      }
+      // assignment keeps the capacity, keys don't allocate once warm
+      currentKey = value;
+      return !loader.cancelled.load();
+    }
+
+    bool parse_error(std::size_t position, const std::string& lastToken, const nlohmann::detail::exception& ex) {
+      return fail(std::string(ex.what()) + " at byte " + std::to_string(position) + " near '" + lastToken + "'");
+    }
+
+    // Publishes whatever has been parsed since the last hand over
+    void flush() {
+      publishedStrings += (uint32_t)chunk->strings.size();
+      loader.publishChunk(chunk);
+      chunk = loader.acquireChunk();
+    }
+
+    void release() {
+      loader.publishChunk(chunk);
+      chunk = nullptr;
+    }
+
+  private:
+    enum Section {
+      SECTION_NONE,
+      SECTION_MATERIALS,
+      SECTION_MODELS,
+      SECTION_LIGHTS,
+      SECTION_INSTANCES
+    };
+
+    struct InstanceRecord {
+      glm::vec3 position;
+      glm::vec3 rotation;
+      glm::vec3 scale;
+      float matrix[16];
+      bool hasMatrix;
+      uint32_t model;
+      uint32_t material;
+      uint32_t flags;
+    };
+
+    bool fail(const std::string& message) {
+      loader.setError("ERROR::SCENE::" + message);
+      return false;
+    }
+
+    bool number(double value) {
+      if (depth == 4) {
+        if (numberCount < 16)
+          numbers[numberCount++] = (float)value;
+      }
+      else if (depth == 3) {
+        float v = (float)value;
+        switch (section) {
+          case SECTION_MATERIALS:
+            if (currentKey == "shininess")
+              material.shininess = v;
+            break;
+          case SECTION_LIGHTS:
+            if (currentKey == "intensity")
+              light.intensity = v;
+            else if (currentKey == "range")
+              light.range = v;
+            else if (currentKey == "innerAngle")
+              light.innerAngle = v;
+            else if (currentKey == "outerAngle")
+              light.outerAngle = v;
+            break;
+          case SECTION_INSTANCES:
+            if (currentKey == "scale")
+              instance.scale = glm::vec3(v);
+            else if (currentKey == "model") {
+              if (value < 0 || (uint32_t)value >= modelCount)
+                return fail("Model index out of range: " + std::to_string((long long)value));
+              instance.model = (uint32_t)value;
+            }
+            else if (currentKey == "material") {
+              if (value < 0 || (uint32_t)value >= materialCount)
+                return fail("Material index out of range: " + std::to_string((long long)value));
+              instance.material = (uint32_t)value;
+            }
+            break;
+          default:
+            break;
+        }
+      }
+      else if (depth == 1 && currentKey == "instanceCount" && value > 0) {
+        chunk->instanceCountHint = (uint32_t)value;
+      }
+      return !loader.cancelled.load();
+    }
+
+    void assignVector() {
+      if (numberCount < 3 && currentKey != "matrix")
+        return;
+      glm::vec3 v(numbers[0], numbers[1], numbers[2]);
+
+      switch (section) {
+        case SECTION_MATERIALS:
+          if (currentKey == "color")
+            material.color = v;
+          break;
+        case SECTION_LIGHTS:
+          if (currentKey == "position")
+            light.position = v;
+          else if (currentKey == "direction")
+            light.direction = v;
+          else if (currentKey == "color")
+            light.color = v;
+          break;
+        case SECTION_INSTANCES:
+          if (currentKey == "position")
+            instance.position = v;
+          else if (currentKey == "rotation")
+            instance.rotation = v;
+          else if (currentKey == "scale")
+            instance.scale = v;
+          else if (currentKey == "matrix" && numberCount == 16) {
+            std::memcpy(instance.matrix, numbers, sizeof(numbers));
+            instance.hasMatrix = true;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    void beginRecord() {
+      switch (section) {
+        case SECTION_MATERIALS:
+          material = SceneMaterial();
+          break;
+        case SECTION_MODELS:
+          model = SceneModel();
+          break;
+        case SECTION_LIGHTS:
+          light = SceneLight();
+          break;
+        case SECTION_INSTANCES:
+          instance.position = glm::vec3(0.0f);
+          instance.rotation = glm::vec3(0.0f);
+          instance.scale = glm::vec3(1.0f);
+          instance.hasMatrix = false;
+          instance.model = SCENE_NONE;
+          instance.material = SCENE_NONE;
+          instance.flags = 0;
+          break;
+        default:
+          break;
+      }
+    }
+
+    bool endRecord() {
+      switch (section) {
+        case SECTION_MATERIALS:
+          if (material.name != SCENE_NONE)
+            materialNames[stringAt(material.name)] = materialCount;
+          chunk->materials.push_back(material);
+          materialCount++;
+          break;
+        case SECTION_MODELS:
+          if (model.path == SCENE_NONE && model.primitive == PRIMITIVE_NONE)
+            return fail("Model needs either a path or a primitive");
+          if (model.name != SCENE_NONE)
+            modelNames[stringAt(model.name)] = modelCount;
+          chunk->models.push_back(model);
+          modelCount++;
+          break;
+        case SECTION_LIGHTS:
+          // a zero direction can't be normalized, it keeps pointing down
+          if (glm::dot(light.direction, light.direction) > 0.0f)
+            light.direction = glm::normalize(light.direction);
+          else
+            light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+          chunk->lights.push_back(light);
+          break;
+        case SECTION_INSTANCES: {
+          if (instance.model == SCENE_NONE)
+            return fail("Instance without a model");
+
+          SceneInstance record;
+          record.model = instance.model;
+          record.material = instance.material;
+          record.flags = instance.flags;
+          if (instance.hasMatrix) {
+            std::memcpy(&record.transform[0][0], instance.matrix, sizeof(instance.matrix));
+          }
+          else {
+            // rotation is given as euler angles in degrees, applied in X, Y, Z order
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), instance.position);
+            transform = glm::rotate(transform, glm::radians(instance.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+            transform = glm::rotate(transform, glm::radians(instance.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+            transform = glm::rotate(transform, glm::radians(instance.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+            record.transform = glm::scale(transform, instance.scale);
+          }
+          chunk->instances.push_back(record);
+
+          if (chunk->instances.size() >= SCENE_CHUNK_INSTANCES)
+            flush();
+          break;
+        }
+        default:
+          break;
+      }
+      return true;
+    }
+
+    // Appends a string to the chunk, the returned offset is where it will end up in Scene::strings
+    uint32_t addString(const std::string& value) {
+      uint32_t offset = publishedStrings + (uint32_t)chunk->strings.size();
+      chunk->strings.insert(chunk->strings.end(), value.begin(), value.end());
+      chunk->strings.push_back('\0');
+      return offset;
+    }
+
+    // Only valid for strings added to the current chunk, which is always the case for names of the record being closed
+    std::string stringAt(uint32_t offset) const {
+      return std::string(&chunk->strings[offset - publishedStrings]);
+    }
+
+    SceneLoader& loader;
+    SceneLoader::Chunk* chunk = nullptr;
+    uint32_t publishedStrings = 0;
+
+    int depth = 0;
+    Section section = SECTION_NONE;
+    std::string currentKey;
+    float numbers[16] = {};
+    int numberCount = 0;
+
+    SceneMaterial material;
+    SceneModel model;
+    SceneLight light;
+    InstanceRecord instance;
+
+    uint32_t materialCount = 0;
+    uint32_t modelCount = 0;
+    std::unordered_map<std::string, uint32_t> materialNames;
+    std::unordered_map<std::string, uint32_t> modelNames;
+
+    friend class SceneLoader;
+};
+
+SceneLoader::~SceneLoader() {
+  cancelled = true;
+  if (worker.joinable())
+    worker.join();
+  for (Chunk* chunk : allChunks)
+    delete chunk;
+}
+
+bool SceneLoader::Start(const std::string& path) {
+  std::ifstream check(path);
+  if (!check.good()) {
+    setError("ERROR::SCENE::File does not exist: " + path);
+    std::cerr << Error() << std::endl;
+    return false;
+  }
+  check.close();
+
+  finished = false;
+  setError("");
+  cancelled = false;
+  worker = std::thread(&SceneLoader::run, this, path);
+  return true;
+}
+
+void SceneLoader::run(std::string path) {
+  std::ifstream file(path, std::ios::binary);
+  SceneSaxHandler handler(*this);
+
+  try {
+    // the stream adapter reads the file incrementally, records are published while the rest is still on disk
+    nlohmann::json::sax_parse(file, &handler);
+  }
+  catch (const std::exception& e) {
+    setError("ERROR::SCENE::" + std::string(e.what()));
+  }
+
+  if (failed && !cancelled)
+    std::cerr << Error() << std::endl;
+
+  handler.release();
+  finished = true;
+}
+
+SceneLoader::Chunk* SceneLoader::acquireChunk() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!freeChunks.empty()) {
+    Chunk* chunk = freeChunks.back();
+    freeChunks.pop_back();
+    return chunk;
+  }
+  Chunk* chunk = new Chunk();
+  chunk->instances.reserve(SCENE_CHUNK_INSTANCES);
+  allChunks.push_back(chunk);
+  return chunk;
+}
+
+void SceneLoader::publishChunk(Chunk* chunk) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ready.push_back(chunk);
+}
+
+void SceneLoader::consumeChunk(Chunk* chunk, Scene& scene) {
+  if (chunk->instanceCountHint > 0)
+    scene.instances.reserve(chunk->instanceCountHint);
+
+  scene.materials.insert(scene.materials.end(), chunk->materials.begin(), chunk->materials.end());
+  scene.models.insert(scene.models.end(), chunk->models.begin(), chunk->models.end());
+  scene.lights.insert(scene.lights.end(), chunk->lights.begin(), chunk->lights.end());
+  scene.instances.insert(scene.instances.end(), chunk->instances.begin(), chunk->instances.end());
+  scene.strings.insert(scene.strings.end(), chunk->strings.begin(), chunk->strings.end());
+
+  // clear keeps the capacity, so recycled chunks don't allocate again
+  chunk->materials.clear();
+  chunk->models.clear();
+  chunk->lights.clear();
+  chunk->instances.clear();
+  chunk->strings.clear();
+  chunk->instanceCountHint = 0;
+}
+
+void SceneLoader::setError(const std::string& message) {
+  std::lock_guard<std::mutex> lock(mutex);
+  error = message;
+  failed = !message.empty();
+}
+
+std::string SceneLoader::Error() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return error;
+}
+
+bool SceneLoader::Poll(Scene& scene) {
+  // read the flag first, everything published before it was set is in the ready list below
+  bool done = finished.load();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    consuming.swap(ready);
+  }
+
+  for (Chunk* chunk : consuming)
+    consumeChunk(chunk, scene);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    freeChunks.insert(freeChunks.end(), consuming.begin(), consuming.end());
+  }
+  consuming.clear();
+
+  return done;
+}
+
+bool SceneLoader::Finish(Scene& scene) {
+  if (worker.joinable())
+    worker.join();
+  Poll(scene);
+  return !failed;
+}
+
+bool SceneLoader::Load(const std::string& path, Scene& scene) {
+  SceneLoader loader;
+  if (!loader.Start(path))
+    return false;
+  return loader.Finish(scene);
+}
@@ -0,0 +1,224 @@
+#include "scene_binary.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+// records are written and mapped as raw memory, their layout is part of the file format
+static_assert(std::is_trivially_copyable<SceneMaterial>::value, "SceneMaterial must be POD");
+static_assert(std::is_trivially_copyable<SceneModel>::value, "SceneModel must be POD");
+static_assert(std::is_trivially_copyable<SceneLight>::value, "SceneLight must be POD");
+static_assert(sizeof(SceneMaterial) == 28, "SceneMaterial layout changed, bump SCENE_BINARY_VERSION");
+static_assert(sizeof(SceneModel) == 12, "SceneModel layout changed, bump SCENE_BINARY_VERSION");
+static_assert(sizeof(SceneLight) == 56, "SceneLight layout changed, bump SCENE_BINARY_VERSION");
+static_assert(sizeof(glm::mat4) == 64, "unexpected glm::mat4 size");
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + SCENE_BINARY_ALIGNMENT - 1) & ~(uint64_t)(SCENE_BINARY_ALIGNMENT - 1);
+}
+
+// Writes the file front to back, padding every section to the alignment
+class BinaryWriter {
+  public:
+    explicit BinaryWriter(std::ofstream& file) : file(file) {}
+
+    void write(const void* data, size_t bytes) {
+      file.write((const char*)data, bytes);
+      offset += bytes;
+    }
+
+    void pad() {
+      static const char zeros[SCENE_BINARY_ALIGNMENT] = {};
+      uint64_t aligned = alignOffset(offset);
+      write(zeros, (size_t)(aligned - offset));
+    }
+
+    uint64_t offset = 0;
+
+  private:
+    std::ofstream& file;
+};
+
+bool SceneCompiler::Compile(const Scene& scene, const std::string& path) {
+  const uint64_t instanceCount = scene.instances.size();
+
+  // the engine uses the file in place without looking at every id, so broken references never get written
+  for (size_t i = 0; i < scene.instances.size(); i++) {
+    const SceneInstance& instance = scene.instances[i];
+    if (instance.model >= scene.models.size() || (instance.material != SCENE_NONE && instance.material >= scene.materials.size())) {
+      std::cerr << "ERROR::SCENE_BINARY::Instance " << i << " references a missing model or material" << std::endl;
+      return false;
+    }
+  }
+
+  // lay out all sections first so the header can be written in one go
+  SceneBinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = SCENE_BINARY_MAGIC;
+  header.version = SCENE_BINARY_VERSION;
+
+  const uint64_t counts[BINARY_SECTION_COUNT] = {
+    scene.materials.size(), scene.models.size(), scene.lights.size(),
+    instanceCount, instanceCount, instanceCount, instanceCount,
+    scene.strings.size()
+  };
+  const uint32_t strides[BINARY_SECTION_COUNT] = {
+    sizeof(SceneMaterial), sizeof(SceneModel), sizeof(SceneLight),
+    sizeof(glm::mat4), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+    sizeof(char)
+  };
+
+  uint64_t offset = alignOffset(sizeof(SceneBinaryHeader));
+  for (int i = 0; i < BINARY_SECTION_COUNT; i++) {
+    header.sections[i].offset = offset;
+    header.sections[i].count = counts[i];
+    header.sections[i].stride = strides[i];
+    offset = alignOffset(offset + counts[i] * strides[i]);
+  }
+  header.fileSize = offset;
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.good()) {
+    std::cerr << "ERROR::SCENE_BINARY::Can't open " << path << " for writing" << std::endl;
+    return false;
+  }
+
+  BinaryWriter writer(file);
+  writer.write(&header, sizeof(header));
+  writer.pad();
+
+  writer.write(scene.materials.data(), scene.materials.size() * sizeof(SceneMaterial));
+  writer.pad();
+  writer.write(scene.models.data(), scene.models.size() * sizeof(SceneModel));
+  writer.pad();
+  writer.write(scene.lights.data(), scene.lights.size() * sizeof(SceneLight));
+  writer.pad();
+
+  // instances are split into one array per field so each consumer only touches the pages it needs
+  for (const SceneInstance& instance : scene.instances)
+    writer.write(&instance.transform, sizeof(glm::mat4));
+  writer.pad();
+  for (const SceneInstance& instance : scene.instances)
+    writer.write(&instance.model, sizeof(uint32_t));
+  writer.pad();
+  for (const SceneInstance& instance : scene.instances)
+    writer.write(&instance.material, sizeof(uint32_t));
+  writer.pad();
+  for (const SceneInstance& instance : scene.instances)
+    writer.write(&instance.flags, sizeof(uint32_t));
+  writer.pad();
+
+  writer.write(scene.strings.data(), scene.strings.size());
+  writer.pad();
+
+  file.close();
+  if (!file.good() || writer.offset != header.fileSize) {
+    std::cerr << "ERROR::SCENE_BINARY::Failed writing " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+MappedScene::~MappedScene() {
+  Close();
+}
+
+template <typename T>
+bool MappedScene::mapSection(const SceneBinaryHeader& header, SceneBinarySection section, SceneArray<T>& array) {
+  const SceneBinarySectionEntry& entry = header.sections[section];
+  if (entry.stride != sizeof(T) || entry.offset % SCENE_BINARY_ALIGNMENT != 0 ||
+      entry.offset > size || entry.count > (size - entry.offset) / sizeof(T)) {
+    std::cerr << "ERROR::SCENE_BINARY::Invalid section " << section << std::endl;
+    return false;
+  }
+  array = SceneArray<T>((const T*)((const char*)base + entry.offset), (size_t)entry.count);
+  return true;
+}
+
+bool MappedScene::Open(const std::string& path) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "ERROR::SCENE_BINARY::File does not exist: " << path << std::endl;
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SceneBinaryHeader)) {
+    std::cerr << "ERROR::SCENE_BINARY::File too small: " << path << std::endl;
+    close(fd);
+    return false;
+  }
+
+  size = (size_t)info.st_size;
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "ERROR::SCENE_BINARY::mmap failed for " << path << std::endl;
+    size = 0;
+    return false;
+  }
+  base = mapping;
+
+  const SceneBinaryHeader& header = *(const SceneBinaryHeader*)base;
+  if (header.magic != SCENE_BINARY_MAGIC || header.version != SCENE_BINARY_VERSION || header.fileSize != size) {
+    std::cerr << "ERROR::SCENE_BINARY::Not a compiled scene or wrong version: " << path << std::endl;
+    Close();
+    return false;
+  }
+
+  bool valid = mapSection(header, BINARY_SECTION_MATERIALS, materials) &&
+               mapSection(header, BINARY_SECTION_MODELS, models) &&
+               mapSection(header, BINARY_SECTION_LIGHTS, lights) &&
+               mapSection(header, BINARY_SECTION_TRANSFORMS, transforms) &&
+               mapSection(header, BINARY_SECTION_MODEL_IDS, modelIds) &&
+               mapSection(header, BINARY_SECTION_MATERIAL_IDS, materialIds) &&
+               mapSection(header, BINARY_SECTION_FLAGS, flags) &&
+               mapSection(header, BINARY_SECTION_STRINGS, strings);
+
+  // every instance array must have the same length and the string table must be terminated
+  if (valid && (modelIds.size() != transforms.size() || materialIds.size() != transforms.size() ||
+                flags.size() != transforms.size() || (!strings.empty() && strings[strings.size() - 1] != '\0'))) {
+    std::cerr << "ERROR::SCENE_BINARY::Inconsistent sections in " << path << std::endl;
+    valid = false;
+  }
+
+  if (!valid) {
+    Close();
+    return false;
+  }
+
+  // instance arrays are usually walked front to back
+  madvise(base, size, MADV_SEQUENTIAL);
+  return true;
+}
+
+void MappedScene::Close() {
+  if (base)
+    munmap(base, size);
+  base = nullptr;
+  size = 0;
+  materials = SceneArray<SceneMaterial>();
+  models = SceneArray<SceneModel>();
+  lights = SceneArray<SceneLight>();
+  transforms = SceneArray<glm::mat4>();
+  modelIds = SceneArray<uint32_t>();
+  materialIds = SceneArray<uint32_t>();
+  flags = SceneArray<uint32_t>();
+  strings = SceneArray<char>();
+}
+
+const char* MappedScene::GetString(uint32_t offset) const {
+  if (offset == SCENE_NONE || offset >= strings.size())
+    return "";
+  return &strings[offset];
+}
@@ -1,4 +1,6 @@
 #include "shader.h"
+#include "profiler.h"
+#include "program_cache.h"
 #include "glm/detail/type_vec.hpp"
 
 #include <glad/glad.h>
@@ -8,114 +10,349 @@
 #include <sstream>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <set>
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath) {
-  std::string vertexCode;
-  std::string fragmentCode;
-  std::ifstream vShaderFile;
-  std::ifstream fShaderFile;
+namespace {
 
-  // Check if files exist before attempting to open them
-  std::ifstream checkVFile(vertexPath);
-  if (!checkVFile.good()) {
-    std::cout << "ERROR: Vertex shader file does not exist at: " << vertexPath << std::endl;
+// appends a file to output with its #include lines replaced by the files they name, relative to it.
+// Files already in included are skipped, so every file ends up in a program once.
+bool expandIncludes(const std::string& path, std::string& output, std::set<std::string>& included) {
+  std::ifstream file(path);
+  if (!file.good()) {
+    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+    return false;
   }
-  checkVFile.close();
+  included.insert(path);
+  size_t slash = path.find_last_of('/');
+  std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
 
-  std::ifstream checkFFile(fragmentPath);
-  if (!checkFFile.good()) {
-    std::cout << "ERROR: Fragment shader file does not exist at: " << fragmentPath << std::endl;
+  // #line keeps compile errors pointing at the line of the file they are in
+  std::string line;
+  int number = 0;
+  while (std::getline(file, line)) {
+    number++;
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+      output += line;
+      output += '\n';
+      continue;
+    }
+
+    size_t open = line.find('"', start + 8);
+    size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+    if (close == std::string::npos) {
+      std::cout << "ERROR::SHADER::MALFORMED_INCLUDE: " << path << ":" << number << std::endl;
+      return false;
+    }
+    // normalized so the same file reached through different relative paths counts once
+    std::string includePath = std::filesystem::path(directory + line.substr(open + 1, close - open - 1)).lexically_normal().generic_string();
+    if (included.count(includePath) != 0)
+      continue;
+    output += "#line 0\n";
+    if (!expandIncludes(includePath, output, included))
+      return false;
+    output += "#line " + std::to_string(number) + "\n";
   }
-  checkFFile.close();
+  return true;
+}
 
-  vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+} // namespace
 
-  try {
-    // open files
-    vShaderFile.open(vertexPath);
-    fShaderFile.open(fragmentPath);
-    std::stringstream vShaderStream, fShaderStream;
+std::string Shader::Preprocess(const std::string& path, const std::vector<std::string>& defines, std::vector<std::string>* files) {
+  std::string source;
+  std::set<std::string> included;
+  bool complete = expandIncludes(std::filesystem::path(path).lexically_normal().generic_string(), source, included);
+  if (files)
+    files->assign(included.begin(), included.end());
+  if (!complete)
+    return "";
+  if (defines.empty())
+    return source;
 
-    // read file's buffer contents into streams
-    vShaderStream << vShaderFile.rdbuf();
-    fShaderStream << fShaderFile.rdbuf();
+  // #version has to stay the first thing in the source, the defines go right after it
+  std::string block;
+  for (const std::string& define : defines)
+    block += "#define " + define + "\n";
+  size_t insert = 0;
+  size_t version = source.find("#version");
+  if (version != std::string::npos) {
+    size_t lineEnd = source.find('\n', version);
+    insert = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+  }
+  int nextLine = (int)std::count(source.begin(), source.begin() + insert, '\n');
+  block += "#line " + std::to_string(nextLine) + "\n";
+  return source.insert(insert, block);
+}
 
-    // close file handlers
-    vShaderFile.close();
-    fShaderFile.close();
+// KHR_parallel_shader_compile and its ARB twin, glad was generated without extensions
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
 
-    // convert stream into string
-    vertexCode = vShaderStream.str();
-    fragmentCode = fShaderStream.str();
+static bool parallelCompile = false;
 
-    // Check if files are empty
-    if (vertexCode.empty()) {
-      std::cout << "WARNING: Vertex shader file is empty!" << std::endl;
-    }
-    if (fragmentCode.empty()) {
-      std::cout << "WARNING: Fragment shader file is empty!" << std::endl;
-    }
+bool Shader::EnableParallelCompile(GLADloadproc loader) {
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  const char* function = nullptr;
+  for (GLint i = 0; i < extensionCount && !function; i++) {
+    const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+    if (strcmp(extension, "GL_KHR_parallel_shader_compile") == 0)
+      function = "glMaxShaderCompilerThreadsKHR";
+    else if (strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)
+      function = "glMaxShaderCompilerThreadsARB";
+  }
+  if (!function)
+    return false;
+
+  // let the driver pick how many threads it compiles on
+  PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader(function);
+  if (maxThreads)
+    maxThreads(0xFFFFFFFF);
+  parallelCompile = true;
+  return true;
+}
+
+bool Shader::ParallelCompile() {
+  return parallelCompile;
+}
+
+// every shader alive, for hot reloading
+static std::vector<Shader*> liveShaders;
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines, bool wait)
+    : vertexPath(vertexPath), fragmentPath(fragmentPath), defines(defines) {
+  startBuild(current);
+  ID = current.program;
+  liveShaders.push_back(this);
+  if (wait)
+    Wait();
+}
+
+Shader::~Shader() {
+  liveShaders.erase(std::remove(liveShaders.begin(), liveShaders.end(), this), liveShaders.end());
+  if (reload.program != 0) {
+    finishBuild(reload);
+    glDeleteProgram(reload.program);
+  }
+  // a build still in flight has its stages released first
+  finishBuild(current);
+  glDeleteProgram(ID);
+}
 
-    std::cout << "Vertex shader content length: " << vertexCode.length() << std::endl;
-    std::cout << "Fragment shader content length: " << fragmentCode.length() << std::endl;
+void Shader::startBuild(Build& build) {
+  std::vector<std::string> vertexFiles;
+  std::string vertexCode = Preprocess(vertexPath, defines, &vertexFiles);
+  std::string fragmentCode = Preprocess(fragmentPath, defines, &dependencies);
+  dependencies.insert(dependencies.end(), vertexFiles.begin(), vertexFiles.end());
+
+  // Check if files are empty
+  if (vertexCode.empty()) {
+    std::cout << "WARNING: Vertex shader file is empty!" << std::endl;
   }
-  catch (std::ifstream::failure& e) {
-    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+  if (fragmentCode.empty()) {
+    std::cout << "WARNING: Fragment shader file is empty!" << std::endl;
   }
 
   const char* vShaderCode = vertexCode.c_str();
   const char* fShaderCode = fragmentCode.c_str();
 
+  // a program linked on an earlier run skips compilation entirely
+  ProgramCache& cache = ProgramCache::Get();
+  build.cacheKey = cache.Key({vertexCode, fragmentCode});
+  build.program = cache.Load(build.cacheKey);
+  build.linked = build.program != 0;
+  if (build.program != 0)
+    return;
+
+  // compile and link without asking for the result, which is what makes the driver wait for it
+  build.vertexStage = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(build.vertexStage, 1, &vShaderCode, NULL);
+  glCompileShader(build.vertexStage);
+
+  build.fragmentStage = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(build.fragmentStage, 1, &fShaderCode, NULL);
+  glCompileShader(build.fragmentStage);
+
+  build.program = glCreateProgram();
+  glAttachShader(build.program, build.vertexStage);
+  glAttachShader(build.program, build.fragmentStage);
+  cache.PrepareLink(build.program);
+  glLinkProgram(build.program);
+  build.pending = true;
+}
+
+bool Shader::buildDone(const Build& build) const {
+  if (!build.pending || !parallelCompile)
+    return true;
+  int done = 0;
+  glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+  return done != 0;
+}
+
+void Shader::finishBuild(Build& build) {
+  if (!build.pending)
+    return;
+  build.pending = false;
 
-  // compile shaders
-  unsigned int vertex, fragment;
   int success;
   char infoLog[512];
 
-  // vertex shader
-  vertex = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex, 1, &vShaderCode, NULL);
-  glCompileShader(vertex);
-
   // error checking
-  glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(build.vertexStage, GL_COMPILE_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+    glGetShaderInfoLog(build.vertexStage, 512, NULL, infoLog);
+    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED " << vertexPath << "\n" << infoLog << std::endl;
   }
-
-  // fragment shader
-  fragment = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment, 1, &fShaderCode, NULL);
-  glCompileShader(fragment);
-
-  // error checking
-  glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(build.fragmentStage, GL_COMPILE_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+    glGetShaderInfoLog(build.fragmentStage, 512, NULL, infoLog);
+    std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED " << fragmentPath << "\n" << infoLog << std::endl;
   }
 
-  // shader program
-  ID = glCreateProgram();
-  glAttachShader(ID, vertex);
-  glAttachShader(ID, fragment);
-  glLinkProgram(ID);
-
   // linking error checking
-  glGetProgramiv(ID, GL_LINK_STATUS, &success);
+  glGetProgramiv(build.program, GL_LINK_STATUS, &success);
+  build.linked = success != 0;
   if (!success) {
-    glGetProgramInfoLog(ID, 512, NULL, infoLog);
+    glGetProgramInfoLog(build.program, 512, NULL, infoLog);
     std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
   }
-  
-  glDeleteShader(vertex);
-  glDeleteShader(fragment);
+  else {
+    ProgramCache::Get().Store(build.cacheKey, build.program);
+  }
+
+  glDeleteShader(build.vertexStage);
+  glDeleteShader(build.fragmentStage);
+  build.vertexStage = build.fragmentStage = 0;
+}
+
+bool Shader::Ready() {
+  if (!buildDone(current))
+    return false;
+  finishBuild(current);
+  return true;
+}
+
+void Shader::Wait() {
+  finishBuild(current);
+}
+
+bool Shader::DependsOn(const std::string& file) const {
+  std::string normalized = std::filesystem::path(file).lexically_normal().generic_string();
+  return std::find(dependencies.begin(), dependencies.end(), normalized) != dependencies.end();
+}
+
+void Shader::Reload() {
+  // an edit while the last one still compiles replaces it
+  if (reload.program != 0) {
+    finishBuild(reload);
+    glDeleteProgram(reload.program);
+  }
+  reload = Build();
+  dependencies.clear();
+  startBuild(reload);
+}
+
+// copies the value of every active uniform of from that to also has, so state set once (samplers, material
+// parameters) survives a reload
+static void copyUniforms(GLuint from, GLuint to) {
+  GLint count = 0;
+  glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &count);
+  glUseProgram(to);
+  for (GLint i = 0; i < count; i++) {
+    char name[256];
+    GLint size;
+    GLenum type;
+    glGetActiveUniform(from, (GLuint)i, sizeof(name), NULL, &size, &type, name);
+
+    // arrays are listed once as name[0], every element has its own location
+    std::string base = name;
+    size_t bracket = base.find('[');
+    if (bracket != std::string::npos)
+      base = base.substr(0, bracket);
+    for (GLint element = 0; element < size; element++) {
+      std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : std::string(name);
+      GLint source = glGetUniformLocation(from, elementName.c_str());
+      GLint target = glGetUniformLocation(to, elementName.c_str());
+      if (source < 0 || target < 0)
+        continue;
+
+      GLfloat floats[16];
+      GLint ints[4];
+      GLuint uints[4];
+      switch (type) {
+        case GL_FLOAT: glGetUniformfv(from, source, floats); glUniform1fv(target, 1, floats); break;
+        case GL_FLOAT_VEC2: glGetUniformfv(from, source, floats); glUniform2fv(target, 1, floats); break;
+        case GL_FLOAT_VEC3: glGetUniformfv(from, source, floats); glUniform3fv(target, 1, floats); break;
+        case GL_FLOAT_VEC4: glGetUniformfv(from, source, floats); glUniform4fv(target, 1, floats); break;
+        case GL_FLOAT_MAT2: glGetUniformfv(from, source, floats); glUniformMatrix2fv(target, 1, GL_FALSE, floats); break;
+        case GL_FLOAT_MAT3: glGetUniformfv(from, source, floats); glUniformMatrix3fv(target, 1, GL_FALSE, floats); break;
+        case GL_FLOAT_MAT4: glGetUniformfv(from, source, floats); glUniformMatrix4fv(target, 1, GL_FALSE, floats); break;
+        case GL_INT_VEC2: glGetUniformiv(from, source, ints); glUniform2iv(target, 1, ints); break;
+        case GL_INT_VEC3: glGetUniformiv(from, source, ints); glUniform3iv(target, 1, ints); break;
+        case GL_INT_VEC4: glGetUniformiv(from, source, ints); glUniform4iv(target, 1, ints); break;
+        case GL_UNSIGNED_INT: glGetUniformuiv(from, source, uints); glUniform1uiv(target, 1, uints); break;
+        case GL_UNSIGNED_INT_VEC2: glGetUniformuiv(from, source, uints); glUniform2uiv(target, 1, uints); break;
+        case GL_UNSIGNED_INT_VEC3: glGetUniformuiv(from, source, uints); glUniform3uiv(target, 1, uints); break;
+        case GL_UNSIGNED_INT_VEC4: glGetUniformuiv(from, source, uints); glUniform4uiv(target, 1, uints); break;
+        default:
+          // ints, bools and every sampler type are a single int
+          glGetUniformiv(from, source, ints);
+          glUniform1iv(target, 1, ints);
+          break;
+      }
+    }
+  }
+}
+
+size_t Shader::ReloadChanged(const std::vector<std::string>& changedFiles) {
+  size_t started = 0;
+  for (Shader* shader : liveShaders) {
+    for (const std::string& file : changedFiles) {
+      if (shader->DependsOn(file)) {
+        shader->Reload();
+        started++;
+        break;
+      }
+    }
+  }
+  return started;
+}
+
+size_t Shader::FinishReloads() {
+  size_t swapped = 0;
+  for (Shader* shader : liveShaders) {
+    Build& reload = shader->reload;
+    if (reload.program == 0 || !shader->buildDone(reload))
+      continue;
+    shader->finishBuild(reload);
+
+    // a broken edit keeps the program that worked
+    if (!reload.linked) {
+      std::cout << "ERROR::SHADER::RELOAD_FAILED " << shader->vertexPath << " + " << shader->fragmentPath << ", keeping the old program" << std::endl;
+      glDeleteProgram(reload.program);
+    }
+    else {
+      shader->finishBuild(shader->current);
+      copyUniforms(shader->ID, reload.program);
+      glUseProgram(0);
+      glDeleteProgram(shader->ID);
+      shader->current = reload;
+      shader->ID = reload.program;
+      std::cout << "Reloaded " << shader->vertexPath << " + " << shader->fragmentPath << std::endl;
+      swapped++;
+    }
+    reload = Build();
+  }
+  return swapped;
 }
 
 void Shader::use() {
+  Wait();
   glUseProgram(ID);
+  Profiler::Get().CountStateChange();
 }
 
 void Shader::setBool(const std::string &name, bool value) const {
@@ -0,0 +1,61 @@
+#include "shader_variants.h"
+
+#include <iostream>
+#include <vector>
+
+ShaderVariants::ShaderVariants(const char* vertexPath, const char* fragmentPath)
+    : vertexPath(vertexPath), fragmentPath(fragmentPath) {}
+
+const char* ShaderVariants::FeatureDefine(uint32_t feature) {
+  switch (feature) {
+    case SHADER_INSTANCED: return "INSTANCED";
+    case SHADER_SKINNED: return "SKINNED";
+    case SHADER_NORMAL_MAP: return "NORMAL_MAP";
+    case SHADER_SHADOWS: return "SHADOWS";
+    case SHADER_VERTEX_ANIMATION: return "VERTEX_ANIMATION";
+    case SHADER_MORPH_TARGETS: return "MORPH_TARGETS";
+    default: return nullptr;
+  }
+}
+
+Shader& ShaderVariants::create(uint32_t features, bool wait) {
+  std::vector<std::string> defines;
+  for (uint32_t bit = 0; bit < SHADER_FEATURE_COUNT; bit++) {
+    if (features & (1u << bit))
+      defines.push_back(FeatureDefine(1u << bit));
+  }
+  if (features >> SHADER_FEATURE_COUNT)
+    std::cout << "ERROR::SHADER_VARIANTS::Unknown feature bits " << (features >> SHADER_FEATURE_COUNT << SHADER_FEATURE_COUNT) << std::endl;
+
+  Shader* shader = new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines, wait);
+  variants[features].reset(shader);
+  return *shader;
+}
+
+void ShaderVariants::Request(uint32_t features) {
+  if (variants.find(features) == variants.end())
+    create(features, false);
+}
+
+Shader& ShaderVariants::Get(uint32_t features) {
+  std::unordered_map<uint32_t, std::unique_ptr<Shader>>::iterator it = variants.find(features);
+  if (it == variants.end())
+    return create(features, true);
+  it->second->Wait();
+  return *it->second;
+}
+
+Shader& ShaderVariants::GetOrFallback(uint32_t features, uint32_t fallback) {
+  std::unordered_map<uint32_t, std::unique_ptr<Shader>>::iterator it = variants.find(features);
+  Shader& shader = it == variants.end() ? create(features, false) : *it->second;
+  if (shader.Ready() || features == fallback)
+    return Get(features);
+  return Get(fallback);
+}
+
+size_t ShaderVariants::PendingCount() {
+  size_t pending = 0;
+  for (std::unordered_map<uint32_t, std::unique_ptr<Shader>>::iterator it = variants.begin(); it != variants.end(); ++it)
+    pending += it->second->Ready() ? 0 : 1;
+  return pending;
+}
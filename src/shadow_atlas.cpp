@@ -0,0 +1,518 @@
+#include "shadow_atlas.h"
+#include "animation.h"
+#include "profiler.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+static_assert((SHADOW_ATLAS_SIZE >> (SHADOW_ATLAS_LEVELS - 1)) == SHADOW_ATLAS_MIN_TILE, "levels must reach the smallest tile");
+
+// near plane of the light projections
+static const float SHADOW_ATLAS_NEAR = 0.05f;
+// depth bias applied while rendering the casters, in slope and depth buffer units
+static const float SHADOW_ATLAS_SLOPE_BIAS = 2.0f;
+static const float SHADOW_ATLAS_CONSTANT_BIAS = 4.0f;
+
+// cube faces in the order the fragment shader picks them: +X, -X, +Y, -Y, +Z, -Z
+static const glm::vec3 CUBE_DIRECTIONS[6] = {
+  glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+  glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+static const glm::vec3 CUBE_UPS[6] = {
+  glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+  glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+};
+
+static int levelOffset(int level) { return ((1 << (2 * level)) - 1) / 3; }
+
+// full field of view of a light's faces in radians
+static float faceFov(SceneLightType type, float outerAngle) {
+  if (type == LIGHT_POINT)
+    return glm::radians(90.0f);
+  // a little wider than the cone so the filter taps at its edge stay inside
+  return std::min(glm::radians(2.0f * outerAngle + 2.0f), glm::radians(170.0f));
+}
+
+static GLuint createAtlasTexture() {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  Profiler::Get().TrackTextureMemory((long long)SHADOW_ATLAS_SIZE * SHADOW_ATLAS_SIZE * 4);
+  return texture;
+}
+
+static bool attachDepth(GLuint framebuffer, GLuint texture) {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return complete;
+}
+
+bool ShadowAtlas::Init(const ShadowAtlasSettings& atlasSettings) {
+  settings = atlasSettings;
+  tiles.assign(levelOffset(SHADOW_ATLAS_LEVELS), TILE_FREE);
+  depthShader.reset(new Shader("resources/shaders/shadowDepth.vs", "resources/shaders/shadowDepth.fs"));
+
+  staticTexture = createAtlasTexture();
+  finalTexture = createAtlasTexture();
+  glGenFramebuffers(1, &staticFramebuffer);
+  glGenFramebuffers(1, &finalFramebuffer);
+  if (!attachDepth(staticFramebuffer, staticTexture) || !attachDepth(finalFramebuffer, finalTexture)) {
+    std::cout << "ERROR::SHADOW_ATLAS::Atlas framebuffer is not complete" << std::endl;
+    return false;
+  }
+
+  // the final atlas starts out lit everywhere, tiles that never got a shadow read as far away
+  glBindFramebuffer(GL_FRAMEBUFFER, finalFramebuffer);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenBuffers(1, &faceBuffer);
+  glGenTextures(1, &faceTexture);
+  glBindBuffer(GL_TEXTURE_BUFFER, faceBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * SHADOW_ATLAS_FACE_TEXELS, NULL, GL_STREAM_DRAW);
+  glBindTexture(GL_TEXTURE_BUFFER, faceTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, faceBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  initialized = true;
+  return true;
+}
+
+void ShadowAtlas::Shutdown() {
+  if (staticTexture != 0) {
+    GLuint textures[] = {staticTexture, finalTexture};
+    glDeleteTextures(2, textures);
+    Profiler::Get().TrackTextureMemory(-2LL * SHADOW_ATLAS_SIZE * SHADOW_ATLAS_SIZE * 4);
+  }
+  GLuint framebuffers[] = {staticFramebuffer, finalFramebuffer};
+  glDeleteFramebuffers(2, framebuffers);
+  glDeleteBuffers(1, &faceBuffer);
+  glDeleteTextures(1, &faceTexture);
+  staticTexture = finalTexture = staticFramebuffer = finalFramebuffer = faceBuffer = faceTexture = 0;
+  depthShader.reset();
+  lights.clear();
+  lightIndex.clear();
+  initialized = false;
+}
+
+int ShadowAtlas::findFree(int level, int index, int target) const {
+  int node = levelOffset(level) + index;
+  if (level == target)
+    return tiles[node] == TILE_FREE ? node : -1;
+  if (tiles[node] != TILE_SPLIT)
+    return -1;
+  for (int child = 0; child < 4; child++) {
+    int found = findFree(level + 1, index * 4 + child, target);
+    if (found >= 0)
+      return found;
+  }
+  return -1;
+}
+
+int ShadowAtlas::findSplittable(int level, int index, int target, int& foundLevel) const {
+  int node = levelOffset(level) + index;
+  if (tiles[node] == TILE_FREE) {
+    foundLevel = level;
+    return node;
+  }
+  if (tiles[node] != TILE_SPLIT || level + 1 >= target)
+    return -1;
+
+  // the smallest free tile, so big ones stay whole for big requests
+  int best = -1;
+  for (int child = 0; child < 4; child++) {
+    int childLevel = -1;
+    int found = findSplittable(level + 1, index * 4 + child, target, childLevel);
+    if (found >= 0 && childLevel > foundLevel) {
+      best = found;
+      foundLevel = childLevel;
+    }
+  }
+  return best;
+}
+
+int ShadowAtlas::allocateTile(int target) {
+  // a free tile of the right size in an already split part first
+  int node = findFree(0, 0, target);
+  if (node >= 0) {
+    tiles[node] = TILE_USED;
+    return node;
+  }
+
+  int level = -1;
+  node = findSplittable(0, 0, target, level);
+  if (node < 0)
+    return -1;
+
+  int index = node - levelOffset(level);
+  while (level < target) {
+    tiles[node] = TILE_SPLIT;
+    level++;
+    index *= 4;
+    node = levelOffset(level) + index;
+    for (int child = 0; child < 4; child++)
+      tiles[node + child] = TILE_FREE;
+  }
+  tiles[node] = TILE_USED;
+  return node;
+}
+
+void ShadowAtlas::freeTile(int node) {
+  int level = 0;
+  while (levelOffset(level + 1) <= node)
+    level++;
+  int index = node - levelOffset(level);
+  tiles[node] = TILE_FREE;
+
+  // merge back up while all four siblings are free
+  while (level > 0) {
+    int first = levelOffset(level) + (index & ~3);
+    if (tiles[first] != TILE_FREE || tiles[first + 1] != TILE_FREE || tiles[first + 2] != TILE_FREE || tiles[first + 3] != TILE_FREE)
+      break;
+    level--;
+    index /= 4;
+    tiles[levelOffset(level) + index] = TILE_FREE;
+  }
+}
+
+glm::ivec3 ShadowAtlas::tileRect(int node) const {
+  int level = 0;
+  while (levelOffset(level + 1) <= node)
+    level++;
+  int index = node - levelOffset(level);
+
+  int x = 0, y = 0;
+  for (int bit = 0; bit < level; bit++) {
+    x |= ((index >> (2 * bit)) & 1) << bit;
+    y |= ((index >> (2 * bit + 1)) & 1) << bit;
+  }
+  int size = SHADOW_ATLAS_SIZE >> level;
+  return glm::ivec3(x * size, y * size, size);
+}
+
+bool ShadowAtlas::allocateLight(LightShadow& shadow, int level) {
+  for (int i = 0; i < shadow.faceCount; i++) {
+    shadow.faces[i].tile = allocateTile(level);
+    if (shadow.faces[i].tile < 0) {
+      for (int j = 0; j < i; j++) {
+        freeTile(shadow.faces[j].tile);
+        shadow.faces[j].tile = -1;
+      }
+      return false;
+    }
+  }
+  shadow.level = level;
+  return true;
+}
+
+void ShadowAtlas::releaseLight(LightShadow& shadow) {
+  for (int i = 0; i < 6; i++) {
+    Face& face = shadow.faces[i];
+    if (face.tile >= 0)
+      freeTile(face.tile);
+    face.tile = -1;
+    face.staticValid = false;
+  }
+  shadow.level = -1;
+}
+
+bool ShadowAtlas::evictLeastRecent() {
+  // lights shadowed this frame are never taken apart
+  LightShadow* oldest = nullptr;
+  for (LightShadow& shadow : lights) {
+    if (shadow.level >= 0 && shadow.lastUsed < frame && (!oldest || shadow.lastUsed < oldest->lastUsed))
+      oldest = &shadow;
+  }
+  if (!oldest)
+    return false;
+  releaseLight(*oldest);
+  return true;
+}
+
+void ShadowAtlas::fitFaces(LightShadow& shadow) {
+  glm::vec3 position(shadow.transform[3]);
+  float nearPlane = std::min(SHADOW_ATLAS_NEAR, shadow.range * 0.5f);
+  glm::mat4 projection = glm::perspective(faceFov(shadow.type, shadow.outerAngle), 1.0f, nearPlane, shadow.range);
+
+  for (int i = 0; i < shadow.faceCount; i++) {
+    glm::vec3 direction = CUBE_DIRECTIONS[i];
+    glm::vec3 up = CUBE_UPS[i];
+    if (shadow.type == LIGHT_SPOT) {
+      // spot lights shine down their -Z
+      direction = glm::normalize(-glm::vec3(shadow.transform[2]));
+      up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    shadow.faces[i].matrix = projection * glm::lookAt(position, position + direction, up);
+    shadow.faces[i].staticValid = false;
+    shadow.faces[i].dirty = true;
+  }
+}
+
+void ShadowAtlas::InvalidateStatic(const AABB& bounds) {
+  if (bounds.IsEmpty())
+    return;
+  for (LightShadow& shadow : lights) {
+    for (int i = 0; i < shadow.faceCount && shadow.level >= 0; i++) {
+      Face& face = shadow.faces[i];
+      if (face.staticValid && Frustum::FromMatrix(face.matrix).Overlaps(bounds))
+        face.staticValid = false;
+    }
+  }
+}
+
+void ShadowAtlas::bindTile(const Face& face) {
+  glm::ivec3 rect = tileRect(face.tile);
+  glViewport(rect.x, rect.y, rect.z, rect.z);
+  glScissor(rect.x, rect.y, rect.z, rect.z);
+}
+
+size_t ShadowAtlas::drawCasters(World& world, const Face& face) {
+  depthShader->setMat4("lightViewProjection", face.matrix);
+  size_t drawn = 0;
+  for (Entity entity : faceCasters) {
+    const MeshRendererComponent* renderer = world.Get<MeshRendererComponent>(entity);
+    const WorldTransformComponent* transform = world.Get<WorldTransformComponent>(entity);
+    if (!renderer || !transform || !renderer->model || renderer->model->meshes.empty())
+      continue;
+    const AnimatorComponent* animator = world.Get<AnimatorComponent>(entity);
+    renderer->model->Draw(*depthShader, transform->matrix, animator ? (int)animator->paletteOffset : -1);
+    drawn++;
+  }
+  return drawn;
+}
+
+void ShadowAtlas::Update(World& world, const DynamicBVH& bvh, const glm::mat4& viewProjection, const glm::vec3& viewPosition,
+                         float projectionScale, int width, int height) {
+  frame++;
+  faceData.clear();
+  if (!initialized)
+    return;
+
+  // forget lights whose entity is gone
+  for (size_t i = 0; i < lights.size();) {
+    lights[i].firstFace = -1;
+    if (world.IsAlive(lights[i].entity)) {
+      i++;
+      continue;
+    }
+    releaseLight(lights[i]);
+    lightIndex.erase(EntityToBits(lights[i].entity));
+    if (i + 1 < lights.size()) {
+      lights[i] = lights.back();
+      lightIndex[EntityToBits(lights[i].entity)] = i;
+    }
+    lights.pop_back();
+  }
+
+  // shadowed lights whose range reaches into the view, weighed by their radius on screen in pixels
+  Frustum frustum = Frustum::FromMatrix(viewProjection);
+  requests.clear();
+  world.Each<LightComponent, WorldTransformComponent>([&](Entity entity, LightComponent& light, WorldTransformComponent& transform) {
+    if (!light.castShadows || light.type == LIGHT_DIRECTIONAL || light.range <= 0.0f)
+      return;
+    glm::vec3 position(transform.matrix[3]);
+    if (!frustum.Overlaps(AABB{position - glm::vec3(light.range), position + glm::vec3(light.range)}))
+      return;
+    float distance = glm::length(position - viewPosition);
+    float importance = distance > light.range ? light.range / distance * projectionScale * 0.5f * height : (float)height;
+    requests.push_back({entity, &light, transform.matrix, importance});
+  });
+
+  std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) { return a.importance > b.importance; });
+  size_t maxLights = (size_t)std::max(0, settings.maxShadowedLights);
+  if (requests.size() > maxLights)
+    requests.resize(maxLights);
+
+  // tiles for the most important lights first, so they are the ones that get the big ones
+  for (const Request& request : requests) {
+    const LightComponent& light = *request.light;
+    int faceCount = light.type == LIGHT_POINT ? 6 : 1;
+
+    size_t index;
+    std::unordered_map<uint64_t, size_t>::iterator it = lightIndex.find(EntityToBits(request.entity));
+    if (it == lightIndex.end()) {
+      index = lights.size();
+      lights.push_back(LightShadow());
+      LightShadow& created = lights.back();
+      created.entity = request.entity;
+      created.level = -1;
+      created.firstFace = -1;
+      for (int i = 0; i < 6; i++)
+        created.faces[i] = {glm::mat4(1.0f), -1, false, false};
+      lightIndex[EntityToBits(request.entity)] = index;
+    } else {
+      index = it->second;
+    }
+    LightShadow& shadow = lights[index];
+    shadow.lastUsed = frame;
+
+    // a moved or reshaped light loses its tiles
+    if (shadow.level >= 0 && (shadow.type != light.type || shadow.faceCount != faceCount || shadow.transform != request.transform ||
+                              shadow.range != light.range || shadow.outerAngle != light.outerAngle))
+      releaseLight(shadow);
+    shadow.type = light.type;
+    shadow.faceCount = faceCount;
+    shadow.transform = request.transform;
+    shadow.range = light.range;
+    shadow.outerAngle = light.outerAngle;
+
+    // power of two tile around the light's size on screen. Grows right away, but only shrinks once it is
+    // two sizes too big so lights near the threshold don't re-render all the time.
+    float texels = request.importance * settings.texelsPerPixel;
+    int level = 0;
+    while ((SHADOW_ATLAS_SIZE >> level) > SHADOW_ATLAS_MAX_TILE)
+      level++;
+    while (level + 1 < SHADOW_ATLAS_LEVELS && (float)(SHADOW_ATLAS_SIZE >> (level + 1)) >= texels)
+      level++;
+    if (shadow.level >= 0 && (level < shadow.level || level > shadow.level + 1))
+      releaseLight(shadow);
+
+    if (shadow.level < 0) {
+      // evict the least recently used lights to make room, then settle for smaller tiles
+      bool placed = false;
+      for (int candidate = level; candidate < SHADOW_ATLAS_LEVELS && !placed; candidate++) {
+        while (!(placed = allocateLight(shadow, candidate)) && evictLeastRecent()) {
+        }
+      }
+      if (!placed)
+        continue;
+      fitFaces(shadow);
+    }
+  }
+
+  glEnable(GL_SCISSOR_TEST);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(SHADOW_ATLAS_SLOPE_BIAS, SHADOW_ATLAS_CONSTANT_BIAS);
+  depthShader->use();
+  depthShader->setInt("bonePalette", ANIMATION_TEXTURE_UNIT);
+  unsigned int rendered = 0;
+  size_t drawn = 0;
+
+  // static geometry into the faces that don't have it yet, a bounded number per frame
+  glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+  int staticBudget = settings.staticFacesPerFrame;
+  for (const Request& request : requests) {
+    LightShadow& shadow = lights[lightIndex[EntityToBits(request.entity)]];
+    for (int i = 0; i < shadow.faceCount && shadow.level >= 0 && staticBudget > 0; i++) {
+      Face& face = shadow.faces[i];
+      if (face.staticValid)
+        continue;
+
+      faceCasters.clear();
+      bvh.QueryFrustum(Frustum::FromMatrix(face.matrix), [&](uint32_t, uint64_t userData) {
+        Entity entity = EntityFromBits(userData);
+        if (!world.Has<TransformComponent>(entity) && !world.Has<AnimatorComponent>(entity))
+          faceCasters.push_back(entity);
+      });
+      bindTile(face);
+      glClear(GL_DEPTH_BUFFER_BIT);
+      drawn += drawCasters(world, face);
+      face.staticValid = true;
+      face.dirty = true;
+      staticBudget--;
+      rendered++;
+    }
+  }
+
+  // the few moving or animated entities, tested against every face directly
+  dynamicCasters.clear();
+  dynamicBounds.clear();
+  world.Each<TransformComponent, MeshRendererComponent, BoundsComponent>([&](Entity entity, TransformComponent&, MeshRendererComponent&, BoundsComponent& bounds) {
+    dynamicCasters.push_back(entity);
+    dynamicBounds.push_back(bounds.world);
+  });
+  world.Each<AnimatorComponent, MeshRendererComponent, BoundsComponent>([&](Entity entity, AnimatorComponent&, MeshRendererComponent&, BoundsComponent& bounds) {
+    if (!world.Has<TransformComponent>(entity)) {
+      dynamicCasters.push_back(entity);
+      dynamicBounds.push_back(bounds.world);
+    }
+  });
+
+  // faces with moving casters start over from their static depth and get those drawn on top, faces they
+  // just left get the static depth back
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, finalFramebuffer);
+  for (const Request& request : requests) {
+    LightShadow& shadow = lights[lightIndex[EntityToBits(request.entity)]];
+    bool ready = shadow.level >= 0;
+    for (int i = 0; i < shadow.faceCount && ready; i++)
+      ready = shadow.faces[i].staticValid;
+    if (!ready)
+      continue;
+
+    shadow.firstFace = (int)(faceData.size() / SHADOW_ATLAS_FACE_TEXELS);
+    float texelScale = 2.0f * std::tan(0.5f * faceFov(shadow.type, shadow.outerAngle)) / (float)(SHADOW_ATLAS_SIZE >> shadow.level);
+    for (int i = 0; i < shadow.faceCount; i++) {
+      Face& face = shadow.faces[i];
+      Frustum faceFrustum = Frustum::FromMatrix(face.matrix);
+      faceCasters.clear();
+      for (size_t c = 0; c < dynamicCasters.size(); c++) {
+        if (faceFrustum.Overlaps(dynamicBounds[c]))
+          faceCasters.push_back(dynamicCasters[c]);
+      }
+
+      glm::ivec3 rect = tileRect(face.tile);
+      if (face.dirty || !faceCasters.empty()) {
+        bindTile(face);
+        glBlitFramebuffer(rect.x, rect.y, rect.x + rect.z, rect.y + rect.z, rect.x, rect.y, rect.x + rect.z, rect.y + rect.z,
+                          GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        if (!faceCasters.empty()) {
+          drawn += drawCasters(world, face);
+          rendered++;
+        }
+        face.dirty = !faceCasters.empty();
+      }
+
+      // matrix columns, then the tile in atlas coordinates and the world size of a texel one unit away
+      for (int column = 0; column < 4; column++)
+        faceData.push_back(face.matrix[column]);
+      faceData.push_back(glm::vec4(glm::vec3(rect) / (float)SHADOW_ATLAS_SIZE, texelScale));
+    }
+  }
+
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, width, height);
+  Profiler::Get().CountShadows(rendered, (unsigned int)drawn);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, faceBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(1, faceData.size()) * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+  if (!faceData.empty())
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, faceData.size() * sizeof(glm::vec4), faceData.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+int ShadowAtlas::FirstFace(Entity light) const {
+  std::unordered_map<uint64_t, size_t>::const_iterator it = lightIndex.find(EntityToBits(light));
+  return it == lightIndex.end() ? -1 : lights[it->second].firstFace;
+}
+
+void ShadowAtlas::Apply(Shader& shader) const {
+  glActiveTexture(GL_TEXTURE0 + SHADOW_ATLAS_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D, finalTexture);
+  glActiveTexture(GL_TEXTURE0 + SHADOW_ATLAS_TEXTURE_UNIT + 1);
+  glBindTexture(GL_TEXTURE_BUFFER, faceTexture);
+  glActiveTexture(GL_TEXTURE0);
+  Profiler::Get().CountStateChange(2);
+
+  shader.setInt("shadowAtlas", SHADOW_ATLAS_TEXTURE_UNIT);
+  shader.setInt("shadowFaces", SHADOW_ATLAS_TEXTURE_UNIT + 1);
+  shader.setFloat("shadowAtlasTexel", 1.0f / SHADOW_ATLAS_SIZE);
+}
@@ -0,0 +1,66 @@
+#include "systems.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+TransformComponent MakeTransform(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+  TransformComponent transform;
+  transform.position = position;
+  transform.rotation = rotation;
+  transform.scale = scale;
+  transform.dirty = 1;
+  return transform;
+}
+
+void UpdateTransforms(World& world) {
+  world.ParallelEach<TransformComponent, WorldTransformComponent>([](Entity, TransformComponent& transform, WorldTransformComponent& worldTransform) {
+    if (!transform.dirty)
+      return;
+
+    glm::mat4 matrix = glm::mat4_cast(transform.rotation);
+    matrix[0] *= transform.scale.x;
+    matrix[1] *= transform.scale.y;
+    matrix[2] *= transform.scale.z;
+    matrix[3] = glm::vec4(transform.position, 1.0f);
+    worldTransform.matrix = matrix;
+    transform.dirty = 0;
+  });
+}
+
+void UpdateBounds(World& world, DynamicBVH& bvh) {
+  // static entities have no TransformComponent and never show up here. The BVH isn't thread safe, so
+  // this runs serially, the margin keeps small moves from touching the tree at all.
+  world.Each<TransformComponent, WorldTransformComponent, MeshRendererComponent, BoundsComponent>(
+      [&](Entity entity, TransformComponent&, WorldTransformComponent& transform, MeshRendererComponent& renderer, BoundsComponent& bounds) {
+        if (!renderer.model)
+          return;
+
+        bounds.world = TransformAABB(renderer.model->bounds, transform.matrix);
+        if (bounds.proxy == BVH_NULL)
+          bounds.proxy = bvh.Insert(bounds.world, EntityToBits(entity));
+        else
+          bvh.Move(bounds.proxy, bounds.world);
+      });
+}
+
+void SyncCameras(World& world) {
+  world.Each<CameraComponent, TransformComponent>([](Entity, CameraComponent& camera, TransformComponent& transform) {
+    if (!camera.camera)
+      return;
+
+    // the camera's world matrix is the inverse of its view matrix
+    glm::mat4 cameraWorld = glm::inverse(camera.camera->GetViewMatrix());
+    transform.position = camera.camera->Position;
+    transform.rotation = glm::quat_cast(glm::mat3(cameraWorld));
+    transform.scale = glm::vec3(1.0f);
+    transform.dirty = 1;
+  });
+}
+
+void RegisterEngineSystems(World& world, DynamicBVH& bvh) {
+  world.AddSystem("SyncCameras", MaskOf<CameraComponent>(), MaskOf<TransformComponent>(),
+                  [](World& w, float) { SyncCameras(w); });
+  world.AddSystem("UpdateTransforms", MaskOf<TransformComponent>(), MaskOf<TransformComponent, WorldTransformComponent>(),
+                  [](World& w, float) { UpdateTransforms(w); });
+  world.AddSystem("UpdateBounds", MaskOf<WorldTransformComponent, MeshRendererComponent>(), MaskOf<BoundsComponent>(),
+                  [&bvh](World& w, float) { UpdateBounds(w, bvh); });
+}
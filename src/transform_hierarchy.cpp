@@ -0,0 +1,121 @@
+#include "transform_hierarchy.h"
+#include "job_system.h"
+
+#include <algorithm>
+
+uint32_t TransformHierarchy::AddNode(uint32_t parentIndex, const glm::mat4& localTransform) {
+  uint32_t node = (uint32_t)local.size();
+
+  if (parentIndex != TRANSFORM_NO_PARENT) {
+    // the parent's subtree has to end right here, otherwise the new node would split someone else's range
+    if (parentIndex >= node || subtreeEnd[parentIndex] != node)
+      return TRANSFORM_NO_PARENT;
+
+    for (uint32_t p = parentIndex; p != TRANSFORM_NO_PARENT; p = parent[p])
+      subtreeEnd[p] = node + 1;
+  }
+
+  local.push_back(localTransform);
+  world.push_back(localTransform);
+  parent.push_back(parentIndex);
+  subtreeEnd.push_back(node + 1);
+  dirty.push_back(0);
+
+  // the parent world matrix might itself be stale, let Update sort it out
+  SetLocal(node, localTransform);
+  return node;
+}
+
+void TransformHierarchy::SetLocal(uint32_t node, const glm::mat4& localTransform) {
+  local[node] = localTransform;
+  if (!dirty[node]) {
+    dirty[node] = 1;
+    dirtyNodes.push_back(node);
+  }
+}
+
+void TransformHierarchy::Clear() {
+  local.clear();
+  world.clear();
+  parent.clear();
+  subtreeEnd.clear();
+  dirty.clear();
+  dirtyNodes.clear();
+  ranges.clear();
+}
+
+void TransformHierarchy::updateRange(uint32_t begin, uint32_t end) {
+  // depth first order guarantees every parent inside the range is computed before its children
+  for (uint32_t i = begin; i < end; i++) {
+    uint32_t p = parent[i];
+    world[i] = p == TRANSFORM_NO_PARENT ? local[i] : world[p] * local[i];
+  }
+}
+
+void TransformHierarchy::splitRange(uint32_t root, std::vector<Range>& out) {
+  // explicit stack, a long chain of single children would overflow the call stack
+  std::vector<uint32_t> stack(1, root);
+  while (!stack.empty()) {
+    uint32_t node = stack.back();
+    stack.pop_back();
+    uint32_t end = subtreeEnd[node];
+
+    if (end - node <= ParallelGrain) {
+      // neighbouring small sibling subtrees are merged, their parents are already computed
+      if (!out.empty() && out.back().end == node && out.back().end - out.back().begin + (end - node) <= ParallelGrain)
+        out.back().end = end;
+      else
+        out.push_back({node, end});
+      continue;
+    }
+
+    // too big for one work item: compute the node now and hand its children out separately.
+    // Children are pushed in reverse so they pop in order and adjacent ranges can merge.
+    updateRange(node, node + 1);
+    size_t first = stack.size();
+    for (uint32_t child = node + 1; child < end; child = subtreeEnd[child])
+      stack.push_back(child);
+    std::reverse(stack.begin() + first, stack.end());
+  }
+}
+
+size_t TransformHierarchy::Update() {
+  // nothing moved, nothing to do
+  if (dirtyNodes.empty())
+    return 0;
+
+  // sorted dirty nodes let us skip everything that lies inside an already collected subtree
+  std::sort(dirtyNodes.begin(), dirtyNodes.end());
+
+  ranges.clear();
+  size_t total = 0;
+  uint32_t coveredEnd = 0;
+  for (uint32_t node : dirtyNodes) {
+    dirty[node] = 0;
+    if (node < coveredEnd)
+      continue;
+    ranges.push_back({node, subtreeEnd[node]});
+    coveredEnd = subtreeEnd[node];
+    total += subtreeEnd[node] - node;
+  }
+  dirtyNodes.clear();
+
+  JobSystem& jobs = JobSystem::Get();
+  if (total < ParallelGrain * 2 || jobs.ThreadCount() == 1) {
+    for (const Range& range : ranges)
+      updateRange(range.begin, range.end);
+    return total;
+  }
+
+  // break big subtrees into independent pieces, the roots of split subtrees are computed on the way
+  std::vector<Range> work;
+  work.reserve(ranges.size());
+  for (const Range& range : ranges)
+    splitRange(range.begin, work);
+
+  jobs.ParallelFor(work.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      updateRange(work[i].begin, work[i].end);
+  });
+  return total;
+}
@@ -0,0 +1,312 @@
+#include "triangle_bvh.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRIANGLE_BVH_SSE 1
+#include <emmintrin.h>
+#endif
+
+// bins per axis for the SAH sweep
+static const int SAH_BINS = 16;
+
+// nodes a ray keeps pending before it has to fall back to the heap
+static const uint32_t STACK_SIZE = 64;
+
+namespace {
+
+struct BuildTriangle {
+    AABB box;
+    glm::vec3 center;
+};
+
+struct PendingNode {
+    uint32_t node;
+    float distance;
+};
+
+// entry distance of the ray into the node, FLT_MAX if it misses within maxT
+#ifdef TRIANGLE_BVH_SSE
+inline float intersectNode(const TriangleBVHNode& node, __m128 origin, __m128 invDirection, __m128 xyzMask, float maxT) {
+    // the fourth lane of min/max holds leftFirst/count, masking it to zero keeps it out of the math. Lane
+    // 3 then yields 0 for the entry, which doubles as the clamp to the ray start, and maxT for the exit.
+    __m128 boxMin = _mm_and_ps(_mm_load_ps(node.min), xyzMask);
+    __m128 boxMax = _mm_and_ps(_mm_load_ps(node.max), xyzMask);
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(boxMin, origin), invDirection);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(boxMax, origin), invDirection);
+    __m128 tNear = _mm_min_ps(t0, t1);
+    __m128 tFar = _mm_or_ps(_mm_and_ps(_mm_max_ps(t0, t1), xyzMask), _mm_andnot_ps(xyzMask, _mm_set1_ps(maxT)));
+
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+    tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+    tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    float enter = _mm_cvtss_f32(tNear);
+    return enter <= _mm_cvtss_f32(tFar) ? enter : FLT_MAX;
+}
+#else
+inline float intersectNode(const TriangleBVHNode& node, const Ray& ray, float maxT) {
+    AABB box = { glm::vec3(node.min[0], node.min[1], node.min[2]), glm::vec3(node.max[0], node.max[1], node.max[2]) };
+    float enter = IntersectRayAABB(ray, box, maxT);
+    return enter >= 0.0f ? enter : FLT_MAX;
+}
+#endif
+
+inline void setBounds(TriangleBVHNode& node, const AABB& box) {
+    for (int i = 0; i < 3; i++) {
+      node.min[i] = box.min[i];
+      node.max[i] = box.max[i];
+    }
+}
+
+} // namespace
+
+void TriangleBVH::Build(const glm::vec3* positions, size_t stride, const unsigned int* indices, size_t indexCount) {
+  uint32_t triangleCount = (uint32_t)(indexCount / 3);
+  nodes.clear();
+  vertices.clear();
+  triangleIds.clear();
+  nodeCount = 0;
+  if (triangleCount == 0)
+    return;
+
+  const unsigned char* base = (const unsigned char*)positions;
+  std::vector<BuildTriangle> triangles(triangleCount);
+  std::vector<uint32_t> order(triangleCount);
+  for (uint32_t i = 0; i < triangleCount; i++) {
+    BuildTriangle& triangle = triangles[i];
+    triangle.box = AABB::Empty();
+    for (int corner = 0; corner < 3; corner++)
+      triangle.box.Grow(*(const glm::vec3*)(base + indices[i * 3 + corner] * stride));
+    triangle.center = triangle.box.Center();
+    order[i] = i;
+  }
+
+  // a binary tree over n leaves has at most 2n - 1 nodes, node 1 stays unused so sibling pairs start
+  // on even indices and share a cache line
+  nodes.resize(triangleCount * 2 + 1);
+  nodes[0].leftFirst = 0;
+  nodes[0].count = triangleCount;
+  uint32_t used = 2;
+
+  std::vector<uint32_t> stack(1, 0);
+  while (!stack.empty()) {
+    TriangleBVHNode& node = nodes[stack.back()];
+    stack.pop_back();
+
+    uint32_t first = node.leftFirst;
+    uint32_t count = node.count;
+    AABB bounds = AABB::Empty();
+    AABB centerBounds = AABB::Empty();
+    for (uint32_t i = first; i < first + count; i++) {
+      bounds.Grow(triangles[order[i]].box);
+      centerBounds.Grow(triangles[order[i]].center);
+    }
+    setBounds(node, bounds);
+    if (count == 1)
+      continue;
+
+    // sweep the bins of every axis for the cheapest split
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = FLT_MAX;
+    glm::vec3 extent = centerBounds.max - centerBounds.min;
+    for (int axis = 0; axis < 3; axis++) {
+      if (extent[axis] <= 0.0f)
+        continue;
+
+      AABB binBounds[SAH_BINS];
+      uint32_t binCount[SAH_BINS] = {};
+      for (int b = 0; b < SAH_BINS; b++)
+        binBounds[b] = AABB::Empty();
+
+      float scale = SAH_BINS / extent[axis];
+      for (uint32_t i = first; i < first + count; i++) {
+        const BuildTriangle& triangle = triangles[order[i]];
+        int bin = std::min(SAH_BINS - 1, (int)((triangle.center[axis] - centerBounds.min[axis]) * scale));
+        binCount[bin]++;
+        binBounds[bin].Grow(triangle.box);
+      }
+
+      float leftArea[SAH_BINS - 1];
+      uint32_t leftCount[SAH_BINS - 1];
+      AABB left = AABB::Empty();
+      uint32_t sum = 0;
+      for (int b = 0; b < SAH_BINS - 1; b++) {
+        left.Grow(binBounds[b]);
+        sum += binCount[b];
+        leftArea[b] = sum ? left.HalfArea() : 0.0f;
+        leftCount[b] = sum;
+      }
+
+      AABB right = AABB::Empty();
+      sum = 0;
+      for (int b = SAH_BINS - 1; b > 0; b--) {
+        right.Grow(binBounds[b]);
+        sum += binCount[b];
+        if (!sum || !leftCount[b - 1])
+          continue;
+        float cost = leftArea[b - 1] * leftCount[b - 1] + right.HalfArea() * sum;
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestSplit = b;
+        }
+      }
+    }
+
+    // stay a leaf when splitting costs more than testing every triangle, unless the leaf would be huge
+    float leafCost = bounds.HalfArea() * count;
+    uint32_t middle;
+    if (bestAxis < 0) {
+      if (count <= MaxLeafSize)
+        continue;
+      middle = first + count / 2;
+    }
+    else {
+      if (bestCost >= leafCost && count <= MaxLeafSize)
+        continue;
+      float scale = SAH_BINS / extent[bestAxis];
+      float minimum = centerBounds.min[bestAxis];
+      uint32_t* split = std::partition(order.data() + first, order.data() + first + count, [&](uint32_t triangle) {
+        return std::min(SAH_BINS - 1, (int)((triangles[triangle].center[bestAxis] - minimum) * scale)) < bestSplit;
+      });
+      middle = (uint32_t)(split - order.data());
+    }
+
+    uint32_t leftChild = used;
+    used += 2;
+    nodes[leftChild].leftFirst = first;
+    nodes[leftChild].count = middle - first;
+    nodes[leftChild + 1].leftFirst = middle;
+    nodes[leftChild + 1].count = first + count - middle;
+    node.leftFirst = leftChild;
+    node.count = 0;
+    stack.push_back(leftChild);
+    stack.push_back(leftChild + 1);
+  }
+
+  nodes.resize(used);
+  nodes.shrink_to_fit();
+  nodeCount = used - 1;
+
+  // copy the triangles in leaf order
+  vertices.resize(triangleCount * 3);
+  triangleIds.resize(triangleCount);
+  for (uint32_t i = 0; i < triangleCount; i++) {
+    uint32_t triangle = order[i];
+    triangleIds[i] = triangle;
+    for (int corner = 0; corner < 3; corner++)
+      vertices[i * 3 + corner] = *(const glm::vec3*)(base + indices[triangle * 3 + corner] * stride);
+  }
+}
+
+AABB TriangleBVH::Bounds() const {
+  if (nodes.empty())
+    return AABB::Empty();
+  return { glm::vec3(nodes[0].min[0], nodes[0].min[1], nodes[0].min[2]),
+           glm::vec3(nodes[0].max[0], nodes[0].max[1], nodes[0].max[2]) };
+}
+
+bool TriangleBVH::Raycast(const Ray& ray, float maxT, TriangleHit& hit) const {
+  if (nodes.empty())
+    return false;
+
+#ifdef TRIANGLE_BVH_SSE
+  __m128 origin = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, 0.0f);
+  __m128 invDirection = _mm_setr_ps(ray.invDirection.x, ray.invDirection.y, ray.invDirection.z, 0.0f);
+  __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+#define INTERSECT_NODE(node) intersectNode(node, origin, invDirection, xyzMask, maxT)
+#else
+#define INTERSECT_NODE(node) intersectNode(node, ray, maxT)
+#endif
+
+  if (INTERSECT_NODE(nodes[0]) == FLT_MAX)
+    return false;
+
+  PendingNode fixed[STACK_SIZE];
+  std::vector<PendingNode> heap;
+  PendingNode* stack = fixed;
+  uint32_t capacity = STACK_SIZE;
+  uint32_t count = 0;
+  bool found = false;
+  uint32_t index = 0;
+
+  while (true) {
+    const TriangleBVHNode& node = nodes[index];
+    if (node.count > 0) {
+      // Möller-Trumbore against every triangle of the leaf, both sides count
+      for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+        const glm::vec3& v0 = vertices[i * 3];
+        glm::vec3 edge1 = vertices[i * 3 + 1] - v0;
+        glm::vec3 edge2 = vertices[i * 3 + 2] - v0;
+        glm::vec3 p = glm::cross(ray.direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::fabs(determinant) < 1e-12f)
+          continue;
+
+        float inverse = 1.0f / determinant;
+        glm::vec3 s = ray.origin - v0;
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+          continue;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(ray.direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+          continue;
+        float t = glm::dot(edge2, q) * inverse;
+        if (t < 0.0f || t >= maxT)
+          continue;
+
+        maxT = t;
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        hit.triangle = triangleIds[i];
+        found = true;
+      }
+    }
+    else {
+      // visit the nearer child next and keep the other one for later
+      uint32_t near = node.leftFirst, far = node.leftFirst + 1;
+      float nearDistance = INTERSECT_NODE(nodes[near]);
+      float farDistance = INTERSECT_NODE(nodes[far]);
+      if (farDistance < nearDistance) {
+        std::swap(near, far);
+        std::swap(nearDistance, farDistance);
+      }
+
+      if (nearDistance != FLT_MAX) {
+        if (farDistance != FLT_MAX) {
+          if (count == capacity) {
+            std::vector<PendingNode> grown(capacity * 2);
+            std::copy(stack, stack + count, grown.begin());
+            heap.swap(grown);
+            stack = heap.data();
+            capacity *= 2;
+          }
+          stack[count++] = {far, farDistance};
+        }
+        index = near;
+        continue;
+      }
+    }
+
+    // pop the next pending node that can still beat the closest hit
+    bool next = false;
+    while (count > 0) {
+      PendingNode pending = stack[--count];
+      if (pending.distance < maxT) {
+        index = pending.node;
+        next = true;
+        break;
+      }
+    }
+    if (!next)
+      break;
+  }
+#undef INTERSECT_NODE
+
+  return found;
+}
@@ -0,0 +1,274 @@
+#include "vertex_animation.h"
+#include "animation.h"
+#include "components.h"
+#include "job_system.h"
+#include "material.h"
+#include "model.h"
+#include "profiler.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <map>
+
+static int8_t packSigned(float value) {
+  return (int8_t)std::lround(std::min(std::max(value, -1.0f), 1.0f) * 127.0f);
+}
+
+bool BakeVertexAnimation(const Model& model, VertexAnimation& bake) {
+  bake = VertexAnimation();
+  if (model.animations.empty())
+    return false;
+
+  for (const Mesh& mesh : model.meshes) {
+    bake.meshFirstVertex.push_back(bake.vertexCount);
+    bake.vertexCount += (uint32_t)mesh.vertices.size();
+  }
+  if (bake.vertexCount == 0)
+    return false;
+
+  // every frame takes vertexCount texels, the texture can't grow past the driver's limit
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  size_t maxFrames = (size_t)maxSize * VERTEX_ANIMATION_TEXTURE_WIDTH / bake.vertexCount;
+  std::vector<uint32_t> frameClips;
+  for (size_t i = 0; i < model.animations.size(); i++) {
+    const AnimationClip& clip = model.animations[i];
+    uint32_t frames = std::max(2u, (uint32_t)std::ceil(clip.duration * VERTEX_ANIMATION_SAMPLE_RATE) + 1);
+    if (bake.frameCount + frames > maxFrames) {
+      std::cout << "WARNING::VERTEX_ANIMATION::" << model.animations.size() - i << " clips don't fit into the textures" << std::endl;
+      break;
+    }
+    bake.clips.push_back({bake.frameCount, frames, clip.duration});
+    bake.frameCount += frames;
+    frameClips.insert(frameClips.end(), frames, (uint32_t)i);
+  }
+  if (bake.clips.empty())
+    return false;
+
+  // play every clip back on the worker threads, frames are independent
+  struct Scratch {
+    AnimationPose pose;
+    std::vector<glm::mat4> nodeMatrices;
+    std::vector<glm::mat4> palette;
+    AABB bounds = AABB::Empty();
+  };
+  std::vector<Scratch> threadScratch(JobSystem::Get().ThreadCount());
+  size_t texels = (size_t)bake.frameCount * bake.vertexCount;
+  std::vector<glm::vec3> positions(texels);
+  std::vector<int8_t> normals(texels * 4, 0);
+  JobSystem::Get().ParallelFor(bake.frameCount, 1, [&](size_t begin, size_t end) {
+    Scratch& scratch = threadScratch[JobSystem::ThreadIndex()];
+    scratch.palette.resize(std::max(model.boneNodes.size(), (size_t)1));
+    for (size_t frame = begin; frame < end; frame++) {
+      uint32_t clipIndex = frameClips[frame];
+      const VertexAnimationClip& clip = bake.clips[clipIndex];
+      // the sampler wraps the duration back to the start, the last frame stops just short of it
+      float time = std::min(clip.duration * (float)(frame - clip.firstFrame) / (float)(clip.frameCount - 1),
+                            std::nextafter(clip.duration, 0.0f));
+      const AnimationClip& animation = model.animations[clipIndex];
+      SampleAnimation(animation, std::max(time, 0.0f), scratch.pose);
+      ComputeSkinningPalette(model, animation, scratch.pose, scratch.nodeMatrices, scratch.palette.data());
+
+      for (size_t m = 0; m < model.meshes.size(); m++) {
+        const Mesh& mesh = model.meshes[m];
+        // meshes without bones follow their node, animated or not
+        glm::mat4 rigid = m < model.meshNodes.size() ? scratch.nodeMatrices[model.meshNodes[m]] : glm::mat4(1.0f);
+        size_t first = frame * bake.vertexCount + bake.meshFirstVertex[m];
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+          const Vertex& vertex = mesh.vertices[v];
+          glm::mat4 skin = rigid;
+          if (mesh.skinned) {
+            skin = glm::mat4(0.0f);
+            for (int i = 0; i < MAX_BONE_INFLUENCE; i++) {
+              int bone = vertex.m_BoneIDs[i];
+              if (vertex.m_Weights[i] > 0.0f && bone >= 0 && (size_t)bone < model.boneNodes.size())
+                skin += vertex.m_Weights[i] * scratch.palette[bone];
+            }
+          }
+
+          glm::vec3 position = glm::vec3(skin * glm::vec4(vertex.Position, 1.0f));
+          glm::vec3 normal = glm::mat3(skin) * vertex.Normal;
+          float length = glm::length(normal);
+          if (length > 0.0f)
+            normal /= length;
+          positions[first + v] = position;
+          scratch.bounds.Grow(position);
+          int8_t* packed = &normals[(first + v) * 4];
+          packed[0] = packSigned(normal.x);
+          packed[1] = packSigned(normal.y);
+          packed[2] = packSigned(normal.z);
+        }
+      }
+    }
+  });
+
+  bake.bounds = AABB::Empty();
+  for (const Scratch& scratch : threadScratch)
+    bake.bounds.Grow(scratch.bounds);
+  if (bake.bounds.IsEmpty())
+    return false;
+
+  // positions are stored relative to the bounds over every frame, 16 bits per axis
+  size_t height = (texels + VERTEX_ANIMATION_TEXTURE_WIDTH - 1) / VERTEX_ANIMATION_TEXTURE_WIDTH;
+  size_t padded = height * VERTEX_ANIMATION_TEXTURE_WIDTH;
+  glm::vec3 extent = bake.bounds.max - bake.bounds.min;
+  std::vector<uint16_t> quantized(padded * 4, 0);
+  JobSystem::Get().ParallelFor(texels, 4096, [&](size_t begin, size_t end) {
+    for (size_t texel = begin; texel < end; texel++) {
+      for (int c = 0; c < 3; c++) {
+        float normalized = extent[c] > 0.0f ? (positions[texel][c] - bake.bounds.min[c]) / extent[c] : 0.0f;
+        quantized[texel * 4 + c] = (uint16_t)std::lround(std::min(std::max(normalized, 0.0f), 1.0f) * 65535.0f);
+      }
+      quantized[texel * 4 + 3] = 65535;
+    }
+  });
+  normals.resize(padded * 4, 0);
+
+  glGenTextures(1, &bake.positions);
+  glBindTexture(GL_TEXTURE_2D, bake.positions);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, VERTEX_ANIMATION_TEXTURE_WIDTH, (GLsizei)height, 0, GL_RGBA, GL_UNSIGNED_SHORT, quantized.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glGenTextures(1, &bake.normals);
+  glBindTexture(GL_TEXTURE_2D, bake.normals);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8_SNORM, VERTEX_ANIMATION_TEXTURE_WIDTH, (GLsizei)height, 0, GL_RGBA, GL_BYTE, normals.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  bake.textureBytes = padded * (4 * sizeof(uint16_t) + 4);
+  Profiler::Get().TrackTextureMemory((long long)bake.textureBytes);
+
+  std::cout << "BakeVertexAnimation: " << bake.clips.size() << " clips, " << bake.frameCount << " frames of " << bake.vertexCount
+            << " vertices, " << bake.textureBytes / 1024 << " KB" << std::endl;
+  return true;
+}
+
+void DestroyVertexAnimation(VertexAnimation& bake) {
+  if (bake.positions)
+    glDeleteTextures(1, &bake.positions);
+  if (bake.normals)
+    glDeleteTextures(1, &bake.normals);
+  Profiler::Get().TrackTextureMemory(-(long long)bake.textureBytes);
+  bake = VertexAnimation();
+}
+
+void CrowdRenderer::Shutdown() {
+  destroyBuffers();
+  for (auto& entry : bakes)
+    DestroyVertexAnimation(entry.second);
+  bakes.clear();
+}
+
+const VertexAnimation* CrowdRenderer::Bake(const Model& model) {
+  std::unordered_map<const Model*, VertexAnimation>::iterator it = bakes.find(&model);
+  if (it == bakes.end()) {
+    // a failed bake stays in the map without textures so it isn't tried again
+    it = bakes.emplace(&model, VertexAnimation()).first;
+    BakeVertexAnimation(model, it->second);
+  }
+  return it->second.positions ? &it->second : nullptr;
+}
+
+void CrowdRenderer::Build(World& world) {
+  destroyBuffers();
+
+  // group by model and material, every group becomes one instanced draw per mesh
+  std::map<std::pair<Model*, uint32_t>, std::vector<Entity>> groups;
+  world.Each<VertexAnimationComponent, MeshRendererComponent, WorldTransformComponent>(
+      [&](Entity entity, VertexAnimationComponent&, MeshRendererComponent& renderer, WorldTransformComponent&) {
+        if (renderer.model && bakes.count(renderer.model) && bakes[renderer.model].positions)
+          groups[std::make_pair(renderer.model, renderer.material)].push_back(entity);
+      });
+  if (groups.empty())
+    return;
+
+  std::vector<CrowdInstance> instances;
+  for (const auto& group : groups) {
+    Batch batch;
+    batch.model = group.first.first;
+    batch.bake = &bakes[batch.model];
+    batch.material = group.first.second;
+    batch.first = (uint32_t)instances.size();
+    batch.count = (uint32_t)group.second.size();
+    batch.bounds = AABB::Empty();
+    batch.mirrored = false;
+
+    for (Entity entity : group.second) {
+      const glm::mat4& matrix = world.Get<WorldTransformComponent>(entity)->matrix;
+      const VertexAnimationComponent* animation = world.Get<VertexAnimationComponent>(entity);
+      const VertexAnimationClip& clip = batch.bake->clips[std::min((size_t)animation->clip, batch.bake->clips.size() - 1)];
+      instances.push_back({matrix, glm::vec4((float)clip.firstFrame, (float)clip.frameCount, animation->timeOffset,
+                                             clip.FrameRate() * animation->speed)});
+      batch.bounds.Grow(TransformAABB(batch.bake->bounds, matrix));
+      batch.mirrored = batch.mirrored || glm::determinant(glm::mat3(matrix)) < 0.0f;
+    }
+    batches.push_back(batch);
+  }
+  instanceCount = instances.size();
+
+  glGenBuffers(1, &instanceBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(CrowdInstance), instances.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  Profiler::Get().TrackBufferMemory((long long)(instanceCount * sizeof(CrowdInstance)));
+
+  std::cout << "Crowds: " << instanceCount << " instances in " << batches.size() << " batches" << std::endl;
+}
+
+void CrowdRenderer::Draw(Shader& shader, const glm::mat4& viewProjection, float time) {
+  visibleCount = 0;
+  if (!Ready())
+    return;
+
+  Frustum frustum = Frustum::FromMatrix(viewProjection);
+  shader.setFloat("animationTime", time);
+  shader.setInt("vertexPositions", VERTEX_ANIMATION_POSITION_UNIT);
+  shader.setInt("vertexNormals", VERTEX_ANIMATION_NORMAL_UNIT);
+  for (const Batch& batch : batches) {
+    if (!frustum.Overlaps(batch.bounds)) {
+      Profiler::Get().CountCulled(batch.count);
+      continue;
+    }
+
+    const VertexAnimation& bake = *batch.bake;
+    glActiveTexture(GL_TEXTURE0 + VERTEX_ANIMATION_POSITION_UNIT);
+    glBindTexture(GL_TEXTURE_2D, bake.positions);
+    glActiveTexture(GL_TEXTURE0 + VERTEX_ANIMATION_NORMAL_UNIT);
+    glBindTexture(GL_TEXTURE_2D, bake.normals);
+    glActiveTexture(GL_TEXTURE0);
+    Profiler::Get().CountStateChange(2);
+    shader.setVec3("bakeBoundsMin", bake.bounds.min);
+    shader.setVec3("bakeBoundsExtent", bake.bounds.max - bake.bounds.min);
+    shader.setInt("bakeVertexCount", (int)bake.vertexCount);
+
+    size_t offset = batch.first * sizeof(CrowdInstance);
+    for (size_t i = 0; i < batch.model->meshes.size(); i++) {
+      Mesh& mesh = batch.model->meshes[i];
+      MaterialLibrary::Get().Bind(batch.material != MATERIAL_NONE ? batch.material : mesh.material);
+      if (batch.mirrored)
+        glDisable(GL_CULL_FACE);
+      else
+        mesh.SetFaceCulling(false);
+      shader.setInt("meshFirstVertex", (int)bake.meshFirstVertex[i]);
+      mesh.SetInstanceBuffer(instanceBuffer, offset, sizeof(CrowdInstance));
+      mesh.SetInstanceAttribute(VERTEX_ANIMATION_ATTRIBUTE, instanceBuffer, offset + offsetof(CrowdInstance, animation), sizeof(CrowdInstance));
+      mesh.DrawInstanced(batch.count);
+    }
+    visibleCount += batch.count;
+  }
+  glDisable(GL_CULL_FACE);
+}
+
+void CrowdRenderer::destroyBuffers() {
+  if (instanceBuffer) {
+    glDeleteBuffers(1, &instanceBuffer);
+    Profiler::Get().TrackBufferMemory(-(long long)(instanceCount * sizeof(CrowdInstance)));
+  }
+  instanceBuffer = 0;
+  batches.clear();
+  instanceCount = 0;
+  visibleCount = 0;
+}
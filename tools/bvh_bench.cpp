@@ -0,0 +1,235 @@
+// Compares DynamicBVH queries against brute force loops over the same boxes, then times ray casts
+// against a TriangleBVH over a mesh of about a million triangles.
+//
+// usage: bvh_bench [max objects]
+//
+// Objects are random boxes at constant density, so every query touches roughly the same number of
+// results whatever the object count. Each row also checks that both methods find the same objects.
+
+#include "bvh.h"
+#include "triangle_bvh.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct QuerySet
+{
+  std::vector<AABB> boxes;
+  std::vector<Sphere> spheres;
+  std::vector<Frustum> frustums;
+  std::vector<Ray> rays;
+};
+
+// times fn over every query, returns microseconds per query and adds the results found to total
+template <typename Fn>
+static double timeQueries(size_t queries, size_t &total, Fn fn)
+{
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < queries; i++)
+    total += fn(i);
+  return millisecondsSince(start) * 1000.0 / queries;
+}
+
+static void printRow(const char *name, double bvh, double brute, size_t bvhHits, size_t bruteHits)
+{
+  std::cout << "  " << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(2)
+            << std::setw(12) << bvh << " us" << std::setw(12) << brute << " us" << std::setw(10)
+            << brute / std::max(bvh, 1e-6) << "x" << (bvhHits == bruteHits ? "" : "   MISMATCH") << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  size_t maxObjects = argc > 1 ? (size_t)std::atoll(argv[1]) : 1000000;
+  const size_t queries = 200;
+  std::mt19937 rng(1234);
+  std::cout << std::fixed;
+
+  for (size_t count = 1000; count <= maxObjects; count *= 10)
+  {
+    // about one object per 8 cubic units
+    float side = std::cbrt((float)count * 8.0f);
+    std::uniform_real_distribution<float> position(0.0f, side);
+    std::uniform_real_distribution<float> size(0.2f, 1.5f);
+
+    std::vector<AABB> objects(count);
+    for (AABB &box : objects)
+    {
+      glm::vec3 center(position(rng), position(rng), position(rng));
+      glm::vec3 extents(size(rng), size(rng), size(rng));
+      box = {center - extents * 0.5f, center + extents * 0.5f};
+    }
+
+    Clock::time_point start = Clock::now();
+    DynamicBVH bvh;
+    std::vector<uint32_t> proxies(count);
+    for (size_t i = 0; i < count; i++)
+      proxies[i] = bvh.Insert(objects[i], i);
+    double insertTime = millisecondsSince(start);
+    float insertCost = bvh.Cost();
+
+    start = Clock::now();
+    bvh.Rebuild();
+    double rebuildTime = millisecondsSince(start);
+
+    std::cout << count << " objects: insert " << std::setprecision(1) << insertTime << " ms (cost "
+              << insertCost << "), rebuild " << rebuildTime << " ms (cost " << bvh.Cost() << "), height "
+              << bvh.Height() << std::endl;
+    std::cout << "  query           bvh        brute   speedup" << std::endl;
+
+    QuerySet set;
+    for (size_t i = 0; i < queries; i++)
+    {
+      glm::vec3 center(position(rng), position(rng), position(rng));
+      set.boxes.push_back({center - glm::vec3(4.0f), center + glm::vec3(4.0f)});
+      set.spheres.push_back({center, 4.0f});
+
+      // narrow camera looking at the middle of the volume from a random spot
+      glm::mat4 view = glm::lookAt(center, glm::vec3(side * 0.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+      glm::mat4 projection = glm::perspective(glm::radians(20.0f), 1.0f, 0.1f, 30.0f);
+      set.frustums.push_back(Frustum::FromMatrix(projection * view));
+
+      glm::vec3 target(position(rng), position(rng), position(rng));
+      set.rays.push_back(Ray(center, glm::normalize(target - center)));
+    }
+
+    size_t bvhHits = 0, bruteHits = 0;
+    double bvhTime = timeQueries(queries, bvhHits, [&](size_t q) {
+      size_t found = 0;
+      bvh.QueryAABB(set.boxes[q], [&](uint32_t, uint64_t) { found++; });
+      return found;
+    });
+    double bruteTime = timeQueries(queries, bruteHits, [&](size_t q) {
+      size_t found = 0;
+      for (const AABB &box : objects)
+        found += Overlaps(box, set.boxes[q]);
+      return found;
+    });
+    printRow("aabb", bvhTime, bruteTime, bvhHits, bruteHits);
+
+    bvhHits = bruteHits = 0;
+    bvhTime = timeQueries(queries, bvhHits, [&](size_t q) {
+      size_t found = 0;
+      bvh.QuerySphere(set.spheres[q], [&](uint32_t, uint64_t) { found++; });
+      return found;
+    });
+    bruteTime = timeQueries(queries, bruteHits, [&](size_t q) {
+      size_t found = 0;
+      for (const AABB &box : objects)
+        found += Overlaps(set.spheres[q], box);
+      return found;
+    });
+    printRow("sphere", bvhTime, bruteTime, bvhHits, bruteHits);
+
+    bvhHits = bruteHits = 0;
+    bvhTime = timeQueries(queries, bvhHits, [&](size_t q) {
+      size_t found = 0;
+      bvh.QueryFrustum(set.frustums[q], [&](uint32_t, uint64_t) { found++; });
+      return found;
+    });
+    bruteTime = timeQueries(queries, bruteHits, [&](size_t q) {
+      size_t found = 0;
+      for (const AABB &box : objects)
+        found += set.frustums[q].Overlaps(box);
+      return found;
+    });
+    printRow("frustum", bvhTime, bruteTime, bvhHits, bruteHits);
+
+    // closest box along each ray, several boxes can tie so the hit distance is what gets compared
+    bvhHits = bruteHits = 0;
+    bvhTime = timeQueries(queries, bvhHits, [&](size_t q) {
+      float closest = 1e30f;
+      bvh.Raycast(set.rays[q], closest, [&](uint32_t, uint64_t userData, float maxT) {
+        float t = IntersectRayAABB(set.rays[q], objects[userData], maxT);
+        if (t < 0.0f)
+          return maxT;
+        closest = t;
+        return t;
+      });
+      return (size_t)(closest * 1000.0f);
+    });
+    bruteTime = timeQueries(queries, bruteHits, [&](size_t q) {
+      float closest = 1e30f;
+      for (size_t i = 0; i < count; i++)
+      {
+        float t = IntersectRayAABB(set.rays[q], objects[i], closest);
+        if (t >= 0.0f)
+          closest = t;
+      }
+      return (size_t)(closest * 1000.0f);
+    });
+    printRow("ray", bvhTime, bruteTime, bvhHits, bruteHits);
+
+    // move 1% of the objects a little, as a frame of simulation would
+    std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+    size_t moves = std::max<size_t>(1, count / 100);
+    start = Clock::now();
+    for (size_t i = 0; i < moves; i++)
+    {
+      size_t object = (i * 7919) % count;
+      glm::vec3 offset(step(rng), step(rng), step(rng));
+      objects[object].min += offset;
+      objects[object].max += offset;
+      bvh.Move(proxies[object], objects[object]);
+    }
+    std::cout << "  moved " << moves << " objects in " << std::setprecision(2) << millisecondsSince(start)
+              << " ms (cost " << bvh.Cost() << ")" << std::endl
+              << std::endl;
+  }
+
+  // bumpy sphere with 2 * 708 * 708 triangles
+  const int segments = 708;
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+  for (int y = 0; y <= segments; y++)
+  {
+    for (int x = 0; x <= segments; x++)
+    {
+      float theta = 3.14159265f * y / segments, phi = 6.2831853f * x / segments;
+      float radius = 1.0f + 0.05f * std::sin(x * 0.3f) * std::cos(y * 0.2f);
+      positions.push_back(radius * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+    }
+  }
+  for (int y = 0; y < segments; y++)
+  {
+    for (int x = 0; x < segments; x++)
+    {
+      unsigned int a = y * (segments + 1) + x, b = a + 1, c = a + segments + 1, d = c + 1;
+      unsigned int quad[6] = {a, c, b, b, c, d};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+
+  Clock::time_point start = Clock::now();
+  TriangleBVH triangles;
+  triangles.Build(positions.data(), sizeof(glm::vec3), indices.data(), indices.size());
+  std::cout << triangles.TriangleCount() << " triangles: build " << std::setprecision(1) << millisecondsSince(start)
+            << " ms, " << triangles.NodeCount() << " nodes" << std::endl;
+
+  std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+  const size_t rays = 10000;
+  size_t hits = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < rays; i++)
+  {
+    glm::vec3 origin(offset(rng) * 3.0f, offset(rng) * 3.0f, 3.0f);
+    glm::vec3 target(offset(rng) * 0.5f, offset(rng) * 0.5f, 0.0f);
+    TriangleHit hit;
+    hits += triangles.Raycast(Ray(origin, glm::normalize(target - origin)), 1e30f, hit);
+  }
+  std::cout << "  ray cast " << std::setprecision(2) << millisecondsSince(start) * 1000.0 / rays << " us, " << hits
+            << " of " << rays << " hit" << std::endl;
+  return 0;
+}
@@ -0,0 +1,43 @@
+// Compiles a JSON scene into the flat binary format the engine memory maps.
+//
+// usage: scene_compiler <scene.json> <scene.scnb>
+
+#include "scene.h"
+#include "scene_binary.h"
+
+#include <chrono>
+#include <iostream>
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    std::cout << "usage: " << argv[0] << " <scene.json> <scene.scnb>" << std::endl;
+    return 1;
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  Scene scene;
+  if (!SceneLoader::Load(argv[1], scene))
+    return 1;
+
+  std::chrono::steady_clock::time_point parsed = std::chrono::steady_clock::now();
+
+  if (!SceneCompiler::Compile(scene, argv[2]))
+    return 1;
+
+  std::chrono::steady_clock::time_point written = std::chrono::steady_clock::now();
+
+  // make sure the output maps back cleanly before declaring success
+  MappedScene mapped;
+  if (!mapped.Open(argv[2]))
+    return 1;
+
+  std::cout << "Compiled " << argv[1] << " -> " << argv[2] << std::endl;
+  std::cout << "  " << scene.materials.size() << " materials, " << scene.models.size() << " models, "
+            << scene.lights.size() << " lights, " << mapped.InstanceCount() << " instances" << std::endl;
+  std::cout << "  parse " << std::chrono::duration<double, std::milli>(parsed - start).count() << " ms, write "
+            << std::chrono::duration<double, std::milli>(written - parsed).count() << " ms" << std::endl;
+  return 0;
+}